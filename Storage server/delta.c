@@ -0,0 +1,297 @@
+#include "header.h"
+#include <sys/inotify.h>
+
+#define DELTA_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | IN_ONLYDIR)
+#define DELTA_READ_BUFFER 65536
+#define DELTA_FRAME_EVENTS 1024 // events per OP_DELTA frame
+
+// Held while the tree changes, so the watcher and naming-server requests
+// never apply the same change twice
+pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+// Serializes frames on the naming server connection
+pthread_mutex_t naming_send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Node *watch_root;
+static int inotify_fd = -1;
+static char **watch_paths; // path of the watched directory, by watch descriptor
+static int watch_capacity;
+static int delta_socket = -1;
+static uint64_t next_seq = 1;
+
+// Point deltas at a new naming server connection, -1 while there is none.
+// The caller holds naming_send_lock.
+void setDeltaSocket(int sock)
+{
+    delta_socket = sock;
+}
+
+// Send one unsolicited frame on the current naming server connection;
+// dropped while there is none
+int sendToNamingServer(uint8_t opcode, const char *data, size_t length)
+{
+    int rc = -1;
+    pthread_mutex_lock(&naming_send_lock);
+    if (delta_socket >= 0)
+        rc = sendFrame(delta_socket, opcode, 0, WIRE_OK, data, length);
+    pthread_mutex_unlock(&naming_send_lock);
+    return rc;
+}
+
+static void watchDirectory(Node *dir, const char *path)
+{
+    int wd = inotify_add_watch(inotify_fd, dir->dataLocation, DELTA_WATCH_MASK);
+    if (wd < 0)
+    {
+        perror("inotify_add_watch failed");
+        return;
+    }
+    if (wd >= watch_capacity)
+    {
+        int capacity = watch_capacity ? watch_capacity : 64;
+        while (capacity <= wd)
+            capacity *= 2;
+        watch_paths = realloc(watch_paths, capacity * sizeof(char *));
+        memset(watch_paths + watch_capacity, 0, (capacity - watch_capacity) * sizeof(char *));
+        watch_capacity = capacity;
+    }
+    // Watching a directory again returns the same descriptor
+    free(watch_paths[wd]);
+    watch_paths[wd] = strdup(path);
+
+    if (!dir->children)
+        return;
+    for (unsigned int i = 0; i < dir->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(dir->children, i);
+        if (child && child->type == DIRECTORY_NODE)
+        {
+            char child_path[MAX_PATH_LENGTH];
+            if (snprintf(child_path, sizeof(child_path), "%s/%s", path, child->name) < (int)sizeof(child_path))
+                watchDirectory(child, child_path);
+        }
+    }
+}
+
+// Drop the watches of a directory that left the tree and everything below it
+static void unwatchDirectory(const char *path)
+{
+    size_t len = strlen(path);
+    for (int wd = 0; wd < watch_capacity; wd++)
+    {
+        if (watch_paths[wd] && strncmp(watch_paths[wd], path, len) == 0 &&
+            (watch_paths[wd][len] == '\0' || watch_paths[wd][len] == '/'))
+        {
+            inotify_rm_watch(inotify_fd, wd);
+            free(watch_paths[wd]);
+            watch_paths[wd] = NULL;
+        }
+    }
+}
+
+static void putEvent(WireBuffer *events, uint32_t *count, uint8_t kind, NodeType type, const char *path)
+{
+    wirePutU8(events, kind);
+    wirePutU8(events, (uint8_t)type);
+    wirePutString(events, path);
+    (*count)++;
+}
+
+// A directory that appears with contents (mkdir -p, mv, cp -r) is announced
+// parent first, so the naming server can apply the events in order
+static void putSubtreeEvents(WireBuffer *events, uint32_t *count, Node *node, const char *path)
+{
+    putEvent(events, count, DELTA_ADD, node->type, path);
+    if (node->type != DIRECTORY_NODE || !node->children)
+        return;
+    for (unsigned int i = 0; i < node->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(node->children, i);
+        if (!child)
+            continue;
+        char child_path[MAX_PATH_LENGTH];
+        if (snprintf(child_path, sizeof(child_path), "%s/%s", path, child->name) < (int)sizeof(child_path))
+            putSubtreeEvents(events, count, child, child_path);
+    }
+}
+
+static Permissions permissionsOf(mode_t mode)
+{
+    Permissions perms = 0;
+    if (mode & S_IRUSR)
+        perms |= READ;
+    if (mode & S_IWUSR)
+        perms |= WRITE;
+    if (mode & S_IXUSR)
+        perms |= EXECUTE;
+    return perms;
+}
+
+// Bring the tree in line with one inotify event and record what changed.
+// Changes made through the naming server are already in the tree and are
+// not reported again. Called with tree_lock held.
+static void applyWatchEvent(const struct inotify_event *ev, WireBuffer *events, uint32_t *count)
+{
+    if (ev->mask & IN_IGNORED)
+    {
+        if (ev->wd >= 0 && ev->wd < watch_capacity)
+        {
+            free(watch_paths[ev->wd]);
+            watch_paths[ev->wd] = NULL;
+        }
+        return;
+    }
+    if (ev->wd < 0 || ev->wd >= watch_capacity || !watch_paths[ev->wd] || ev->len == 0 || ev->name[0] == '.')
+        return;
+
+    const char *dir_path = watch_paths[ev->wd];
+    char path[MAX_PATH_LENGTH];
+    if (snprintf(path, sizeof(path), "%s/%s", dir_path, ev->name) >= (int)sizeof(path))
+        return;
+    Node *parent = dir_path[0] ? searchPath(watch_root, dir_path) : watch_root;
+    if (!parent || parent->type != DIRECTORY_NODE)
+        return;
+    Node *node = searchNode(parent->children, ev->name);
+
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        if (node)
+        {
+            // Created through the naming server; only the watch is missing
+            if (node->type == DIRECTORY_NODE)
+                watchDirectory(node, path);
+            return;
+        }
+        char location[PATH_MAX];
+        struct stat st;
+        if (snprintf(location, sizeof(location), "%s/%s", parent->dataLocation, ev->name) >= (int)sizeof(location) ||
+            lstat(location, &st) < 0)
+            return;
+        NodeType type = S_ISDIR(st.st_mode) ? DIRECTORY_NODE : FILE_NODE;
+        node = createNode(parent->arena, ev->name, type, permissionsOf(st.st_mode), location);
+        node->parent = parent;
+        insertNode(parent->children, node);
+        if (type == DIRECTORY_NODE)
+        {
+            // Watch first, so entries created while we scan are not missed
+            watchDirectory(node, path);
+            traverseAndAdd(node, location);
+            watchDirectory(node, path);
+        }
+        putSubtreeEvents(events, count, node, path);
+    }
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        if (!node)
+            return;
+        if (node->type == DIRECTORY_NODE)
+            unwatchDirectory(path);
+        removeNode(parent->children, node);
+        putEvent(events, count, DELTA_REMOVE, node->type, path);
+        freeNode(node);
+    }
+    else if (node)
+    {
+        struct stat st;
+        if ((ev->mask & IN_ATTRIB) && stat(node->dataLocation, &st) == 0)
+            node->permissions = permissionsOf(st.st_mode);
+        putEvent(events, count, DELTA_MODIFY, node->type, path);
+    }
+}
+
+// Send events to the naming server in frames of at most DELTA_FRAME_EVENTS.
+// Events are dropped while disconnected: re-registration compares the
+// whole tree anyway.
+static void publishDelta(const WireBuffer *events, uint32_t count)
+{
+    WireReader reader;
+    wireReaderInit(&reader, events->data, events->length);
+
+    pthread_mutex_lock(&naming_send_lock);
+    while (count > 0)
+    {
+        uint32_t batch = count < DELTA_FRAME_EVENTS ? count : DELTA_FRAME_EVENTS;
+        size_t start = reader.offset;
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            wireGetU8(&reader); // kind
+            wireGetU8(&reader); // node type
+            reader.offset += wireGetU16(&reader);
+        }
+
+        WireBuffer frame;
+        wireBufferInit(&frame);
+        wirePutU64(&frame, next_seq);
+        wirePutU32(&frame, batch);
+        wirePutBytes(&frame, events->data + start, reader.offset - start);
+        if (delta_socket >= 0)
+            sendFrame(delta_socket, OP_DELTA, 0, WIRE_OK, frame.data, frame.length);
+        wireBufferFree(&frame);
+
+        next_seq += batch;
+        count -= batch;
+    }
+    pthread_mutex_unlock(&naming_send_lock);
+}
+
+static void *deltaWatcher(void *arg)
+{
+    (void)arg;
+    char *buffer = malloc(DELTA_READ_BUFFER);
+    while (1)
+    {
+        ssize_t n = read(inotify_fd, buffer, DELTA_READ_BUFFER);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            perror("inotify read failed");
+            break;
+        }
+
+        WireBuffer events;
+        uint32_t count = 0;
+        wireBufferInit(&events);
+        pthread_mutex_lock(&tree_lock);
+        for (char *p = buffer; p < buffer + n;)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW)
+                printf("Namespace watcher overflowed; some local changes were not reported\n");
+            else
+                applyWatchEvent(ev, &events, &count);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        pthread_mutex_unlock(&tree_lock);
+
+        if (count > 0)
+            publishDelta(&events, count);
+        wireBufferFree(&events);
+    }
+    free(buffer);
+    return NULL;
+}
+
+// Watch every directory under root and report local changes to the naming
+// server as OP_DELTA frames
+int startDeltaWatcher(Node *root)
+{
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0)
+    {
+        perror("inotify_init1 failed");
+        return -1;
+    }
+    watch_root = root;
+    pthread_mutex_lock(&tree_lock);
+    watchDirectory(root, "");
+    pthread_mutex_unlock(&tree_lock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, deltaWatcher, NULL) != 0)
+    {
+        perror("Failed to create namespace watcher thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -16,14 +16,17 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <asm-generic/socket.h>
+#include "../common/wire.h"
+#include "../common/arena.h"
 #define TABLE_SIZE 10
+#define NODE_TABLE_INITIAL_CAPACITY 8
 #define MAX_COMMAND_LENGTH 10
 #define MAX_PATH_LENGTH 1024
 #define MAX_CONTENT_LENGTH 100001
 #define CHUNK_SIZE 100001
 #define BUFFER_SIZE 100001
 #define MAX_BUFFER_SIZE 100001
-#define ACK_PORT 8090
+#define WRITE_ACK_BATCH 64 // completions per OP_WRITE_ACK frame
 
 typedef enum
 {
@@ -55,14 +58,15 @@ typedef enum
 
 typedef struct Node
 {
-    char *name;      
+    const char *name;  // interned in the tree's arena
+    unsigned int hash; // hash(name), cached for child table probing
     NodeType type;
     Permissions permissions;
     char *dataLocation;
     struct Node *parent;
-    struct Node *next;
     struct NodeTable *children; 
     int lock_type; // 0= none, 1 = read, 2 = write
+    Arena *arena;  // allocator shared by the whole tree
 } Node;
 
 struct ClientData
@@ -70,8 +74,10 @@ struct ClientData
     int socket;
     int client_port;
     int port;
-    char* ip;
+    char* ip;              // naming server
+    const char *local_ip;  // this server, as it registers itself
     Node *root;
+    int copy_status; // first failure seen in the current incoming COPY session
 };
 
 typedef struct
@@ -81,13 +87,60 @@ typedef struct
     int socket;
 } ThreadArgs;
 
+// One request from the naming server, handled on its own thread
+typedef struct NamingRequest
+{
+    Node *root;
+    int socket;
+    WireHeader hdr;
+    char *payload;
+} NamingRequest;
+
+// Per-directory child table: open addressing with linear probing. The
+// capacity is a power of two and doubles once the table is 75% full, so
+// lookups stay O(1) however large a directory grows.
 typedef struct NodeTable
 {
-    Node *table[TABLE_SIZE];
+    Node **slots;
+    Arena *arena;
+    unsigned int capacity;
+    unsigned int count; // live children
+    unsigned int used;  // live children plus tombstones
 } NodeTable;
 
+// What a client request needs of a node, copied out under tree_lock. The
+// watcher or a DELETE may free the node itself while the request runs.
+typedef struct FileRef
+{
+    Node *root;
+    char path[MAX_PATH_LENGTH];   // as the client named it
+    char tree_path[MAX_PATH_LENGTH]; // from the root, as replicas know it
+    char name[NAME_MAX + 1];
+    char location[PATH_MAX];
+    NodeType type;
+    Permissions permissions;
+    int lock_type;
+} FileRef;
+
+// One entry of a subtree being copied to a peer, listed under tree_lock
+typedef struct CopyEntry
+{
+    NodeType type;
+    Permissions permissions;
+    char *name;
+    char *location;
+    char *dest_path; // directory on the peer to create it in
+} CopyEntry;
+
+typedef struct CopyList
+{
+    CopyEntry *entries; // parents before their children
+    int count;
+    int capacity;
+} CopyList;
+
 typedef struct AsyncWriteTask {
-    Node *targetNode;
+    FileRef target;
     char *data;
     size_t size;
     int clientId; // To identify the client socket
@@ -100,12 +153,18 @@ typedef struct AsyncWriteTask {
 extern AsyncWriteTask *asyncWriteQueue; // The head of the queue
 extern pthread_mutex_t queueMutex;      // Mutex for queue protection
 extern pthread_cond_t queueCondition;   // Condition variable for signaling
+extern int storage_client_port;          // port clients (and peers) connect to
+extern pthread_mutex_t tree_lock;        // see delta.c
+extern pthread_mutex_t naming_send_lock;
 
 unsigned int hash(const char *str);
-NodeTable *createNodeTable();
-Node *createNode(const char *name, NodeType type, Permissions perms, const char *dataLocation);
+NodeTable *createNodeTable(Arena *arena);
+Node *createNode(Arena *arena, const char *name, NodeType type, Permissions perms, const char *dataLocation);
 void insertNode(NodeTable *table, Node *node);
 Node *searchNode(NodeTable *table, const char *name);
+int removeNode(NodeTable *table, Node *node);
+Node *nodeTableSlot(NodeTable *table, unsigned int i);
+void freeNodeTable(NodeTable *table);
 void addFile(Node *parentDir, const char *fileName, Permissions perms, const char *dataLocation);
 void addDirectory(Node *parentDir, const char *dirName, Permissions perms);
 Node *searchPath(Node *root, const char *path);
@@ -114,21 +173,32 @@ char **splitPath(const char *path, int *count);
 int hasPermission(Node *node, Permissions perm);
 void listDirectory(Node *dir);
 void freeNode(Node *node);
+void freeTree(Node *root);
 void traverseAndAdd(Node *parentDir, const char *path);
 CommandType parseCommand(const char *cmd);
 void printUsage();
-void processCommand_namingServer(Node *root, char *input, int client_socket);
-void processCommand_user(Node *root, char *input, int client_socket);
+void processCommand_namingServer(Node *root, WireHeader *hdr, char *payload, int naming_socket);
+void processCommand_user(struct ClientData *client, WireHeader *hdr, char *payload);
 Node *createEmptyNode(Node *parentDir, const char *name, NodeType type);
 int deleteNode(Node *node);
 int copyNode(Node *sourceNode, Node *destDir, const char *newName);
-int getFileMetadata(Node *fileNode, struct stat *metadata);
-ssize_t streamAudioFile(Node *fileNode, char *buffer, size_t size, off_t offset);
-int copy_directory_recursive(int peer_socket, Node *dir_node, const char *dest_path, int naming_socket);
-void copy_files_to_peer(const char *source_path, const char *dest_path, const char *peer_ip, int peer_port, Node *root, int naming_socket);
-int copy_single_file(int peer_socket, Node *source_node, const char *dest_path, int naming_socket);
+int getFileMetadata(const FileRef *file, struct stat *metadata);
+ssize_t streamAudioFile(const FileRef *file, char *buffer, size_t size, off_t offset);
+int copy_files_to_peer(const char *source_path, const char *dest_path, const char *peer_ip, int peer_port, Node *root);
+int copy_single_file(int peer_socket, const CopyEntry *entry);
+int copy_single_dir(int peer_socket, const CopyEntry *entry);
 Node *findNode(Node *root, const char *path);
-void *flushAsyncWrites(char *ip);
-void sendAckToNamingServer(const char *status, const char *message, int clientId, const char *fileName, const char *clientIP, int clientPort, char *ip);
+void flushAsyncWrites(void);
+int startDeltaWatcher(Node *root);
+void setDeltaSocket(int sock);
+int sendToNamingServer(uint8_t opcode, const char *data, size_t length);
+int startReplication(Node *root);
+int configureReplica(int slot, const char *peer_ip, int peer_port, const char *backup_dir);
+uint64_t replicaLag(int slot);
+void replicateCreate(const char *path, NodeType type);
+void replicateDelete(const char *path, NodeType type);
+int nodePath(Node *node, char *out, size_t size);
+void replicateWrite(const char *path, const char *data, size_t length, off_t offset);
+void applyReplicaBatch(struct ClientData *client, WireHeader *hdr, WireReader *reader);
 
 #endif
@@ -1,144 +1,246 @@
 #include "header.h"
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+#include <sys/statvfs.h>
 #define PORT 8080
+#define FILE_COUNT_BEATS 20 // heartbeats between recounts of the files held
+#define TREE_COMPRESS_THRESHOLD (256 * 1024) // smaller images are sent raw
 
 AsyncWriteTask *asyncWriteQueue = NULL;                   // The head of the queue
 pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;   // Mutex for queue protection
 pthread_cond_t queueCondition = PTHREAD_COND_INITIALIZER; // Condition variable for signaling
+int storage_client_port;
 
-int sendNodeChain(int sock, Node *node)
-{
-    Node *current = node;
-    char ack[1024];
-    while (current != NULL)
-    {
-        // Send marker for valid node
-        int valid_marker = 1;
-        if (send(sock, &valid_marker, sizeof(int), 0) < 0)
-            return -1;
-        recv(sock,ack,sizeof(ack),0);
+// Client load, reported to the naming server with every heartbeat
+#define LOAD_LATENCY_WEIGHT 0.2 // weight of the newest request in the average
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t client_inflight;
+static double client_latency_us;
 
-        // Send node data
-        int name_len = strlen(current->name) + 1;
-        if (send(sock, &name_len, sizeof(int), 0) < 0)
-            return -1;
-        recv(sock, ack, sizeof(ack), 0);
-
-        if (send(sock, current->name, name_len, 0) < 0)
-            return -1;
-        recv(sock, ack, sizeof(ack), 0);
+// True when location is parent_location + "/" + name and can be left out
+static int isDerivedLocation(const char *parent_location, const Node *node)
+{
+    size_t len = strlen(parent_location);
+    return node->dataLocation && strncmp(node->dataLocation, parent_location, len) == 0 &&
+           node->dataLocation[len] == '/' && strcmp(node->dataLocation + len + 1, node->name) == 0;
+}
 
-        if (send(sock, &current->type, sizeof(NodeType), 0) < 0)
-            return -1;
-        recv(sock, ack, sizeof(ack), 0);
+// Append node and everything below it to the registration image, in pre-order
+static void encodeTreeNode(WireBuffer *image, Node *node, const char *parent_location, uint32_t *count)
+{
+    uint8_t flags = node->type == DIRECTORY_NODE ? TREE_NODE_DIRECTORY : 0;
+    if (parent_location && isDerivedLocation(parent_location, node))
+        flags |= TREE_NODE_DERIVED_LOCATION;
+
+    wirePutU8(image, flags);
+    wirePutU8(image, (uint8_t)node->permissions);
+    wirePutString(image, node->name);
+    if (!(flags & TREE_NODE_DERIVED_LOCATION))
+        wirePutString(image, node->dataLocation);
+    (*count)++;
+
+    if (node->type != DIRECTORY_NODE)
+        return;
+    wirePutU32(image, node->children ? node->children->count : 0);
+    if (!node->children)
+        return;
+    for (unsigned int i = 0; i < node->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(node->children, i);
+        if (child)
+            encodeTreeNode(image, child, node->dataLocation, count);
+    }
+}
 
-        if (send(sock, &current->permissions, sizeof(Permissions), 0) < 0)
+static int sendImageChunks(int sock, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t chunk = length < WIRE_CHUNK_SIZE ? length : WIRE_CHUNK_SIZE;
+        if (sendFrame(sock, OP_DATA, 0, WIRE_OK, data, chunk) < 0)
             return -1;
-        recv(sock, ack, sizeof(ack), 0);
+        data += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
 
-        int loc_len = strlen(current->dataLocation) + 1;
-        if (send(sock, &loc_len, sizeof(int), 0) < 0)
-            return -1;
-        recv(sock, ack, sizeof(ack), 0);
+#ifdef USE_ZLIB
+// Deflate the image straight onto the socket, one OP_DATA frame per output chunk
+static int sendDeflatedImage(int sock, const WireBuffer *image)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit(&stream, Z_BEST_SPEED) != Z_OK)
+        return -1;
 
-        if (send(sock, current->dataLocation, loc_len, 0) < 0)
-            return -1;
-        recv(sock, ack, sizeof(ack), 0);
+    char *out = (char *)malloc(WIRE_CHUNK_SIZE);
+    stream.next_in = (Bytef *)image->data;
+    stream.avail_in = image->length;
+    int rc;
+    do
+    {
+        stream.next_out = (Bytef *)out;
+        stream.avail_out = WIRE_CHUNK_SIZE;
+        rc = deflate(&stream, Z_FINISH);
+        size_t produced = WIRE_CHUNK_SIZE - stream.avail_out;
+        if (produced && sendFrame(sock, OP_DATA, 0, WIRE_OK, out, produced) < 0)
+            rc = Z_STREAM_ERROR;
+    } while (rc == Z_OK);
+    deflateEnd(&stream);
+    free(out);
+    return rc == Z_STREAM_END ? 0 : -1;
+}
+#endif
 
-        // If this node has children (is a directory)
-        if (current->type == DIRECTORY_NODE && current->children != NULL)
-        {
-            // Send marker indicating has children
-            int has_children = 1;
-            if (send(sock, &has_children, sizeof(int), 0) < 0)
-                return -1;
-            recv(sock, ack, sizeof(ack), 0);
-
-            // Send the entire hash table of children
-            for (int i = 0; i < TABLE_SIZE; i++)
-            {
-                if (sendNodeChain(sock, current->children->table[i]) < 0)
-                    return -1;
-            }
-        }
+// Send the whole tree below root as a single image: OP_TREE, OP_DATA*, OP_END
+int sendTreeImage(int sock, Node *root)
+{
+    WireBuffer image;
+    uint32_t count = 0;
+    wireBufferInit(&image);
+    encodeTreeNode(&image, root, NULL, &count);
+
+    uint8_t encoding = TREE_ENCODING_RAW;
+#ifdef USE_ZLIB
+    if (image.length >= TREE_COMPRESS_THRESHOLD)
+        encoding = TREE_ENCODING_DEFLATE;
+#endif
+
+    WireBuffer info;
+    wireBufferInit(&info);
+    wirePutU8(&info, encoding);
+    wirePutU32(&info, count);
+    wirePutU64(&info, image.length);
+    int rc = sendFrame(sock, OP_TREE, 0, WIRE_OK, info.data, info.length);
+    wireBufferFree(&info);
+
+    if (rc == 0)
+    {
+#ifdef USE_ZLIB
+        if (encoding == TREE_ENCODING_DEFLATE)
+            rc = sendDeflatedImage(sock, &image);
         else
-        {
-            // Send marker indicating no children
-            int has_children = 0;
-            if (send(sock, &has_children, sizeof(int), 0) < 0)
-                return -1;
-            recv(sock, ack, sizeof(ack), 0);
-        }
+#endif
+            rc = sendImageChunks(sock, image.data, image.length);
+    }
+    if (rc == 0)
+        rc = sendFrame(sock, OP_END, 0, WIRE_OK, NULL, 0);
+
+    printf("Sent namespace image: %u nodes, %zu bytes\n", count, image.length);
+    wireBufferFree(&image);
+    return rc;
+}
 
-        current = current->next;
+static uint64_t fingerprintNode(Node *node, uint64_t path_state)
+{
+    uint64_t sum = namespaceEntryDigest(path_state, node->type == DIRECTORY_NODE);
+    if (node->type != DIRECTORY_NODE || !node->children)
+        return sum;
+    for (unsigned int i = 0; i < node->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(node->children, i);
+        if (!child)
+            continue;
+        uint64_t state = namespaceHashExtend(path_state, "/", 1);
+        state = namespaceHashExtend(state, child->name, strlen(child->name));
+        sum += fingerprintNode(child, state);
     }
-    // sleep(1);
-    // Send end of chain marker
-    int end_marker = -1;
-    if (send(sock, &end_marker, sizeof(int), 0) < 0)
-        return -1;
-    recv(sock, ack, sizeof(ack), 0);
+    return sum;
+}
 
-    return 0;
+// Order-independent digest of every path and type below root
+static uint64_t treeFingerprint(Node *root)
+{
+    return fingerprintNode(root, NAMESPACE_HASH_INIT);
 }
 
 // Function to send server information including the hash table
 int sendServerInfo(int sock, const char *ip, int nm_port, int client_port, Node *root)
 {
-    char buffer[1024]; // Adjust the size as needed
-    int offset = 0;
-
-    // Copy IP address to buffer
-    memcpy(buffer + offset, ip, 16);
-    offset += 16;
-
-    // Copy NM port to buffer
-    memcpy(buffer + offset, &nm_port, sizeof(int));
-    offset += sizeof(int);
+    WireBuffer info;
+    wireBufferInit(&info);
+    wirePutString(&info, ip);
+    wirePutU32(&info, (uint32_t)nm_port);
+    wirePutU32(&info, (uint32_t)client_port);
+    wirePutU64(&info, treeFingerprint(root));
+    int rc = sendFrame(sock, OP_REGISTER, 0, WIRE_OK, info.data, info.length);
+    wireBufferFree(&info);
+    if (rc < 0)
+    {
+        perror("Failed to send data");
+        return -1;
+    }
 
-    // Copy client port to buffer
-    memcpy(buffer + offset, &client_port, sizeof(int));
-    offset += sizeof(int);
+    // A naming server that restored our tree from disk only needs the
+    // fingerprint; otherwise it asks for the whole image
+    WireHeader reply;
+    char respond[256];
+    if (recvFrameInto(sock, &reply, respond, sizeof(respond)) < 0 || reply.status != WIRE_OK)
+        return -1;
+    if (reply.length < 1 || (uint8_t)respond[0] == REGISTER_TREE_KNOWN)
+    {
+        printf("Naming server already holds this namespace\n");
+        return 0;
+    }
 
-    // Send the entire buffer
-    if (send(sock, buffer, offset, 0) < 0)
+    if (sendTreeImage(sock, root) < 0)
     {
-        perror("Failed to send data");
+        perror("Failed to send namespace image");
         return -1;
     }
-    memset(buffer, 0 , sizeof(buffer));
-    recv(sock, buffer, sizeof(buffer), 0);
-    // Send the root node and its entire structure
-    return sendNodeChain(sock, root);
+    if (recvFrameInto(sock, &reply, respond, sizeof(respond)) < 0 || reply.status != WIRE_OK)
+        return -1;
+    return 0;
 }
 
 void *handleClient(void *arg)
 {
     struct ClientData *data = (struct ClientData *)arg;
     int client_socket = data->socket;
-    Node *root = data->root;
-    char buffer[100001];
 
     while (1)
     {
-        memset(buffer, 0, sizeof(buffer));
-        ssize_t bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
-        // send(client_socket, "Received\n", strlen("Received\n"), 0);
-        if (bytes_received <= 0)
+        WireHeader hdr;
+        char *payload;
+        if (recvFrame(client_socket, &hdr, &payload) < 0)
         {
             printf("Client disconnected\n");
             break;
         }
 
         // Check if client wants to exit
-        if (strncasecmp(buffer, "exit", 4) == 0)
+        if (hdr.opcode == OP_EXIT)
         {
             printf("Client requested to exit\n");
+            free(payload);
             break;
         }
-        processCommand_user(data->root,buffer,data->socket);
-        // Placeholder response
-        // const char *response = "Request received and processed\n";
-        // send(client_socket, response, strlen(response), 0);
+        // Streams are paced and copies and replication come from peers, so
+        // only reads and metadata lookups say how quickly clients are served
+        int busy = hdr.opcode == OP_READ || hdr.opcode == OP_WRITE || hdr.opcode == OP_META || hdr.opcode == OP_STREAM;
+        int timed = hdr.opcode == OP_READ || hdr.opcode == OP_META;
+        struct timespec start, end;
+        if (busy)
+        {
+            pthread_mutex_lock(&load_lock);
+            client_inflight++;
+            pthread_mutex_unlock(&load_lock);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+        processCommand_user(data, &hdr, payload);
+        free(payload);
+        if (busy)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double elapsed = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+            pthread_mutex_lock(&load_lock);
+            client_inflight--;
+            if (timed)
+                client_latency_us += LOAD_LATENCY_WEIGHT * (elapsed - client_latency_us);
+            pthread_mutex_unlock(&load_lock);
+        }
     }
 
     close(client_socket);
@@ -159,6 +261,15 @@ void *handleClient(void *arg)
 //     return NULL;
 // }
 
+static void *namingRequestWorker(void *arg)
+{
+    NamingRequest *request = (NamingRequest *)arg;
+    processCommand_namingServer(request->root, &request->hdr, request->payload, request->socket);
+    free(request->payload);
+    free(request);
+    return NULL;
+}
+
 void *namingServerHandler(void *arg)
 {
     struct ClientData *info = (struct ClientData *)arg;
@@ -168,66 +279,141 @@ void *namingServerHandler(void *arg)
     while (1)
     {
         // Receive command from naming server
-        char command[100001];
-        memset(command, 0 , sizeof(command));
-        ssize_t bytes_received = recv(naming_server_sock, command, sizeof(command), 0);
+        WireHeader hdr;
+        char *payload;
+        int rc = recvFrame(naming_server_sock, &hdr, &payload);
 
-        if (bytes_received <= 0)
+        if (rc < 0)
         {
             // Connection lost, attempt to reconnect
             printf("Lost connection to naming server. Attempting to reconnect...\n");
+            pthread_mutex_lock(&naming_send_lock);
+            setDeltaSocket(-1);
+            pthread_mutex_unlock(&naming_send_lock);
             close(naming_server_sock);
 
             // Recreate socket and attempt reconnection
             struct sockaddr_in naming_serv_addr;
-            naming_server_sock = socket(AF_INET, SOCK_STREAM, 0);
+            memset(&naming_serv_addr, 0, sizeof(naming_serv_addr));
             naming_serv_addr.sin_family = AF_INET;
-            naming_serv_addr.sin_port = info->port;
+            naming_serv_addr.sin_port = htons(info->port);
             inet_pton(AF_INET, info->ip, &naming_serv_addr.sin_addr);
 
-            while (connect(naming_server_sock, (struct sockaddr *)&naming_serv_addr,
-                           sizeof(naming_serv_addr)) < 0)
+            while (1)
             {
+                naming_server_sock = socket(AF_INET, SOCK_STREAM, 0);
+                if (naming_server_sock >= 0 &&
+                    connect(naming_server_sock, (struct sockaddr *)&naming_serv_addr, sizeof(naming_serv_addr)) == 0)
+                    break;
+                if (naming_server_sock >= 0)
+                    close(naming_server_sock);
                 sleep(5); // Wait before retry
             }
 
-            // Reregister with naming server
-            if (sendServerInfo(naming_server_sock, info->ip, info->port, info->client_port, root) < 0)
+            // Reregister with naming server. Deltas wait until it is done;
+            // any that describe the tree just sent are ignored as repeats.
+            pthread_mutex_lock(&naming_send_lock);
+            pthread_mutex_lock(&tree_lock);
+            rc = sendServerInfo(naming_server_sock, info->local_ip, info->port, info->client_port, root);
+            pthread_mutex_unlock(&tree_lock);
+            if (rc == 0)
+                setDeltaSocket(naming_server_sock);
+            pthread_mutex_unlock(&naming_send_lock);
+            if (rc < 0)
             {
                 printf("Failed to re-register with naming server\n");
+                shutdown(naming_server_sock, SHUT_RDWR); // the next receive fails and we start over
+                sleep(5);
                 continue;
             }
             printf("Successfully reconnected to naming server\n");
             info->socket = naming_server_sock;
             continue;
         }
-        command[bytes_received] = '\0';
-        printf("naming aaya\n");
-        processCommand_namingServer(root, command, naming_server_sock);
+        // The naming server pipelines requests, so a slow COPY must not
+        // hold up the CREATEs and DELETEs queued behind it
+        NamingRequest *request = malloc(sizeof(NamingRequest));
+        request->root = root;
+        request->socket = naming_server_sock;
+        request->hdr = hdr;
+        request->payload = payload;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, namingRequestWorker, request) != 0)
+        {
+            perror("Failed to create naming request thread");
+            namingRequestWorker(request);
+            continue;
+        }
+        pthread_detach(thread);
     }
     return NULL;
 }
 
-void *periodicFlush(void *arg)
+static uint32_t countFiles(Node *dir)
 {
-    char* ip=(char*)arg;
-    printf("you");
-    while (1)
+    uint32_t count = 0;
+    if (!dir->children)
+        return 0;
+    for (unsigned int i = 0; i < dir->children->capacity; i++)
     {
-        printf("ova");
-        pthread_mutex_lock(&queueMutex); // Lock the mutex before checking the queue
+        Node *child = nodeTableSlot(dir->children, i);
+        if (child)
+            count += child->type == FILE_NODE ? 1 : countFiles(child);
+    }
+    return count;
+}
 
-        // Wait if the queue is empty
-        while (!asyncWriteQueue)
+// Lets the naming server tell a hung or unreachable storage server from a
+// merely idle one, and tells it how busy and how full this server is and
+// how far its backups are
+static void *heartbeatSender(void *arg)
+{
+    Node *root = (Node *)arg;
+    uint32_t file_count = 0;
+    for (unsigned int beat_number = 0;; beat_number++)
+    {
+        usleep(HEARTBEAT_INTERVAL_MS * 1000);
+        if (beat_number % FILE_COUNT_BEATS == 0)
         {
-            printf("are uou ");
-            pthread_cond_wait(&queueCondition, &queueMutex); // Wait for a signal if the queue is empty
+            pthread_mutex_lock(&tree_lock);
+            file_count = countFiles(root);
+            pthread_mutex_unlock(&tree_lock);
         }
+        struct statvfs fs;
+        uint64_t free_bytes = 0, total_bytes = 0;
+        if (statvfs(root->dataLocation, &fs) == 0)
+        {
+            free_bytes = (uint64_t)fs.f_bavail * fs.f_frsize;
+            total_bytes = (uint64_t)fs.f_blocks * fs.f_frsize;
+        }
+        WireBuffer beat;
+        wireBufferInit(&beat);
+        pthread_mutex_lock(&load_lock);
+        wirePutU32(&beat, client_inflight);
+        wirePutU32(&beat, (uint32_t)client_latency_us);
+        pthread_mutex_unlock(&load_lock);
+        wirePutU64(&beat, free_bytes);
+        wirePutU64(&beat, total_bytes);
+        wirePutU32(&beat, file_count);
+        for (int slot = 1; slot <= REPLICA_SLOTS; slot++)
+            wirePutU64(&beat, replicaLag(slot));
+        sendToNamingServer(OP_HEARTBEAT, beat.data, beat.length);
+        wireBufferFree(&beat);
+    }
+    return NULL;
+}
 
-        flushAsyncWrites(ip);                // Call to periodically flush the queue
-        pthread_mutex_unlock(&queueMutex); // Unlock the mutex after flushing
-
-        sleep(1); // Sleep for 1 second before the next flush cycle
+// Worker for asynchronous writes: sleeps until some are queued, then
+// writes out everything queued at once
+void *periodicFlush(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&queueMutex);
+    while (1)
+    {
+        while (!asyncWriteQueue)
+            pthread_cond_wait(&queueCondition, &queueMutex);
+        flushAsyncWrites();
     }
     return NULL;
 }
@@ -331,6 +517,7 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
     int client_port = ntohs(local_addr.sin_port);
+    storage_client_port = client_port;
 
 
     
@@ -346,7 +533,7 @@ int main(int argc, char *argv[])
         perror("Listen failed");
         exit(EXIT_FAILURE);
     }
-    if (pthread_create(&flushThread, NULL, periodicFlush,ip_address) != 0)
+    if (pthread_create(&flushThread, NULL, periodicFlush, NULL) != 0)
     {
         perror("Failed to create flush thread");
         return 1;
@@ -358,8 +545,12 @@ int main(int argc, char *argv[])
 
     printf("Storage server is listening for client connections on port %d...\n", client_port);
 
-    Node *root = createNode("/home", DIRECTORY_NODE, READ | WRITE | EXECUTE, "/home");
+    Node *root = createNode(arenaCreate(), "/home", DIRECTORY_NODE, READ | WRITE | EXECUTE, "/home");
     traverseAndAdd(root, "/home");
+    ArenaUsage usage;
+    arenaGetUsage(root->arena, &usage);
+    printf("Tree memory: %zu KB reserved, %zu KB in use, %zu objects, %zu names (%zu references)\n",
+           usage.reserved / 1024, usage.in_use / 1024, usage.objects, usage.interned, usage.intern_refs);
 
 
     // Locate and set lock_type for /readtest.txt and /writetest.txt
@@ -425,7 +616,15 @@ int main(int argc, char *argv[])
     else
     {
         printf("Successfully registered with naming server\n");
+        pthread_mutex_lock(&naming_send_lock);
+        setDeltaSocket(naming_server_sock);
+        pthread_mutex_unlock(&naming_send_lock);
     }
+    startDeltaWatcher(root);
+    startReplication(root);
+    pthread_t heartbeat_thread;
+    if (pthread_create(&heartbeat_thread, NULL, heartbeatSender, root) == 0)
+        pthread_detach(heartbeat_thread);
     pthread_t naming_server_thread;
     struct ClientData *server_info = malloc(sizeof(struct ClientData));
     server_info->socket = naming_server_sock;
@@ -433,6 +632,7 @@ int main(int argc, char *argv[])
     server_info->client_port = client_port;
     server_info->port = port;
     server_info->ip = ip_address;
+    server_info->local_ip = ip_buffer; // main never returns
     if (pthread_create(&naming_server_thread, NULL, namingServerHandler, server_info) != 0)
     {
         perror("Failed to create naming server handler thread");
@@ -454,6 +654,7 @@ int main(int argc, char *argv[])
         struct ClientData *client_data = malloc(sizeof(struct ClientData));
         client_data->socket = client_socket;
         client_data->root = root;
+        client_data->copy_status = WIRE_OK;
         pthread_t thread_id;
         if (pthread_create(&thread_id, NULL, handleClient, (void *)client_data) != 0)
         {
@@ -465,8 +666,7 @@ int main(int argc, char *argv[])
         pthread_detach(thread_id);
         printf("New client connected. Assigned to thread %lu\n", (unsigned long)thread_id);
     }
-    freeNode(root);
     close(storage_server_sock);
-    freeNode(root);
+    freeTree(root);
     return 0;
 }
\ No newline at end of file
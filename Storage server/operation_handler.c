@@ -41,40 +41,81 @@ void printUsage()
     printf("EXIT                           - Exit the program\n");
 }
 
-ssize_t readFileChunk(Node *node, char *buffer, size_t size, off_t offset)
+// Fill file from node. Called with tree_lock held.
+static int snapshotFile(Node *root, Node *node, const char *path, FileRef *file)
 {
-    printf("lock_type = %d\n", node->lock_type);
-    node->lock_type = 1; // Set read lock
-    printf("lock_type = %d\n", node->lock_type);
-    int fd = open(node->dataLocation, O_RDONLY);
+    file->root = root;
+    if (snprintf(file->path, sizeof(file->path), "%s", path) >= (int)sizeof(file->path) ||
+        nodePath(node, file->tree_path, sizeof(file->tree_path)) < 0 ||
+        snprintf(file->name, sizeof(file->name), "%s", node->name) >= (int)sizeof(file->name) ||
+        snprintf(file->location, sizeof(file->location), "%s", node->dataLocation ? node->dataLocation : "") >=
+            (int)sizeof(file->location))
+        return -1;
+    file->type = node->type;
+    file->permissions = node->permissions;
+    file->lock_type = node->lock_type;
+    return 0;
+}
+
+// Look up path and copy out what a request needs of it, so that no Node is
+// used once tree_lock is dropped
+static int lookupFile(Node *root, const char *path, FileRef *file)
+{
+    pthread_mutex_lock(&tree_lock);
+    Node *node = searchPath(root, path);
+    int rc = node ? snapshotFile(root, node, path, file) : -1;
+    pthread_mutex_unlock(&tree_lock);
+    return rc;
+}
+
+// Mark the node file was taken from, if it is still there
+static void setLockType(const FileRef *file, int lock_type)
+{
+    pthread_mutex_lock(&tree_lock);
+    Node *node = searchPath(file->root, file->path);
+    if (node)
+        node->lock_type = lock_type;
+    pthread_mutex_unlock(&tree_lock);
+}
+
+ssize_t readFileChunk(const FileRef *file, char *buffer, size_t size, off_t offset)
+{
+    setLockType(file, 1); // Set read lock
+    int fd = open(file->location, O_RDONLY);
     if (fd < 0)
+    {
+        setLockType(file, 0);
         return -1;
+    }
 
     lseek(fd, offset, SEEK_SET);
     ssize_t bytes = read(fd, buffer, size);
     close(fd);
-    node->lock_type = 0; // Release lock
-    printf("lock_type = %d\n", node->lock_type);
+    setLockType(file, 0); // Release lock
 
     return bytes;
 }
 
 // Helper function to write file in chunks
-ssize_t writeFileChunk(Node *node, const char *buffer, size_t size, off_t offset)
+ssize_t writeFileChunk(const FileRef *file, const char *buffer, size_t size, off_t offset)
 {
-    printf("lock_type = %d\n", node->lock_type);
-    node->lock_type = 2; // Set write lock
-    printf("lock_type = %d\n", node->lock_type);
-    int fd = open(node->dataLocation, O_WRONLY | O_APPEND);
+    setLockType(file, 2); // Set write lock
+    int fd = open(file->location, O_WRONLY | O_APPEND);
     if (fd < 0)
+    {
+        setLockType(file, 0);
         return -1;
+    }
 
     lseek(fd, offset, SEEK_SET);
     ssize_t bytes = write(fd, buffer, size);
+    // O_APPEND: the data went to the end, whatever offset says
+    off_t end = lseek(fd, 0, SEEK_CUR);
     close(fd);
-    node->lock_type = 0; // Release lock
-    printf("lock_type = %d\n", node->lock_type);
+    setLockType(file, 0); // Release lock
 
+    if (bytes > 0 && end >= bytes)
+        replicateWrite(file->tree_path, buffer, bytes, end - bytes);
     return bytes;
 }
 
@@ -98,115 +139,87 @@ int min(int a, int b)
     return b;
 }
 
-void sendAckToNamingServer(const char *status, const char *message, int clientId, const char *fileName, const char *clientIP, int clientPort,char *ip)
+static void putWriteAck(WireBuffer *acks, uint32_t *count, uint8_t phase, const AsyncWriteTask *task)
 {
-    int ack_socket;
-    struct sockaddr_in naming_server_addr;
-    const int naming_server_port = ACK_PORT; // Dedicated port for async write acknowledgments
-
-    // Create a socket
-    ack_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (ack_socket < 0)
-    {
-        perror("Socket creation failed");
-        return;
-    }
-
-    // Set up the naming server address
-    memset(&naming_server_addr, 0, sizeof(naming_server_addr));
-    naming_server_addr.sin_family = AF_INET;
-    naming_server_addr.sin_port = htons(naming_server_port);
-
-    // Convert IP address to binary form
-    if (inet_pton(AF_INET,ip, &naming_server_addr.sin_addr) <= 0)
-    {
-        perror("Invalid address or address not supported");
-        close(ack_socket);
-        return;
-    }
-
-    // Connect to the naming server
-    if (connect(ack_socket, (struct sockaddr *)&naming_server_addr, sizeof(naming_server_addr)) < 0)
-    {
-        perror("Connection to naming server failed");
-        close(ack_socket);
-        return;
-    }
+    wirePutU8(acks, phase);
+    wirePutU32(acks, (uint32_t)task->clientId);
+    wirePutString(acks, task->clientIP);
+    wirePutU16(acks, (uint16_t)task->clientPort);
+    wirePutString(acks, task->target.name);
+    (*count)++;
+}
 
-    // Prepare the acknowledgment message
-    char ack_message[512];
-    snprintf(ack_message, sizeof(ack_message),
-             "%s Message from Storage Server:\n"
-             "Client ID: %d\nClient IP: %s\nClient Port: %d\n"
-             "File: %s\nMessage: %s\n",
-             status, clientId, clientIP, clientPort, fileName, message);
-    // Send the acknowledgment message
-    if (send(ack_socket, ack_message, strlen(ack_message), 0) < 0)
-    {
-        perror("Failed to send acknowledgment to naming server");
-        close(ack_socket);
+// Send the acks gathered so far as one OP_WRITE_ACK frame on the naming
+// server connection. Dropped while disconnected; the naming server then
+// reports those writes as stalled.
+static void sendWriteAcks(WireBuffer *acks, uint32_t *count)
+{
+    if (*count == 0)
         return;
-    }
-
-    printf("Acknowledgment sent to naming server:\n%s\n", ack_message);
-
-    // Close the socket
-    close(ack_socket);
+    WireBuffer frame;
+    wireBufferInit(&frame);
+    wirePutU32(&frame, *count);
+    wirePutBytes(&frame, acks->data, acks->length);
+    if (sendToNamingServer(OP_WRITE_ACK, frame.data, frame.length) < 0)
+        fprintf(stderr, "Failed to send %u write acknowledgments to naming server\n", *count);
+    wireBufferFree(&frame);
+    acks->length = 0;
+    *count = 0;
 }
 
-void *flushAsyncWrites(char *ip)
+// Write out everything queued so far. The whole batch is acknowledged as
+// started in one frame, and completions follow every WRITE_ACK_BATCH
+// writes and at the end. Called with queueMutex held, which is released
+// while writing.
+void flushAsyncWrites(void)
 {
+    AsyncWriteTask *batch = asyncWriteQueue;
+    asyncWriteQueue = NULL;
+    pthread_mutex_unlock(&queueMutex);
 
-    printf("is the function even called\n");
-    while (1)
+    WireBuffer acks;
+    uint32_t count = 0;
+    wireBufferInit(&acks);
+    for (AsyncWriteTask *task = batch; task; task = task->next)
+        putWriteAck(&acks, &count, WRITE_ACK_STARTED, task);
+    sendWriteAcks(&acks, &count);
+
+    while (batch)
     {
-        // pthread_mutex_lock(&queueMutex);
+        AsyncWriteTask *task = batch;
+        batch = batch->next;
 
-        // Wait until there are tasks in the queue
-        while (!asyncWriteQueue)
+        FILE *file = fopen(task->target.location, "a");
+        if (file)
         {
-            pthread_cond_wait(&queueCondition, &queueMutex);
+            size_t written = fwrite(task->data, 1, task->size, file);
+            long end = ftell(file);
+            fclose(file);
+            if (written > 0 && end >= (long)written)
+                replicateWrite(task->target.tree_path, task->data, written, end - written);
+            printf("Async write completed for file: %s\n", task->target.name);
+            putWriteAck(&acks, &count, WRITE_ACK_COMPLETED, task);
+            if (count >= WRITE_ACK_BATCH)
+                sendWriteAcks(&acks, &count);
         }
-
-        // Process tasks in the queue
-        while (asyncWriteQueue)
+        else
         {
-            AsyncWriteTask *task = asyncWriteQueue;
-            asyncWriteQueue = asyncWriteQueue->next;
-
-            pthread_mutex_unlock(&queueMutex);
-            sendAckToNamingServer("Start", "Write operation started for file", task->clientId, task->targetNode->name, task->clientIP, task->clientPort,ip);
-
-            // Simulate writing to persistent storage
-            FILE *file = fopen(task->targetNode->dataLocation, "a");
-            if (file)
-            {
-                fwrite(task->data, 1, task->size, file);
-                fclose(file);
-                printf("Async write completed for file: %s\n", task->targetNode->name);
-                sendAckToNamingServer("End", "Write operation completed successfully for file", task->clientId, task->targetNode->name, task->clientIP, task->clientPort,ip);
-            }
-            else
-            {
-                perror("Error writing to file");
-            }
-
-            // Free the task memory
-            free(task->data);
-            free(task);
-
-            pthread_mutex_lock(&queueMutex);
+            perror("Error writing to file");
         }
 
-        pthread_mutex_unlock(&queueMutex);
+        free(task->data);
+        free(task);
     }
-    return NULL;
+    sendWriteAcks(&acks, &count);
+    wireBufferFree(&acks);
+
+    pthread_mutex_lock(&queueMutex);
 }
 
-int queueAsyncWrite(Node *targetNode, const char *data, size_t size, int client_socket, const char *client_ip, int client_port)
+int queueAsyncWrite(const FileRef *target, const char *data, size_t size, int client_socket, const char *client_ip, int client_port)
 {
     // Validate that the node is a file
-    if (targetNode->type != FILE_NODE)
+    if (target->type != FILE_NODE)
     {
         fprintf(stderr, "Error: Target node is not a file.\n");
         return -1;
@@ -221,7 +234,7 @@ int queueAsyncWrite(Node *targetNode, const char *data, size_t size, int client_
     }
 
     // Initialize the task
-    task->targetNode = targetNode;
+    task->target = *target;
     task->data = malloc(size);
     if (!task->data)
     {
@@ -262,597 +275,489 @@ int queueAsyncWrite(Node *targetNode, const char *data, size_t size, int client_
     return 0;
 }
 
-void processCommand_user(Node *root, char *input, int client_socket)
+// Receive OP_DATA frames up to the closing OP_END. Each chunk is passed to
+// sink (when set); returns the total byte count or -1 if the stream broke.
+// A sink failure is reported through *sink_failed but the stream is still
+// drained so the connection stays in sync.
+static long receiveData(int sock, WireHeader *end, char *buffer, size_t size,
+                        int (*sink)(void *ctx, const char *data, size_t length, long offset), void *ctx, int *sink_failed)
 {
-    char path[MAX_PATH_LENGTH];
-    char buffer[100001];
-    char secondPath[MAX_PATH_LENGTH];
-    char typeStr[5];
-    struct stat metadata;
-    char command[20];
+    long total = 0;
+    *sink_failed = 0;
+    while (1)
+    {
+        if (recvFrameInto(sock, end, buffer, size) < 0)
+            return -1;
+        if (end->opcode == OP_END)
+            return total;
+        if (end->opcode != OP_DATA)
+            return -1;
+        if (sink && !*sink_failed && sink(ctx, buffer, end->length, total) < 0)
+            *sink_failed = 1;
+        total += end->length;
+    }
+}
+
+static int writeSink(void *ctx, const char *data, size_t length, long offset)
+{
+    return writeFileChunk((const FileRef *)ctx, data, length, offset) == (ssize_t)length ? 0 : -1;
+}
+
+typedef struct
+{
+    char *data;
+    long capacity;
+} AsyncBuffer;
+
+static int bufferSink(void *ctx, const char *data, size_t length, long offset)
+{
+    AsyncBuffer *buf = (AsyncBuffer *)ctx;
+    if (offset + (long)length > buf->capacity)
+        return -1;
+    memcpy(buf->data + offset, data, length);
+    return 0;
+}
+
+static void handleWrite(struct ClientData *client, WireHeader *hdr, const FileRef *target, long fileSize, int is_sync, int ack_port)
+{
+    int client_socket = client->socket;
     char response[1024];
-    int is_sync = 1;
+    char *buffer = malloc(WIRE_CHUNK_SIZE + 1);
+    WireHeader end;
+    int sink_failed;
 
-    // Clear any leading/trailing whitespace
-    char *cmd_start = input;
-    while (*cmd_start == ' ')
-        cmd_start++;
-    if (strlen(cmd_start) == 0)
+    // Tell the client to start streaming
+    sendReply(client_socket, hdr, WIRE_OK, NULL, 0);
+    if (is_sync == 1)
     {
-        send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command: Empty Command!\033[0m\n\0", strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command: Empty Command!\033[0m\n\0"), 0);
+        printf("synchornous writing is happening\n");
+        long totalReceived = receiveData(client_socket, &end, buffer, WIRE_CHUNK_SIZE + 1, writeSink, (void *)target, &sink_failed);
+        if (totalReceived < 0)
+        {
+            free(buffer);
+            return;
+        }
+        if (sink_failed)
+        {
+            sendError(client_socket, &end, ERR_WRITE, "Unable to Write to the file!");
+        }
+        else
+        {
+            snprintf(response, sizeof(response), "Successfully wrote %ld bytes\n", totalReceived);
+            sendReply(client_socket, &end, WIRE_OK, response, strlen(response));
+        }
+        free(buffer);
         return;
     }
-    if (sscanf(cmd_start, "%s", command) != 1)
+
+    printf("Asynchornous writing is happening\n");
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    char client_ip[INET_ADDRSTRLEN] = "0.0.0.0";
+    if (getpeername(client_socket, (struct sockaddr *)&client_addr, &addr_len) == 0)
     {
-        send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n\0", strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n\0"), 0);
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+    }
+    AsyncBuffer async = {malloc(fileSize > 0 ? fileSize : 1), fileSize};
+    long totalReceived = receiveData(client_socket, &end, buffer, WIRE_CHUNK_SIZE + 1,
+                                     async.data ? bufferSink : NULL, &async, &sink_failed);
+    free(buffer);
+    if (totalReceived < 0)
+    {
+        free(async.data);
+        return;
+    }
+    if (!async.data)
+    {
+        sendError(client_socket, &end, ERR_NO_MEMORY, "Memory allocation failed!");
+        return;
+    }
+    if (sink_failed || totalReceived != fileSize)
+    {
+        free(async.data);
+        sendError(client_socket, &end, ERR_RECEIVE, "Unable to receive file data.");
         return;
     }
-    cmd_start += strlen(command);
-    while (*cmd_start == ' ')
-        cmd_start++;
 
-    if (strcmp(command, "EXIT") == 0)
+    // Queue the data for asynchronous write
+    if (queueAsyncWrite(target, async.data, fileSize, client_socket, client_ip, ack_port) != 0)
     {
-        send(client_socket, "Exiting...\n", strlen("Exiting...\n"), 0);
+        free(async.data);
+        sendError(client_socket, &end, ERR_QUEUE, "Failed to queue asynchronous write!");
         return;
     }
+    free(async.data);
+    const char *accepted = "ACK: WRITE REQUEST ACCEPTED\n";
+    sendReply(client_socket, &end, WIRE_OK, accepted, strlen(accepted));
+}
 
-    CommandType cmd = parseCommand(command);
-    switch (cmd)
+// Incoming COPY from a peer storage server: create the entry under dest_dir,
+// and for files store the OP_DATA frames that follow
+static void handleCopyEntry(struct ClientData *client, WireHeader *hdr, WireReader *reader)
+{
+    char path[MAX_PATH_LENGTH];
+    char name[1024];
+    wireGetString(reader, path, sizeof(path));
+    wireGetString(reader, name, sizeof(name));
+    wireGetU32(reader); // permissions
+    NodeType type = hdr->opcode == OP_COPY_DIR ? DIRECTORY_NODE : FILE_NODE;
+
+    char target_path[MAX_PATH_LENGTH];
+    int named = snprintf(target_path, sizeof(target_path), "%s/%s", strcmp(path, "/") == 0 ? "" : path, name) <
+                (int)sizeof(target_path);
+    FileRef target;
+    int have_target = 0;
+    pthread_mutex_lock(&tree_lock);
+    Node *parentDir = reader->error ? NULL : findNode(client->root, path);
+    Node *created = NULL;
+    if (!parentDir)
+    {
+        if (client->copy_status == WIRE_OK)
+            client->copy_status = ERR_PARENT_MISSING;
+    }
+    else if (!(created = createEmptyNode(parentDir, name, type)))
+    {
+        if (client->copy_status == WIRE_OK)
+            client->copy_status = type == FILE_NODE ? ERR_CREATE : ERR_CREATE_DIR;
+    }
+    else if (named)
+    {
+        have_target = snapshotFile(client->root, created, target_path, &target) == 0;
+    }
+    pthread_mutex_unlock(&tree_lock);
+    if (created && named)
+        replicateCreate(target_path, type);
+
+    if (type == FILE_NODE)
     {
-    case CMD_READ:
-    case CMD_WRITE:
-    case CMD_META:
-    case CMD_STREAM:
-        if (sscanf(cmd_start, "%s", path) != 1)
+        char *buffer = malloc(WIRE_CHUNK_SIZE + 1);
+        WireHeader end;
+        int sink_failed;
+        if (receiveData(client->socket, &end, buffer, WIRE_CHUNK_SIZE + 1, have_target ? writeSink : NULL, &target, &sink_failed) < 0 ||
+            sink_failed)
         {
-            send(client_socket, " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\033[0m\n\0", strlen(" \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\033[0m\n\0"), 0);
+            if (client->copy_status == WIRE_OK)
+                client->copy_status = ERR_COPY;
+        }
+        free(buffer);
+    }
+}
+
+void processCommand_user(struct ClientData *client, WireHeader *hdr, char *payload)
+{
+    int client_socket = client->socket;
+    Node *root = client->root;
+    char path[MAX_PATH_LENGTH];
+    char buffer[100001];
+    struct stat metadata;
+    char response[1024];
+    WireReader reader;
+    wireReaderInit(&reader, payload, hdr->length);
+
+    switch (hdr->opcode)
+    {
+    case OP_READ:
+    case OP_WRITE:
+    case OP_META:
+    case OP_STREAM:
+    {
+        uint8_t sync_flag = 0;
+        uint64_t fileSize = 0;
+        int ack_port = 0;
+        if (hdr->opcode == OP_WRITE)
+        {
+            sync_flag = wireGetU8(&reader);
+            fileSize = wireGetU64(&reader);
+            ack_port = wireGetU16(&reader);
+        }
+        if (wireGetString(&reader, path, sizeof(path)) < 0)
+        {
+            sendError(client_socket, hdr, ERR_NOT_FOUND, "Path not found!");
             return;
         }
 
-        Node *targetNode = searchPath(root, path);
-        if (!targetNode)
+        FileRef target;
+        if (lookupFile(root, path, &target) < 0)
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
+            sendError(client_socket, hdr, ERR_NOT_FOUND, "Path not found!");
             return;
         }
 
-        if (cmd == CMD_READ)
+        if (hdr->opcode == OP_READ)
         {
-            printf("read command. lock_type = %d\n", targetNode->lock_type);
+            printf("read command. lock_type = %d\n", target.lock_type);
             // Check if the lock is open
-            if (targetNode->lock_type == 2)
+            if (target.lock_type == 2)
             {
-                snprintf(response, sizeof(response), " \033[1;31mERROR 52:\033[0m \033[38;5;214mFile is being written to\n\0\033[0m");                              
-                send(client_socket, response, strlen(response), 0);
+                sendError(client_socket, hdr, ERR_LOCKED, "File is being written to");
                 return;
             }
-            ssize_t bytes;
-            off_t offset = 0;
-            struct stat st;
-            if ((targetNode->permissions & READ) == 0)
+            if ((target.permissions & READ) == 0)
             {
-                const char *error = " \033[1;31mERROR 50:\033[0m \033[38;5;214mPermission Denied!\033[0m\n\0";
-                send(client_socket, error, strlen(error), 0);
+                sendError(client_socket, hdr, ERR_PERMISSION, "Permission Denied!");
                 return;
             }
-            if (targetNode->type != FILE_NODE)
+            if (target.type != FILE_NODE)
             {
-                const char *error = " \033[1;31mERROR 51:\033[0m \033[38;5;214mNot a File!\033[0m\n\0";
-                send(client_socket, error, strlen(error), 0);
+                sendError(client_socket, hdr, ERR_NOT_FILE, "Not a File!");
                 return;
             }
-            if (getFileMetadata(targetNode, &st) == 0)
-            {
-                memset(response, 0, sizeof(response));
-                snprintf(response, sizeof(response), "FILE_SIZE:%ld\n", st.st_size);
-                send(client_socket, response, strlen(response), 0);
-                memset(buffer, 0, sizeof(buffer));
-                recv(client_socket, buffer, sizeof(buffer), 0);
-            }
-            memset(buffer, 0, sizeof(buffer));
-
-            while ((bytes = readFileChunk(targetNode, buffer, sizeof(buffer), offset)) > 0)
+            ssize_t bytes;
+            off_t offset = 0;
+            struct stat st;
+            WireBuffer size;
+            wireBufferInit(&size);
+            wirePutU64(&size, getFileMetadata(&target, &st) == 0 ? (uint64_t)st.st_size : 0);
+            sendReply(client_socket, hdr, WIRE_OK, size.data, size.length);
+            wireBufferFree(&size);
+
+            // Stream the content without waiting for per-chunk acks
+            while ((bytes = readFileChunk(&target, buffer, WIRE_CHUNK_SIZE, offset)) > 0)
             {
-                // printf("%s\n", buffer);
-                send(client_socket, buffer, bytes, 0);
-                memset(buffer, 0, sizeof(buffer));
-                recv(client_socket, buffer, sizeof(buffer), 0);
+                if (sendFrame(client_socket, OP_DATA, hdr->request_id, WIRE_OK, buffer, bytes) < 0)
+                    return;
                 offset += bytes;
-                memset(buffer, 0, sizeof(buffer));
             }
-
-            // Send end marker
-            send(client_socket, "END_OF_FILE\n", strlen("END_OF_FILE\n"), 0);
-            memset(buffer, 0, sizeof(buffer));
-            recv(client_socket, buffer, sizeof(buffer), 0);
+            sendFrame(client_socket, OP_END, hdr->request_id, WIRE_OK, NULL, 0);
         }
-        else if (cmd == CMD_WRITE)
+        else if (hdr->opcode == OP_WRITE)
         {
-            printf("write command. lock_type = %d\n", targetNode->lock_type);
+            printf("write command. lock_type = %d\n", target.lock_type);
             // Check if the lock is open
-            if (targetNode->lock_type == 2)
+            if (target.lock_type == 2)
             {
-                printf(" \033[1;31mERROR 52:\033[0m \033[38;5;214mFile is being written to\n\0\033[0m");
-                printf(" ");
-                snprintf(response, sizeof(response), " \033[1;31mERROR 52:\033[0m \033[38;5;214mFile is being written to\n\0\033[0m");
-                send(client_socket, response, strlen(response), 0);
+                sendError(client_socket, hdr, ERR_LOCKED, "File is being written to");
                 return;
             }
-            // Check if the lock is open
-            if (targetNode->lock_type == 1)
+            if (target.lock_type == 1)
             {
-                printf(" \033[1;31mERROR 52:\033[0m \033[38;5;214mFile is being read\n\0\033[0m");
-                printf(" ");
-                snprintf(response, sizeof(response), "\033[1;31mERROR: 52\033[0m \033[38;5;214mFile is being read\033[0m\n\0");
-                send(client_socket, response, strlen(response), 0);
+                sendError(client_socket, hdr, ERR_LOCKED, "File is being read");
                 return;
             }
-            send(client_socket, "Error: Invalid file size format\n", strlen("Error: Invalid file size format\n"), 0);
-
-            // First receive file size from client
-            memset(buffer, 0, sizeof(buffer));
-            recv(client_socket, buffer, sizeof(buffer), 0);
-            if ((targetNode->permissions & WRITE) == 0)
+            if ((target.permissions & WRITE) == 0)
             {
-                const char *error = " \033[1;31mERROR 50:\033[0m \033[38;5;214mPermission Denied!\033[0m\n\0";
-                send(client_socket, error, strlen(error), 0);
+                sendError(client_socket, hdr, ERR_PERMISSION, "Permission Denied!");
                 return;
             }
-            if (targetNode->type != FILE_NODE)
+            if (target.type != FILE_NODE)
             {
-                const char *error = " \033[1;31mERROR 51:\033[0m \033[38;5;214mNot a File!\033[0m\n\0";
-                send(client_socket, error, strlen(error), 0);
+                sendError(client_socket, hdr, ERR_NOT_FILE, "Not a File!");
                 return;
             }
-            long fileSize;
-            int ack_port;
-            if (sscanf(buffer, "FILE_SIZE:%ld|ACK_PORT:%d", &fileSize, &ack_port) != 2)
+            if (reader.error)
             {
-                send(client_socket, " \033[1;31mERROR 46:\033[0m \033[38;5;214mInvalid file size format!\033[0m\n\0",
-                     strlen(" \033[1;31mERROR 46:\033[0m \033[38;5;214mInvalid file size format!\033[0m\n\0"), 0);
+                sendError(client_socket, hdr, ERR_BAD_SIZE, "Invalid file size format!");
                 return;
             }
-            if (fileSize >= 10) // condition that will check whether asynchornous write should happen or not
-            {
-                is_sync = 0;
-            }
-            if (strstr(input, "--SYNC"))
-            {
-                is_sync = 1;
-            }
-
-            // Send acknowledgment
-            send(client_socket, "READY_TO_RECEIVE\n", strlen("READY_TO_RECEIVE\n"), 0);
-            if (is_sync == 1)
-            {
-                printf("synchornous writing is happening\n");
-                // for synchronous writing
-                // Receive file content in chunks
-                long totalReceived = 0;
-                while (totalReceived < fileSize)
-                {
-                    memset(buffer, 0, sizeof(buffer));
-                    ssize_t bytesReceived = recv(client_socket, buffer,
-                                                 min(sizeof(buffer), fileSize - totalReceived), 0);
-
-                    if (bytesReceived <= 0)
-                    {
-                        send(client_socket, " \033[1;31mERROR 56:\033[0m \033[38;5;214mUnable to receive file data!\033[0m\n\0",
-                             strlen(" \033[1;31mERROR 56:\033[0m \033[38;5;214mUnable to receive file data!\033[0m\n\0"), 0);
-                        return;
-                    }
-
-                    if (writeFileChunk(targetNode, buffer, bytesReceived, totalReceived) != bytesReceived)
-                    {
-                        send(client_socket, " \033[1;31mERROR 57:\033[0m \033[38;5;214mUnable to Write to the file!\033[0m\n\0",
-                             strlen(" \033[1;31mERROR 57:\033[0m \033[38;5;214mUnable to Write to the file!\033[0m\n\0"), 0);
-                        return;
-                    }
-                    send(client_socket, "ok\0", 3, 0);
-                    totalReceived += bytesReceived;
-                }
-                memset(buffer, 0, sizeof(buffer));
-                recv(client_socket, buffer, sizeof(buffer), 0);
-                memset(response, 0, sizeof(response));
-                snprintf(response, sizeof(response), "Successfully wrote %ld bytes\n", totalReceived);
-                send(client_socket, response, strlen(response), 0);
-            }
-            else
-            {
-                printf("Asynchornous writing is happening\n");
-                struct sockaddr_in client_addr;
-                socklen_t addr_len = sizeof(client_addr);
-                if (getpeername(client_socket, (struct sockaddr *)&client_addr, &addr_len) == -1)
-                {
-                    perror("Error retrieving client IP and port");
-                    return;
-                }
-                char client_ip[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-                int client_port = ack_port;
-                char *asyncDataBuffer = malloc(fileSize);
-
-                if (!asyncDataBuffer)
-                {
-                    send(client_socket, " \033[1;31mERROR 58:\033[0m \033[38;5;214mMemory allocation failed!\033[0m\n\0",
-                         strlen(" \033[1;31mERROR 58:\033[0m \033[38;5;214mMemory allocation failed!\033[0m\n\0"), 0);
-                    return;
-                }
-
-                long totalReceived = 0;
-                while (totalReceived < fileSize)
-                {
-                    memset(buffer, 0, sizeof(buffer));
-                    ssize_t bytesReceived = recv(client_socket, buffer,
-                                                 min(sizeof(buffer), fileSize - totalReceived), 0);
-
-                    if (bytesReceived <= 0)
-                    {
-                        free(asyncDataBuffer);
-                        send(client_socket, " \033[1;31mERROR 56:\033[0m \033[38;5;214mUnable to receive file data.\033[0m\n\0",
-                             strlen(" \033[1;31mERROR 56:\033[0m \033[38;5;214mUnable to receive file data.\033[0m\n\0"), 0);
-                        return;
-                    }
-                    send(client_socket, "ok\0", 3, 0);
-
-                    // Copy data to the async buffer
-                    memcpy(asyncDataBuffer + totalReceived, buffer, bytesReceived);
-                    totalReceived += bytesReceived;
-                }
-                memset(buffer, 0, sizeof(buffer));
-                recv(client_socket, buffer, sizeof(buffer), 0);
-
-                send(client_socket, "ACK: WRITE REQUEST ACCEPTED\n", strlen("ACK: WRITE REQUEST ACCEPTED\n"), 0);
-
-                // Queue the data for asynchronous write
-                if (queueAsyncWrite(targetNode, asyncDataBuffer, fileSize, client_socket, client_ip, client_port) != 0)
-                {
-                    free(asyncDataBuffer);
-                    send(client_socket, " \033[1;31mERROR 90:\033[0m \033[38;5;214mFailed to queue asynchronous write!\033[0m\n\0", strlen(" \033[1;31mERROR 90:\033[0m \033[38;5;214mFailed to queue asynchronous write!\033[0m\n\0"), 0);
-                    return;
-                }
-
-                // Notify the client that the asynchronous write has been queued
-                // snprintf(response, sizeof(response), "Asynchronous write of %ld bytes queued successfully\n", fileSize);
-                // send(client_socket, response, strlen(response), 0);
-            }
+            // Large writes are acknowledged early and flushed asynchronously
+            // unless the client asked for --SYNC
+            int is_sync = (fileSize < 10 || sync_flag) ? 1 : 0;
+            handleWrite(client, hdr, &target, (long)fileSize, is_sync, ack_port);
         }
-        else if (cmd == CMD_META)
+        else if (hdr->opcode == OP_META)
         {
-            if (getFileMetadata(targetNode, &metadata) == 0)
+            if (getFileMetadata(&target, &metadata) == 0)
             {
                 char permissions[64];
                 getPermissionsString(metadata.st_mode & 0777, permissions, sizeof(permissions));
-                memset(response, 0, sizeof(response));
                 snprintf(response, sizeof(response),
                          "File Metadata:\nName: %s\nType: %s\nSize: %ld bytes\n"
                          "Permissions: %s\nLast access: %sLast modification: %s\n",
-                         targetNode->name,
-                         targetNode->type == FILE_NODE ? "File" : "Directory",
+                         target.name,
+                         target.type == FILE_NODE ? "File" : "Directory",
                          metadata.st_size,
                          permissions,
                          ctime(&metadata.st_atime),
                          ctime(&metadata.st_mtime));
-                send(client_socket, response, strlen(response), 0);
+                sendReply(client_socket, hdr, WIRE_OK, response, strlen(response));
             }
             else
             {
-                send(client_socket, " \033[1;31mERROR 30:\033[0m \033[38;5;214mUnable to get MetaData.\033[0m\n\0",
-                     strlen(" \033[1;31mERROR 30:\033[0m \033[38;5;214mUnable to get MetaData.\033[0m\n\0"), 0);
+                sendError(client_socket, hdr, ERR_METADATA, "Unable to get MetaData.");
             }
         }
-        else if (cmd == CMD_STREAM)
+        else
         {
             off_t offset = 0;
-            int chunks = 0;
             ssize_t bytes;
-            if ((targetNode->permissions & READ) == 0)
+            if ((target.permissions & READ) == 0)
             {
-                const char *error = " \033[1;31mERROR 50:\033[0m \033[38;5;214mPermission Denied!\033[0m\n\0";
-                send(client_socket, error, strlen(error), 0);
+                sendError(client_socket, hdr, ERR_PERMISSION, "Permission Denied!");
                 return;
             }
-            if (targetNode->type != FILE_NODE)
+            if (target.type != FILE_NODE)
             {
-                const char *error = " \033[1;31mERROR 51:\033[0m \033[38;5;214mNot a File!\033[0m\n\0";
-                send(client_socket, error, strlen(error), 0);
+                sendError(client_socket, hdr, ERR_NOT_FILE, "Not a File!");
                 return;
             }
-            send(client_socket, "START_STREAM\n", strlen("START_STREAM\n"), 0);
+            sendReply(client_socket, hdr, WIRE_OK, NULL, 0);
 
-            while ((bytes = streamAudioFile(targetNode, buffer, CHUNK_SIZE, offset)) > 0)
+            while ((bytes = streamAudioFile(&target, buffer, CHUNK_SIZE, offset)) > 0)
             {
-                if (send(client_socket, buffer, bytes, 0) != bytes)
-                {
-                    send(client_socket, " \033[1;31mERROR 31:\033[0m \033[38;5;214mUnable to Stream Data!\033[0m\n\0",
-                         strlen(" \033[1;31mERROR 31:\033[0m \033[38;5;214mUnable to Stream Data!\033[0m\n\0"), 0);
-                    break;
-                }
-                memset(buffer, 0, sizeof(buffer));
-                recv(client_socket, buffer, sizeof(buffer), 0);
-                memset(buffer, 0, sizeof(buffer));
+                if (sendFrame(client_socket, OP_DATA, hdr->request_id, WIRE_OK, buffer, bytes) < 0)
+                    return;
                 offset += bytes;
-                chunks++;
                 usleep(100000);
             }
-            send(client_socket, "END_STREAM\n", strlen("END_STREAM\n"), 0);
-            memset(buffer, 0, sizeof(buffer));
-            recv(client_socket, buffer, sizeof(buffer), 0);
+            sendFrame(client_socket, OP_END, hdr->request_id, WIRE_OK, NULL, 0);
         }
         break;
-    case CMD_FILECOPY:
-        char name[1024];
-        int permissions;
-        if (sscanf(cmd_start, "%s %s %d", path, name, &permissions) != 3)
-        {
-            send(client_socket, " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath is needed!\033[0m\n\0", strlen(" \033[1;31mERROR 404:\033[0m \033[38;5;214mPath is needed!\033[0m\n\0"), 0);
-            return;
-        }
-        Node *parentDir = findNode(root, path);
-        if (!parentDir)
-        {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 100:\033[0m \033[38;5;214mParent Directory Missing!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
-            return;
-        }
-
-        NodeType type = FILE_NODE;
-        if (createEmptyNode(parentDir, name, type))
-        {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), "CREATE DONE");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
-            memset(buffer, 0, sizeof(buffer));
-            size_t bytes_received;
-            int totalReceived = 0;
-            char node_path[1024];
-            snprintf(node_path, sizeof(node_path), "%s/%s", path, name);
-            // printf("%s\n", node_path);
-            Node *target = findNode(root, node_path);
-            memset(buffer, 0, sizeof(buffer));
-            while ((bytes_received = recv(client_socket, buffer, sizeof(buffer), 0)) > 0)
-            {
-                send(client_socket, command, strlen(command), 0);
-                // printf("%d\n",bytes_received);
-                // size+=bytes_received;
-                buffer[bytes_received] = '\0';
-                if (strncmp(buffer, "END_OF_FILE\n", 12) == 0)
-                    break;
-                writeFileChunk(target, buffer, bytes_received, totalReceived);
-                memset(buffer, 0, sizeof(buffer));
-            }
-            // return;
-        }
-        else
-        {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 32:\033[0m \033[38;5;214mUnable to create node!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
-            return;
-        }
+    }
+    case OP_COPY_FILE:
+    case OP_COPY_DIR:
+        handleCopyEntry(client, hdr, &reader);
         break;
-    case CMD_DIRCOPY:
-        char name2[1024];
-        int permissions2;
-        if (sscanf(cmd_start, "%s %s %d", path, name2, &permissions2) != 3)
-        {
-            send(client_socket, " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath is needed!\033[0m\n\0", strlen(" \033[1;31mERROR 404:\033[0m \033[38;5;214mPath is needed!\033[0m\n\0"), 0);
-            return;
-        }
-        parentDir = findNode(root, path);
-        if (!parentDir)
-        {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 100:\033[0m \033[38;5;214mParent Disrectory Missing!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
-            return;
-        }
 
-        type = DIRECTORY_NODE;
-        if (createEmptyNode(parentDir, name2, type))
-        {
-            memset(response, 0, sizeof(response));
+    case OP_REPLICA_LOG:
+        applyReplicaBatch(client, hdr, &reader);
+        break;
 
-            snprintf(response, sizeof(response), "CREATE DONE");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
-            return;
-        }
+    case OP_SYNC:
+        // End of an incoming COPY session: report the first failure, if any
+        if (client->copy_status == WIRE_OK)
+            sendReply(client_socket, hdr, WIRE_OK, "CREATE DONE", strlen("CREATE DONE"));
         else
-        {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 44:\033[0m \033[38;5;214mFailed to Create!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
-            return;
-        }
+            sendError(client_socket, hdr, client->copy_status, "Copy failed on destination");
+        client->copy_status = WIRE_OK;
         break;
 
-    case CMD_UNKNOWN:
-        send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mUnknown command: %s\nUsage: READ|WRITE|META|STREAM <args>\n\033[0m\n\0", strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mUnknown command: %s\nUsage: READ|WRITE|META|STREAM <args>\n\033[0m\n\0"), 0);
+    default:
+        sendError(client_socket, hdr, ERR_INVALID, "Unknown command\nUsage: READ|WRITE|META|STREAM <args>");
         break;
     }
 }
 
-void processCommand_namingServer(Node *root, char *input, int client_socket)
+// Requests from the naming server run concurrently (see namingServerHandler),
+// so each reply frame is written under naming_send_lock
+static void replyNamingServer(int naming_socket, WireHeader *hdr, uint16_t status, const char *message)
+{
+    pthread_mutex_lock(&naming_send_lock);
+    if (status == WIRE_OK)
+        sendReply(naming_socket, hdr, WIRE_OK, message, strlen(message));
+    else
+        sendError(naming_socket, hdr, status, message);
+    pthread_mutex_unlock(&naming_send_lock);
+}
+
+void processCommand_namingServer(Node *root, WireHeader *hdr, char *payload, int naming_socket)
 {
     char path[MAX_PATH_LENGTH];
-    char buffer[MAX_CONTENT_LENGTH];
     char secondPath[MAX_PATH_LENGTH];
-    char typeStr[5];
-    struct stat metadata;
-    char command[20];
-    char response[100001];
-    printf("helllo\n");
-    char *cmd_start = input;
-    while (*cmd_start == ' ')
-        cmd_start++;
-    if (strlen(cmd_start) == 0)
-    {
-        printf("hey\n");
-        send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command: It is empty!\033[0m\n\0", strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command: It is empty!\033[0m\n\0"), 0);
-        return;
-    }
-    if (sscanf(cmd_start, "%s", command) != 1)
-    {
-        send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command Format!\033[0m\n\0", strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command Format!\033[0m\n\0"), 0);
-        return;
-    }
-    cmd_start += strlen(command);
-    while (*cmd_start == ' ')
-        cmd_start++;
+    WireReader reader;
+    wireReaderInit(&reader, payload, hdr->length);
+    printf("%s\n", wireOpcodeName(hdr->opcode));
 
-    if (strcmp(command, "EXIT") == 0)
+    switch (hdr->opcode)
     {
-        send(client_socket, "Exiting...\n", strlen("Exiting...\n"), 0);
-        return;
-    }
-    printf("%s\n", command);
-    CommandType cmd = parseCommand(command);
-    // printf("%d\n",cmd);
-    int temp;
-    switch (cmd)
+    case OP_CREATE:
     {
-    case CMD_CREATE:
-        // char ack[100001];
-        // send(client_socket, "lala lala\n", strlen("lala lala\n"), 0);
-        // recv(client_socket,ack,sizeof(ack),0);
-        if (sscanf(cmd_start, "%s %d %s", typeStr, &temp, path) != 3)
+        uint8_t type = wireGetU8(&reader);
+        if (wireGetString(&reader, path, sizeof(path)) < 0)
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command: Type and path are required!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
+            replyNamingServer(naming_socket, hdr, ERR_INVALID, "Invalid Command: Type and path are required!");
             return;
         }
         char *lastSlash = strrchr(path, '/');
         if (!lastSlash)
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 404:\033[0m \033[38;5;214mInvalid Path Format!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
+            replyNamingServer(naming_socket, hdr, ERR_NOT_FOUND, "Invalid Path Format!");
             return;
         }
         *lastSlash = '\0';
         char *name = lastSlash + 1;
+        pthread_mutex_lock(&tree_lock);
         Node *parentDir = searchPath(root, path);
         *lastSlash = '/';
 
         if (!parentDir)
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 100:\033[0m \033[38;5;214mParent Directory Missing!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
+            pthread_mutex_unlock(&tree_lock);
+            replyNamingServer(naming_socket, hdr, ERR_PARENT_MISSING, "Parent Directory Missing!");
             return;
         }
 
-        NodeType type = (strcasecmp(typeStr, "DIR") == 0) ? DIRECTORY_NODE : FILE_NODE;
-        if (createEmptyNode(parentDir, name, type))
+        Node *created = createEmptyNode(parentDir, name, type == DIRECTORY_NODE ? DIRECTORY_NODE : FILE_NODE);
+        pthread_mutex_unlock(&tree_lock);
+        if (created)
         {
-            memset(response, 0, sizeof(response));
-            printf("hillo\n");
-            fflush(stdout);
-            snprintf(response, sizeof(response), "CREATE DONE");
-            if (send(client_socket, response, strlen(response), 0) < 0)
-            {
-                perror("hajnckm");
-            }
-            printf("sent\n");
-            fflush(stdout);
-            memset(response, 0, sizeof(response));
-            return;
+            replicateCreate(path, created->type);
+            replyNamingServer(naming_socket, hdr, WIRE_OK, "CREATE DONE");
         }
         else
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 32:\033[0m \033[38;5;214mUnable to create node!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
+            replyNamingServer(naming_socket, hdr, ERR_CREATE, "Unable to create node!");
         }
         break;
+    }
 
-    case CMD_COPY:
-        sscanf(cmd_start, "%s %s", path, secondPath);
-        memset(buffer, 0, sizeof(buffer));
-        snprintf(buffer, sizeof(buffer), "ACknowledgement");
-        ssize_t bytes_sent = send(client_socket, buffer, strlen(buffer), 0);
-        printf("Bytes sent: %zd\n", bytes_sent);
-        fflush(stdout);
-
-        if (bytes_sent <= 0)
+    case OP_COPY:
+    {
+        char peer_ip[16];
+        wireGetString(&reader, path, sizeof(path));
+        wireGetString(&reader, secondPath, sizeof(secondPath));
+        wireGetString(&reader, peer_ip, sizeof(peer_ip));
+        int peer_port = wireGetU16(&reader);
+        if (reader.error)
         {
-            perror("Failed to send COPY command to source");
-            fflush(stdout);
+            replyNamingServer(naming_socket, hdr, ERR_INVALID, "Invalid Command Format!");
             return;
         }
-        printf("sent %s\n", buffer);
-        fflush(stdout);
-        memset(buffer, 0, sizeof(buffer));
-        ssize_t bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received <= 0)
-            break;
-        buffer[bytes_received] = '\0';
-        char peer_ip[16];
-        int peer_port;
-        int flag = 0;
-        if (strncmp(buffer, "SOURCE SERVER_INFO", 18) == 0)
+        int status = copy_files_to_peer(path, secondPath, peer_ip, peer_port, root);
+        if (status == WIRE_OK)
+            replyNamingServer(naming_socket, hdr, WIRE_OK, "COPY DONE");
+        else
+            replyNamingServer(naming_socket, hdr, status, "Directory copy failed!");
+        break;
+    }
+
+    case OP_REPLICATE:
+    {
+        char peer_ip[INET_ADDRSTRLEN];
+        uint8_t slot = wireGetU8(&reader);
+        wireGetString(&reader, peer_ip, sizeof(peer_ip));
+        int peer_port = wireGetU16(&reader);
+        wireGetString(&reader, path, sizeof(path));
+        if (reader.error || configureReplica(slot, peer_ip, peer_port, path) < 0)
         {
-            printf("source\n");
-            sscanf(buffer, "SOURCE SERVER_INFO %s %d", peer_ip, &peer_port);
-            copy_files_to_peer(path, secondPath, peer_ip, peer_port, root, client_socket);
-            flag = 1;
+            replyNamingServer(naming_socket, hdr, ERR_INVALID, "Invalid Command Format!");
+            return;
         }
+        replyNamingServer(naming_socket, hdr, WIRE_OK, "REPLICATE DONE");
         break;
+    }
 
-    case CMD_DELETE:
-        if (sscanf(cmd_start, "%s", path) != 1)
+    case OP_DELETE:
+    {
+        if (wireGetString(&reader, path, sizeof(path)) < 0)
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 404:\033[0m \033[38;5;214mMissing Path argument!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
+            replyNamingServer(naming_socket, hdr, ERR_NOT_FOUND, "Missing Path argument!");
             return;
         }
+        pthread_mutex_lock(&tree_lock);
         Node *nodeToDelete = searchPath(root, path);
         if (!nodeToDelete)
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
+            pthread_mutex_unlock(&tree_lock);
+            replyNamingServer(naming_socket, hdr, ERR_NOT_FOUND, "Path not found!");
             return;
         }
-        if (deleteNode(nodeToDelete) == 0)
+        NodeType deleted_type = nodeToDelete->type;
+        int deleted = deleteNode(nodeToDelete);
+        pthread_mutex_unlock(&tree_lock);
+        if (deleted == 0)
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), "DELETE DONE");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
+            replicateDelete(path, deleted_type);
+            replyNamingServer(naming_socket, hdr, WIRE_OK, "DELETE DONE");
         }
         else
         {
-            memset(response, 0, sizeof(response));
-            snprintf(response, sizeof(response), " \033[1;31mERROR 33:\033[0m \033[38;5;214mUnable to delete node!\033[0m\n\0");
-            send(client_socket, response, strlen(response), 0);
-            memset(response, 0, sizeof(response));
+            replyNamingServer(naming_socket, hdr, ERR_DELETE, "Unable to delete node!");
         }
         break;
+    }
 
-    case CMD_UNKNOWN:
-        memset(response, 0, sizeof(response));
-        snprintf(response, sizeof(response), " \033[1;31mERROR 101:\033[0m \033[38;5;214mUnknown command: %s\nUsage: READ|WRITE|META|STREAM <args>\n\033[0m\n\0", command);
-        send(client_socket, response, strlen(response), 0);
-        memset(response, 0, sizeof(response));
+    default:
+        replyNamingServer(naming_socket, hdr, ERR_INVALID, "Unknown command");
         break;
     }
 }
@@ -1,30 +1,30 @@
 #include "header.h"
 
-int getFileMetadata(Node *fileNode, struct stat *metadata)
+int getFileMetadata(const FileRef *file, struct stat *metadata)
 {
-    if (!fileNode || !fileNode->dataLocation)
+    if (!file || !file->location[0])
     {
         return -1;
     }
 
-    return stat(fileNode->dataLocation, metadata);
+    return stat(file->location, metadata);
 }
 
-ssize_t streamAudioFile(Node *fileNode, char *buffer, size_t size, off_t offset)
+ssize_t streamAudioFile(const FileRef *file, char *buffer, size_t size, off_t offset)
 {
-    if (fileNode->type != FILE_NODE)
+    if (file->type != FILE_NODE)
     {
         printf("Error: Not a file\n");
         return -1;
     }
 
-    if (!hasPermission(fileNode, READ))
+    if ((file->permissions & READ) == 0)
     {
         printf("Error: No read permission\n");
         return -1;
     }
 
-    int fd = open(fileNode->dataLocation, O_RDONLY);
+    int fd = open(file->location, O_RDONLY);
     if (fd == -1)
     {
         perror("Error opening audio file");
@@ -88,7 +88,7 @@ Node *createEmptyNode(Node *parentDir, const char *name, NodeType type)
     }
 
     // Create and insert the node
-    Node *newNode = createNode(name, type, READ | WRITE, fullPath);
+    Node *newNode = createNode(parentDir->arena, name, type, READ | WRITE, fullPath);
     newNode->parent = parentDir;
     insertNode(parentDir->children, newNode);
     return newNode;
@@ -105,15 +105,11 @@ int deleteNode(Node *node)
     // Recursively delete all children if the node is a directory
     if (node->type == DIRECTORY_NODE && node->children)
     {
-        for (int i = 0; i < TABLE_SIZE; i++)
+        for (unsigned int i = 0; i < node->children->capacity; i++)
         {
-            Node *child = node->children->table[i];
-            while (child)
-            {
-                Node *next = child->next;
+            Node *child = nodeTableSlot(node->children, i);
+            if (child)
                 deleteNode(child);
-                child = next;
-            }
         }
     }
 
@@ -136,32 +132,12 @@ int deleteNode(Node *node)
     }
 
     // Remove node from parent's hash table
-    unsigned int index = hash(node->name);
-    Node *current = node->parent->children->table[index];
-    Node *prev = NULL;
-
-    while (current != NULL)
+    if (removeNode(node->parent->children, node) != 0)
     {
-        if (current == node)
-        {
-            if (prev == NULL)
-            {
-                node->parent->children->table[index] = current->next;
-            }
-            else
-            {
-                prev->next = current->next;
-            }
-            free(node->name);
-            free(node->dataLocation);
-            free(node);
-            return 0;
-        }
-        prev = current;
-        current = current->next;
+        return -1;
     }
-
-    return -1;
+    freeNode(node);
+    return 0;
 }
 
 int copyNode(Node *sourceNode, Node *destDir, const char *newName)
@@ -188,7 +164,7 @@ int copyNode(Node *sourceNode, Node *destDir, const char *newName)
         }
 
         // Create node in our file system
-        Node *newDir = createNode(newName ? newName : sourceNode->name,
+        Node *newDir = createNode(destDir->arena, newName ? newName : sourceNode->name,
                                   DIRECTORY_NODE, sourceNode->permissions, destPath);
         newDir->parent = destDir;
         insertNode(destDir->children, newDir);
@@ -258,7 +234,7 @@ int copyNode(Node *sourceNode, Node *destDir, const char *newName)
         close(destFd);
 
         // Create node in our file system
-        Node *newFile = createNode(newName ? newName : sourceNode->name,
+        Node *newFile = createNode(destDir->arena, newName ? newName : sourceNode->name,
                                    FILE_NODE, sourceNode->permissions, destPath);
         newFile->parent = destDir;
         insertNode(destDir->children, newFile);
@@ -327,23 +303,7 @@ Node *findNode(Node *root, const char *path)
             return NULL;
         }
 
-        Node *child = NULL;
-        for (int i = 0; i < TABLE_SIZE; i++)
-        {
-            child = childrenTable->table[i];
-            while (child != NULL)
-            {
-                if (strcmp(child->name, token) == 0)
-                {
-                    break;
-                }
-                child = child->next;
-            }
-            if (child)
-            {
-                break;
-            }
-        }
+        Node *child = searchNode(childrenTable, token);
 
         if (!child)
         {
@@ -361,136 +321,136 @@ Node *findNode(Node *root, const char *path)
     return current;
 }
 
-void copy_files_to_peer(const char *source_path, const char *dest_path, const char *peer_ip, int peer_port, Node *root, int naming_socket)
+// Append node, and everything below it, to list as entries to create under
+// dest_path on the peer. Called with tree_lock held.
+static int collectCopyEntries(CopyList *list, Node *node, const char *dest_path)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 16;
+        CopyEntry *grown = realloc(list->entries, capacity * sizeof(CopyEntry));
+        if (!grown)
+            return -1;
+        list->entries = grown;
+        list->capacity = capacity;
+    }
+    CopyEntry *entry = &list->entries[list->count];
+    entry->type = node->type;
+    entry->permissions = node->permissions;
+    entry->name = strdup(node->name);
+    entry->location = strdup(node->dataLocation ? node->dataLocation : "");
+    entry->dest_path = strdup(dest_path);
+    list->count++;
+    if (!entry->name || !entry->location || !entry->dest_path)
+        return -1;
+    if (node->type != DIRECTORY_NODE)
+        return 0;
+
+    char new_dest_path[MAX_PATH_LENGTH];
+    if (snprintf(new_dest_path, sizeof(new_dest_path), "%s/%s", dest_path, node->name) >= (int)sizeof(new_dest_path))
+        return -1;
+    for (unsigned int i = 0; i < node->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(node->children, i);
+        if (child && collectCopyEntries(list, child, new_dest_path) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void freeCopyList(CopyList *list)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        free(list->entries[i].name);
+        free(list->entries[i].location);
+        free(list->entries[i].dest_path);
+    }
+    free(list->entries);
+}
+
+// Push source_path into dest_path on a peer storage server. The subtree is
+// listed under tree_lock first, as a DELETE may free it while we send. All
+// frames are written back to back and the peer reports the outcome once, in
+// its reply to the closing OP_SYNC. Returns WIRE_OK or an error status.
+int copy_files_to_peer(const char *source_path, const char *dest_path, const char *peer_ip, int peer_port, Node *root)
 {
+    CopyList list = {NULL, 0, 0};
+    pthread_mutex_lock(&tree_lock);
     Node *source_node = findNode(root, source_path);
+    int listed = source_node ? collectCopyEntries(&list, source_node, dest_path) : -1;
+    pthread_mutex_unlock(&tree_lock);
+    if (!source_node || listed < 0)
+    {
+        freeCopyList(&list);
+        return source_node ? ERR_COPY : ERR_NOT_FOUND;
+    }
     int peer_socket = connectToServer(peer_ip, peer_port);
     if (peer_socket < 0)
-        return;
-
-    if (source_node->type == FILE_NODE)
     {
-
-        if (copy_single_file(peer_socket, source_node, dest_path, naming_socket))
-        {
-            // printf("done\n");
-            send(naming_socket, "COPY DONE", strlen("COPY DONE"), 0);
-        }
-        else
-        {
-            // printf("fail\n");
-            send(naming_socket, " \033[1;31mERROR 45:\033[0m \033[38;5;214mDirectory copy failed!\033[0m\n\0", strlen(" \033[1;31mERROR 45:\033[0m \033[38;5;214mDirectory copy failed!\033[0m\n\0"), 0);
-        }
+        freeCopyList(&list);
+        return ERR_COPY;
     }
-    else if (source_node->type == DIRECTORY_NODE)
+
+    int ok = 1;
+    for (int i = 0; i < list.count && ok; i++)
     {
-        // printf("hii\n");
-        if(copy_directory_recursive(peer_socket, source_node, dest_path,naming_socket))
-        {
-            // printf("done\n");
-            send(naming_socket, "COPY DONE", strlen("COPY DONE"),0);
-        }
+        if (list.entries[i].type == FILE_NODE)
+            ok = copy_single_file(peer_socket, &list.entries[i]);
         else
-        {
-            // printf("fail\n");
-            send(naming_socket, " \033[1;31mERROR 45:\033[0m \033[38;5;214mDirectory copy failed!\033[0m\n\0", strlen(" \033[1;31mERROR 45:\033[0m \033[38;5;214mDirectory copy failed!\033[0m\n\0"), 0);
-        }
+            ok = copy_single_dir(peer_socket, &list.entries[i]);
     }
+    freeCopyList(&list);
 
+    int status = ERR_COPY;
+    WireHeader reply;
+    char respond[1024];
+    if (ok && sendFrame(peer_socket, OP_SYNC, 0, WIRE_OK, NULL, 0) == 0 &&
+        recvFrameInto(peer_socket, &reply, respond, sizeof(respond)) == 0)
+    {
+        status = reply.status;
+    }
     close(peer_socket);
+    return status;
 }
 
-int copy_single_file(int peer_socket, Node *source_node, const char *dest_path, int naming_socket)
+int copy_single_file(int peer_socket, const CopyEntry *entry)
 {
-    // Send file metadata
-    char metadata[MAX_BUFFER_SIZE];
-    memset(metadata, 0 , sizeof(metadata));
-    snprintf(metadata, sizeof(metadata), "FILE_META %s %s %d", dest_path, source_node->name, source_node->permissions);
-    send(peer_socket, metadata, strlen(metadata), 0);
-    char respond[1024];
-    memset(respond, 0 , sizeof(respond));
-    recv(peer_socket, respond, sizeof(respond), 0);
-    // printf("%s\n", respond);
-    if (strncmp(respond, "CREATE DONE", 11) == 0)
-    {
-        FILE *fp = fopen(source_node->dataLocation, "rb");
-        if (!fp)
-            return 0;
-
-        char buffer[100001];
-        size_t bytes_read;
-        char com[20];
-        while ((bytes_read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
-        {
-            // printf("%s\n", buffer);
-            send(peer_socket, buffer, bytes_read, 0);
-            memset(com, 0 , sizeof(com));
-            recv(peer_socket, com, sizeof(com), 0);
-            memset(buffer, 0, sizeof(buffer));
-        }
-        fclose(fp);
-        send(peer_socket, "END_OF_FILE\n", strlen("END_OF_FILE\n"), 0);
-        memset(buffer, 0 , sizeof(buffer));
-        recv(peer_socket, buffer, sizeof(buffer), 0);
-        // send(naming_socket, "COPY DONE", strlen("COPY DONE"), 0);
-        return 1;
-    }
-    else
-    {
-        // send(naming_socket, respond, strlen(respond), 0);
+    FILE *fp = fopen(entry->location, "rb");
+    if (!fp)
         return 0;
+
+    // Send file metadata, then the content
+    WireBuffer meta;
+    wireBufferInit(&meta);
+    wirePutString(&meta, entry->dest_path);
+    wirePutString(&meta, entry->name);
+    wirePutU32(&meta, entry->permissions);
+    int rc = sendFrame(peer_socket, OP_COPY_FILE, 0, WIRE_OK, meta.data, meta.length);
+    wireBufferFree(&meta);
+
+    char *buffer = malloc(WIRE_CHUNK_SIZE);
+    size_t bytes_read;
+    while (rc == 0 && (bytes_read = fread(buffer, 1, WIRE_CHUNK_SIZE, fp)) > 0)
+    {
+        rc = sendFrame(peer_socket, OP_DATA, 0, WIRE_OK, buffer, bytes_read);
     }
+    free(buffer);
+    fclose(fp);
+    if (rc == 0)
+        rc = sendFrame(peer_socket, OP_END, 0, WIRE_OK, NULL, 0);
+    return rc == 0;
 }
 
-int copy_directory_recursive(int peer_socket, Node *dir_node, const char *dest_path,int naming_socket)
+// Create directory on peer; its entries follow in the list
+int copy_single_dir(int peer_socket, const CopyEntry *entry)
 {
-    // Create directory on peer
-    char dir_cmd[MAX_BUFFER_SIZE];
-    memset(dir_cmd, 0, sizeof(dir_cmd));
-    snprintf(dir_cmd, sizeof(dir_cmd), "CREATE_DIR %s %s %d",dest_path, dir_node->name, dir_node->permissions);
-    send(peer_socket, dir_cmd, strlen(dir_cmd), 0);
-    memset(dir_cmd, 0 , sizeof(dir_cmd));
-    recv(peer_socket,dir_cmd,sizeof(dir_cmd),0);
-    int flag=1;
-    if (strncmp(dir_cmd, "CREATE DONE",11)==0)
-    {
-        // Recursively copy all children
-        for (int i = 0; i < TABLE_SIZE; i++)
-        {
-            Node *child = dir_node->children->table[i];
-            while (child)
-            {
-                char new_dest_path[MAX_PATH_LENGTH];
-                snprintf(new_dest_path, sizeof(new_dest_path), "%s/%s", dest_path, dir_node->name);
-
-                if (child->type == FILE_NODE)
-                {
-                    if(!copy_single_file(peer_socket, child, new_dest_path, naming_socket))
-                    {
-                        flag=0;
-                        break;
-                    }
-                }
-                else
-                {
-                    if(!copy_directory_recursive(peer_socket, child, new_dest_path,naming_socket))
-                    {
-                        flag=0;
-                        break;
-                    }
-                }
-                child = child->next;
-            }
-        }
-        if(flag)
-        return 1;
-        else
-        {
-            return 0;
-        }
-    }
-    else
-    {
-        return 0;
-    }
-}
\ No newline at end of file
+    WireBuffer meta;
+    wireBufferInit(&meta);
+    wirePutString(&meta, entry->dest_path);
+    wirePutString(&meta, entry->name);
+    wirePutU32(&meta, entry->permissions);
+    int rc = sendFrame(peer_socket, OP_COPY_DIR, 0, WIRE_OK, meta.data, meta.length);
+    wireBufferFree(&meta);
+    return rc == 0;
+}
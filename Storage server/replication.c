@@ -0,0 +1,690 @@
+#include "header.h"
+#include <inttypes.h>
+
+#define REPL_LOG_LIMIT (64 * 1024 * 1024) // log bytes kept for replicas that fall behind
+#define REPL_BATCH_BYTES (1024 * 1024)    // records per OP_REPLICA_LOG frame, roughly
+#define REPL_RETRY_SECONDS 2
+
+// Replication log: every change made through this storage server (client
+// writes, and creates, deletes and copies asked for by the naming server)
+// is appended as an encoded record (see wire.h) and shipped to the backups
+// in the naming server's REPLICA_SLOTS. A replica that reconnects only gets
+// the records it has not confirmed; one that fell further behind than the
+// log reaches, or never had a copy, gets a snapshot of the whole tree.
+// Changes made behind the server's back are not logged and reach the
+// backups with the next snapshot. Backup directories themselves are never
+// replicated.
+
+typedef struct ReplRecord
+{
+    size_t length;
+    char data[];
+} ReplRecord;
+
+typedef struct ReplicaSlot
+{
+    int configured;
+    unsigned int generation; // bumped whenever the slot is pointed elsewhere
+    char peer_ip[INET_ADDRSTRLEN];
+    int peer_port;
+    char backup_dir[MAX_PATH_LENGTH];
+    uint64_t acked; // last sequence number the replica confirmed
+    int synced;     // connected, and acked is the replica's real position
+} ReplicaSlot;
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static ReplRecord **records; // live records are records[record_start .. record_end)
+static size_t record_start;
+static size_t record_end;
+static size_t record_capacity;
+static uint64_t first_seq = 1; // sequence number of records[record_start]
+static size_t log_bytes;
+static uint64_t log_epoch;
+static ReplicaSlot slots[REPLICA_SLOTS];
+static Node *repl_root;
+
+static uint64_t nextSeq(void)
+{
+    return first_seq + (record_end - record_start);
+}
+
+// Drop what every replica has confirmed, and the oldest records past
+// REPL_LOG_LIMIT. Called with log_lock held.
+static void trimLog(void)
+{
+    uint64_t keep_from = nextSeq();
+    for (int i = 0; i < REPLICA_SLOTS; i++)
+    {
+        if (slots[i].configured && slots[i].acked + 1 < keep_from)
+            keep_from = slots[i].acked + 1;
+    }
+    while (record_start < record_end && (first_seq < keep_from || log_bytes > REPL_LOG_LIMIT))
+    {
+        log_bytes -= records[record_start]->length;
+        free(records[record_start++]);
+        first_seq++;
+    }
+    if (record_start > record_capacity / 2)
+    {
+        memmove(records, records + record_start, (record_end - record_start) * sizeof(ReplRecord *));
+        record_end -= record_start;
+        record_start = 0;
+    }
+}
+
+static void appendRecord(const WireBuffer *record)
+{
+    pthread_mutex_lock(&log_lock);
+    int replicated = 0;
+    for (int i = 0; i < REPLICA_SLOTS; i++)
+        replicated |= slots[i].configured;
+    // Nothing to log until a backup exists: its first sync is a snapshot
+    if (replicated)
+    {
+        if (record_end == record_capacity)
+        {
+            record_capacity = record_capacity ? record_capacity * 2 : 1024;
+            records = realloc(records, record_capacity * sizeof(ReplRecord *));
+        }
+        ReplRecord *entry = malloc(sizeof(ReplRecord) + record->length);
+        entry->length = record->length;
+        memcpy(entry->data, record->data, record->length);
+        records[record_end++] = entry;
+        log_bytes += record->length;
+        trimLog();
+        pthread_cond_broadcast(&log_cond);
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+static int isBackupPath(const char *path)
+{
+    return strncmp(path, "/backup_", 8) == 0;
+}
+
+static void putRecord(WireBuffer *record, uint8_t kind, NodeType type, const char *path)
+{
+    wirePutU8(record, kind);
+    wirePutU8(record, (uint8_t)type);
+    wirePutString(record, path);
+}
+
+static void putWrite(WireBuffer *record, const char *path, const char *data, size_t length, uint64_t offset)
+{
+    putRecord(record, REPL_WRITE, FILE_NODE, path);
+    wirePutU64(record, offset);
+    wirePutU32(record, (uint32_t)length);
+    wirePutBytes(record, data, length);
+}
+
+// Path of node below the storage root, e.g. "/dir/file". Called with
+// tree_lock held.
+int nodePath(Node *node, char *out, size_t size)
+{
+    if (!node->parent)
+    {
+        out[0] = '\0';
+        return 0;
+    }
+    if (nodePath(node->parent, out, size) < 0)
+        return -1;
+    size_t len = strlen(out);
+    return snprintf(out + len, size - len, "/%s", node->name) < (int)(size - len) ? 0 : -1;
+}
+
+void replicateCreate(const char *path, NodeType type)
+{
+    if (isBackupPath(path))
+        return;
+    WireBuffer record;
+    wireBufferInit(&record);
+    putRecord(&record, REPL_CREATE, type, path);
+    appendRecord(&record);
+    wireBufferFree(&record);
+}
+
+void replicateDelete(const char *path, NodeType type)
+{
+    if (isBackupPath(path))
+        return;
+    WireBuffer record;
+    wireBufferInit(&record);
+    putRecord(&record, REPL_DELETE, type, path);
+    appendRecord(&record);
+    wireBufferFree(&record);
+}
+
+// length bytes of data now sit at offset in the file at path
+void replicateWrite(const char *path, const char *data, size_t length, off_t offset)
+{
+    if (isBackupPath(path))
+        return;
+    WireBuffer record;
+    wireBufferInit(&record);
+    putWrite(&record, path, data, length, (uint64_t)offset);
+    appendRecord(&record);
+    wireBufferFree(&record);
+}
+
+// ---- Primary side: shipping the log ----
+
+static int connectPeer(const char *ip, int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+        return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0 ||
+        connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Send one OP_REPLICA_LOG frame and wait for the replica's position; the
+// replica holds nothing of this epoch when *applied comes back as -1
+static int sendBatch(int sock, const char *backup_dir, uint64_t first, uint8_t flags, uint32_t count,
+                     const WireBuffer *body, int64_t *applied)
+{
+    WireBuffer frame;
+    wireBufferInit(&frame);
+    wirePutU64(&frame, log_epoch);
+    wirePutU64(&frame, first);
+    wirePutU8(&frame, flags);
+    wirePutU32(&frame, count);
+    wirePutString(&frame, backup_dir);
+    if (body && body->length)
+        wirePutBytes(&frame, body->data, body->length);
+    int rc = sendFrame(sock, OP_REPLICA_LOG, 0, WIRE_OK, frame.data, frame.length);
+    wireBufferFree(&frame);
+    if (rc < 0)
+        return -1;
+
+    WireHeader reply;
+    char *payload;
+    if (recvFrame(sock, &reply, &payload) < 0)
+        return -1;
+    WireReader reader;
+    wireReaderInit(&reader, payload, reply.length);
+    uint64_t epoch = wireGetU64(&reader);
+    uint64_t position = wireGetU64(&reader);
+    *applied = epoch == log_epoch ? (int64_t)position : -1;
+    rc = (reply.status == WIRE_OK && !reader.error) ? 0 : -1;
+    free(payload);
+    return rc;
+}
+
+// Pre-order list of the tree as `type(1) path(string) location(string)`
+// entries, backup directories left out. Called with tree_lock held.
+static void collectTree(Node *dir, const char *path, WireBuffer *entries, uint32_t *count)
+{
+    if (!dir->children)
+        return;
+    for (unsigned int i = 0; i < dir->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(dir->children, i);
+        char child_path[MAX_PATH_LENGTH];
+        if (!child || snprintf(child_path, sizeof(child_path), "%s/%s", path, child->name) >= (int)sizeof(child_path) ||
+            isBackupPath(child_path))
+            continue;
+        wirePutU8(entries, (uint8_t)child->type);
+        wirePutString(entries, child_path);
+        wirePutString(entries, child->dataLocation);
+        (*count)++;
+        if (child->type == DIRECTORY_NODE)
+            collectTree(child, child_path, entries, count);
+    }
+}
+
+static int flushSnapshot(int sock, const char *backup_dir, uint64_t start, uint8_t flags, WireBuffer *body, uint32_t *count)
+{
+    int64_t applied;
+    int rc = sendBatch(sock, backup_dir, start, REPL_BATCH_SNAPSHOT | flags, *count, body, &applied);
+    body->length = 0;
+    *count = 0;
+    return rc;
+}
+
+// Rebuild the backup from scratch. Log records from start on are shipped
+// afterwards; those that the snapshot already reflects are harmless to
+// apply again.
+static int sendSnapshot(int sock, const char *backup_dir, uint64_t start)
+{
+    WireBuffer entries;
+    uint32_t entry_count = 0;
+    wireBufferInit(&entries);
+    pthread_mutex_lock(&tree_lock);
+    collectTree(repl_root, "", &entries, &entry_count);
+    pthread_mutex_unlock(&tree_lock);
+
+    WireBuffer body;
+    uint32_t count = 0;
+    int rc = 0;
+    wireBufferInit(&body);
+    putRecord(&body, REPL_RESET, DIRECTORY_NODE, "/");
+    count++;
+
+    char *chunk = malloc(WIRE_CHUNK_SIZE);
+    WireReader reader;
+    wireReaderInit(&reader, entries.data, entries.length);
+    for (uint32_t i = 0; i < entry_count && rc == 0; i++)
+    {
+        char path[MAX_PATH_LENGTH];
+        char location[PATH_MAX];
+        NodeType type = (NodeType)wireGetU8(&reader);
+        wireGetString(&reader, path, sizeof(path));
+        wireGetString(&reader, location, sizeof(location));
+        putRecord(&body, REPL_CREATE, type, path);
+        count++;
+
+        // Deleted since the tree was listed: the log replays the delete
+        int fd = type == FILE_NODE ? open(location, O_RDONLY) : -1;
+        ssize_t bytes;
+        uint64_t offset = 0;
+        while (fd >= 0 && rc == 0 && (bytes = read(fd, chunk, WIRE_CHUNK_SIZE)) > 0)
+        {
+            putWrite(&body, path, chunk, bytes, offset);
+            count++;
+            offset += bytes;
+            if (body.length >= REPL_BATCH_BYTES)
+                rc = flushSnapshot(sock, backup_dir, start, 0, &body, &count);
+        }
+        if (fd >= 0)
+            close(fd);
+        if (rc == 0 && body.length >= REPL_BATCH_BYTES)
+            rc = flushSnapshot(sock, backup_dir, start, 0, &body, &count);
+    }
+    if (rc == 0)
+        rc = flushSnapshot(sock, backup_dir, start, REPL_BATCH_SNAPSHOT_END, &body, &count);
+    free(chunk);
+    wireBufferFree(&body);
+    wireBufferFree(&entries);
+    return rc;
+}
+
+// Bring the replica up to date and keep it there until the connection
+// breaks or the slot is pointed elsewhere
+static void shipToReplica(ReplicaSlot *slot, int sock, unsigned int generation, const char *backup_dir)
+{
+    int64_t applied;
+    if (sendBatch(sock, backup_dir, 0, 0, 0, NULL, &applied) < 0)
+        return;
+
+    pthread_mutex_lock(&log_lock);
+    uint64_t next = (uint64_t)(applied + 1);
+    int snapshot = applied < 0 || next < first_seq || next > nextSeq();
+    if (snapshot)
+        next = nextSeq();
+    else
+        printf("Replica %s:%d%s resumes after record %" PRId64 "\n", slot->peer_ip, slot->peer_port, backup_dir, applied);
+
+    while (slot->generation == generation)
+    {
+        if (snapshot)
+        {
+            printf("Sending a snapshot to replica %s:%d%s\n", slot->peer_ip, slot->peer_port, backup_dir);
+            pthread_mutex_unlock(&log_lock);
+            int rc = sendSnapshot(sock, backup_dir, next);
+            pthread_mutex_lock(&log_lock);
+            if (rc < 0)
+                break;
+            snapshot = 0;
+        }
+        if (slot->generation == generation)
+        {
+            slot->acked = next - 1;
+            slot->synced = 1;
+            trimLog();
+        }
+        // Trimmed past this replica while it was being sent something else
+        if (next < first_seq)
+        {
+            snapshot = 1;
+            next = nextSeq();
+            continue;
+        }
+        while (next == nextSeq() && slot->generation == generation)
+            pthread_cond_wait(&log_cond, &log_lock);
+        if (slot->generation != generation || next < first_seq)
+            continue;
+
+        WireBuffer body;
+        uint32_t count = 0;
+        wireBufferInit(&body);
+        for (size_t i = record_start + (next - first_seq); i < record_end && body.length < REPL_BATCH_BYTES; i++)
+        {
+            wirePutBytes(&body, records[i]->data, records[i]->length);
+            count++;
+        }
+        uint64_t first = next;
+        pthread_mutex_unlock(&log_lock);
+        int rc = sendBatch(sock, backup_dir, first, 0, count, &body, &applied);
+        wireBufferFree(&body);
+        pthread_mutex_lock(&log_lock);
+        if (rc < 0 || applied < 0)
+            break;
+        next = (uint64_t)(applied + 1);
+    }
+    if (slot->generation == generation)
+        slot->synced = 0;
+    pthread_mutex_unlock(&log_lock);
+}
+
+static void *replicaShipper(void *arg)
+{
+    ReplicaSlot *slot = (ReplicaSlot *)arg;
+    while (1)
+    {
+        pthread_mutex_lock(&log_lock);
+        while (!slot->configured)
+            pthread_cond_wait(&log_cond, &log_lock);
+        unsigned int generation = slot->generation;
+        char peer_ip[INET_ADDRSTRLEN];
+        char backup_dir[MAX_PATH_LENGTH];
+        int peer_port = slot->peer_port;
+        memcpy(peer_ip, slot->peer_ip, sizeof(peer_ip));
+        memcpy(backup_dir, slot->backup_dir, sizeof(backup_dir));
+        pthread_mutex_unlock(&log_lock);
+
+        int sock = connectPeer(peer_ip, peer_port);
+        if (sock >= 0)
+        {
+            shipToReplica(slot, sock, generation, backup_dir);
+            close(sock);
+        }
+
+        pthread_mutex_lock(&log_lock);
+        int moved = slot->generation != generation;
+        pthread_mutex_unlock(&log_lock);
+        if (!moved)
+            sleep(REPL_RETRY_SECONDS);
+    }
+    return NULL;
+}
+
+// Point a backup slot at a peer, as asked by the naming server (OP_REPLICATE)
+int configureReplica(int slot_index, const char *peer_ip, int peer_port, const char *backup_dir)
+{
+    if (slot_index < 1 || slot_index > REPLICA_SLOTS || strlen(peer_ip) >= INET_ADDRSTRLEN)
+        return -1;
+    ReplicaSlot *slot = &slots[slot_index - 1];
+    pthread_mutex_lock(&log_lock);
+    if (!slot->configured || strcmp(slot->peer_ip, peer_ip) != 0 || slot->peer_port != peer_port ||
+        strcmp(slot->backup_dir, backup_dir) != 0)
+    {
+        snprintf(slot->peer_ip, sizeof(slot->peer_ip), "%s", peer_ip);
+        snprintf(slot->backup_dir, sizeof(slot->backup_dir), "%s", backup_dir);
+        slot->peer_port = peer_port;
+        slot->acked = 0;
+        slot->synced = 0;
+        slot->configured = 1;
+        slot->generation++;
+        pthread_cond_broadcast(&log_cond);
+    }
+    pthread_mutex_unlock(&log_lock);
+    return 0;
+}
+
+// Log records the backup in a slot has yet to confirm
+uint64_t replicaLag(int slot_index)
+{
+    ReplicaSlot *slot = &slots[slot_index - 1];
+    pthread_mutex_lock(&log_lock);
+    uint64_t lag = slot->synced ? nextSeq() - 1 - slot->acked : REPLICA_LAG_UNKNOWN;
+    pthread_mutex_unlock(&log_lock);
+    return lag;
+}
+
+int startReplication(Node *root)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    log_epoch = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 16);
+    repl_root = root;
+    for (int i = 0; i < REPLICA_SLOTS; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, replicaShipper, &slots[i]) != 0)
+        {
+            perror("Failed to create replication thread");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    return 0;
+}
+
+// ---- Replica side ----
+
+// A backup directory is a direct child of the root named backup_<id>
+static int validBackupDir(const char *backup_dir)
+{
+    return isBackupPath(backup_dir) && !strchr(backup_dir + 1, '/') && !strstr(backup_dir, "..");
+}
+
+// How far a backup directory is, kept beside it as a hidden file so it
+// survives restarts of either server
+static void replicaStatePath(Node *root, const char *backup_dir, char *out, size_t size)
+{
+    snprintf(out, size, "%s/.%s.replica", root->dataLocation, backup_dir + 1);
+}
+
+static void loadReplicaState(Node *root, const char *backup_dir, uint64_t *epoch, uint64_t *applied)
+{
+    char path[PATH_MAX];
+    replicaStatePath(root, backup_dir, path, sizeof(path));
+    *epoch = 0;
+    *applied = 0;
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return;
+    if (fscanf(file, "%" SCNu64 " %" SCNu64, epoch, applied) != 2)
+        *epoch = *applied = 0;
+    fclose(file);
+}
+
+static void saveReplicaState(Node *root, const char *backup_dir, uint64_t epoch, uint64_t applied)
+{
+    char path[PATH_MAX];
+    char temp[PATH_MAX + 4];
+    replicaStatePath(root, backup_dir, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *file = fopen(temp, "w");
+    if (!file)
+        return;
+    fprintf(file, "%" PRIu64 " %" PRIu64 "\n", epoch, applied);
+    if (fclose(file) == 0)
+        rename(temp, path);
+}
+
+// rm -rf; with keep_top the directory itself stays
+static void removeTree(const char *location, int keep_top)
+{
+    struct stat st;
+    if (lstat(location, &st) < 0)
+        return;
+    if (!S_ISDIR(st.st_mode))
+    {
+        unlink(location);
+        return;
+    }
+    DIR *dir = opendir(location);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        char child[PATH_MAX];
+        if (snprintf(child, sizeof(child), "%s/%s", location, entry->d_name) < (int)sizeof(child))
+            removeTree(child, 0);
+    }
+    if (dir)
+        closedir(dir);
+    if (!keep_top)
+        rmdir(location);
+}
+
+typedef struct ReplicaChange
+{
+    uint8_t kind;
+    NodeType type;
+    char path[MAX_PATH_LENGTH];
+    uint64_t offset;
+    uint32_t length;
+    const char *data; // points into the received frame
+} ReplicaChange;
+
+static int readRecord(WireReader *reader, ReplicaChange *change)
+{
+    change->kind = wireGetU8(reader);
+    change->type = (NodeType)wireGetU8(reader);
+    wireGetString(reader, change->path, sizeof(change->path));
+    change->offset = 0;
+    change->length = 0;
+    change->data = NULL;
+    if (change->kind == REPL_WRITE)
+    {
+        change->offset = wireGetU64(reader);
+        change->length = wireGetU32(reader);
+        if (reader->offset + change->length > reader->length)
+            reader->error = 1;
+        else
+            change->data = reader->data + reader->offset;
+        reader->offset += change->length;
+    }
+    return reader->error ? -1 : 0;
+}
+
+static int applyRecord(const char *base, const ReplicaChange *change)
+{
+    if (change->path[0] != '/' || strstr(change->path, ".."))
+        return -1;
+    char location[PATH_MAX];
+    if (snprintf(location, sizeof(location), "%s%s", base, change->kind == REPL_RESET ? "" : change->path) >=
+        (int)sizeof(location))
+        return -1;
+
+    switch (change->kind)
+    {
+    case REPL_RESET:
+        removeTree(location, 1);
+        if (mkdir(location, 0755) < 0 && errno != EEXIST)
+            return -1;
+        break;
+    case REPL_CREATE:
+        if (change->type == DIRECTORY_NODE)
+        {
+            if (mkdir(location, 0755) < 0 && errno != EEXIST)
+                return -1;
+        }
+        else
+        {
+            int fd = open(location, O_CREAT | O_WRONLY, 0644);
+            if (fd < 0)
+                return -1;
+            close(fd);
+        }
+        break;
+    case REPL_DELETE:
+        removeTree(location, 0);
+        break;
+    case REPL_WRITE:
+    {
+        int fd = open(location, O_CREAT | O_WRONLY, 0644);
+        if (fd < 0)
+            return -1;
+        ssize_t written = pwrite(fd, change->data, change->length, (off_t)change->offset);
+        close(fd);
+        if (written != (ssize_t)change->length)
+            return -1;
+        break;
+    }
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+// OP_REPLICA_LOG from a primary. Records go straight to the disk under the
+// backup directory; the namespace watcher (delta.c) then adds them to the
+// tree and reports them to the naming server like any other local change.
+void applyReplicaBatch(struct ClientData *client, WireHeader *hdr, WireReader *reader)
+{
+    char backup_dir[MAX_PATH_LENGTH];
+    uint64_t epoch = wireGetU64(reader);
+    uint64_t first = wireGetU64(reader);
+    uint8_t flags = wireGetU8(reader);
+    uint32_t count = wireGetU32(reader);
+    wireGetString(reader, backup_dir, sizeof(backup_dir));
+    if (reader->error || !validBackupDir(backup_dir))
+    {
+        sendError(client->socket, hdr, ERR_INVALID, "Invalid replication batch");
+        return;
+    }
+
+    char base[PATH_MAX];
+    snprintf(base, sizeof(base), "%s%s", client->root->dataLocation, backup_dir);
+    uint64_t saved_epoch, applied;
+    loadReplicaState(client->root, backup_dir, &saved_epoch, &applied);
+
+    uint16_t status = WIRE_OK;
+    if (flags & REPL_BATCH_SNAPSHOT)
+    {
+        // Until the last frame arrives the directory matches no position
+        if (saved_epoch != 0)
+        {
+            saveReplicaState(client->root, backup_dir, 0, 0);
+            saved_epoch = applied = 0;
+        }
+        ReplicaChange change;
+        for (uint32_t i = 0; i < count && readRecord(reader, &change) == 0; i++)
+        {
+            if (applyRecord(base, &change) < 0)
+                fprintf(stderr, "Failed to apply replicated change to %s%s\n", backup_dir, change.path);
+        }
+        if (reader->error)
+            status = ERR_INVALID;
+        else if (flags & REPL_BATCH_SNAPSHOT_END)
+        {
+            saved_epoch = epoch;
+            applied = first - 1;
+            saveReplicaState(client->root, backup_dir, epoch, applied);
+            printf("Replica %s is complete up to record %" PRIu64 "\n", backup_dir, applied);
+        }
+    }
+    else if (count > 0)
+    {
+        if (saved_epoch != epoch || first > applied + 1)
+            status = ERR_INVALID; // a gap: the primary starts over with a snapshot
+        ReplicaChange change;
+        for (uint32_t i = 0; i < count && status == WIRE_OK; i++)
+        {
+            if (readRecord(reader, &change) < 0)
+            {
+                status = ERR_INVALID;
+                break;
+            }
+            // Records this replica already holds are skipped
+            if (first + i <= applied)
+                continue;
+            if (applyRecord(base, &change) < 0)
+                fprintf(stderr, "Failed to apply replicated change to %s%s\n", backup_dir, change.path);
+            applied = first + i;
+        }
+        if (status == WIRE_OK)
+            saveReplicaState(client->root, backup_dir, epoch, applied);
+    }
+
+    WireBuffer out;
+    wireBufferInit(&out);
+    wirePutU64(&out, saved_epoch);
+    wirePutU64(&out, applied);
+    sendReply(client->socket, hdr, status, out.data, out.length);
+    wireBufferFree(&out);
+}
@@ -10,9 +10,10 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <pthread.h>
+#include <time.h>
+#include "../common/wire.h"
 
 #define MAX_BUFFER_SIZE 100001
-#define ACK_RECEIVE_PORT 9091 // Dedicated port for receiving ACKs
 int ack_socket;               // Declare globally to be accessed by both functions
 struct sockaddr_in ack_addr;
 int ack_port;
@@ -22,10 +23,13 @@ void displayHelp()
     printf("READ <path> - Read file content\n");
     printf("WRITE <path> - Write content to file\n");
     printf("DELETE <path> - Delete a file or folder\n");
-    printf("CREATE FILE/DIR <no> <path> - Create a new file or folder\n");
-    printf("LIST <path> - List all files and folders in the specified directory\n");
+    printf("CREATE FILE/DIR <no>|AUTO <path> - Create a new file or folder\n");
+    printf("LIST [path] [--depth N] [--limit N] [--after CURSOR] - List files and folders below a path\n");
+    printf("FIND <path> <glob> [--limit N [--after CURSOR]] - Find entries below a path whose names match a glob\n");
     printf("META <path> - Get file metadata\n");
+    printf("RESOLVE [--write] <path>... - Look up many paths at once for the commands that follow\n");
     printf("STREAM <path> - Stream file content\n");
+    printf("STATS [--json] - Show naming server latencies and traffic\n");
     printf("EXIT - Close connection and exit\n");
 
     printf("HELP - Display this help message\n\n");
@@ -38,6 +42,7 @@ struct ServerInfo
 {
     char ip[20];
     int port;
+    char path[1024]; // may differ from the one asked for when a backup serves it
 };
 
 int connectToServer(const char *ip, int port)
@@ -114,8 +119,160 @@ void initializeAckSocket()
         exit(-1);
     }
 }
+
+// Where paths were last resolved to. A leased answer is reused until its
+// lease runs out or the naming server invalidates it; one without a lease is
+// used by the next command on its path only.
+#define LOCATION_SLOTS 1024
+struct CachedLocation
+{
+    int valid;
+    uint8_t access;
+    char path[1024]; // normalized
+    struct ServerInfo server;
+    uint64_t expires_ms; // 0: use once
+    uint64_t version;
+};
+static struct CachedLocation locations[LOCATION_SLOTS];
+static uint64_t invalidated_version; // newest OP_INVALIDATE seen
+static pthread_mutex_t locations_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Same form the naming server keys leases by: one leading '/', no doubled
+// or trailing '/'
+static int normalizePath(const char *path, char *out, size_t size)
+{
+    size_t len = 0;
+    out[len++] = '/';
+    for (const char *p = path; *p; p++)
+    {
+        if (*p == '/' && out[len - 1] == '/')
+            continue;
+        if (len + 1 >= size)
+            return -1;
+        out[len++] = *p;
+    }
+    if (len > 1 && out[len - 1] == '/')
+        len--;
+    out[len] = '\0';
+    return 0;
+}
+
+static struct CachedLocation *locationSlot(const char *key)
+{
+    unsigned int hash = 2166136261u;
+    for (const char *p = key; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    return &locations[hash % LOCATION_SLOTS];
+}
+
+static void cacheLocation(const char *path, uint8_t access, const struct ServerInfo *server, uint32_t lease_ms,
+                          uint64_t version)
+{
+    char key[1024];
+    if (normalizePath(path, key, sizeof(key)) < 0)
+        return;
+    pthread_mutex_lock(&locations_lock);
+    struct CachedLocation *entry = locationSlot(key);
+    entry->valid = 1;
+    entry->access = access;
+    snprintf(entry->path, sizeof(entry->path), "%s", key);
+    entry->server = *server;
+    // An invalidation may have overtaken the reply; don't keep the answer then
+    entry->expires_ms = lease_ms > 0 && version >= invalidated_version ? monotonicMs() + lease_ms : 0;
+    entry->version = version;
+    pthread_mutex_unlock(&locations_lock);
+}
+
+static int takeLocation(const char *path, uint8_t access, struct ServerInfo *server)
+{
+    char key[1024];
+    if (normalizePath(path, key, sizeof(key)) < 0)
+        return 0;
+    int found = 0;
+    pthread_mutex_lock(&locations_lock);
+    struct CachedLocation *entry = locationSlot(key);
+    // A write must go to the primary, which a read answer may not name
+    if (entry->valid && strcmp(entry->path, key) == 0 && (entry->access == access || access != ACCESS_WRITE))
+    {
+        if (entry->expires_ms == 0 || entry->expires_ms > monotonicMs())
+        {
+            *server = entry->server;
+            found = 1;
+        }
+        if (entry->expires_ms == 0 || !found)
+            entry->valid = 0;
+    }
+    pthread_mutex_unlock(&locations_lock);
+    return found;
+}
+
+static void dropLocation(const char *path)
+{
+    char key[1024];
+    if (normalizePath(path, key, sizeof(key)) < 0)
+        return;
+    pthread_mutex_lock(&locations_lock);
+    struct CachedLocation *entry = locationSlot(key);
+    if (entry->valid && strcmp(entry->path, key) == 0)
+        entry->valid = 0;
+    pthread_mutex_unlock(&locations_lock);
+}
+
+// OP_INVALIDATE: answers for key and below, given before version, are void
+static void invalidateLocations(const char *key, uint64_t version)
+{
+    size_t len = strlen(key);
+    pthread_mutex_lock(&locations_lock);
+    if (version > invalidated_version)
+        invalidated_version = version;
+    for (int i = 0; i < LOCATION_SLOTS; i++)
+    {
+        struct CachedLocation *entry = &locations[i];
+        if (entry->valid && entry->version < version &&
+            (len == 1 || (strncmp(entry->path, key, len) == 0 && (entry->path[len] == '\0' || entry->path[len] == '/'))))
+            entry->valid = 0;
+    }
+    pthread_mutex_unlock(&locations_lock);
+}
+
 pthread_t ack_thread;
 
+// Notices from the naming server (write acks, OP_INVALIDATE) arrive as a
+// stream of frames on a connection the naming server keeps open
+static void *noticeChannel(void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+    char buffer[4096];
+    WireHeader hdr;
+    while (recvFrameInto(sock, &hdr, buffer, sizeof(buffer)) == 0)
+    {
+        if (hdr.opcode == OP_INVALIDATE)
+        {
+            WireReader reader;
+            char path[1024];
+            wireReaderInit(&reader, buffer, hdr.length);
+            uint64_t version = wireGetU64(&reader);
+            if (wireGetString(&reader, path, sizeof(path)) >= 0)
+                invalidateLocations(path, version);
+        }
+        else
+        {
+            printf("Received ACK: %s\n", buffer);
+        }
+    }
+    close(sock); // The naming server closed the channel
+    return NULL;
+}
+
+// The naming server may hold more than one channel open at once (one per
+// address it knows this client by), so each gets its own thread
 void *ackReceiver(void *arg)
 {
     while (1)
@@ -123,7 +280,6 @@ void *ackReceiver(void *arg)
         int new_sock;
         struct sockaddr_in client_addr;
         socklen_t addr_len = sizeof(client_addr);
-        char buffer[1024];
 
         // Accept the incoming connection from the naming server
         new_sock = accept(ack_socket, (struct sockaddr *)&client_addr, &addr_len);
@@ -133,80 +289,109 @@ void *ackReceiver(void *arg)
             continue;
         }
 
-        memset(buffer, 0, sizeof(buffer));
-        // Receive the acknowledgment message
-        ssize_t recv_size = recv(new_sock, buffer, sizeof(buffer) - 1, 0);
-        if (recv_size > 0)
-        {
-            buffer[recv_size] = '\0'; // Null-terminate the received message
-            printf("Received ACK: %s\n", buffer);
-        }
-        else
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, noticeChannel, (void *)(intptr_t)new_sock) != 0)
         {
-            perror("Failed to receive acknowledgment");
+            perror("Failed to create notice thread");
+            close(new_sock);
+            continue;
         }
-
-        close(new_sock); // Close the socket after handling the ACK
+        pthread_detach(thread);
     }
 
     return NULL;
 }
 
-void handleRead(int sock, const char *command)
+uint32_t next_request_id = 0;
+
+void printError(const WireHeader *hdr, const char *message)
 {
-    char buffer[MAX_BUFFER_SIZE];
-    ssize_t bytes_received;
-
-    // Send command to server
-    send(sock, command, strlen(command), 0);
-
-    // First receive file size
-    memset(buffer, 0, sizeof(buffer));
-    bytes_received = recv(sock, buffer, sizeof(buffer), 0);
-    buffer[bytes_received] = '\0';
-    send(sock, command, strlen(command), 0);
-
-    if (strncmp(buffer, "FILE_SIZE:", 10) == 0)
-    {
-        long fileSize;
-        sscanf(buffer, "FILE_SIZE:%ld", &fileSize);
-        printf("Receiving file of size: %ld bytes\n", fileSize);
-        long size = 0;
-        // Receive file content
-        memset(buffer, 0, sizeof(buffer));
-        while ((bytes_received = recv(sock, buffer, sizeof(buffer), 0)) > 0)
-        {
-            send(sock, command, strlen(command), 0);
-            // printf("%d\n",bytes_received);
-            // size+=bytes_received;
-            buffer[bytes_received] = '\0';
-            if (strncmp(buffer, "END_OF_FILE\n", 12) == 0)
-                break;
-            printf("%s", buffer);
-            memset(buffer, 0, sizeof(buffer));
-        }
+    printf(" \033[1;31mERROR %d:\033[0m \033[38;5;214m%s\033[0m\n", hdr->status, message);
+}
+
+// Send one request and wait for its reply. The reply payload is
+// NUL-terminated and must be freed by the caller.
+int sendRequest(int sock, uint8_t opcode, const WireBuffer *payload, WireHeader *reply, char **reply_payload)
+{
+    *reply_payload = NULL;
+    if (sendFrame(sock, opcode, ++next_request_id, WIRE_OK, payload ? payload->data : NULL, payload ? payload->length : 0) < 0)
+    {
+        printf("Error: Unable to send request.\n");
+        return -1;
     }
+    if (recvFrame(sock, reply, reply_payload) < 0)
+    {
+        printf("Error: Unable to receive response from server.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Print a reply that is either a plain message or an error
+void printReply(int sock, uint8_t opcode, WireBuffer *request)
+{
+    WireHeader reply;
+    char *respond;
+    if (sendRequest(sock, opcode, request, &reply, &respond) < 0)
+        return;
+    if (reply.status != WIRE_OK)
+        printError(&reply, respond);
     else
+        printf("%s\n", respond);
+    free(respond);
+}
+
+void handleRead(int sock, const char *path)
+{
+    WireBuffer request;
+    WireHeader reply;
+    char *respond;
+    wireBufferInit(&request);
+    wirePutString(&request, path);
+    int rc = sendRequest(sock, OP_READ, &request, &reply, &respond);
+    wireBufferFree(&request);
+    if (rc < 0)
+        return;
+    if (reply.status != WIRE_OK)
+    {
+        printError(&reply, respond);
+        free(respond);
+        return;
+    }
+
+    WireReader reader;
+    wireReaderInit(&reader, respond, reply.length);
+    printf("Receiving file of size: %llu bytes\n", (unsigned long long)wireGetU64(&reader));
+    free(respond);
+
+    // Receive file content until the END frame
+    while (recvFrame(sock, &reply, &respond) == 0)
     {
-        printf("%s", buffer + 1);
-        printf("\033[0m");
+        if (reply.opcode != OP_DATA)
+        {
+            free(respond);
+            break;
+        }
+        fwrite(respond, 1, reply.length, stdout);
+        free(respond);
     }
 }
 
 void handleWrite(int sock, const char *command)
 {
     char buffer[MAX_BUFFER_SIZE];
-    char content[MAX_BUFFER_SIZE * 16]; // Larger buffer for user input
+    static char content[MAX_BUFFER_SIZE * 16]; // Larger buffer for user input
     char filepath[256];
 
     // Extract filepath from command
-    sscanf(command, "WRITE %s", filepath);
+    sscanf(command, "WRITE %255s", filepath);
+    int sync_write = strstr(command, "--SYNC") != NULL;
 
     // Get content size from user
     printf("Enter the number of characters to write: ");
 
     long contentSize;
-    if (scanf("%ld", &contentSize) != 1)
+    if (scanf("%ld", &contentSize) != 1 || contentSize < 0)
     {
         printf("Error: Invalid content size\n");
         return;
@@ -222,15 +407,14 @@ void handleWrite(int sock, const char *command)
 
     // Read input until desired size is reached or buffer is full
     size_t total_size = 0;
+    content[0] = '\0';
     while (total_size < (size_t)contentSize)
     {
         if (!fgets(buffer, sizeof(buffer), stdin))
         {
             if (ferror(stdin))
             {
-                printf(" \033[1;31mERROR: 34\033[0m \033[38;5;214mUnable to Read input\033[0m\n\0");
-                printf("\033[0m");
-
+                printf(" \033[1;31mERROR: 34\033[0m \033[38;5;214mUnable to Read input\033[0m\n");
                 return;
             }
             break; // EOF reached
@@ -246,97 +430,67 @@ void handleWrite(int sock, const char *command)
         }
 
         // Append input to content buffer
-        strcat(content, buffer);
+        memcpy(content + total_size, buffer, input_len + 1);
         total_size += input_len;
         printf("%s\n", buffer);
-        memset(buffer, 0, sizeof(buffer));
     }
 
     // Clear any EOF condition
     clearerr(stdin);
-
-    // Send command to server
-    send(sock, command, strlen(command), 0);
-    memset(buffer, 0, sizeof(buffer));
-    recv(sock, buffer, sizeof(buffer), 0);
-    // Send content size
-    memset(buffer, 0, sizeof(buffer));
-    snprintf(buffer, sizeof(buffer), "FILE_SIZE:%ld|ACK_PORT:%d", contentSize, ack_port);
-    send(sock, buffer, strlen(buffer), 0);
-    // recv(sock, buffer, sizeof(buffer), 0);
-
-    memset(buffer, 0, sizeof(buffer));
-    // Wait for server acknowledgment
-    ssize_t recv_size = recv(sock, buffer, sizeof(buffer), 0);
-    if (recv_size <= 0)
-    {
-        printf("Error receiving server acknowledgment\n");
+    if (total_size > (size_t)contentSize)
+        total_size = contentSize;
+
+    // Announce the write; the server replies once it is ready for the data
+    WireBuffer request;
+    WireHeader reply;
+    char *respond;
+    wireBufferInit(&request);
+    wirePutU8(&request, sync_write);
+    wirePutU64(&request, total_size);
+    wirePutU16(&request, ack_port);
+    wirePutString(&request, filepath);
+    int rc = sendRequest(sock, OP_WRITE, &request, &reply, &respond);
+    wireBufferFree(&request);
+    if (rc < 0)
         return;
-    }
-    buffer[recv_size] = '\0';
-
-    if (strcmp(buffer, "READY_TO_RECEIVE\n") != 0)
+    if (reply.status != WIRE_OK)
     {
-        printf("%s", buffer + 1);
-        printf("\033[0m");
-        memset(buffer, 0, strlen(buffer));
-        memset(content, 0, strlen(content));
+        printError(&reply, respond);
+        free(respond);
         return;
     }
+    free(respond);
 
-    // Send content in chunks
-    size_t remaining = contentSize;
+    // Send content in chunks, back to back
     size_t offset = 0;
-
-    while (remaining > 0)
+    while (offset < total_size)
     {
-        size_t chunk_size = (remaining < MAX_BUFFER_SIZE) ? remaining : MAX_BUFFER_SIZE;
-        ssize_t sent = send(sock, content + offset, chunk_size, 0);
-
-        if (sent <= 0)
+        size_t chunk_size = total_size - offset < WIRE_CHUNK_SIZE ? total_size - offset : WIRE_CHUNK_SIZE;
+        if (sendFrame(sock, OP_DATA, next_request_id, WIRE_OK, content + offset, chunk_size) < 0)
         {
             printf("Error sending data\n");
             return;
         }
-
-        remaining -= sent;
-        offset += sent;
-        recv(sock, buffer, sizeof(buffer), 0);
+        offset += chunk_size;
     }
-    memset(buffer, 0, sizeof(buffer));
-    send(sock, "bruh\0", 5, 0);
 
     // Receive confirmation
-    recv_size = recv(sock, buffer, sizeof(buffer), 0);
-    if (recv_size <= 0)
-    {
-        printf("Error receiving server confirmation\n");
-        return;
-    }
-    buffer[recv_size] = '\0';
-    memset(content, 0, sizeof(content));
-    printf("%s", buffer);
-    printf("\033[0m");
+    printReply(sock, OP_END, NULL);
 }
-void handleMeta(int sock, const char *command)
-{
-    char buffer[MAX_BUFFER_SIZE];
 
-    send(sock, command, strlen(command), 0);
-    memset(buffer, 0, sizeof(buffer));
-    ssize_t bytes_received = recv(sock, buffer, sizeof(buffer), 0);
-    buffer[bytes_received] = '\0';
-    printf("%s", buffer);
-    printf("\033[0m");
+void handleMeta(int sock, const char *path)
+{
+    WireBuffer request;
+    wireBufferInit(&request);
+    wirePutString(&request, path);
+    printReply(sock, OP_META, &request);
+    wireBufferFree(&request);
 }
 
-void handleStream(int sock, const char *command)
+void handleStream(int sock, const char *path)
 {
-    char buffer[100001];
-    ssize_t bytes_received;
     int pipe_fd[2];
     pid_t ffplay_pid;
-    int stop_stream = 0;
 
     if (pipe(pipe_fd) == -1)
     {
@@ -365,42 +519,37 @@ void handleStream(int sock, const char *command)
 
     close(pipe_fd[0]);
 
-    send(sock, command, strlen(command), 0);
-
-    memset(buffer, 0, sizeof(buffer));
-    bytes_received = recv(sock, buffer, sizeof(buffer), 0);
-    buffer[bytes_received] = '\0';
+    WireBuffer request;
+    WireHeader reply;
+    char *respond;
+    wireBufferInit(&request);
+    wirePutString(&request, path);
+    int rc = sendRequest(sock, OP_STREAM, &request, &reply, &respond);
+    wireBufferFree(&request);
 
-    if (strcmp(buffer, "START_STREAM\n") == 0)
+    if (rc == 0 && reply.status == WIRE_OK)
     {
+        free(respond);
         printf("Stream started...\n");
 
-        while ((bytes_received = recv(sock, buffer, sizeof(buffer), 0)) > 0)
+        while (recvFrame(sock, &reply, &respond) == 0)
         {
-            buffer[bytes_received] = '\0';
-
-            send(sock, command, strlen(command), 0);
-
-            if (strcmp(buffer, "END_STREAM\n") == 0)
-            {
-                break;
-            }
-
-            write(pipe_fd[1], buffer, bytes_received);
-            printf("Streaming chunk: %zd bytes\n", bytes_received);
-            memset(buffer, 0, sizeof(buffer));
-            if (stop_stream)
+            if (reply.opcode != OP_DATA)
             {
+                free(respond);
                 break;
             }
+            write(pipe_fd[1], respond, reply.length);
+            printf("Streaming chunk: %u bytes\n", reply.length);
+            free(respond);
         }
 
         printf("Stream complete.\n");
     }
-    else
+    else if (rc == 0)
     {
-        printf("%s", buffer + 1);
-        printf("\033[0m");
+        printError(&reply, respond);
+        free(respond);
     }
 
     close(pipe_fd[1]);
@@ -410,28 +559,292 @@ void handleStream(int sock, const char *command)
     waitpid(ffplay_pid, &status, 0);
 }
 
-struct ServerInfo connect_naming_server(int sock, char *command)
+// RESOLVE [--write] <path>...
+void handleResolve(int naming_sock, char *command)
 {
-    struct ServerInfo server = {"", 0}; // Initialize with empty IP and port 0
+    uint8_t access = ACCESS_READ;
+    char *paths[RESOLVE_MAX_PATHS];
+    uint32_t count = 0;
+    char *save;
+    strtok_r(command, " ", &save);
+    for (char *token = strtok_r(NULL, " ", &save); token; token = strtok_r(NULL, " ", &save))
+    {
+        if (strcmp(token, "--write") == 0)
+            access = ACCESS_WRITE;
+        else if (count < RESOLVE_MAX_PATHS)
+            paths[count++] = token;
+    }
+    if (count == 0)
+    {
+        printf(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n");
+        return;
+    }
+
+    WireBuffer request;
+    WireHeader reply;
+    char *response;
+    wireBufferInit(&request);
+    wirePutU8(&request, access);
+    wirePutU16(&request, ack_port);
+    wirePutU32(&request, count);
+    for (uint32_t i = 0; i < count; i++)
+        wirePutString(&request, paths[i]);
+    int rc = sendRequest(naming_sock, OP_RESOLVE, &request, &reply, &response);
+    wireBufferFree(&request);
+    if (rc < 0)
+        return;
+    if (reply.status != WIRE_OK)
+    {
+        printError(&reply, response);
+        free(response);
+        return;
+    }
 
-    send(sock, command, strlen(command), 0);
-    char buffer[100001];
-    memset(buffer, 0, sizeof(buffer));
-    recv(sock, buffer, sizeof(buffer), 0);
+    WireReader reader;
+    wireReaderInit(&reader, response, reply.length);
+    if (wireGetU32(&reader) != count)
+    {
+        printf("Error: Malformed RESOLVE reply.\n");
+        free(response);
+        return;
+    }
+    for (uint32_t i = 0; i < count && !reader.error; i++)
+    {
+        uint16_t status = wireGetU16(&reader);
+        if (status != WIRE_OK)
+        {
+            printf("%s: \033[1;31mERROR %d\033[0m\n", paths[i], status);
+            continue;
+        }
+        uint8_t type = wireGetU8(&reader);
+        uint8_t copies = wireGetU8(&reader);
+        struct ServerInfo primary = {"", 0, ""};
+        for (uint8_t j = 0; j < copies; j++)
+        {
+            struct ServerInfo server = {"", 0, ""};
+            wireGetString(&reader, server.ip, sizeof(server.ip));
+            server.port = wireGetU16(&reader);
+            wireGetString(&reader, server.path, sizeof(server.path));
+            if (j == 0)
+            {
+                printf("%s: %s on %s:%d %s", paths[i], type == 1 ? "Directory" : "File", server.ip, server.port, server.path);
+                primary = server;
+            }
+            else
+            {
+                printf("%s %s:%d", j == 1 ? " (also" : ",", server.ip, server.port);
+            }
+        }
+        printf("%s\n", copies > 1 ? ")" : "");
+        uint32_t lease_ms = wireGetU32(&reader);
+        uint64_t version = wireGetU64(&reader);
+        if (copies > 0 && !reader.error)
+            cacheLocation(paths[i], access, &primary, lease_ms, version);
+    }
+    free(response);
+}
+
+struct ServerInfo connect_naming_server(int sock, uint8_t access, const char *path)
+{
+    struct ServerInfo server = {"", 0, ""}; // Initialize with empty IP and port 0
+
+    WireBuffer request;
+    WireHeader reply;
+    char *respond;
+    wireBufferInit(&request);
+    wirePutU8(&request, access);
+    wirePutString(&request, path);
+    wirePutU16(&request, ack_port);
+    int rc = sendRequest(sock, OP_LOOKUP, &request, &reply, &respond);
+    wireBufferFree(&request);
+    if (rc < 0)
+        return server;
 
     // Check if path not found
-    if (buffer[0] == ' ')
+    if (reply.status != WIRE_OK)
     {
-        printf("%s", buffer + 1);
-        printf("\033[0m");
+        printError(&reply, respond);
         fflush(stdout);
+        free(respond);
         return server; // Return with null port (0)
     }
 
-    sscanf(buffer, "StorageServer: %s : %d", server.ip, &server.port);
-    printf("%d %s", server.port, server.ip);
+    WireReader reader;
+    wireReaderInit(&reader, respond, reply.length);
+    wireGetString(&reader, server.ip, sizeof(server.ip));
+    server.port = wireGetU16(&reader);
+    if (wireGetString(&reader, server.path, sizeof(server.path)) < 0)
+        snprintf(server.path, sizeof(server.path), "%s", path);
+    uint32_t lease_ms = wireGetU32(&reader);
+    uint64_t version = wireGetU64(&reader);
+    if (!reader.error && lease_ms > 0)
+        cacheLocation(path, access, &server, lease_ms, version);
+    free(respond);
+    printf("%d %s\n", server.port, server.ip);
     return server;
 }
+
+// READ, WRITE, META and STREAM: ask the naming server where the path lives,
+// unless a cached answer says so already, then talk to that storage server
+// directly
+void storageOperation(int naming_sock, const char *command, uint8_t access)
+{
+    char path[1024];
+    if (sscanf(command, "%*s %1023s", path) != 1)
+    {
+        printf(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n");
+        return;
+    }
+    struct ServerInfo storage_server;
+    int storage_sock = -1;
+    if (takeLocation(path, access, &storage_server))
+    {
+        storage_sock = connectToServer(storage_server.ip, storage_server.port);
+        if (storage_sock < 0)
+            dropLocation(path);
+    }
+    if (storage_sock < 0)
+    {
+        // Not resolved beforehand, or that server has gone away since
+        storage_server = connect_naming_server(naming_sock, access, path);
+        if (storage_server.port == 0)
+        {
+            return;
+        }
+        storage_sock = connectToServer(storage_server.ip, storage_server.port);
+        if (storage_sock < 0)
+        {
+            return;
+        }
+    }
+    if (access == ACCESS_READ)
+        handleRead(storage_sock, storage_server.path);
+    else if (access == ACCESS_WRITE)
+        handleWrite(storage_sock, command);
+    else if (access == ACCESS_META)
+        handleMeta(storage_sock, storage_server.path);
+    else
+        handleStream(storage_sock, storage_server.path);
+    sendFrame(storage_sock, OP_EXIT, 0, WIRE_OK, NULL, 0);
+    close(storage_sock);
+}
+
+// LIST [path] [--depth N] [--limit N] [--after CURSOR]
+// Entries are printed as the naming server streams them in; when --limit
+// cuts the listing short, the cursor to continue from is printed at the end.
+void handleList(int naming_sock, char *command)
+{
+    char path[1024] = ""; // empty path lists the whole namespace
+    char after[1024] = "";
+    unsigned int depth = 0, limit = 0;
+    char *save;
+    strtok_r(command, " ", &save);
+    for (char *token = strtok_r(NULL, " ", &save); token; token = strtok_r(NULL, " ", &save))
+    {
+        char *value = NULL;
+        if (strcmp(token, "--depth") == 0 || strcmp(token, "--limit") == 0 || strcmp(token, "--after") == 0)
+        {
+            value = strtok_r(NULL, " ", &save);
+            if (!value)
+            {
+                printf(" \033[1;31mERROR 101:\033[0m \033[38;5;214mMissing value for %s\033[0m\n", token);
+                return;
+            }
+        }
+        if (strcmp(token, "--depth") == 0)
+            depth = strtoul(value, NULL, 10);
+        else if (strcmp(token, "--limit") == 0)
+            limit = strtoul(value, NULL, 10);
+        else if (strcmp(token, "--after") == 0)
+            snprintf(after, sizeof(after), "%s", value);
+        else
+            snprintf(path, sizeof(path), "%s", token);
+    }
+
+    WireBuffer request;
+    WireHeader reply;
+    char *response;
+    wireBufferInit(&request);
+    wirePutString(&request, path);
+    wirePutU32(&request, depth);
+    wirePutU32(&request, limit);
+    wirePutString(&request, after);
+    int rc = sendRequest(naming_sock, OP_LIST, &request, &reply, &response);
+    wireBufferFree(&request);
+    if (rc < 0)
+        return;
+    if (reply.status != WIRE_OK)
+    {
+        printError(&reply, response);
+        free(response);
+        return;
+    }
+    free(response);
+
+    printf("List of files and directories:\n");
+    while (recvFrame(naming_sock, &reply, &response) == 0)
+    {
+        if (reply.opcode == OP_DATA)
+        {
+            fwrite(response, 1, reply.length, stdout);
+            free(response);
+            continue;
+        }
+        if (reply.length > 0)
+            printf("-- more entries: LIST %s --limit %u --after %s\n", path[0] ? path : "/", limit, response);
+        free(response);
+        break;
+    }
+}
+
+void handleFind(int naming_sock, const char *command)
+{
+    char path[1024], glob[1024];
+    char after[1024] = "";
+    unsigned int limit = 0;
+    int fields = sscanf(command, "FIND %1023s %1023s --limit %u --after %1023s", path, glob, &limit, after);
+    if (fields < 2)
+    {
+        printf(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n");
+        return;
+    }
+
+    WireBuffer request;
+    WireHeader reply;
+    char *response;
+    wireBufferInit(&request);
+    wirePutString(&request, path);
+    wirePutString(&request, glob);
+    wirePutU32(&request, limit);
+    wirePutString(&request, after);
+    int rc = sendRequest(naming_sock, OP_FIND, &request, &reply, &response);
+    wireBufferFree(&request);
+    if (rc < 0)
+        return;
+    if (reply.status != WIRE_OK)
+    {
+        printError(&reply, response);
+        free(response);
+        return;
+    }
+    free(response);
+
+    printf("Matches for %s under %s:\n", glob, path);
+    while (recvFrame(naming_sock, &reply, &response) == 0)
+    {
+        if (reply.opcode == OP_DATA)
+        {
+            fwrite(response, 1, reply.length, stdout);
+            free(response);
+            continue;
+        }
+        if (reply.length > 0)
+            printf("-- more matches: FIND %s %s --limit %u --after %s\n", path, glob, limit, response);
+        free(response);
+        break;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     if (argc != 3)
@@ -486,130 +899,98 @@ int main(int argc, char *argv[])
 
         if (strcmp(command, "EXIT") == 0)
         {
-            send(naming_sock, command, strlen(command), 0);
+            sendFrame(naming_sock, OP_EXIT, ++next_request_id, WIRE_OK, NULL, 0);
             break;
         }
 
         if (strncmp(command, "READ ", 5) == 0)
         {
-            struct ServerInfo storage_server = connect_naming_server(naming_sock, command);
-            if (storage_server.port == 0)
-            {
-                continue;
-            }
-            int storage_sock = connectToServer(storage_server.ip, storage_server.port);
-            if (storage_sock < 0)
-            {
-                continue;
-            }
-            handleRead(storage_sock, command);
-            close(storage_sock);
+            storageOperation(naming_sock, command, ACCESS_READ);
         }
         else if (strncmp(command, "WRITE ", 6) == 0)
         {
-            struct ServerInfo storage_server = connect_naming_server(naming_sock, command);
-            if (storage_server.port == 0)
-            {
-                continue;
-            }
-            int storage_sock = connectToServer(storage_server.ip, storage_server.port);
-            if (storage_sock < 0)
-            {
-                continue;
-            }
-            handleWrite(storage_sock, command);
-            close(storage_sock);
+            storageOperation(naming_sock, command, ACCESS_WRITE);
         }
         else if (strncmp(command, "META ", 5) == 0)
         {
-            struct ServerInfo storage_server = connect_naming_server(naming_sock, command);
-            if (storage_server.port == 0)
-            {
-                continue;
-            }
-            int storage_sock = connectToServer(storage_server.ip, storage_server.port);
-            if (storage_sock < 0)
-            {
-                continue;
-            }
-            handleMeta(storage_sock, command);
-            close(storage_sock);
+            storageOperation(naming_sock, command, ACCESS_META);
         }
         else if (strncmp(command, "STREAM ", 7) == 0)
         {
-            struct ServerInfo storage_server = connect_naming_server(naming_sock, command);
-            if (storage_server.port == 0)
+            storageOperation(naming_sock, command, ACCESS_STREAM);
+        }
+        else if (strncmp(command, "CREATE ", 7) == 0)
+        {
+            char type[16], server[16], path[1024];
+            unsigned int number = 0;
+            // AUTO (server 0) lets the naming server pick the storage server
+            if (sscanf(command, "CREATE %15s %15s %1023s", type, server, path) != 3 ||
+                (strcmp(type, "FILE") != 0 && strcmp(type, "DIR") != 0) ||
+                (strcmp(server, "AUTO") != 0 && sscanf(server, "%u", &number) != 1))
             {
+                printf(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n");
                 continue;
             }
-            int storage_sock = connectToServer(storage_server.ip, storage_server.port);
-            if (storage_sock < 0)
+            WireBuffer request;
+            wireBufferInit(&request);
+            wirePutU8(&request, strcmp(type, "DIR") == 0 ? 1 : 0); // FILE_NODE / DIRECTORY_NODE
+            wirePutU32(&request, number);
+            wirePutString(&request, path);
+            printReply(naming_sock, OP_CREATE, &request);
+            wireBufferFree(&request);
+        }
+        else if (strncmp(command, "DELETE ", 7) == 0)
+        {
+            char path[1024];
+            if (sscanf(command, "DELETE %1023s", path) != 1)
             {
+                printf(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n");
                 continue;
             }
-            handleStream(storage_sock, command);
-            close(storage_sock);
+            WireBuffer request;
+            wireBufferInit(&request);
+            wirePutString(&request, path);
+            printReply(naming_sock, OP_DELETE, &request);
+            wireBufferFree(&request);
         }
-        else if (strncmp(command, "CREATE ", 7) == 0)
+        else if (strncmp(command, "COPY ", 5) == 0)
         {
-            char respond[100001];
-            send(naming_sock, command, strlen(command), 0);
-            memset(respond, 0, sizeof(respond));
-            if (recv(naming_sock, respond, sizeof(respond), 0) < 0)
+            char source[1024], dest[1024];
+            if (sscanf(command, "COPY %1023s %1023s", source, dest) != 2)
             {
-                perror("rec client");
+                printf(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n");
+                continue;
             }
-            printf("%s\n", respond);
-            printf("\033[0m");
+            WireBuffer request;
+            wireBufferInit(&request);
+            wirePutString(&request, source);
+            wirePutString(&request, dest);
+            printReply(naming_sock, OP_COPY, &request);
+            wireBufferFree(&request);
         }
-        else if (strncmp(command, "DELETE ", 7) == 0)
+        else if (strncmp(command, "LIST", 4) == 0)
         {
-            char respond[100001];
-            send(naming_sock, command, strlen(command), 0);
-            memset(respond, 0, sizeof(respond));
-            recv(naming_sock, respond, sizeof(respond), 0);
-            printf("%s\n", respond);
-            printf("\033[0m");
+            handleList(naming_sock, command);
         }
-        else if (strncmp(command, "COPY ", 5) == 0)
+        else if (strncmp(command, "RESOLVE ", 8) == 0)
         {
-            char respond[100001];
-            send(naming_sock, command, strlen(command), 0);
-            memset(respond, 0, sizeof(respond));
-            recv(naming_sock, respond, sizeof(respond), 0);
-            printf("%s\n", respond);
-            printf("\033[0m");
+            handleResolve(naming_sock, command);
         }
-        else if (strncmp(command, "LIST", 4) == 0)
+        else if (strncmp(command, "FIND ", 5) == 0)
         {
-            char response[100001] = {0}; // Buffer for response
-
-            // Send the LIST command to the naming server
-            send(naming_sock, command, strlen(command), 0);
-
-            memset(response, 0, sizeof(response));
-            // Receive the response from the server
-            int bytes_received = recv(naming_sock, response, sizeof(response) - 1, 0);
-
-            if (bytes_received > 0)
-            {
-                response[bytes_received] = '\0'; // Null-terminate the response
-                printf("List of files and directories:\n%s", response);
-            }
-            else
-            {
-                printf("Error: Unable to receive response from naming server.\n");
-            }
+            handleFind(naming_sock, command);
+        }
+        else if (strcmp(command, "STATS") == 0 || strcmp(command, "STATS --json") == 0)
+        {
+            WireBuffer request;
+            wireBufferInit(&request);
+            wirePutU8(&request, strcmp(command, "STATS") == 0 ? STATS_FORMAT_TEXT : STATS_FORMAT_JSON);
+            printReply(naming_sock, OP_STATS, &request);
+            wireBufferFree(&request);
         }
         else
         {
-            // printf("Invalid command. Type HELP for available commands.\n");
-            char respond[100001];
-            send(naming_sock, command, strlen(command), 0);
-            memset(respond, 0, sizeof(respond));
-            recv(naming_sock, respond, sizeof(respond), 0);
-            printf("%s\n", respond);
-            printf("\033[0m");
+            printf(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n");
         }
     }
 
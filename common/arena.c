@@ -0,0 +1,283 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+} ArenaBlock;
+
+// Header in front of an allocation too big for any class
+typedef struct ArenaLarge
+{
+    struct ArenaLarge *prev;
+    struct ArenaLarge *next;
+    size_t size;
+    size_t pad; // keeps the data 16-byte aligned
+} ArenaLarge;
+
+typedef struct InternedString
+{
+    struct InternedString *next; // same bucket
+    unsigned int hash;
+    unsigned int refs;
+    char text[];
+} InternedString;
+
+#define BLOCK_HEADER ((sizeof(ArenaBlock) + 15) & ~(size_t)15)
+
+static int classOf(size_t size)
+{
+    int index = 0;
+    size_t class_size = ARENA_MIN_CLASS;
+    while (class_size < size)
+    {
+        class_size <<= 1;
+        index++;
+    }
+    return index;
+}
+
+static size_t classSize(int index)
+{
+    return (size_t)ARENA_MIN_CLASS << index;
+}
+
+Arena *arenaCreate(void)
+{
+    Arena *arena = calloc(1, sizeof(Arena));
+    if (!arena)
+        return NULL;
+    pthread_mutex_init(&arena->lock, NULL);
+    return arena;
+}
+
+// Drop the tree's memory in one go. Nothing allocated from the arena may be
+// used afterwards.
+void arenaRelease(Arena *arena)
+{
+    if (!arena)
+        return;
+    while (arena->blocks)
+    {
+        ArenaBlock *block = arena->blocks;
+        arena->blocks = block->next;
+        free(block);
+    }
+    while (arena->large)
+    {
+        ArenaLarge *large = arena->large;
+        arena->large = large->next;
+        free(large);
+    }
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+// Called with arena->lock held
+static void *allocLocked(Arena *arena, size_t size)
+{
+    if (size == 0)
+        size = 1;
+    if (size > ARENA_MAX_CLASS)
+    {
+        ArenaLarge *large = malloc(sizeof(ArenaLarge) + size);
+        if (!large)
+            return NULL;
+        large->size = size;
+        large->prev = NULL;
+        large->next = arena->large;
+        if (arena->large)
+            arena->large->prev = large;
+        arena->large = large;
+        arena->usage.reserved += sizeof(ArenaLarge) + size;
+        arena->usage.in_use += size;
+        arena->usage.objects++;
+        return large + 1;
+    }
+
+    int index = classOf(size);
+    size_t rounded = classSize(index);
+    void *ptr = arena->free_lists[index];
+    if (ptr)
+    {
+        arena->free_lists[index] = *(void **)ptr;
+    }
+    else
+    {
+        if (arena->left < rounded)
+        {
+            // The tail of the old block is left unused
+            ArenaBlock *block = malloc(ARENA_BLOCK_SIZE);
+            if (!block)
+                return NULL;
+            block->next = arena->blocks;
+            arena->blocks = block;
+            arena->cursor = (char *)block + BLOCK_HEADER;
+            arena->left = ARENA_BLOCK_SIZE - BLOCK_HEADER;
+            arena->usage.reserved += ARENA_BLOCK_SIZE;
+        }
+        ptr = arena->cursor;
+        arena->cursor += rounded;
+        arena->left -= rounded;
+    }
+    arena->usage.in_use += rounded;
+    arena->usage.objects++;
+    return ptr;
+}
+
+// Called with arena->lock held
+static void freeLocked(Arena *arena, void *ptr, size_t size)
+{
+    if (size == 0)
+        size = 1;
+    arena->usage.objects--;
+    if (size > ARENA_MAX_CLASS)
+    {
+        ArenaLarge *large = (ArenaLarge *)ptr - 1;
+        if (large->prev)
+            large->prev->next = large->next;
+        else
+            arena->large = large->next;
+        if (large->next)
+            large->next->prev = large->prev;
+        arena->usage.reserved -= sizeof(ArenaLarge) + large->size;
+        arena->usage.in_use -= large->size;
+        free(large);
+        return;
+    }
+    int index = classOf(size);
+    *(void **)ptr = arena->free_lists[index];
+    arena->free_lists[index] = ptr;
+    arena->usage.in_use -= classSize(index);
+}
+
+void *arenaAlloc(Arena *arena, size_t size)
+{
+    pthread_mutex_lock(&arena->lock);
+    void *ptr = allocLocked(arena, size);
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+void *arenaCalloc(Arena *arena, size_t size)
+{
+    void *ptr = arenaAlloc(arena, size);
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+// size must be the size the piece was allocated with
+void arenaFree(Arena *arena, void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+    pthread_mutex_lock(&arena->lock);
+    freeLocked(arena, ptr, size);
+    pthread_mutex_unlock(&arena->lock);
+}
+
+char *arenaStrdup(Arena *arena, const char *str)
+{
+    size_t length = strlen(str) + 1;
+    char *copy = arenaAlloc(arena, length);
+    if (copy)
+        memcpy(copy, str, length);
+    return copy;
+}
+
+void arenaFreeString(Arena *arena, char *str)
+{
+    if (str)
+        arenaFree(arena, str, strlen(str) + 1);
+}
+
+// Called with arena->lock held
+static void growInternTable(Arena *arena)
+{
+    unsigned int capacity = arena->intern_capacity ? arena->intern_capacity * 2 : ARENA_INTERN_INITIAL;
+    InternedString **buckets = allocLocked(arena, capacity * sizeof(InternedString *));
+    if (!buckets)
+        return;
+    memset(buckets, 0, capacity * sizeof(InternedString *));
+    for (unsigned int i = 0; i < arena->intern_capacity; i++)
+    {
+        InternedString *entry = arena->interned[i];
+        while (entry)
+        {
+            InternedString *next = entry->next;
+            entry->next = buckets[entry->hash & (capacity - 1)];
+            buckets[entry->hash & (capacity - 1)] = entry;
+            entry = next;
+        }
+    }
+    if (arena->interned)
+        freeLocked(arena, arena->interned, arena->intern_capacity * sizeof(InternedString *));
+    arena->interned = buckets;
+    arena->intern_capacity = capacity;
+}
+
+// The arena's shared copy of str, whose hash the caller has already worked
+// out. Each call takes a reference that arenaUnintern gives back.
+const char *arenaIntern(Arena *arena, const char *str, unsigned int hash)
+{
+    pthread_mutex_lock(&arena->lock);
+    if (arena->usage.interned >= arena->intern_capacity)
+        growInternTable(arena);
+    InternedString *entry = NULL;
+    if (arena->intern_capacity)
+    {
+        entry = arena->interned[hash & (arena->intern_capacity - 1)];
+        while (entry && (entry->hash != hash || strcmp(entry->text, str) != 0))
+            entry = entry->next;
+    }
+    if (!entry)
+    {
+        size_t length = strlen(str) + 1;
+        entry = arena->intern_capacity ? allocLocked(arena, sizeof(InternedString) + length) : NULL;
+        if (!entry)
+        {
+            pthread_mutex_unlock(&arena->lock);
+            return NULL;
+        }
+        entry->hash = hash;
+        entry->refs = 0;
+        memcpy(entry->text, str, length);
+        InternedString **bucket = &arena->interned[hash & (arena->intern_capacity - 1)];
+        entry->next = *bucket;
+        *bucket = entry;
+        arena->usage.interned++;
+    }
+    entry->refs++;
+    arena->usage.intern_refs++;
+    pthread_mutex_unlock(&arena->lock);
+    return entry->text;
+}
+
+void arenaUnintern(Arena *arena, const char *str)
+{
+    if (!str)
+        return;
+    InternedString *entry = (InternedString *)(str - offsetof(InternedString, text));
+    pthread_mutex_lock(&arena->lock);
+    arena->usage.intern_refs--;
+    if (--entry->refs == 0)
+    {
+        InternedString **link = &arena->interned[entry->hash & (arena->intern_capacity - 1)];
+        while (*link != entry)
+            link = &(*link)->next;
+        *link = entry->next;
+        arena->usage.interned--;
+        freeLocked(arena, entry, sizeof(InternedString) + strlen(entry->text) + 1);
+    }
+    pthread_mutex_unlock(&arena->lock);
+}
+
+void arenaGetUsage(Arena *arena, ArenaUsage *usage)
+{
+    pthread_mutex_lock(&arena->lock);
+    *usage = arena->usage;
+    pthread_mutex_unlock(&arena->lock);
+}
@@ -0,0 +1,57 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Allocator for one namespace tree. Memory is carved out of ARENA_BLOCK_SIZE
+// blocks in power-of-two size classes, from ARENA_MIN_CLASS up to
+// ARENA_MAX_CLASS bytes; freed pieces go back on their class's free list
+// for the next allocation of that size. Larger requests get their own
+// malloc but are still owned by the arena. arenaRelease frees everything
+// at once, whatever the number of objects, so a tree is dropped without
+// walking it.
+//
+// Names are interned: every node called "src" shares one reference-counted
+// copy.
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_MIN_CLASS 16
+#define ARENA_MAX_CLASS 4096
+#define ARENA_CLASSES 9 // 16 .. 4096
+#define ARENA_INTERN_INITIAL 256
+
+typedef struct ArenaUsage
+{
+    size_t reserved;  // bytes taken from malloc
+    size_t in_use;    // bytes handed out, rounded to their class
+    size_t objects;   // live allocations
+    size_t interned;  // distinct interned strings
+    size_t intern_refs;
+} ArenaUsage;
+
+typedef struct Arena
+{
+    pthread_mutex_t lock;
+    struct ArenaBlock *blocks;
+    struct ArenaLarge *large;
+    char *cursor; // free space in the newest block
+    size_t left;
+    void *free_lists[ARENA_CLASSES];
+    struct InternedString **interned;
+    unsigned int intern_capacity;
+    ArenaUsage usage;
+} Arena;
+
+Arena *arenaCreate(void);
+void arenaRelease(Arena *arena);
+void *arenaAlloc(Arena *arena, size_t size);
+void *arenaCalloc(Arena *arena, size_t size);
+void arenaFree(Arena *arena, void *ptr, size_t size);
+char *arenaStrdup(Arena *arena, const char *str);
+void arenaFreeString(Arena *arena, char *str);
+const char *arenaIntern(Arena *arena, const char *str, unsigned int hash);
+void arenaUnintern(Arena *arena, const char *str);
+void arenaGetUsage(Arena *arena, ArenaUsage *usage);
+
+#endif // ARENA_H
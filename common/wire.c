@@ -0,0 +1,320 @@
+#include "wire.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+int sendAll(int sock, const void *data, size_t length)
+{
+    const char *p = (const char *)data;
+    while (length > 0)
+    {
+        ssize_t sent = send(sock, p, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+        p += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+int recvAll(int sock, void *data, size_t length)
+{
+    char *p = (char *)data;
+    while (length > 0)
+    {
+        ssize_t got = recv(sock, p, length, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        p += got;
+        length -= got;
+    }
+    return 0;
+}
+
+void encodeHeader(const WireHeader *hdr, unsigned char *out)
+{
+    uint16_t magic = htons(hdr->magic);
+    uint32_t request_id = htonl(hdr->request_id);
+    uint16_t status = htons(hdr->status);
+    uint16_t flags = htons(hdr->flags);
+    uint32_t length = htonl(hdr->length);
+    memcpy(out, &magic, 2);
+    out[2] = hdr->version;
+    out[3] = hdr->opcode;
+    memcpy(out + 4, &request_id, 4);
+    memcpy(out + 8, &status, 2);
+    memcpy(out + 10, &flags, 2);
+    memcpy(out + 12, &length, 4);
+}
+
+// Returns 0 for a well-formed header of a version we understand
+int decodeHeader(const unsigned char *in, WireHeader *hdr)
+{
+    uint16_t magic, status, flags;
+    uint32_t request_id, length;
+    memcpy(&magic, in, 2);
+    memcpy(&request_id, in + 4, 4);
+    memcpy(&status, in + 8, 2);
+    memcpy(&flags, in + 10, 2);
+    memcpy(&length, in + 12, 4);
+    hdr->magic = ntohs(magic);
+    hdr->version = in[2];
+    hdr->opcode = in[3];
+    hdr->request_id = ntohl(request_id);
+    hdr->status = ntohs(status);
+    hdr->flags = ntohs(flags);
+    hdr->length = ntohl(length);
+    if (hdr->magic != WIRE_MAGIC || hdr->version != WIRE_VERSION || hdr->length > WIRE_MAX_PAYLOAD)
+        return -1;
+    return 0;
+}
+
+static int sendFrameFlags(int sock, uint8_t opcode, uint32_t request_id, uint16_t status, uint16_t flags,
+                          const void *payload, uint32_t length)
+{
+    WireHeader hdr = {WIRE_MAGIC, WIRE_VERSION, opcode, request_id, status, flags, length};
+    unsigned char frame[WIRE_HEADER_SIZE + 512];
+
+    // Small frames go out in a single send; larger payloads follow the header
+    if (length <= sizeof(frame) - WIRE_HEADER_SIZE)
+    {
+        encodeHeader(&hdr, frame);
+        if (length)
+            memcpy(frame + WIRE_HEADER_SIZE, payload, length);
+        return sendAll(sock, frame, WIRE_HEADER_SIZE + length);
+    }
+    encodeHeader(&hdr, frame);
+    if (sendAll(sock, frame, WIRE_HEADER_SIZE) < 0)
+        return -1;
+    return sendAll(sock, payload, length);
+}
+
+int sendFrame(int sock, uint8_t opcode, uint32_t request_id, uint16_t status, const void *payload, uint32_t length)
+{
+    return sendFrameFlags(sock, opcode, request_id, status, 0, payload, length);
+}
+
+int sendReply(int sock, const WireHeader *request, uint16_t status, const void *payload, uint32_t length)
+{
+    return sendFrameFlags(sock, request->opcode, request->request_id, status, WIRE_FLAG_REPLY, payload, length);
+}
+
+// Error replies carry a short human readable message as their payload
+int sendError(int sock, const WireHeader *request, uint16_t status, const char *message)
+{
+    return sendReply(sock, request, status, message, message ? strlen(message) : 0);
+}
+
+int recvHeader(int sock, WireHeader *hdr)
+{
+    unsigned char raw[WIRE_HEADER_SIZE];
+    if (recvAll(sock, raw, sizeof(raw)) < 0)
+        return -1;
+    return decodeHeader(raw, hdr);
+}
+
+// Receive one frame into a freshly allocated, NUL-terminated payload that the
+// caller frees
+int recvFrame(int sock, WireHeader *hdr, char **payload)
+{
+    *payload = NULL;
+    if (recvHeader(sock, hdr) < 0)
+        return -1;
+    char *data = (char *)malloc(hdr->length + 1);
+    if (!data)
+        return -1;
+    if (hdr->length && recvAll(sock, data, hdr->length) < 0)
+    {
+        free(data);
+        return -1;
+    }
+    data[hdr->length] = '\0';
+    *payload = data;
+    return 0;
+}
+
+// Receive one frame into a caller buffer, which must have room for the
+// payload plus a terminating NUL
+int recvFrameInto(int sock, WireHeader *hdr, char *buffer, size_t size)
+{
+    if (recvHeader(sock, hdr) < 0 || hdr->length >= size)
+        return -1;
+    if (hdr->length && recvAll(sock, buffer, hdr->length) < 0)
+        return -1;
+    buffer[hdr->length] = '\0';
+    return 0;
+}
+
+const char *wireOpcodeName(uint8_t opcode)
+{
+    static const char *names[] = {
+        "UNKNOWN", "REGISTER", "LOOKUP", "LIST", "CREATE", "DELETE", "COPY", "EXIT",
+        "READ", "WRITE", "META", "STREAM", "DATA", "END", "COPY_FILE", "COPY_DIR",
+        "SYNC", "WRITE_ACK", "NOTICE", "TREE", "DELTA", "HEARTBEAT",
+        "REPLICATE", "REPLICA_LOG", "STATS", "FIND", "RESOLVE", "INVALIDATE"};
+    if (opcode >= sizeof(names) / sizeof(names[0]))
+        return names[0];
+    return names[opcode];
+}
+
+void wireBufferInit(WireBuffer *buf)
+{
+    buf->data = NULL;
+    buf->length = 0;
+    buf->capacity = 0;
+}
+
+void wireBufferFree(WireBuffer *buf)
+{
+    free(buf->data);
+    wireBufferInit(buf);
+}
+
+static void reserve(WireBuffer *buf, size_t extra)
+{
+    if (buf->length + extra <= buf->capacity)
+        return;
+    size_t capacity = buf->capacity ? buf->capacity : 256;
+    while (capacity < buf->length + extra)
+        capacity *= 2;
+    buf->data = (char *)realloc(buf->data, capacity);
+    buf->capacity = capacity;
+}
+
+void wirePutBytes(WireBuffer *buf, const void *data, size_t length)
+{
+    reserve(buf, length);
+    memcpy(buf->data + buf->length, data, length);
+    buf->length += length;
+}
+
+void wirePutU8(WireBuffer *buf, uint8_t value)
+{
+    wirePutBytes(buf, &value, 1);
+}
+
+void wirePutU16(WireBuffer *buf, uint16_t value)
+{
+    value = htons(value);
+    wirePutBytes(buf, &value, 2);
+}
+
+void wirePutU32(WireBuffer *buf, uint32_t value)
+{
+    value = htonl(value);
+    wirePutBytes(buf, &value, 4);
+}
+
+void wirePutU64(WireBuffer *buf, uint64_t value)
+{
+    wirePutU32(buf, (uint32_t)(value >> 32));
+    wirePutU32(buf, (uint32_t)value);
+}
+
+// Strings are a 16-bit length followed by the bytes, without a NUL
+void wirePutString(WireBuffer *buf, const char *str)
+{
+    size_t length = str ? strlen(str) : 0;
+    if (length > 0xFFFF)
+        length = 0xFFFF;
+    wirePutU16(buf, (uint16_t)length);
+    if (length)
+        wirePutBytes(buf, str, length);
+}
+
+void wireReaderInit(WireReader *reader, const char *data, size_t length)
+{
+    reader->data = data;
+    reader->length = length;
+    reader->offset = 0;
+    reader->error = 0;
+}
+
+static const char *take(WireReader *reader, size_t length)
+{
+    if (reader->error || reader->length - reader->offset < length)
+    {
+        reader->error = 1;
+        return NULL;
+    }
+    const char *p = reader->data + reader->offset;
+    reader->offset += length;
+    return p;
+}
+
+uint8_t wireGetU8(WireReader *reader)
+{
+    const char *p = take(reader, 1);
+    return p ? (uint8_t)p[0] : 0;
+}
+
+uint16_t wireGetU16(WireReader *reader)
+{
+    uint16_t value;
+    const char *p = take(reader, 2);
+    if (!p)
+        return 0;
+    memcpy(&value, p, 2);
+    return ntohs(value);
+}
+
+uint32_t wireGetU32(WireReader *reader)
+{
+    uint32_t value;
+    const char *p = take(reader, 4);
+    if (!p)
+        return 0;
+    memcpy(&value, p, 4);
+    return ntohl(value);
+}
+
+uint64_t wireGetU64(WireReader *reader)
+{
+    uint64_t high = wireGetU32(reader);
+    return (high << 32) | wireGetU32(reader);
+}
+
+// Copy a string field into out (NUL-terminated). Fails if it does not fit.
+int wireGetString(WireReader *reader, char *out, size_t size)
+{
+    uint16_t length = wireGetU16(reader);
+    const char *p = take(reader, length);
+    if (!p || length >= size)
+    {
+        reader->error = 1;
+        if (size)
+            out[0] = '\0';
+        return -1;
+    }
+    memcpy(out, p, length);
+    out[length] = '\0';
+    return 0;
+}
+
+// FNV-1a over the path bytes, continued from the parent's state
+uint64_t namespaceHashExtend(uint64_t state, const char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        state ^= (unsigned char)data[i];
+        state *= 1099511628211ULL;
+    }
+    return state;
+}
+
+// Mix the path state with the node type (splitmix64 finalizer) so that the
+// per-node digests are well spread before they are summed
+uint64_t namespaceEntryDigest(uint64_t path_state, int is_directory)
+{
+    uint64_t z = path_state + (is_directory ? 0x9E3779B97F4A7C15ULL : 0x6A09E667F3BCC909ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
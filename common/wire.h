@@ -0,0 +1,256 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Framing shared by the client, naming server and storage server. Every
+// message is a fixed 16-byte header followed by `length` payload bytes, all
+// integers in network byte order:
+//
+//   magic(2) version(1) opcode(1) request_id(4) status(2) flags(2) length(4)
+//
+// Frames are self-delimiting, so several can be written back to back on one
+// connection and the receiver never depends on recv() boundaries.
+
+#define WIRE_MAGIC 0x4E46 // "NF"
+#define WIRE_VERSION 1
+#define WIRE_HEADER_SIZE 16
+#define WIRE_MAX_PAYLOAD (64 * 1024 * 1024)
+#define WIRE_CHUNK_SIZE 65536 // payload size used for OP_DATA frames
+
+#define WIRE_FLAG_REPLY 0x0001
+
+typedef enum
+{
+    OP_REGISTER = 1, // SS -> NS: ip, naming port, client port
+    OP_LOOKUP,       // client -> NS: which storage server holds a path
+    OP_LIST,
+    OP_CREATE,
+    OP_DELETE,
+    OP_COPY,
+    OP_EXIT,
+    OP_READ, // client -> SS
+    OP_WRITE,
+    OP_META,
+    OP_STREAM,
+    OP_DATA, // one chunk of file content
+    OP_END,  // closes a run of OP_DATA frames
+    OP_COPY_FILE, // SS -> SS during COPY
+    OP_COPY_DIR,
+    OP_SYNC,      // SS -> SS: end of a copy session, reply carries its outcome
+    OP_WRITE_ACK, // SS -> NS: asynchronous write progress, batched
+    OP_NOTICE,    // NS -> client: asynchronous message
+    OP_TREE,      // SS -> NS: namespace image announcement, image follows as OP_DATA
+    OP_DELTA,     // SS -> NS: unsolicited namespace changes made by the storage server
+    OP_HEARTBEAT, // SS -> NS: unsolicited liveness beat carrying load, capacity and replica lag
+    OP_REPLICATE, // NS -> SS: keep a backup directory on a peer up to date
+    OP_REPLICA_LOG, // SS -> SS: one batch of replication log records
+    OP_STATS,       // client -> NS: format(1), STATS_FORMAT_TEXT or _JSON; reply is the report
+    OP_FIND,        // client -> NS: prefix(string) glob(string) limit(4) [cursor(string)]; matches stream back as for LIST
+    OP_RESOLVE,     // client -> NS: OP_LOOKUP for many paths at once
+    OP_INVALIDATE   // NS -> client notice socket: version(8) path(string); drop cached answers at or below path
+} WireOpcode;
+
+// OP_HEARTBEAT carries the sender's load and capacity,
+//
+//   inflight(4) latency_us(4) free_bytes(8) total_bytes(8) file_count(4)
+//
+// client requests being served right now, a moving average of how long one
+// takes, the space left on the storage root's file system and the files
+// it holds, followed by `lag(8)` for each of the REPLICA_SLOTS: log records
+// the backup has yet to confirm, or REPLICA_LAG_UNKNOWN while it is not in
+// sync
+#define HEARTBEAT_INTERVAL_MS 500
+#define REPLICA_LAG_UNKNOWN UINT64_MAX
+
+// OP_WRITE_ACK is sent on the storage server's registration connection and
+// carries `count(4)` acks, each `phase(1) client_id(4) client_ip(string)
+// client_port(2) file(string)`
+#define WRITE_ACK_STARTED 0
+#define WRITE_ACK_COMPLETED 1
+
+// OP_REGISTER carries `ip(string) nm_port(4) client_port(4) fingerprint(8)`.
+// The fingerprint (see namespaceEntryDigest) lets a naming server that
+// restored this storage server's tree from disk confirm it without a
+// transfer; the reply payload says whether the tree is still needed.
+#define REGISTER_TREE_KNOWN 0
+#define REGISTER_SEND_TREE 1
+
+// Namespace image sent by a storage server when the REGISTER reply asks for
+// it. The OP_TREE payload is `encoding(1) node_count(4) raw_length(8)`; the
+// image follows as OP_DATA frames closed by OP_END, and the naming server
+// replies once the whole image has been decoded. The raw image is every
+// node in pre-order:
+//
+//   flags(1) permissions(1) name(string) [location(string)] [child_count(4)]
+//
+// location is omitted when it is the parent's location + "/" + name, and
+// child_count is present for directories only.
+#define TREE_ENCODING_RAW 0
+#define TREE_ENCODING_DEFLATE 1 // zlib stream, only when built with -DUSE_ZLIB
+#define TREE_NODE_DIRECTORY 0x01
+#define TREE_NODE_DERIVED_LOCATION 0x02
+
+// Changes a storage server notices on its own disk after registering. The
+// OP_DELTA payload is `first_seq(8) count(4)` followed by count events
+//
+//   kind(1) node_type(1) path(string)
+//
+// numbered first_seq, first_seq + 1, ... Sequence numbers never restart
+// while the storage server runs, so the naming server can drop repeats and
+// spot gaps. Changes the naming server asked for are not echoed back.
+#define DELTA_ADD 1
+#define DELTA_REMOVE 2
+#define DELTA_MODIFY 3
+
+// Report formats for OP_STATS
+#define STATS_FORMAT_TEXT 0
+#define STATS_FORMAT_JSON 1
+
+// Replication of a storage server to its backups. OP_REPLICATE carries
+// `slot(1) peer_ip(string) peer_port(2) backup_dir(string)` and points one
+// of the server's REPLICA_SLOTS at the peer. From then on the server ships
+// its replication log there as OP_REPLICA_LOG frames:
+//
+//   epoch(8) first_seq(8) flags(1) count(4) backup_dir(string) records...
+//
+// and each record is
+//
+//   kind(1) node_type(1) path(string) [offset(8) length(4) data]
+//
+// with offset, length and data present for REPL_WRITE only. Log records are
+// numbered first_seq, first_seq + 1, ... within an epoch, which changes
+// whenever the storage server restarts. The reply carries `epoch(8)
+// applied(8)`, the epoch and last sequence number the replica holds; a
+// batch with count 0 just asks for them. When the log no longer reaches back that far, the server sends a
+// snapshot instead: frames flagged REPL_BATCH_SNAPSHOT whose records start
+// with REPL_RESET and rebuild the whole tree, the last one also flagged
+// REPL_BATCH_SNAPSHOT_END. Applying a record twice is harmless.
+#define REPLICA_SLOTS 2
+#define REPL_CREATE 1
+#define REPL_DELETE 2
+#define REPL_WRITE 3
+#define REPL_RESET 4
+#define REPL_BATCH_SNAPSHOT 0x01
+#define REPL_BATCH_SNAPSHOT_END 0x02
+
+// OP_CREATE from a client carries `type(1) server_id(4) path(string)`;
+// server_id 0 lets the naming server place the entry (see placement.h).
+//
+// OP_LOOKUP carries `access(1) path(string) notify_port(2)`; the reply is
+// `ip(string) port(2) path(string) lease_ms(4) version(8)`, the storage
+// server to use, the path to ask it for, and how long the answer may be
+// reused. Reads may be sent to an up-to-date backup, under its backup
+// directory. notify_port is where the client's notice socket listens; 0 (or
+// leaving it out) asks for no lease, and lease_ms 0 grants none. A leased
+// answer stays good until it expires or an OP_INVALIDATE with a newer
+// version covers its path (see lease.h).
+//
+// OP_RESOLVE carries `access(1) notify_port(2) count(4)` and count paths
+// (strings), at most RESOLVE_MAX_PATHS. The reply is `count(4)` followed,
+// for each path in order, by `status(2)` and, when that is WIRE_OK,
+// `type(1) copies(1)`, copies times `ip(string) port(2) path(string)`, then
+// `lease_ms(4) version(8)`. The first copy is the one a LOOKUP would have
+// returned; the others can serve reads too.
+#define RESOLVE_MAX_PATHS 4096
+
+// OP_LOOKUP access kinds
+#define ACCESS_READ 0
+#define ACCESS_WRITE 1
+#define ACCESS_META 2
+#define ACCESS_STREAM 3
+
+// Status codes are the numbers this project has always printed in its
+// "ERROR nnn" messages; 0 means success.
+typedef enum
+{
+    WIRE_OK = 0,
+    ERR_METADATA = 30,
+    ERR_STREAM = 31,
+    ERR_CREATE = 32,
+    ERR_DELETE = 33,
+    ERR_CREATE_DIR = 44,
+    ERR_COPY = 45,
+    ERR_BAD_SIZE = 46,
+    ERR_PERMISSION = 50,
+    ERR_NOT_FILE = 51,
+    ERR_LOCKED = 52,
+    ERR_RECEIVE = 56,
+    ERR_WRITE = 57,
+    ERR_NO_MEMORY = 58,
+    ERR_QUEUE = 90,
+    ERR_PARENT_MISSING = 100,
+    ERR_INVALID = 101,
+    ERR_NOT_DIRECTORY = 400,
+    ERR_EMPTY = 401,
+    ERR_INACTIVE = 402,
+    ERR_NOT_FOUND = 404
+} WireStatus;
+
+typedef struct WireHeader
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint32_t request_id;
+    uint16_t status;
+    uint16_t flags;
+    uint32_t length;
+} WireHeader;
+
+// Growable payload being encoded
+typedef struct WireBuffer
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+} WireBuffer;
+
+// Cursor over a received payload. Reads past the end set `error` and return
+// zeroes, so a message can be decoded field by field and checked once.
+typedef struct WireReader
+{
+    const char *data;
+    size_t length;
+    size_t offset;
+    int error;
+} WireReader;
+
+int sendFrame(int sock, uint8_t opcode, uint32_t request_id, uint16_t status, const void *payload, uint32_t length);
+int sendReply(int sock, const WireHeader *request, uint16_t status, const void *payload, uint32_t length);
+int sendError(int sock, const WireHeader *request, uint16_t status, const char *message);
+int recvHeader(int sock, WireHeader *hdr);
+int recvFrame(int sock, WireHeader *hdr, char **payload);
+int recvFrameInto(int sock, WireHeader *hdr, char *buffer, size_t size);
+int sendAll(int sock, const void *data, size_t length);
+int recvAll(int sock, void *data, size_t length);
+void encodeHeader(const WireHeader *hdr, unsigned char *out);
+int decodeHeader(const unsigned char *in, WireHeader *hdr);
+const char *wireOpcodeName(uint8_t opcode);
+
+void wireBufferInit(WireBuffer *buf);
+void wireBufferFree(WireBuffer *buf);
+void wirePutU8(WireBuffer *buf, uint8_t value);
+void wirePutU16(WireBuffer *buf, uint16_t value);
+void wirePutU32(WireBuffer *buf, uint32_t value);
+void wirePutU64(WireBuffer *buf, uint64_t value);
+void wirePutBytes(WireBuffer *buf, const void *data, size_t length);
+void wirePutString(WireBuffer *buf, const char *str);
+
+void wireReaderInit(WireReader *reader, const char *data, size_t length);
+uint8_t wireGetU8(WireReader *reader);
+uint16_t wireGetU16(WireReader *reader);
+uint32_t wireGetU32(WireReader *reader);
+uint64_t wireGetU64(WireReader *reader);
+int wireGetString(WireReader *reader, char *out, size_t size);
+
+// Namespace fingerprint: the sum of one digest per node, where a node's
+// digest covers its path below the root and its type. The sum does not
+// depend on the order children are visited in, so two servers holding the
+// same tree agree on it whatever their table layouts.
+#define NAMESPACE_HASH_INIT 14695981039346656037ULL
+uint64_t namespaceHashExtend(uint64_t state, const char *data, size_t length);
+uint64_t namespaceEntryDigest(uint64_t path_state, int is_directory);
+#endif // WIRE_H
@@ -0,0 +1,89 @@
+#include "failure_detector.h"
+#include "../common/wire.h"
+#include <math.h>
+
+static double elapsedMs(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+void initFailureDetector(FailureDetector *detector)
+{
+    pthread_mutex_init(&detector->lock, NULL);
+    resetFailureDetector(detector);
+}
+
+// Start over, as if a heartbeat had just arrived. The window is seeded with
+// the nominal interval so a fresh connection is judged sensibly.
+void resetFailureDetector(FailureDetector *detector)
+{
+    pthread_mutex_lock(&detector->lock);
+    detector->intervals[0] = HEARTBEAT_INTERVAL_MS;
+    detector->count = 1;
+    detector->next = 1;
+    detector->sum = HEARTBEAT_INTERVAL_MS;
+    detector->sum_squares = (double)HEARTBEAT_INTERVAL_MS * HEARTBEAT_INTERVAL_MS;
+    clock_gettime(CLOCK_MONOTONIC, &detector->last);
+    pthread_mutex_unlock(&detector->lock);
+}
+
+void heartbeatArrived(FailureDetector *detector)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&detector->lock);
+    double interval = elapsedMs(&detector->last, &now);
+    if (detector->count == HEARTBEAT_WINDOW)
+    {
+        double old = detector->intervals[detector->next];
+        detector->sum -= old;
+        detector->sum_squares -= old * old;
+    }
+    else
+    {
+        detector->count++;
+    }
+    detector->intervals[detector->next] = interval;
+    detector->next = (detector->next + 1) % HEARTBEAT_WINDOW;
+    detector->sum += interval;
+    detector->sum_squares += interval * interval;
+    detector->last = now;
+    pthread_mutex_unlock(&detector->lock);
+}
+
+// phi for the current silence, using the logistic approximation of the
+// normal tail: P(X > t) ~= 1 / (1 + e^(y * (1.5976 + 0.070566 * y^2)))
+double suspicionLevel(FailureDetector *detector)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&detector->lock);
+    double silence = elapsedMs(&detector->last, &now);
+    double mean = detector->sum / detector->count;
+    double variance = detector->sum_squares / detector->count - mean * mean;
+    pthread_mutex_unlock(&detector->lock);
+
+    double stddev = variance > 0 ? sqrt(variance) : 0;
+    if (stddev < HEARTBEAT_MIN_STDDEV_MS)
+        stddev = HEARTBEAT_MIN_STDDEV_MS;
+    double y = (silence - mean - HEARTBEAT_ACCEPTABLE_PAUSE_MS) / stddev;
+    double e = exp(-y * (1.5976 + 0.070566 * y * y));
+    if (silence > mean + HEARTBEAT_ACCEPTABLE_PAUSE_MS)
+        return -log10(e / (1.0 + e));
+    return -log10(1.0 - 1.0 / (1.0 + e));
+}
+
+const char *serverHealthName(ServerHealth health)
+{
+    switch (health)
+    {
+    case SS_HEALTHY:
+        return "healthy";
+    case SS_SUSPECT:
+        return "suspect";
+    default:
+        return "dead";
+    }
+}
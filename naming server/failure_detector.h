@@ -0,0 +1,45 @@
+#ifndef FAILURE_DETECTOR_H
+#define FAILURE_DETECTOR_H
+
+#include <pthread.h>
+#include <time.h>
+
+// Phi-accrual failure detector for one storage server. Storage servers send
+// OP_HEARTBEAT every HEARTBEAT_INTERVAL_MS (see wire.h); the detector keeps
+// the recent inter-arrival times and turns the silence since the last
+// heartbeat into a suspicion level phi = -log10(P(a heartbeat is still this
+// late)). phi adapts to the link: a jittery server needs a longer silence
+// than a steady one to reach the same level.
+
+#define HEARTBEAT_WINDOW 64                 // inter-arrival samples kept
+#define HEARTBEAT_ACCEPTABLE_PAUSE_MS 1000  // added to the mean before phi rises
+#define HEARTBEAT_MIN_STDDEV_MS 500.0
+#define HEARTBEAT_CHECK_MS 250              // how often the health monitor runs
+#define PHI_SUSPECT 2.0                     // about 2.6 s of silence at steady 500 ms beats
+#define PHI_DEAD 8.0                        // about 4 s
+
+typedef enum
+{
+    SS_HEALTHY,
+    SS_SUSPECT, // connected, but heartbeats are late; not routed to
+    SS_DEAD     // declared failed; the connection is torn down
+} ServerHealth;
+
+typedef struct FailureDetector
+{
+    pthread_mutex_t lock;
+    double intervals[HEARTBEAT_WINDOW]; // ms
+    int count;
+    int next;
+    double sum;
+    double sum_squares;
+    struct timespec last;
+} FailureDetector;
+
+void initFailureDetector(FailureDetector *detector);
+void resetFailureDetector(FailureDetector *detector);
+void heartbeatArrived(FailureDetector *detector);
+double suspicionLevel(FailureDetector *detector);
+const char *serverHealthName(ServerHealth health);
+
+#endif // FAILURE_DETECTOR_H
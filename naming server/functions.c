@@ -1,415 +1,220 @@
 #include "header.h"
+#include "path_index.h"
+#include "namespace_store.h"
+#include "write_tracker.h"
+#include "notify.h"
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+#define TREE_MAX_DEPTH 512
+
+// Decode one image record into a new node under parent, or a new root when
+// parent is NULL. For directories the number of children that follow is
+// stored in *children.
+static Node *decodeTreeEntry(Arena *arena, WireReader *reader, Node *parent, uint32_t *children)
+{
+    char name[NAME_MAX + 1];
+    char location[PATH_MAX];
+    char parent_location[PATH_MAX];
+
+    uint8_t flags = wireGetU8(reader);
+    Permissions permissions = (Permissions)wireGetU8(reader);
+    wireGetString(reader, name, sizeof(name));
+    bool derived = flags & TREE_NODE_DERIVED_LOCATION;
+    if (!derived)
+        wireGetString(reader, location, sizeof(location));
+    else if (!parent || nodeLocation(parent, parent_location, sizeof(parent_location)) < 0 ||
+             strlen(parent_location) + 1 + strlen(name) >= sizeof(location))
+        reader->error = 1;
+
+    NodeType type = (flags & TREE_NODE_DIRECTORY) ? DIRECTORY_NODE : FILE_NODE;
+    *children = type == DIRECTORY_NODE ? wireGetU32(reader) : 0;
+    if (reader->error || (!parent && type != DIRECTORY_NODE))
+        return NULL;
+    if (!parent)
+        return createNode(arena, name, type, permissions, location);
+    return createChildNode(parent, name, type, permissions, derived ? NULL : location);
+}
 
-Node *receiveNodeChain(int sock)
+// Rebuild a node and its whole subtree from the pre-order image
+static Node *decodeTreeNode(Arena *arena, WireReader *reader, Node *parent, uint32_t *remaining, int depth)
 {
-    Node *head = NULL;
-    Node *current = NULL;
-
-    	struct sockaddr_in addr;
-    	socklen_t addr_len = sizeof(addr);
-    
-	// Now, let's log the action (get client's IP and port)
-    	if (getpeername(sock, (struct sockaddr *)&addr, &addr_len) == -1) {
-        perror("getpeername failed");
+    if (*remaining == 0 || depth > TREE_MAX_DEPTH)
         return NULL;
-    	}
+    (*remaining)--;
 
-    	// Extract the client IP address and port
-    	char t_ip[INET_ADDRSTRLEN];
-    	int t_port;
-    	get_ip_and_port(&addr, t_ip, &t_port);
+    uint32_t children;
+    Node *node = decodeTreeEntry(arena, reader, parent, &children);
+    if (!node)
+        return NULL;
+    if (children > *remaining)
+        return NULL;
 
-    while (1)
+    // Size the child table once instead of growing it child by child
+    if (children)
+        reserveNodeTable(node->children, children);
+    for (uint32_t i = 0; i < children; i++)
     {
-        // Check for end of chain
-        int marker;
-        if (recv(sock, &marker, sizeof(int), 0) <= 0)
-            return NULL;
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Received Marker");
-        send(sock, "OK", 2, 0);
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Sent OK");
-
-        if (marker == -1)
-            break; // End of chain
-
-        // Receive node data
-        int name_len;
-        if (recv(sock, &name_len, sizeof(int), 0) <= 0)
-            return NULL;
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Received name_len");
-
-        send(sock, "OK", 2, 0);
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Sent OK");
-
-
-        char *name = malloc(name_len);
-        if (recv(sock, name, name_len, 0) <= 0)
-        {
-            free(name);
-            return NULL;
-        }
-        log_message(t_ip, t_port, "Receiving Node Chain- Received Name::", name);
-
-        send(sock, "OK", 2, 0);
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Sent OK");
-
-
-        NodeType type;
-        Permissions permissions;
-        if (recv(sock, &type, sizeof(NodeType), 0) <= 0)
-        {
-            free(name);
-            return NULL;
-        }
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Received NodeType");
-
-        send(sock, "OK", 2, 0);
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Sent OK");
-
-
-        if (recv(sock, &permissions, sizeof(Permissions), 0) <= 0)
-        {
-            free(name);
-            return NULL;
-        }
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Received Permissions");
-
-        send(sock, "OK", 2, 0);
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Sent OK");
-
-
-        int loc_len;
-        if (recv(sock, &loc_len, sizeof(int), 0) <= 0)
-        {
-            free(name);
+        if (!decodeTreeNode(arena, reader, node, remaining, depth + 1))
             return NULL;
-        }
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Received loc_len");
-
-        send(sock, "OK", 2, 0);
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Sent OK");
-
-
-        char *dataLocation = malloc(loc_len);
-        if (recv(sock, dataLocation, loc_len, 0) <= 0)
-        {
-            free(name);
-            free(dataLocation);
-            return NULL;
-        }
-        log_message(t_ip, t_port, "Receiving Node Chain- Received dataLoaction:", dataLocation);
-        
-        send(sock, "OK", 2, 0);
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Sent OK");
-
-
-        // Create new node
-        Node *newNode = createNode(name, type, permissions, dataLocation);
-        free(name);
-        free(dataLocation);
-
-        // Check if node has children
-        int has_children;
-        if (recv(sock, &has_children, sizeof(int), 0) <= 0)
-        {
-            freeNode(newNode);
-            return NULL;
-        }
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Received has_children");
-
-        send(sock, "OK", 2, 0);
-        log_message(t_ip, t_port, "Receiving Node Chain:", "Sent OK");
-
-
-        if (has_children)
-        {
-            // Create hash table for children
-            newNode->children = createNodeTable();
-
-            // Receive all hash table entries
-            for (int i = 0; i < TABLE_SIZE; i++)
-            {
-                newNode->children->table[i] = receiveNodeChain(sock);
-
-                // Set parent pointers for the chain
-                Node *child = newNode->children->table[i];
-                while (child != NULL)
-                {
-                    child->parent = newNode;
-                    child = child->next;
-                }
-            }
-        }
-
-        // Add to chain
-        if (head == NULL)
-        {
-            head = newNode;
-            current = head;
-        }
-        else
-        {
-            current->next = newNode;
-            current = newNode;
-        }
     }
-
-    return head;
+    return node;
 }
 
-void *ackListener(void *arg)
+// OP_DATA payloads land directly in the image buffer
+static int receiveRawImage(int sock, char *image, size_t length)
 {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    char buffer[MAX_BUFFER_SIZE];
-
-    // Create a socket
-    if ((server_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    size_t filled = 0;
+    WireHeader hdr;
+    while (recvHeader(sock, &hdr) == 0)
     {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+        if (hdr.opcode == OP_END && hdr.length == 0)
+            return filled == length ? 0 : -1;
+        if (hdr.opcode != OP_DATA || hdr.length > length - filled)
+            return -1;
+        if (hdr.length && recvAll(sock, image + filled, hdr.length) < 0)
+            return -1;
+        filled += hdr.length;
     }
+    return -1;
+}
 
-    // Set socket options
-    int opt = 1;
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+#ifdef USE_ZLIB
+// Inflate OP_DATA payloads into the image buffer as they arrive
+static int receiveDeflatedImage(int sock, char *image, size_t length)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (length > UINT32_MAX || inflateInit(&stream) != Z_OK)
+        return -1;
+    stream.next_out = (Bytef *)image;
+    stream.avail_out = length;
+
+    char *chunk = (char *)malloc(WIRE_CHUNK_SIZE + 1);
+    WireHeader hdr = {0};
+    int rc = Z_OK;
+    while (recvFrameInto(sock, &hdr, chunk, WIRE_CHUNK_SIZE + 1) == 0 && hdr.opcode == OP_DATA)
     {
-        perror("setsockopt failed");
-        close(server_socket);
-        exit(EXIT_FAILURE);
+        if (hdr.length == 0)
+            continue;
+        stream.next_in = (Bytef *)chunk;
+        stream.avail_in = hdr.length;
+        rc = inflate(&stream, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END)
+            break;
     }
+    int ok = hdr.opcode == OP_END && rc == Z_STREAM_END && stream.total_out == length;
+    inflateEnd(&stream);
+    free(chunk);
+    return ok ? 0 : -1;
+}
+#endif
 
-    // Bind the socket to the specified port
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(ACK_PORT);
-
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+// Rebuild a tree, in an arena of its own, from a complete image of
+// node_count records. Returns NULL unless the image decodes exactly; a
+// partial tree is dropped with its arena.
+Node *decodeTreeImage(const char *image, size_t length, uint32_t node_count)
+{
+    WireReader reader;
+    uint32_t remaining = node_count;
+    wireReaderInit(&reader, image, length);
+    Arena *arena = arenaCreate();
+    if (!arena)
+        return NULL;
+    Node *root = decodeTreeNode(arena, &reader, NULL, &remaining, 0);
+    if (!root || remaining != 0 || reader.offset != reader.length)
     {
-        perror("Binding failed");
-        close(server_socket);
-        exit(EXIT_FAILURE);
+        arenaRelease(arena);
+        return NULL;
     }
+    return root;
+}
 
-    // Start listening for incoming connections
-    if (listen(server_socket, 5) < 0)
+// Receive the namespace image a storage server sends when its REGISTER reply
+// asks for one
+Node *receiveTreeImage(int sock, const char *ss_ip, int ss_port)
+{
+    WireHeader hdr;
+    char *payload;
+    if (recvFrame(sock, &hdr, &payload) < 0 || hdr.opcode != OP_TREE)
     {
-        perror("Listening failed");
-        close(server_socket);
-        exit(EXIT_FAILURE);
+        free(payload);
+        return NULL;
     }
 
-    printf("ACK Listener is running on port %d...\n", ACK_PORT);
+    WireReader reader;
+    wireReaderInit(&reader, payload, hdr.length);
+    uint8_t encoding = wireGetU8(&reader);
+    uint32_t node_count = wireGetU32(&reader);
+    uint64_t raw_length = wireGetU64(&reader);
+    free(payload);
+    // Every record takes at least four bytes, which bounds the node count
+    if (reader.error || node_count == 0 || raw_length > SIZE_MAX || node_count > raw_length / 4)
+        return NULL;
 
-    while (1)
-    {
-        // Accept a client connection
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_addr_len);
-        if (client_socket < 0)
-        {
-            perror("Failed to accept client connection");
-            continue; // Don't exit; keep listening
-        }
+    char *image = (char *)malloc(raw_length);
+    if (!image)
+        return NULL;
 
-        // Receive data from the client
-        memset(buffer, 0, MAX_BUFFER_SIZE);
-        if (recv(client_socket, buffer, MAX_BUFFER_SIZE - 1, 0) < 0)
-        {
-            perror("Failed to receive data");
-            close(client_socket);
-            continue;
-        }
+    int rc = -1;
+    if (encoding == TREE_ENCODING_RAW)
+        rc = receiveRawImage(sock, image, raw_length);
+#ifdef USE_ZLIB
+    else if (encoding == TREE_ENCODING_DEFLATE)
+        rc = receiveDeflatedImage(sock, image, raw_length);
+#endif
+
+    Node *root = rc == 0 ? decodeTreeImage(image, raw_length, node_count) : NULL;
+    free(image);
+
+    char log_buf[128];
+    snprintf(log_buf, sizeof(log_buf), "%u nodes, %llu bytes%s%s", node_count, (unsigned long long)raw_length,
+             encoding == TREE_ENCODING_DEFLATE ? " (deflate)" : "", root ? "" : ", rejected");
+    log_message(ss_ip, ss_port, "Received from SS: TREE", log_buf);
+    return root;
+}
 
-        // Process the received acknowledgment
-        int clientId, clientPort;
+// Apply an OP_WRITE_ACK frame: progress of asynchronous writes on server.
+// Each ack is tracked and passed on to the client that asked for the write.
+void handleWriteAcks(StorageServer *server, const char *payload, size_t length)
+{
+    WireReader reader;
+    wireReaderInit(&reader, payload, length);
+    uint32_t count = wireGetU32(&reader);
+    for (uint32_t i = 0; i < count && !reader.error; i++)
+    {
+        uint8_t phase = wireGetU8(&reader);
+        int clientId = (int)wireGetU32(&reader);
         char clientIP[INET_ADDRSTRLEN];
+        wireGetString(&reader, clientIP, sizeof(clientIP));
+        int clientPort = wireGetU16(&reader);
         char fileName[256];
+        wireGetString(&reader, fileName, sizeof(fileName));
+        if (reader.error)
+            break;
 
-        if (strstr(buffer, "started"))
-        {
-            // Extract details and update the queue
-            if (sscanf(buffer,
-                       "Start Message from Storage Server:\nClient ID: %d\nClient IP: %15s\nClient Port: %d\nFile: %255s",
-                       &clientId, clientIP, &clientPort, fileName) == 4)
-            {
-                updateWriteStateQueue("STARTED", fileName, clientId, clientIP, clientPort);
-                printf("Updated queue with STARTED message for file: %s\n", fileName);
-                 char ack_message[MAX_BUFFER_SIZE];
-                snprintf(ack_message, MAX_BUFFER_SIZE, "ACK: Write STARTED for file: %s", fileName);
-                forwardAckToClient(clientIP, clientPort, ack_message);
-            }
-            else
-            {
-                fprintf(stderr, "Failed to parse STARTED message\n");
-            }
-        }
-        else if (strstr(buffer, "completed"))
-        {
-            // Extract details and update the queue
-            if (sscanf(buffer,
-                       "End Message from Storage Server:\nClient ID: %d\nClient IP: %15s\nClient Port: %d\nFile: %255s",
-                       &clientId, clientIP, &clientPort, fileName) == 4)
-            {
-                updateWriteStateQueue("COMPLETED", fileName, clientId, clientIP, clientPort);
-                printf("Updated queue with COMPLETED message for file: %s\n", fileName);
-                char ack_message[MAX_BUFFER_SIZE];
-                snprintf(ack_message, MAX_BUFFER_SIZE, "ACK: Write COMPLETED for file: %s", fileName);
-                forwardAckToClient(clientIP, clientPort, ack_message);
-            }
-            else
-            {
-                fprintf(stderr, "Failed to parse COMPLETED message\n");
-            }
-        }
-        else
-        {
-            fprintf(stderr, "Unknown message received: %s\n", buffer);
-        }
-
-        // Close the client socket
-        close(client_socket);
+        const char *status = phase == WRITE_ACK_STARTED ? "STARTED" : "COMPLETED";
+        trackWriteAck(phase, fileName, clientId, clientIP, clientPort, server->peer_ip, server->client_port);
+        char ack_message[512];
+        snprintf(ack_message, sizeof(ack_message), "ACK: Write %s for file: %s", status, fileName);
+        forwardAckToClient(clientIP, clientPort, ack_message);
     }
-
-    // Close the server socket (unreachable in this implementation)
-    close(server_socket);
-    return NULL;
+    if (reader.error)
+        log_event(LOG_WARN, server->ip, server->nm_port, "SS", "Malformed write acknowledgment");
 }
+
 void forwardAckToClient(const char *clientIP, int clientPort, const char *ack_message)
 {
-    int client_sock;
-    struct sockaddr_in client_addr;
-
-    // Setup client address based on parsed IP and port
-    client_addr.sin_family = AF_INET;
-    client_addr.sin_port = htons(clientPort);
-
-    if (inet_pton(AF_INET, clientIP, &client_addr.sin_addr) <= 0)
-    {
-        fprintf(stderr, "Invalid client IP address: %s\n", clientIP);
-        log_message(NULL, 0, "Client", "Invalid client IP address");
-        return;
-    }
-
-    client_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (client_sock < 0)
-    {
-        perror("Client socket creation failed");
-        return;
-    }
-
-    // Connect to the client
-    if (connect(client_sock, (struct sockaddr *)&client_addr, sizeof(client_addr)) < 0)
-    {
-        perror("Connection to client failed");
-        close(client_sock);
-        return;
-    }
-
-    // Send the acknowledgment to the client
-    if (send(client_sock, ack_message, strlen(ack_message), 0) < 0)
+    // Queued on the client's notice channel
+    if (notifyClient(clientIP, clientPort, OP_NOTICE, ack_message, strlen(ack_message)) < 0)
     {
-        perror("Failed to send acknowledgment to client");
+        log_event(LOG_DEBUG, clientIP, clientPort, "Client", "Acknowledgment dropped, client unreachable");
     }
     else
     {
         log_message(clientIP, clientPort, "Client - Forwarded ACK to client:", ack_message);
-        printf("Acknowledgment forwarded to client %s:%d\n", clientIP, clientPort);
     }
-
-    close(client_sock);
-}
-
-void recursiveList(Node *node, const char *current_path, char *response, int *response_offset, size_t response_size)
-{
-    if (!node)
-        return;
-
-    // char full_path[1024];
-    // Construct the path for the current node
-    char new_path[1024];
-    if (strcmp(current_path, "") == 0)
-    {
-        // If current_path is empty, use only the node's name
-        snprintf(new_path, sizeof(new_path), "%s", node->name);
-    }
-    else
-    {
-        // Check if node->name causes duplication with current_path
-        if (strstr(current_path, node->name) && strstr(current_path, node->name) + strlen(node->name) == current_path + strlen(current_path))
-        {
-            // If current_path already ends with node->name, don't append it
-            snprintf(new_path, sizeof(new_path), "%s", current_path);
-        }
-        else
-        {
-            // Otherwise, append node->name to current_path
-            snprintf(new_path, sizeof(new_path), "%s/%s", current_path, node->name);
-        }
-    }
-    // Append current node's information to the response
-    *response_offset += snprintf(response + *response_offset, response_size - *response_offset,
-                                 "Path: %s, Type: %s\n",
-                                 new_path,
-                                 (node->type == FILE_NODE ? "File" : "Directory"));
-
-    // If the node is a directory, traverse its children
-    if (node->type == DIRECTORY_NODE)
-    {
-        NodeTable *children = node->children; // Directly use node->children without '&'
-        for (int i = 0; i < TABLE_SIZE; i++)
-        {
-            Node *child_node = children->table[i];
-            while (child_node)
-            {
-                recursiveList(child_node, new_path, response, response_offset, response_size);
-                child_node = child_node->next;
-            }
-        }
-    }
-}
-
-StorageServerList *findStorageServersByPath_List(StorageServerTable *table, const char *path)
-{
-    StorageServerList *matching_servers = NULL;
-    StorageServerList *last_match = NULL;
-
-    for (int i = 0; i < TABLE_SIZE; i++)
-    {
-        pthread_mutex_lock(&table->locks[i]);
-        StorageServer *server = table->table[i];
-
-        while (server)
-        {
-            if (server->active && server->root)
-            {
-                // Use searchPath to check if this server has the path
-                Node *found_node = searchPath(server->root, path);
-                if (found_node != NULL)
-                {
-                    // We found the path in this server, add to the list
-                    StorageServerList *new_match = (StorageServerList *)malloc(sizeof(StorageServerList));
-                    new_match->server = server;
-                    new_match->next = NULL;
-
-                    if (last_match)
-                    {
-                        last_match->next = new_match;
-                    }
-                    else
-                    {
-                        matching_servers = new_match;
-                    }
-                    last_match = new_match;
-                }
-            }
-            server = server->next;
-        }
-        pthread_mutex_unlock(&table->locks[i]);
-    }
-
-    return matching_servers;
 }
 
 Node *findNode(Node *root, const char *path)
@@ -417,7 +222,7 @@ Node *findNode(Node *root, const char *path)
     if (!root || !path || strlen(path) == 0)
     {
         printf("Error: Invalid root or path.\n");
-        log_message(NULL, 0, "FindNode", "Error: Invalid root or path.");
+        log_event(LOG_WARN, NULL, 0, "FindNode", "Error: Invalid root or path.");
         return NULL;
     }
 
@@ -439,34 +244,18 @@ Node *findNode(Node *root, const char *path)
         if (!childrenTable)
         {
             printf("Error: Path component '%s' not found (no children).\n", token);
-            log_message(NULL, 0, "FindNode", "Error: Path component not found (no children).");
+            log_event(LOG_WARN, NULL, 0, "FindNode", "Error: Path component not found (no children).");
 
             free(pathCopy);
             return NULL;
         }
 
-        Node *child = NULL;
-        for (int i = 0; i < TABLE_SIZE; i++)
-        {
-            child = childrenTable->table[i];
-            while (child != NULL)
-            {
-                if (strcmp(child->name, token) == 0)
-                {
-                    break;
-                }
-                child = child->next;
-            }
-            if (child)
-            {
-                break;
-            }
-        }
+        Node *child = searchNode(childrenTable, token);
 
         if (!child)
         {
             printf("Error: Path component '%s' not found.\n", token);
-            log_message(NULL, 0, "FindNode", "Error: Path component not found (no children).");
+            log_event(LOG_WARN, NULL, 0, "FindNode", "Error: Path component not found (no children).");
 
             free(pathCopy);
             return NULL;
@@ -501,316 +290,291 @@ void copyDirectoryContents(Node *sourceDir, Node *destDir)
         return;
     }
 
-    for (int i = 0; i < TABLE_SIZE; i++)
+    for (unsigned int i = 0; i < sourceDir->children->capacity; i++)
     {
-        Node *child = sourceDir->children->table[i];
-        while (child)
+        Node *child = nodeTableSlot(sourceDir->children, i);
+        if (!child)
+            continue;
+        if (child->type == FILE_NODE)
         {
-            if (child->type == FILE_NODE)
-            {
-                // Copy file
-                addFile(destDir, child->name, child->permissions, child->dataLocation);
-            }
-            else if (child->type == DIRECTORY_NODE)
-            {
-                // Create the new directory in the destination
-                addDirectory(destDir, child->name, child->permissions);
+            // Copy file
+            char location[PATH_MAX];
+            addFile(destDir, child->name, child->permissions,
+                    nodeLocation(child, location, sizeof(location)) >= 0 ? location : "");
+        }
+        else if (child->type == DIRECTORY_NODE)
+        {
+            // Create the new directory in the destination
+            addDirectory(destDir, child->name, child->permissions);
 
-                // Find the newly created directory in the destination
-                Node *newDestDir = searchNode(destDir->children, child->name);
+            // Find the newly created directory in the destination
+            Node *newDestDir = searchNode(destDir->children, child->name);
 
-                // Recursively copy the contents of the directory
-                copyDirectoryContents(child, newDestDir);
-            }
-            child = child->next;
+            // Recursively copy the contents of the directory
+            copyDirectoryContents(child, newDestDir);
         }
     }
 }
 
-void updateWriteStateQueue(const char *status, const char *fileName, int clientId, const char *clientIP, int clientPort) {
-    pthread_mutex_lock(&queueMutex);
+// Called by ringSuccessors with by_id_lock held
+static bool canHoldBackup(int id, void *arg)
+{
+    StorageServerTable *table = arg;
+    StorageServer *server = id < table->by_id_capacity ? table->by_id[id] : NULL;
+    return server && server->active;
+}
 
-    // Search for an existing entry for the file
-    AsyncWriteState *current = writeStateQueue;
-    AsyncWriteState *prev = NULL;
-    while (current) {
-        if (strcmp(current->fileName, fileName) == 0 && current->clientId == clientId) {
-            break;
-        }
-        prev = current;
-        current = current->next;
+// The backups one server should have, taken from the ring
+typedef struct BackupPlan
+{
+    StorageServer *server;
+    int id;
+    StorageServer *wanted[REPLICA_SLOTS];
+    int wanted_id[REPLICA_SLOTS];
+    int found;
+} BackupPlan;
+
+// Give every live server the backups the ring asks for. A backup that is
+// still among its server's successors keeps its slot, so only the slots
+// whose successor changed are re-pointed and copied again. The assignments
+// are worked out under the locks; the copying, which makes control
+// requests and namespace changes, runs with none held; a server replaced
+// meanwhile is kept allocated until the pass ends (see retireStorageServer).
+void backup_data(StorageServerTable *server_table)
+{
+    if (!server_table)
+        return;
+
+    pthread_rwlock_rdlock(&server_table->by_id_lock);
+    BackupPlan *plans = calloc(server_table->by_id_capacity ? server_table->by_id_capacity : 1, sizeof(BackupPlan));
+    int count = 0;
+    for (int id = 0; plans && id < server_table->by_id_capacity; id++)
+    {
+        StorageServer *current = server_table->by_id[id];
+        if (!current || !current->active)
+            continue;
+        BackupPlan *plan = &plans[count++];
+        plan->server = current;
+        plan->id = current->id;
+        plan->found = ringSuccessors(&server_table->ring, current->id, plan->wanted_id, REPLICA_SLOTS, canHoldBackup, server_table);
+        for (int i = 0; i < plan->found; i++)
+            plan->wanted[i] = server_table->by_id[plan->wanted_id[i]];
     }
+    pthread_rwlock_unlock(&server_table->by_id_lock);
+    if (!plans)
+        return;
 
-    if (current) {
-        // Update existing entry
-        strncpy(current->status, status, sizeof(current->status));
-        current->status[sizeof(current->status) - 1] = '\0';
-        current->timestamp = time(NULL);
-    } else {
-        // Create a new entry
-        AsyncWriteState *newState = (AsyncWriteState *)malloc(sizeof(AsyncWriteState));
-        if (!newState) {
-            perror("Failed to allocate memory for write state");
-            pthread_mutex_unlock(&queueMutex);
-            return;
+    for (int p = 0; p < count; p++)
+    {
+        BackupPlan *plan = &plans[p];
+        StorageServer *current = plan->server;
+        StorageServer *assigned[REPLICA_SLOTS];
+        pthread_mutex_lock(&current->lock);
+        assigned[0] = current->ss_backup_1;
+        assigned[1] = current->ss_backup_2;
+        pthread_mutex_unlock(&current->lock);
+
+        bool kept[REPLICA_SLOTS] = {false};
+        for (int slot = 0; slot < REPLICA_SLOTS; slot++)
+        {
+            for (int i = 0; i < plan->found; i++)
+            {
+                if (plan->wanted[i] && assigned[slot] == plan->wanted[i] && !kept[slot])
+                {
+                    kept[slot] = true;
+                    plan->wanted[i] = NULL;
+                }
+            }
         }
-        strncpy(newState->fileName, fileName, sizeof(newState->fileName));
-        newState->fileName[sizeof(newState->fileName) - 1] = '\0';
-        newState->clientId = clientId;
-        strncpy(newState->clientIP, clientIP, sizeof(newState->clientIP));
-        newState->clientIP[sizeof(newState->clientIP) - 1] = '\0';
-        newState->clientPort = clientPort;
-        strncpy(newState->status, status, sizeof(newState->status));
-        newState->status[sizeof(newState->status) - 1] = '\0';
-        newState->timestamp = time(NULL);
-        newState->next = NULL;
-
-        // Add to the queue
-        if (!writeStateQueue) {
-            writeStateQueue = newState;
-        } else {
-            prev->next = newState;
+        bool replaced = false;
+        for (int slot = 0; slot < REPLICA_SLOTS && !replaced; slot++)
+        {
+            if (kept[slot])
+                continue;
+            for (int i = 0; i < plan->found; i++)
+            {
+                StorageServer *destination = plan->wanted[i];
+                if (!destination || !take_backup(server_table, current, destination, slot + 1))
+                    continue;
+                plan->wanted[i] = NULL;
+                // Either end may have registered again while we copied;
+                // the registration runs backup_data again
+                replaced = findStorageServerById(server_table, plan->id) != current;
+                if (replaced || findStorageServerById(server_table, plan->wanted_id[i]) != destination)
+                    break;
+                pthread_mutex_lock(&current->lock);
+                if (slot == 0)
+                    current->ss_backup_1 = destination;
+                else
+                    current->ss_backup_2 = destination;
+                pthread_mutex_unlock(&current->lock);
+                break;
+            }
         }
     }
+    free(plans);
+}
 
-    pthread_mutex_unlock(&queueMutex);
+static pthread_mutex_t backup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t backup_wanted = PTHREAD_COND_INITIALIZER;
+static bool backup_pending;
+static bool backup_running;
+static StorageServer *retired; // replaced during a pass, freed after it
+
+static void freeStorageServer(StorageServer *server)
+{
+    if (server->has_handler)
+        pthread_detach(server->handler);
+    if (server->socket >= 0)
+        close(server->socket);
+    pthread_mutex_destroy(&server->lock);
+    freeTree(server->root);
+    free(server);
 }
 
-void *monitorWriteStates(void *arg) {
-    while (1) {
-        pthread_mutex_lock(&queueMutex);
-        time_t currentTime = time(NULL);
-
-        AsyncWriteState *current = writeStateQueue;
-        while (current) {
-            if (strcmp(current->status, "STARTED") == 0 && difftime(currentTime, current->timestamp) > 10) {
-                printf("Warning: Write operation for file '%s' not completed within 10 seconds.\n", current->fileName);
-
-                // Notify the client about the delayed write
-                char delayedAckMessage[MAX_BUFFER_SIZE];
-                snprintf(delayedAckMessage, MAX_BUFFER_SIZE,
-                         "WARNING: Write operation for file '%s' is aborted since ss goes offline.", current->fileName);
-                forwardAckToClient(current->clientIP, current->clientPort, delayedAckMessage);
-
-                // Optionally, trigger a recheck with the storage server
-                // This could be a function like `checkStorageServerState(current->fileName)`
-                printf("Notified client %s:%d about ss offline for file '%s'.\n",
-                       current->clientIP, current->clientPort, current->fileName);
-            }
+// server was replaced and is off the table and the path index. A backup
+// pass works from pointers taken before it started, so while one runs the
+// server is only shut down, and freed once the pass is over.
+void retireStorageServer(StorageServer *server)
+{
+    pthread_mutex_lock(&backup_lock);
+    if (backup_running)
+    {
+        if (server->socket >= 0)
+            shutdown(server->socket, SHUT_RDWR);
+        server->next = retired;
+        retired = server;
+        server = NULL;
+    }
+    pthread_mutex_unlock(&backup_lock);
+    if (server)
+        freeStorageServer(server);
+}
 
-            current = current->next;
+// Runs backup_data off the threads that notice a change, since copying
+// waits on storage servers that may be hung
+static void *backupWorker(void *arg)
+{
+    StorageServerTable *server_table = arg;
+    while (1)
+    {
+        pthread_mutex_lock(&backup_lock);
+        while (!backup_pending)
+            pthread_cond_wait(&backup_wanted, &backup_lock);
+        backup_pending = false;
+        backup_running = true;
+        pthread_mutex_unlock(&backup_lock);
+        backup_data(server_table);
+
+        pthread_mutex_lock(&backup_lock);
+        backup_running = false;
+        StorageServer *done = retired;
+        retired = NULL;
+        pthread_mutex_unlock(&backup_lock);
+        while (done)
+        {
+            StorageServer *next = done->next;
+            freeStorageServer(done);
+            done = next;
         }
-
-        pthread_mutex_unlock(&queueMutex);
-        sleep(5); // Check every 5 seconds
     }
     return NULL;
 }
 
+// Ask the backup worker for a pass; requests made during one are folded
+// into the next
+void requestBackups(void)
+{
+    pthread_mutex_lock(&backup_lock);
+    backup_pending = true;
+    pthread_cond_signal(&backup_wanted);
+    pthread_mutex_unlock(&backup_lock);
+}
 
-void backup_data(StorageServerTable *server_table)
+int startBackupWorker(StorageServerTable *server_table)
 {
-    if (!server_table)
-        return;
-    for (int i = 0; i < TABLE_SIZE; i++)
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, backupWorker, server_table) != 0)
     {
-        StorageServer *current = server_table->table[i];
-        while (current)
-        {
-            printf("curcscs %s %d\n", current->root->name, current->id);
-            pthread_mutex_lock(&current->lock);
-            if (!current->ss_backup_1 || !current->ss_backup_1->active)
-            {
-                printf("empty\n");
-                StorageServer *backup1 = NULL;
-                int offset = 1;
-                while (!backup1 && offset <= server_table->count)
-                {
-                    printf("offset %d \n", offset);
-                    int backup_id = (current->id - offset + server_table->count) % server_table->count;
-                    if (backup_id != current->id)
-                    {
-                        printf("backup_id%d \n", backup_id);
-                        for (int j = 0; j < TABLE_SIZE; j++)
-                        {
-                            StorageServer *potential_backup = server_table->table[j];
-                            if (current->ss_backup_2)
-                            {
-                                if (potential_backup != current->ss_backup_2)
-                                {
-                                    while (potential_backup)
-                                    {
-                                        if (potential_backup->id == backup_id && potential_backup->active)
-                                        {
-                                            printf("current %s %s\n", current->root->name, potential_backup->root->name);
-                                            int check = take_backup(server_table, current, potential_backup);
-                                            if (check)
-                                            {
-                                                printf("DONE\n");
-                                                backup1 = potential_backup;
-                                                break;
-                                            }
-                                        }
-                                        potential_backup = potential_backup->next;
-                                    }
-                                    if (backup1)
-                                        break;
-                                }
-                            }
-                            else
-                            {
-                                while (potential_backup)
-                                {
-                                    if (potential_backup->id == backup_id && potential_backup->active)
-                                    {
-                                        printf("current %s %s\n", current->root->name, potential_backup->root->name);
-                                        int check = take_backup(server_table, current, potential_backup);
-                                        if (check)
-                                        {
-                                            backup1 = potential_backup;
-                                            break;
-                                        }
-                                    }
-                                    potential_backup = potential_backup->next;
-                                }
-                                if (backup1)
-                                    break;
-                            }
-                        }
-                    }
-                    offset++;
-                }
-                if (backup1)
-                    current->ss_backup_1 = backup1;
-            }
-            if (!current->ss_backup_2 || !current->ss_backup_2->active)
-            {
-                StorageServer *backup2 = NULL;
-                int offset = 1;
-
-                while (!backup2 && offset <= server_table->count)
-                {
-                    int backup_id = (current->id - offset - 1 + server_table->count) % server_table->count;
-                    if (backup_id != current->id)
-                    {
-                        for (int j = 0; j < TABLE_SIZE; j++)
-                        {
-                            StorageServer *potential_backup = server_table->table[j];
-                            if (current->ss_backup_1)
-                            {
-                                if (potential_backup != current->ss_backup_1)
-                                {
-                                    while (potential_backup)
-                                    {
-                                        if (potential_backup->id == backup_id && potential_backup->active)
-                                        {
-                                            printf("current %s %s\n", current->root->name, potential_backup->root->name);
-                                            int check = take_backup(server_table, current, potential_backup);
-                                            if (check)
-                                            {
-                                                backup2 = potential_backup;
-                                                break;
-                                            }
-                                        }
-                                        potential_backup = potential_backup->next;
-                                    }
-                                    if (backup2)
-                                        break;
-                                }
-                            }
-                            else
-                            {
-                                while (potential_backup)
-                                {
-                                    if (potential_backup->id == backup_id && potential_backup->active)
-                                    {
-                                        printf("current %s %s\n", current->root->name, potential_backup->root->name);
-                                        int check = take_backup(server_table, current, potential_backup);
-                                        if (check)
-                                        {
-                                            backup2 = potential_backup;
-                                            break;
-                                        }
-                                    }
-                                    potential_backup = potential_backup->next;
-                                }
-                                if (backup2)
-                                    break;
-                            }
-                        }
-                    }
-                    offset++;
-                }
-                if (backup2)
-                    current->ss_backup_2 = backup2;
-            }
-            pthread_mutex_unlock(&current->lock);
-            current = current->next;
-        }
+        perror("Failed to create backup thread");
+        return -1;
     }
+    pthread_detach(thread);
+    return 0;
 }
 
-int take_backup(StorageServerTable *server_table, StorageServer *server, StorageServer *destination)
+// Make destination hold a backup of server in /backup_<id>, kept current by
+// the server's replication log (slot 1 or 2). A directory left from an
+// earlier assignment is reused, so a replica that comes back only receives
+// the changes it missed. Its contents reach the namespace through the
+// destination's own deltas.
+int take_backup(StorageServerTable *server_table, StorageServer *server, StorageServer *destination, int slot)
 {
-    char response[100001];
     char path[1024];
     snprintf(path, sizeof(path), "/backup_%d", server->id);
-    snprintf(response, sizeof(response), "CREATE DIR 1 /backup_%d", server->id);
-    send(destination->socket, response, strlen(response), 0);
-    recv(destination->socket, response, sizeof(response), 0);
-    printf("%s\n", response);
-    if (strncmp(response, "CREATE DONE", 11) == 0)
+
+    WireBuffer out;
+    WireHeader reply;
+    char *response;
+    int rc;
+    lockNamespace(false);
+    Node *existing = destination->root ? searchPath(destination->root, path) : NULL;
+    bool have_dir = existing && existing->type == DIRECTORY_NODE;
+    unlockNamespace();
+    if (!have_dir)
     {
-        printf("yeahhh\n");
-        char *lastSlash = strrchr(path, '/');
-        if (!lastSlash)
-        {
-            return 0;
-        }
-        *lastSlash = '\0';
-        char *name = lastSlash + 1;
-        Node *parentDir = searchPath(destination->root, path);
-        *lastSlash = '/';
-        if (!parentDir)
-        {
+        wireBufferInit(&out);
+        wirePutU8(&out, DIRECTORY_NODE);
+        wirePutString(&out, path);
+        rc = storageServerRequest(destination, OP_CREATE, &out, &reply, &response);
+        wireBufferFree(&out);
+        if (rc < 0)
             return 0;
-        }
-        NodeType typ = DIRECTORY_NODE;
-        Node *newNode = createNode(name, typ, READ | WRITE, path);
-        newNode->parent = parentDir;
-        insertNode(parentDir->children, newNode);
-        char dest_path[1024];
-        snprintf(dest_path, sizeof(dest_path), "/backup_%d", server->id);
-        snprintf(response, sizeof(response), "COPY / /backup_%d", server->id);
-        send(server->socket, response, strlen(response), 0);
-        recv(server->socket, response, sizeof(response), 0);
-        char server_info[MAX_BUFFER_SIZE];
-        printf("hiiek\n");
-        snprintf(server_info, sizeof(server_info), "SOURCE SERVER_INFO %s %d", destination->ip, destination->client_port);
-        send(server->socket, server_info, strlen(server_info), 0);
-        recv(server->socket, response, sizeof(response), 0);
         printf("%s\n", response);
-        if (strncmp(response, "COPY DONE", 9) == 0)
+        free(response);
+        if (reply.status != WIRE_OK)
+            return 0;
+
+        if (!namespaceCreate(destination, path, DIRECTORY_NODE))
+            return 0;
+    }
+
+    wireBufferInit(&out);
+    wirePutU8(&out, (uint8_t)slot);
+    wirePutString(&out, destination->ip);
+    wirePutU16(&out, (uint16_t)destination->client_port);
+    wirePutString(&out, path);
+    rc = storageServerRequest(server, OP_REPLICATE, &out, &reply, &response);
+    wireBufferFree(&out);
+    if (rc < 0)
+        return 0;
+    printf("%s\n", response);
+    free(response);
+    if (reply.status != WIRE_OK)
+        return 0;
+    // Not readable there until the server reports the new backup in sync
+    server->replica_lag[slot - 1] = REPLICA_LAG_UNKNOWN;
+    printf("Backup of storage server %d on storage server %d\n", server->id, destination->id);
+    return 1;
+}
+
+// A storage server that registers again has lost its replication threads
+// and may listen on a new port, so every backup assignment involving it is
+// dropped for backup_data to make again
+void forgetBackups(StorageServerTable *server_table, StorageServer *server)
+{
+    for (int i = 0; i < TABLE_SIZE; i++)
+    {
+        pthread_mutex_lock(&server_table->locks[i]);
+        for (StorageServer *current = server_table->table[i]; current; current = current->next)
         {
-            if (server->root->type == DIRECTORY_NODE)
-            {
-                printf("%s\n", dest_path);
-                Node *destParentNode = findNode(destination->root, dest_path);
-                if (!destParentNode || destParentNode->type != DIRECTORY_NODE)
-                {
-                    printf("Error: Destination path is not a valid directory\n");
-                    return 0;
-                }
-                addDirectory(destParentNode, server->root->name, server->root->permissions);
-                Node *newRootDir = searchNode(destParentNode->children, server->root->name);
-                copyDirectoryContents(server->root, newRootDir);
-                printf("Backup done\n");
-            }
-            else
-            {
-                Node *destParentNode = findNode(destination->root, dest_path);
-                addFile(destParentNode, server->root->name, server->root->permissions, server->root->dataLocation);
-            }
+            if (current->ss_backup_1 == server)
+                current->ss_backup_1 = NULL;
+            if (current->ss_backup_2 == server)
+                current->ss_backup_2 = NULL;
         }
+        pthread_mutex_unlock(&server_table->locks[i]);
     }
-}
\ No newline at end of file
+    server->ss_backup_1 = NULL;
+    server->ss_backup_2 = NULL;
+}
@@ -1,59 +1,247 @@
 #include"header.h"
 
-// Hash function for strings
+// Hash function for strings (FNV-1a). The full 32-bit value is cached in
+// each Node and masked by the child table's capacity when probing.
 unsigned int hash(const char *str)
 {
-    unsigned int hash = 0;
+    unsigned int hash = 2166136261u;
     while (*str)
     {
-        hash = (hash * 31) + *str;
+        hash ^= (unsigned char)*str;
+        hash *= 16777619u;
         str++;
     }
-    return hash % TABLE_SIZE;
+    return hash;
 }
 
+// Marks a deleted slot so that probe sequences running through it stay intact
+static Node node_table_tombstone;
+#define NODE_TOMBSTONE (&node_table_tombstone)
+
 // Initialize a new hash table for storing children
-NodeTable *createNodeTable()
+NodeTable *createNodeTable(Arena *arena)
 {
-    NodeTable *nodeTable = (NodeTable *)malloc(sizeof(NodeTable));
-    for (int i = 0; i < TABLE_SIZE; i++)
-        nodeTable->table[i] = NULL;
+    NodeTable *nodeTable = (NodeTable *)arenaAlloc(arena, sizeof(NodeTable));
+    nodeTable->arena = arena;
+    nodeTable->capacity = NODE_TABLE_INITIAL_CAPACITY;
+    nodeTable->count = 0;
+    nodeTable->used = 0;
+    nodeTable->slots = (Node **)arenaCalloc(arena, nodeTable->capacity * sizeof(Node *));
     return nodeTable;
 }
 
-// Helper to create a new node (file or directory) with metadata
-Node *createNode(const char *name, NodeType type, Permissions perms, const char *dataLocation)
+void freeNodeTable(NodeTable *table)
+{
+    Arena *arena = table->arena;
+    arenaFree(arena, table->slots, table->capacity * sizeof(Node *));
+    arenaFree(arena, table, sizeof(NodeTable));
+}
+
+// Returns the live node stored in slot i, or NULL for empty and deleted slots
+Node *nodeTableSlot(NodeTable *table, unsigned int i)
+{
+    Node *node = table->slots[i];
+    return node == NODE_TOMBSTONE ? NULL : node;
+}
+
+// Rehash into a table of new_capacity slots, dropping tombstones
+static void resizeNodeTable(NodeTable *table, unsigned int new_capacity)
+{
+    Node **old_slots = table->slots;
+    unsigned int old_capacity = table->capacity;
+
+    table->slots = (Node **)arenaCalloc(table->arena, new_capacity * sizeof(Node *));
+    table->capacity = new_capacity;
+    table->used = table->count;
+    for (unsigned int i = 0; i < old_capacity; i++)
+    {
+        Node *node = old_slots[i];
+        if (!node || node == NODE_TOMBSTONE)
+            continue;
+        unsigned int index = node->hash & (new_capacity - 1);
+        while (table->slots[index])
+            index = (index + 1) & (new_capacity - 1);
+        table->slots[index] = node;
+    }
+    arenaFree(table->arena, old_slots, old_capacity * sizeof(Node *));
+}
+
+// Grow the table so that count more children fit without another rehash
+void reserveNodeTable(NodeTable *table, unsigned int count)
+{
+    unsigned int capacity = table->capacity;
+    while ((unsigned long)(table->used + count) * 4 > (unsigned long)capacity * 3)
+        capacity *= 2;
+    if (capacity != table->capacity)
+        resizeNodeTable(table, capacity);
+}
+
+// Allocate a node, keeping location (NULL to derive it from the parent)
+static Node *allocNode(Arena *arena, const char *name, NodeType type, Permissions perms, const char *location)
 {
-    Node *node = (Node *)malloc(sizeof(Node));
-    node->name = strdup(name);
+    size_t location_size = location ? strlen(location) + 1 : 0;
+    Node *node = (Node *)arenaAlloc(arena, sizeof(Node) + location_size);
+    node->hash = hash(name);
+    node->name = arenaIntern(arena, name, node->hash);
     node->type = type;
     node->permissions = perms;
-    node->dataLocation = dataLocation ? strdup(dataLocation) : NULL;
+    node->lock_type = 0; // No lock by default
+    node->has_location = location != NULL;
+    if (location)
+        memcpy(node->location, location, location_size);
     node->parent = NULL;
-    node->next = NULL;
-    node->children = (type == DIRECTORY_NODE) ? createNodeTable() : NULL;
+    node->children = (type == DIRECTORY_NODE) ? createNodeTable(arena) : NULL;
+    return node;
+}
+
+// Helper to create the root of a new tree, allocated from arena. The arena
+// is released with the tree, see freeTree().
+Node *createNode(Arena *arena, const char *name, NodeType type, Permissions perms, const char *location)
+{
+    return allocNode(arena, name, type, perms, location ? location : "");
+}
+
+// The arena the node's tree lives in. Every directory has a child table,
+// and every file a parent directory.
+Arena *nodeArena(const Node *node)
+{
+    return node->children ? node->children->arena : node->parent->children->arena;
+}
+
+// Whether the node's location is exactly the first length bytes of
+// location. Follows the parent links without building the path.
+static bool locationMatches(const Node *node, const char *location, size_t length)
+{
+    while (!node->has_location)
+    {
+        size_t name_length = strlen(node->name);
+        if (length <= name_length || location[length - name_length - 1] != '/' ||
+            memcmp(location + length - name_length, node->name, name_length) != 0)
+            return false;
+        length -= name_length + 1;
+        node = node->parent;
+    }
+    return node->location[0] && strlen(node->location) == length && memcmp(node->location, location, length) == 0;
+}
+
+// Copy the node's location on its storage server into buffer. Returns its
+// length, or -1 if the node has none or it does not fit.
+int nodeLocation(const Node *node, char *buffer, size_t size)
+{
+    size_t length = 0;
+    const Node *base = node;
+    while (!base->has_location)
+    {
+        length += strlen(base->name) + 1;
+        base = base->parent;
+    }
+    size_t base_length = strlen(base->location);
+    if (base_length == 0 || base_length + length >= size)
+        return -1;
+
+    // Fill in the names from the end
+    size_t end = base_length + length;
+    buffer[end] = '\0';
+    for (const Node *n = node; n != base; n = n->parent)
+    {
+        size_t name_length = strlen(n->name);
+        end -= name_length;
+        memcpy(buffer + end, n->name, name_length);
+        buffer[--end] = '/';
+    }
+    memcpy(buffer, base->location, base_length);
+    return (int)(base_length + length);
+}
+
+// Create a node under parentDir and insert it. location is only stored if
+// it differs from the parent's location + "/" + name; NULL derives it.
+Node *createChildNode(Node *parentDir, const char *name, NodeType type, Permissions perms, const char *location)
+{
+    if (location)
+    {
+        size_t length = strlen(location);
+        size_t name_length = strlen(name);
+        if (length > name_length && location[length - name_length - 1] == '/' &&
+            strcmp(location + length - name_length, name) == 0 &&
+            locationMatches(parentDir, location, length - name_length - 1))
+            location = NULL;
+    }
+    else
+    {
+        // Nothing to derive from: the node has no location either
+        const Node *base = parentDir;
+        while (!base->has_location)
+            base = base->parent;
+        if (!base->location[0])
+            location = "";
+    }
+
+    Node *node = allocNode(nodeArena(parentDir), name, type, perms, location);
+    node->parent = parentDir;
+    insertNode(parentDir->children, node);
     return node;
 }
 
 
-// Insert a node into a directory's hash table
+// Insert a node into a directory's hash table, growing it past 75% load
 void insertNode(NodeTable *table, Node *node)
 {
-    unsigned int index = hash(node->name);
-    node->next = table->table[index];
-    table->table[index] = node;
+    if ((table->used + 1) * 4 > table->capacity * 3)
+    {
+        // Mostly tombstones: rehash in place, otherwise double
+        unsigned int new_capacity = table->capacity;
+        if ((table->count + 1) * 2 > table->capacity)
+            new_capacity *= 2;
+        resizeNodeTable(table, new_capacity);
+    }
+
+    unsigned int mask = table->capacity - 1;
+    unsigned int index = node->hash & mask;
+    while (table->slots[index] && table->slots[index] != NODE_TOMBSTONE)
+        index = (index + 1) & mask;
+    if (!table->slots[index])
+        table->used++;
+    table->slots[index] = node;
+    table->count++;
+}
+
+static int findSlot(NodeTable *table, const char *name, unsigned int name_hash)
+{
+    unsigned int mask = table->capacity - 1;
+    unsigned int index = name_hash & mask;
+    Node *current;
+    while ((current = table->slots[index]) != NULL)
+    {
+        if (current != NODE_TOMBSTONE && current->hash == name_hash && strcmp(current->name, name) == 0)
+            return (int)index;
+        index = (index + 1) & mask;
+    }
+    return -1;
 }
 
 // Search for a file or directory in a hash table by name
 Node *searchNode(NodeTable *table, const char *name)
 {
-    unsigned int index = hash(name);
-    Node *current = table->table[index];
-    while (current && strcmp(current->name, name) != 0)
+    int index = findSlot(table, name, hash(name));
+    return index < 0 ? NULL : table->slots[index];
+}
+
+// Unlink node from a directory's hash table. Returns 0 on success
+int removeNode(NodeTable *table, Node *node)
+{
+    unsigned int mask = table->capacity - 1;
+    unsigned int index = node->hash & mask;
+    while (table->slots[index])
     {
-        current = current->next;
+        if (table->slots[index] == node)
+        {
+            table->slots[index] = NODE_TOMBSTONE;
+            table->count--;
+            return 0;
+        }
+        index = (index + 1) & mask;
     }
-    return current;
+    return -1;
 }
 
 void getParentPath(const char *path, char *parent)
@@ -71,7 +259,7 @@ void getParentPath(const char *path, char *parent)
 }
 
 // Add a file under a directory with metadata
-void addFile(Node *parentDir, const char *fileName, Permissions perms, const char *dataLocation)
+void addFile(Node *parentDir, const char *fileName, Permissions perms, const char *location)
 {
     if (parentDir->type != DIRECTORY_NODE)
     {
@@ -79,9 +267,7 @@ void addFile(Node *parentDir, const char *fileName, Permissions perms, const cha
         return;
     }
 
-    Node *newFile = createNode(fileName, FILE_NODE, perms, dataLocation);
-    newFile->parent = parentDir;
-    insertNode(parentDir->children, newFile);
+    createChildNode(parentDir, fileName, FILE_NODE, perms, location);
 }
 
 // Add a directory under a directory
@@ -93,9 +279,7 @@ void addDirectory(Node *parentDir, const char *dirName, Permissions perms)
         return;
     }
 
-    Node *newDir = createNode(dirName, DIRECTORY_NODE, perms, NULL);
-    newDir->parent = parentDir;
-    insertNode(parentDir->children, newDir);
+    createChildNode(parentDir, dirName, DIRECTORY_NODE, perms, NULL);
 }
 
 // Recursive function to search for a file or directory by path
@@ -117,14 +301,11 @@ void printFileSystemTree(Node *node, int depth)
     // If it's a directory, print all its children
     if (node->type == DIRECTORY_NODE && node->children)
     {
-        for (int i = 0; i < TABLE_SIZE; i++)
+        for (unsigned int i = 0; i < node->children->capacity; i++)
         {
-            Node *current = node->children->table[i];
-            while (current)
-            {
+            Node *current = nodeTableSlot(node->children, i);
+            if (current)
                 printFileSystemTree(current, depth + 1);
-                current = current->next;
-            }
         }
     }
 }
@@ -199,17 +380,6 @@ Node *searchPath(Node *root, const char *path)
         if (!found)
         {
             // printf("Component not found: %s\n", pathComponents[i]);
-            // // Print contents of current directory for debugging
-            printf("Contents of directory %s:\n", current->name);
-            for (int j = 0; j < TABLE_SIZE; j++)
-            {
-                Node *child = current->children->table[j];
-                while (child)
-                {
-                    printf("  - %s\n", child->name);
-                    child = child->next;
-                }
-            }
             current = NULL;
             break;
         }
@@ -244,42 +414,43 @@ void listDirectory(Node *dir)
     }
 
     printf("Contents of directory %s:\n", dir->name);
-    for (int i = 0; i < TABLE_SIZE; i++)
+    for (unsigned int i = 0; i < dir->children->capacity; i++)
     {
-        Node *child = dir->children->table[i];
-        while (child)
-        {
-            printf("- %s (%s), Location: %s, Permissions: %d\n",
-                   child->name,
-                   child->type == FILE_NODE ? "File" : "Directory",
-                   child->dataLocation ? child->dataLocation : "N/A",
-                   child->permissions);
-            child = child->next;
-        }
+        Node *child = nodeTableSlot(dir->children, i);
+        if (!child)
+            continue;
+        char location[PATH_MAX];
+        printf("- %s (%s), Location: %s, Permissions: %d\n",
+               child->name,
+               child->type == FILE_NODE ? "File" : "Directory",
+               nodeLocation(child, location, sizeof(location)) >= 0 ? location : "N/A",
+               child->permissions);
     }
 }
 
-// Cleanup function to free allocated memory
+// Give a node and everything below it back to the tree's arena
 void freeNode(Node *node)
 {
+    Arena *arena = nodeArena(node);
     if (node->children)
     {
-        for (int i = 0; i < TABLE_SIZE; i++)
+        for (unsigned int i = 0; i < node->children->capacity; i++)
         {
-            Node *child = node->children->table[i];
-            while (child)
-            {
-                Node *next = child->next;
+            Node *child = nodeTableSlot(node->children, i);
+            if (child)
                 freeNode(child);
-                child = next;
-            }
         }
-        free(node->children);
+        freeNodeTable(node->children);
     }
-    free(node->name);
-    if (node->dataLocation)
-        free(node->dataLocation);
-    free(node);
+    arenaUnintern(arena, node->name);
+    arenaFree(arena, node, sizeof(Node) + (node->has_location ? strlen(node->location) + 1 : 0));
+}
+
+// Drop a whole tree at once, without visiting its nodes
+void freeTree(Node *root)
+{
+    if (root)
+        arenaRelease(nodeArena(root));
 }
 
 // Traverse the file system starting from `path` and add all files/directories to `parentDir`
@@ -322,13 +493,10 @@ void traverseAndAdd(Node *parentDir, const char *path)
         if (st.st_mode & S_IXUSR)
             perms |= EXECUTE;
 
-        Node *newNode = createNode(entry->d_name, type, perms, fullPath);
-        newNode->parent = parentDir;
-
         // printf("Inserting: %s (type: %s)\n", entry->d_name, (type == DIRECTORY_NODE) ? "Directory" : "File");
         // printf("Full path: %s\n", fullPath); // Debug print to check the full path
 
-        insertNode(parentDir->children, newNode);
+        Node *newNode = createChildNode(parentDir, entry->d_name, type, perms, fullPath);
 
         if (type == DIRECTORY_NODE)
         {
@@ -19,7 +19,13 @@
 #include <pthread.h>
 // #include"lru_cache.h"
 #include <ctype.h>
+#include "../common/wire.h"
+#include "../common/arena.h"
+#include "log.h"
+#include "failure_detector.h"
+#include "ring.h"
 #define TABLE_SIZE 10
+#define NODE_TABLE_INITIAL_CAPACITY 8
 #define MAX_COMMAND_LENGTH 10
 #define MAX_PATH_LENGTH 1024
 #define MAX_CONTENT_LENGTH 4096
@@ -28,17 +34,11 @@
 #define STORAGE_PORT 8080
 #define NAMING_PORT 8081
 #define MAX_BUFFER_SIZE 100001
+#define LIST_BATCH_ENTRIES 256 // paths per streamed LIST frame
 #define PATH_SEPARATOR "/"
 #define LOG_FILE "naming_server.log"
 
-extern pthread_mutex_t log_mutex;
-extern void log_message(const char *ip, int port, const char *role, const char *message);
-extern void get_ip_and_port(struct sockaddr_in *sa, char *ip_buffer, int *port);
-extern const char *log_file_path;
 
-#define ACK_RECEIVE_PORT 9091 // Dedicated port for receiving ACKs
-
-#define ACK_PORT 8090 // Port for sending acknowledgment to naming server
 
 typedef enum
 {
@@ -66,18 +66,39 @@ typedef enum
     DIRECTORY_NODE
 } NodeType;
 
+// A node's location on its storage server is normally its parent's location
+// + "/" + name and is not stored; nodeLocation() rebuilds it through the
+// parent links. Only a location that cannot be derived (a root's, or a copy
+// that still points at its source) is kept, in location[] right after the
+// node. The tree's arena is reached through the child tables, see
+// nodeArena().
 typedef struct Node
 {
-    char *name;      
-    NodeType type;
-    Permissions permissions;
-    char *dataLocation;
+    const char *name;           // interned in the tree's arena
     struct Node *parent;
-    struct Node *next;
-    struct NodeTable *children; 
-    int lock_type; // 0= none, 1 = read, 2 = write
+    struct NodeTable *children; // directories only
+    unsigned int hash;          // hash(name), cached for child table probing
+    unsigned int type : 1;         // NodeType
+    unsigned int permissions : 4;  // Permissions
+    unsigned int lock_type : 2;    // 0= none, 1 = read, 2 = write
+    unsigned int has_location : 1; // location[] is set; empty means none
+    char location[];
 } Node;
 
+#define PENDING_BUCKETS 64 // outstanding control requests, hashed by request id
+
+// A control request waiting for its reply. Lives on the caller's stack.
+typedef struct PendingRequest
+{
+    uint32_t request_id;
+    bool done;
+    bool aborted; // the connection closed first
+    WireHeader reply;
+    char *reply_payload;
+    pthread_cond_t cond;
+    struct PendingRequest *next;
+} PendingRequest;
+
 typedef struct StorageServer
 {
     char ip[16];
@@ -87,7 +108,35 @@ typedef struct StorageServer
     Node *root;
     int socket;
     bool active;
+    pthread_t handler; // storageServerHandler on `socket`, while has_handler
+    bool has_handler;
+    char peer_ip[INET_ADDRSTRLEN]; // source address of the control connection
+    ServerHealth health;
+    FailureDetector detector;
     pthread_mutex_t lock;
+    // Control requests are pipelined: any number may be in flight, each
+    // tagged with its own id. storageServerHandler, the only reader of
+    // `socket`, hands every reply to the caller waiting in `pending`.
+    pthread_mutex_t send_lock; // one frame at a time on `socket`
+    pthread_mutex_t pending_lock;
+    uint32_t next_request_id;
+    PendingRequest *pending[PENDING_BUCKETS];
+    uint64_t delta_seq; // last OP_DELTA event applied, 0 before the first
+    // Load from the latest heartbeat, plus the reads handed out since so a
+    // burst of lookups spreads out. Read without a lock.
+    uint32_t load_inflight;
+    uint32_t load_latency_us;
+    uint32_t load_assigned;
+    uint64_t replica_lag[REPLICA_SLOTS]; // of ss_backup_1 and ss_backup_2, see wire.h
+    // Capacity from the latest heartbeat; total_bytes is 0 before the first
+    uint64_t free_bytes;
+    uint64_t total_bytes;
+    uint32_t file_count;
+    // Control requests sent and client requests routed to the server, and
+    // their rate as last sampled (see stats.c)
+    uint64_t requests;
+    uint64_t requests_sampled;
+    double request_rate;
     struct StorageServer *next; // For collision handling in storage server hash table
     struct StorageServer *ss_backup_1;
     struct StorageServer *ss_backup_2;
@@ -99,6 +148,14 @@ typedef struct StorageServerTable
     StorageServer *table[TABLE_SIZE];
     pthread_mutex_t locks[TABLE_SIZE]; // Bucket-level locks for better concurrency
     int count;                         // Number of storage servers
+    // The same servers by id (ids are handed out 1, 2, 3, ...)
+    StorageServer **by_id;
+    int by_id_capacity;
+    // Lock order: a server's lock, then the namespace lock (lockNamespace),
+    // then by_id_lock, then the bucket locks. Registration holds the
+    // namespace lock while it adds and removes servers here.
+    pthread_rwlock_t by_id_lock;
+    HashRing ring; // every registered id; picks backups, see backup_data
 } StorageServerTable;
 
 typedef struct AcceptorArgs
@@ -108,39 +165,32 @@ typedef struct AcceptorArgs
     StorageServerTable *server_table;
 } AcceptorArgs;
 
+// Per-directory child table: open addressing with linear probing. The
+// capacity is a power of two and doubles once the table is 75% full, so
+// lookups stay O(1) however large a directory grows.
 typedef struct NodeTable
 {
-    Node *table[TABLE_SIZE];
+    Node **slots;
+    Arena *arena;
+    unsigned int capacity;
+    unsigned int count; // live children
+    unsigned int used;  // live children plus tombstones
 } NodeTable;
 
-typedef struct StorageServerList
-{
-    StorageServer *server;
-    struct StorageServerList *next;
-} StorageServerList;
-
-typedef struct AsyncWriteState
-{
-    char fileName[256];
-    int clientId;
-    char clientIP[INET_ADDRSTRLEN];
-    int clientPort;
-    char status[10];  // "STARTED" or "COMPLETED"
-    time_t timestamp; // To track when the message was received
-    struct AsyncWriteState *next;
-} AsyncWriteState;
-
-extern AsyncWriteState *writeStateQueue; // Head of the queue
-extern pthread_mutex_t queueMutex;
-
-void updateWriteStateQueue(const char *status, const char *fileName, int clientId, const char *clientIP, int clientPort);
-void *monitorWriteStates(void *arg);
+void *healthMonitor(void *arg);
 unsigned int hash(const char *str);
-NodeTable *createNodeTable();
-Node *createNode(const char *name, NodeType type, Permissions perms, const char *dataLocation);
+NodeTable *createNodeTable(Arena *arena);
+Node *createNode(Arena *arena, const char *name, NodeType type, Permissions perms, const char *location);
+Node *createChildNode(Node *parentDir, const char *name, NodeType type, Permissions perms, const char *location);
+Arena *nodeArena(const Node *node);
+int nodeLocation(const Node *node, char *buffer, size_t size);
 void insertNode(NodeTable *table, Node *node);
 Node *searchNode(NodeTable *table, const char *name);
-void addFile(Node *parentDir, const char *fileName, Permissions perms, const char *dataLocation);
+int removeNode(NodeTable *table, Node *node);
+Node *nodeTableSlot(NodeTable *table, unsigned int i);
+void freeNodeTable(NodeTable *table);
+void reserveNodeTable(NodeTable *table, unsigned int count);
+void addFile(Node *parentDir, const char *fileName, Permissions perms, const char *location);
 void addDirectory(Node *parentDir, const char *dirName, Permissions perms);
 Node *searchPath(Node *root, const char *path);
 void printFileSystemTree(Node *node, int depth);
@@ -149,12 +199,14 @@ int hasPermission(Node *node, Permissions perm);
 void listDirectory(Node *dir);
 
 void freeNode(Node *node);
+void freeTree(Node *root);
 void traverseAndAdd(Node *parentDir, const char *path);
 CommandType parseCommand(const char *cmd);
 void printUsage();
 void getParentPath(const char *path, char *parent);
 void processCommand(Node *root);
-Node *receiveNodeChain(int sock);
+Node *decodeTreeImage(const char *image, size_t length, uint32_t node_count);
+Node *receiveTreeImage(int sock, const char *ss_ip, int ss_port);
 Node *createEmptyNode(Node *parentDir, const char *name, NodeType type);
 int deleteNode(Node *node);
 int copyNode(Node *sourceNode, Node *destDir, const char *newName);
@@ -162,15 +214,23 @@ ssize_t readFile(Node *fileNode, char *buffer, size_t size);
 ssize_t writeFile(Node *fileNode, const char *buffer, size_t size);
 int getFileMetadata(Node *fileNode, struct stat *metadata);
 ssize_t streamAudioFile(Node *fileNode, char *buffer, size_t size, off_t offset);
-int receiveServerInfo(int sock, char *ip_out, int *nm_port_out, int *client_port_out, Node **root_out);
-StorageServerList *findStorageServersByPath_List(StorageServerTable *table, const char *path);
+int receiveServerInfo(StorageServerTable *table, StorageServer *server, StorageServer **restored_out);
 Node *findNode(Node *root, const char *path);
-void recursiveList(Node *node, const char *current_path, char *response, int *response_offset, size_t response_size);
 void copyDirectoryContents(Node *sourceDir, Node *destDir);
-void *ackListener(void *arg);
+void handleWriteAcks(StorageServer *server, const char *payload, size_t length);
 void forwardAckToClient(const char *clientIP, int clientPort, const char *ack_message);
 // void logEvent(const char *level, const char *ip, int port, const char *message);
 
+StorageServer *createStorageServer(int socket);
+void addStorageServer(StorageServerTable *table, StorageServer *server);
+StorageServer *findStorageServerById(StorageServerTable *table, int id);
+StorageServer *findStorageServerByPath(const char *path);
+bool isRoutable(StorageServer *server);
+int storageServerRequest(StorageServer *server, uint8_t opcode, const WireBuffer *payload, WireHeader *reply, char **reply_payload);
 void backup_data(StorageServerTable *server_table);
-int take_backup(StorageServerTable *server_table, StorageServer *server, StorageServer *destination);
+void requestBackups(void);
+void retireStorageServer(StorageServer *server);
+int startBackupWorker(StorageServerTable *server_table);
+int take_backup(StorageServerTable *server_table, StorageServer *server, StorageServer *destination, int slot);
+void forgetBackups(StorageServerTable *server_table, StorageServer *server);
 #endif
@@ -0,0 +1,376 @@
+#include "lease.h"
+#include "path_index.h"
+#include "notify.h"
+
+typedef struct LeaseHolder
+{
+    char ip[INET_ADDRSTRLEN];
+    uint16_t port;
+    uint64_t expires_ms;
+} LeaseHolder;
+
+// One per leased path, and one per directory above a leased path so that a
+// revocation finds everything below it without scanning the table
+typedef struct Lease
+{
+    char *key;     // normalized path
+    int server_id; // -1 while nobody holds it
+    LeaseHolder *holders;
+    int count;
+    int capacity;
+    struct Lease *parent;
+    struct Lease *children;
+    struct Lease *sibling_prev, *sibling_next;
+    struct Lease *server_prev, *server_next; // same server bucket, while held
+    struct Lease *next;                      // same bucket
+} Lease;
+
+typedef struct LeaseNotice
+{
+    char ip[INET_ADDRSTRLEN];
+    uint16_t port;
+    char key[MAX_PATH_LENGTH];
+} LeaseNotice;
+
+static Lease *buckets[LEASE_BUCKETS];
+static Lease *by_server[LEASE_SERVER_BUCKETS];
+static Lease *root; // "/", there whenever anything is leased
+static int lease_count;
+static uint64_t lease_version = 1;
+static pthread_mutex_t lease_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t nowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static Lease *findLease(const char *key)
+{
+    Lease *lease = buckets[hash(key) % LEASE_BUCKETS];
+    while (lease && strcmp(lease->key, key) != 0)
+        lease = lease->next;
+    return lease;
+}
+
+// Move lease to server_id's chain, or off every chain for -1. A lease is on
+// a chain exactly while it has holders.
+static void setLeaseServer(Lease *lease, int server_id)
+{
+    if (lease->server_id == server_id)
+        return;
+    if (lease->server_id >= 0)
+    {
+        if (lease->server_prev)
+            lease->server_prev->server_next = lease->server_next;
+        else
+            by_server[lease->server_id % LEASE_SERVER_BUCKETS] = lease->server_next;
+        if (lease->server_next)
+            lease->server_next->server_prev = lease->server_prev;
+        lease->server_prev = lease->server_next = NULL;
+    }
+    lease->server_id = server_id;
+    if (server_id >= 0)
+    {
+        Lease **head = &by_server[server_id % LEASE_SERVER_BUCKETS];
+        lease->server_next = *head;
+        if (*head)
+            (*head)->server_prev = lease;
+        *head = lease;
+    }
+}
+
+// Unlink lease from its bucket, its server chain and its parent, and free
+// it. Its children must be gone already.
+static void freeLease(Lease *lease)
+{
+    Lease **link = &buckets[hash(lease->key) % LEASE_BUCKETS];
+    while (*link != lease)
+        link = &(*link)->next;
+    *link = lease->next;
+    setLeaseServer(lease, -1);
+    if (lease->sibling_prev)
+        lease->sibling_prev->sibling_next = lease->sibling_next;
+    else if (lease->parent)
+        lease->parent->children = lease->sibling_next;
+    if (lease->sibling_next)
+        lease->sibling_next->sibling_prev = lease->sibling_prev;
+    if (lease == root)
+        root = NULL;
+    free(lease->key);
+    free(lease->holders);
+    free(lease);
+    lease_count--;
+}
+
+// Free lease and then its parents for as long as nobody holds them and
+// nothing below them is leased
+static void releaseLease(Lease *lease)
+{
+    while (lease && lease->count == 0 && !lease->children)
+    {
+        Lease *parent = lease->parent;
+        freeLease(lease);
+        lease = parent;
+    }
+}
+
+// The entry for key, made along with its parents if need be. Returns NULL
+// when the table is full.
+static Lease *leaseFor(const char *key, int len)
+{
+    Lease *lease = findLease(key);
+    if (lease)
+        return lease;
+    if (lease_count >= LEASE_MAX_PATHS)
+        return NULL;
+
+    Lease *parent = NULL;
+    if (len > 1)
+    {
+        char parent_key[MAX_PATH_LENGTH];
+        int parent_len = len - 1;
+        while (parent_len > 0 && key[parent_len] != '/')
+            parent_len--;
+        if (parent_len == 0)
+            parent_len = 1; // the root keeps its slash
+        memcpy(parent_key, key, parent_len);
+        parent_key[parent_len] = '\0';
+        parent = leaseFor(parent_key, parent_len);
+        if (!parent || lease_count >= LEASE_MAX_PATHS)
+        {
+            releaseLease(parent);
+            return NULL;
+        }
+    }
+
+    lease = calloc(1, sizeof(Lease));
+    if (lease)
+        lease->key = strdup(key);
+    if (!lease || !lease->key)
+    {
+        free(lease);
+        releaseLease(parent);
+        return NULL;
+    }
+    lease->server_id = -1;
+    lease->parent = parent;
+    if (parent)
+    {
+        lease->sibling_next = parent->children;
+        if (parent->children)
+            parent->children->sibling_prev = lease;
+        parent->children = lease;
+    }
+    else
+    {
+        root = lease;
+    }
+    unsigned int bucket = hash(key) % LEASE_BUCKETS;
+    lease->next = buckets[bucket];
+    buckets[bucket] = lease;
+    lease_count++;
+    return lease;
+}
+
+// Drop the holders of lease whose lease ran out
+static void pruneHolders(Lease *lease, uint64_t now)
+{
+    int kept = 0;
+    for (int i = 0; i < lease->count; i++)
+    {
+        if (lease->holders[i].expires_ms > now)
+            lease->holders[kept++] = lease->holders[i];
+    }
+    lease->count = kept;
+    if (kept == 0)
+        setLeaseServer(lease, -1);
+}
+
+// Prune every lease below and including lease, freeing the ones left empty
+static void sweepLeases(Lease *lease, uint64_t now)
+{
+    Lease *child = lease->children;
+    while (child)
+    {
+        Lease *next = child->sibling_next;
+        sweepLeases(child, now);
+        child = next;
+    }
+    pruneHolders(lease, now);
+    if (lease->count == 0 && !lease->children)
+        freeLease(lease);
+}
+
+// Namespace version to pass to grantLease, read before resolving the path
+uint64_t leaseVersion(void)
+{
+    pthread_mutex_lock(&lease_lock);
+    uint64_t version = lease_version;
+    pthread_mutex_unlock(&lease_lock);
+    return version;
+}
+
+// Record that ip:port may cache path, resolved to server_id at version.
+// Returns the lease length in ms, or 0 when no lease is given: also when
+// anything was revoked since version, as the answer may predate it.
+uint32_t grantLease(const char *path, int server_id, const char *ip, uint16_t port, uint64_t version)
+{
+    char key[MAX_PATH_LENGTH];
+    int len;
+    if (port == 0 || (len = normalizePath(path, key, sizeof(key))) < 0)
+        return 0;
+    uint64_t now = nowMs();
+
+    pthread_mutex_lock(&lease_lock);
+    if (lease_version != version)
+    {
+        pthread_mutex_unlock(&lease_lock);
+        return 0;
+    }
+    if (lease_count >= LEASE_MAX_PATHS && root)
+        sweepLeases(root, now);
+    Lease *lease = leaseFor(key, len);
+    if (!lease)
+    {
+        pthread_mutex_unlock(&lease_lock);
+        return 0;
+    }
+
+    LeaseHolder *holder = NULL;
+    for (int i = 0; i < lease->count && !holder; i++)
+    {
+        if (lease->holders[i].port == port && strcmp(lease->holders[i].ip, ip) == 0)
+            holder = &lease->holders[i];
+    }
+    for (int i = 0; i < lease->count && !holder; i++)
+    {
+        if (lease->holders[i].expires_ms <= now)
+            holder = &lease->holders[i];
+    }
+    if (!holder && lease->count == lease->capacity && lease->capacity < LEASE_MAX_HOLDERS)
+    {
+        int capacity = lease->capacity ? lease->capacity * 2 : 2;
+        if (capacity > LEASE_MAX_HOLDERS)
+            capacity = LEASE_MAX_HOLDERS;
+        LeaseHolder *grown = realloc(lease->holders, capacity * sizeof(LeaseHolder));
+        if (grown)
+        {
+            lease->holders = grown;
+            lease->capacity = capacity;
+        }
+    }
+    if (!holder && lease->count < lease->capacity)
+        holder = &lease->holders[lease->count++];
+    uint32_t ttl = 0;
+    if (holder)
+    {
+        snprintf(holder->ip, sizeof(holder->ip), "%s", ip);
+        holder->port = port;
+        holder->expires_ms = now + LEASE_TTL_MS;
+        // Holders of a different answer were told when its server was revoked
+        setLeaseServer(lease, server_id);
+        ttl = LEASE_TTL_MS;
+    }
+    else
+    {
+        releaseLease(lease);
+    }
+    pthread_mutex_unlock(&lease_lock);
+    return ttl;
+}
+
+// Add a notice for each live holder of lease, and drop them all. Called
+// with lease_lock held.
+static void collectHolders(Lease *lease, uint64_t now, LeaseNotice **notices, int *count, int *capacity)
+{
+    for (int h = 0; h < lease->count; h++)
+    {
+        if (lease->holders[h].expires_ms <= now)
+            continue;
+        if (*count == *capacity)
+        {
+            *capacity = *capacity ? *capacity * 2 : 16;
+            *notices = realloc(*notices, *capacity * sizeof(LeaseNotice));
+        }
+        LeaseNotice *notice = &(*notices)[(*count)++];
+        memcpy(notice->ip, lease->holders[h].ip, sizeof(notice->ip));
+        notice->port = lease->holders[h].port;
+        snprintf(notice->key, sizeof(notice->key), "%s", lease->key);
+    }
+    lease->count = 0;
+    setLeaseServer(lease, -1);
+}
+
+// Collect the holders of lease and everything below it, and free them all
+static void collectSubtree(Lease *lease, uint64_t now, LeaseNotice **notices, int *count, int *capacity)
+{
+    while (lease->children)
+        collectSubtree(lease->children, now, notices, count, capacity);
+    collectHolders(lease, now, notices, count, capacity);
+    freeLease(lease);
+}
+
+// Tell each holder that its answer for notice->key, and anything below it,
+// is no longer good as of version
+static void sendNotices(LeaseNotice *notices, int count, uint64_t version)
+{
+    for (int i = 0; i < count; i++)
+    {
+        WireBuffer out;
+        wireBufferInit(&out);
+        wirePutU64(&out, version);
+        wirePutString(&out, notices[i].key);
+        if (notifyClient(notices[i].ip, notices[i].port, OP_INVALIDATE, out.data, out.length) < 0)
+            log_event(LOG_DEBUG, notices[i].ip, notices[i].port, "Client", "Lease holder unreachable");
+        wireBufferFree(&out);
+    }
+    free(notices);
+}
+
+// path and everything below it was deleted or replaced
+void revokeLeases(const char *path)
+{
+    char key[MAX_PATH_LENGTH];
+    if (normalizePath(path, key, sizeof(key)) < 0)
+        return;
+    LeaseNotice *notices = NULL;
+    int count = 0, capacity = 0;
+    pthread_mutex_lock(&lease_lock);
+    uint64_t version = ++lease_version;
+    Lease *lease = findLease(key);
+    if (lease)
+    {
+        Lease *parent = lease->parent;
+        collectSubtree(lease, nowMs(), &notices, &count, &capacity);
+        releaseLease(parent);
+    }
+    pthread_mutex_unlock(&lease_lock);
+    sendNotices(notices, count, version);
+}
+
+// The storage server stopped taking clients or moved: every answer naming
+// it is void
+void revokeServerLeases(int server_id)
+{
+    LeaseNotice *notices = NULL;
+    int count = 0, capacity = 0;
+    uint64_t now = nowMs();
+    pthread_mutex_lock(&lease_lock);
+    uint64_t version = ++lease_version;
+    Lease *lease = by_server[server_id % LEASE_SERVER_BUCKETS];
+    while (lease)
+    {
+        // Releasing only frees leases nobody holds, which are on no chain
+        Lease *next = lease->server_next;
+        if (lease->server_id == server_id)
+        {
+            collectHolders(lease, now, &notices, &count, &capacity);
+            releaseLease(lease);
+        }
+        lease = next;
+    }
+    pthread_mutex_unlock(&lease_lock);
+    sendNotices(notices, count, version);
+}
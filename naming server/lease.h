@@ -0,0 +1,32 @@
+#ifndef LEASE_H
+#define LEASE_H
+
+#include "header.h"
+
+// Leases on path resolutions. A client that tells LOOKUP (or RESOLVE) where
+// its notice socket listens may keep the answer for LEASE_TTL_MS and skip
+// the naming server meanwhile. The naming server remembers who holds a
+// lease on which path, and sends them OP_INVALIDATE when the path is
+// deleted or overwritten, or when its server stops taking clients.
+//
+// Each invalidation bumps the namespace version; answers carry the version
+// they were given at, and a client drops a cached path when it is told of a
+// newer version covering it. A client that cannot be reached is forgotten:
+// it keeps its stale answer until the lease runs out, and the storage
+// server turns the request away.
+//
+// Leases are kept as a tree of paths, and held ones are also chained by
+// server, so a revocation only visits the leases it revokes.
+
+#define LEASE_TTL_MS 10000
+#define LEASE_BUCKETS 4096
+#define LEASE_SERVER_BUCKETS 64
+#define LEASE_MAX_PATHS 65536 // leased paths, and directories above them, tracked at once; no new leases past this
+#define LEASE_MAX_HOLDERS 64  // clients per path
+
+uint64_t leaseVersion(void);
+uint32_t grantLease(const char *path, int server_id, const char *ip, uint16_t port, uint64_t version);
+void revokeLeases(const char *path);
+void revokeServerLeases(int server_id);
+
+#endif // LEASE_H
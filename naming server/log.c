@@ -1,22 +1,70 @@
 #include "header.h"
+#include <sched.h>
+#include <sys/uio.h>
 
-// Function to get the current timestamp
+static LogSlot log_ring[LOG_RING_SLOTS];
+static atomic_size_t log_enqueue_pos;
+static size_t log_dequeue_pos; // flusher only
+static atomic_ulong log_dropped;
+static atomic_int log_min_level = LOG_INFO;
+static atomic_int log_flusher_sleeping;
+static atomic_int log_running;
+static int log_fd = -1;
+static pthread_t log_thread;
+static pthread_mutex_t log_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wake = PTHREAD_COND_INITIALIZER;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+// Function to get the current timestamp. The formatted second is cached per
+// thread, so localtime_r() runs at most once a second on each thread.
 void get_timestamp(char *timestamp, size_t size) {
+    static __thread time_t cached_second = -1;
+    static __thread char cached[20];
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(timestamp, size, "%Y-%m-%d %H:%M:%S", tm_info);
+    if (now != cached_second) {
+        struct tm tm_info;
+        localtime_r(&now, &tm_info);
+        strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", &tm_info);
+        cached_second = now;
+    }
+    snprintf(timestamp, size, "%s", cached);
 }
 
-// Function to log the message
-void log_message(const char *ip, int port, const char *role, const char *message) {
-    // Lock the mutex before writing to the log
-    pthread_mutex_lock(&log_mutex);
+// Claim the next free slot, or NULL when the ring is full
+static LogSlot *claimSlot(size_t *position) {
+    size_t pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        LogSlot *slot = &log_ring[pos & (LOG_RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&log_enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *position = pos;
+                return slot;
+            }
+        } else if (seq < pos) {
+            return NULL; // the flusher has not released this slot yet
+        } else {
+            pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
 
-    // Open the log file for appending
-    FILE *log_file = fopen(log_file_path, "a");
-    if (log_file == NULL) {
-        perror("Failed to open log file");
-        pthread_mutex_unlock(&log_mutex);  // Unlock mutex before returning
+// Log a line at the given level without blocking on the log file
+void log_event(LogLevel level, const char *ip, int port, const char *role, const char *message) {
+    if ((int)level < atomic_load_explicit(&log_min_level, memory_order_relaxed))
+        return;
+
+    size_t position;
+    LogSlot *slot = claimSlot(&position);
+    // Warnings and errors are worth a short wait for the flusher
+    for (int i = 0; !slot && level >= LOG_WARN && i < LOG_ERROR_RETRIES; i++) {
+        sched_yield();
+        slot = claimSlot(&position);
+    }
+    if (!slot) {
+        atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
         return;
     }
 
@@ -24,19 +72,149 @@ void log_message(const char *ip, int port, const char *role, const char *message
     char timestamp[20];
     get_timestamp(timestamp, sizeof(timestamp));
 
+    // Non-INFO lines carry their level; INFO keeps the historical format
+    char tag[8] = "";
+    if (level != LOG_INFO)
+        snprintf(tag, sizeof(tag), "%s ", level_names[level]);
+
+    int length;
     // If IP and Port are 0, log only timestamp and message
-    if (ip == NULL || port == 0) {
-        fprintf(log_file, "[%s] %s\n", timestamp, message);
-    } else {
-        // Format log entry: timestamp, IP, port, role, message
-        fprintf(log_file, "[%s] %s:%d %s %s\n", timestamp, ip, port, role, message);
+    if (ip == NULL || port == 0)
+        length = snprintf(slot->line, LOG_SLOT_SIZE, "[%s] %s%s\n", timestamp, tag, message);
+    else
+        length = snprintf(slot->line, LOG_SLOT_SIZE, "[%s] %s%s:%d %s %s\n", timestamp, tag, ip, port, role, message);
+    if (length < 0)
+        length = 0;
+    if (length >= LOG_SLOT_SIZE) {
+        length = LOG_SLOT_SIZE - 1;
+        slot->line[length - 1] = '\n';
     }
+    slot->length = length;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+
+    if (atomic_load_explicit(&log_flusher_sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&log_wake_lock);
+        pthread_cond_signal(&log_wake);
+        pthread_mutex_unlock(&log_wake_lock);
+    }
+}
+
+// Function to log the message
+void log_message(const char *ip, int port, const char *role, const char *message) {
+    log_event(LOG_INFO, ip, port, role, message);
+}
+
+// Write out every filled slot at the head of the ring. Returns the number of
+// lines written.
+static int flushLogRing(void) {
+    int total = 0;
+    for (;;) {
+        struct iovec iov[LOG_FLUSH_BATCH];
+        int count = 0;
+        while (count < LOG_FLUSH_BATCH) {
+            LogSlot *slot = &log_ring[(log_dequeue_pos + count) & (LOG_RING_SLOTS - 1)];
+            if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != log_dequeue_pos + count + 1)
+                break;
+            iov[count].iov_base = slot->line;
+            iov[count].iov_len = slot->length;
+            count++;
+        }
+        if (count == 0)
+            break;
 
-    // Close the log file
-    fclose(log_file);
+        if (log_fd >= 0 && writev(log_fd, iov, count) < 0)
+            perror("Failed to write log file");
 
-    // Unlock the mutex
-    pthread_mutex_unlock(&log_mutex);
+        // Hand the slots back to producers
+        for (int i = 0; i < count; i++) {
+            LogSlot *slot = &log_ring[(log_dequeue_pos + i) & (LOG_RING_SLOTS - 1)];
+            atomic_store_explicit(&slot->sequence, log_dequeue_pos + i + LOG_RING_SLOTS, memory_order_release);
+        }
+        log_dequeue_pos += count;
+        total += count;
+    }
+
+    unsigned long dropped = atomic_exchange_explicit(&log_dropped, 0, memory_order_relaxed);
+    if (dropped && log_fd >= 0) {
+        char timestamp[20], line[96];
+        get_timestamp(timestamp, sizeof(timestamp));
+        int length = snprintf(line, sizeof(line), "[%s] WARN Logger dropped %lu messages\n", timestamp, dropped);
+        if (write(log_fd, line, length) < 0)
+            perror("Failed to write log file");
+    }
+    return total;
+}
+
+static void *logFlusher(void *arg) {
+    (void)arg;
+    while (atomic_load(&log_running)) {
+        if (flushLogRing() > 0)
+            continue;
+
+        // Idle: sleep until a producer signals. The timeout covers a line
+        // published between the check above and the wait.
+        pthread_mutex_lock(&log_wake_lock);
+        atomic_store(&log_flusher_sleeping, 1);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 100 * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (atomic_load(&log_running))
+            pthread_cond_timedwait(&log_wake, &log_wake_lock, &deadline);
+        atomic_store(&log_flusher_sleeping, 0);
+        pthread_mutex_unlock(&log_wake_lock);
+    }
+    flushLogRing();
+    return NULL;
+}
+
+// Open the log file once and start the flusher thread
+int startLogger(const char *path, LogLevel min_level) {
+    atomic_store(&log_enqueue_pos, 0);
+    log_dequeue_pos = 0;
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++)
+        atomic_init(&log_ring[i].sequence, i);
+    atomic_store(&log_min_level, min_level);
+
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log_fd < 0) {
+        perror("Failed to open log file");
+        return -1;
+    }
+    atomic_store(&log_running, 1);
+    if (pthread_create(&log_thread, NULL, logFlusher, NULL) != 0) {
+        perror("Failed to create logger thread");
+        atomic_store(&log_running, 0);
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Drain whatever is still queued and stop the flusher
+void stopLogger(void) {
+    if (!atomic_exchange(&log_running, 0))
+        return;
+    pthread_mutex_lock(&log_wake_lock);
+    pthread_cond_signal(&log_wake);
+    pthread_mutex_unlock(&log_wake_lock);
+    pthread_join(log_thread, NULL);
+    close(log_fd);
+    log_fd = -1;
+}
+
+int parseLogLevel(const char *name, LogLevel *level) {
+    for (int i = LOG_DEBUG; i <= LOG_ERROR; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            *level = (LogLevel)i;
+            return 0;
+        }
+    }
+    return -1;
 }
 
 // Function to get the IP and port from a socket address (sockaddr_in)
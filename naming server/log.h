@@ -0,0 +1,42 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+#include <netinet/in.h>
+
+// Asynchronous logger. Callers format their line straight into a slot of a
+// bounded multi-producer ring and return; a single flusher thread drains the
+// ring with writev() into the log file, which stays open. Request handlers
+// never wait on file I/O. When the ring is full, DEBUG and INFO lines are
+// dropped (and counted) while WARN and ERROR lines wait briefly for room.
+
+#define LOG_RING_SLOTS 4096 // power of two
+#define LOG_SLOT_SIZE 512   // longer lines are truncated
+#define LOG_FLUSH_BATCH 64  // lines per writev()
+#define LOG_ERROR_RETRIES 1000
+
+typedef enum
+{
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+} LogLevel;
+
+typedef struct LogSlot
+{
+    atomic_size_t sequence; // == position when free, position + 1 once filled
+    unsigned int length;
+    char line[LOG_SLOT_SIZE];
+} LogSlot;
+
+extern const char *log_file_path;
+
+int startLogger(const char *path, LogLevel min_level);
+void stopLogger(void);
+int parseLogLevel(const char *name, LogLevel *level);
+void log_event(LogLevel level, const char *ip, int port, const char *role, const char *message);
+void log_message(const char *ip, int port, const char *role, const char *message);
+void get_ip_and_port(struct sockaddr_in *sa, char *ip_buffer, int *port);
+
+#endif
@@ -2,122 +2,198 @@
 #include <stdlib.h>
 #include <string.h>
 
-static unsigned int hashKey(const char *key) {
-    unsigned int hash = 0;
-    while (*key) {
-        hash = (hash * 31) + *key;
-        key++;
-    }
-    return hash % TABLE_SIZE;
+// Low bits of the hash pick the bucket, high bits pick the shard
+static CacheShard *shardFor(LRUCache *cache, unsigned int hash) {
+    return &cache->shards[(hash >> 28) & (LRU_CACHE_SHARDS - 1)];
 }
 
 LRUCache *createLRUCache(int capacity) {
-    printf("Creating cache\n");
+    if (capacity < LRU_CACHE_SHARDS) capacity = LRU_CACHE_SHARDS;
     LRUCache *cache = (LRUCache *)malloc(sizeof(LRUCache));
     cache->capacity = capacity;
-    cache->size = 0;
-    cache->head = NULL;
-    cache->tail = NULL;
-    cache->hashTable = (CacheNode **)calloc(TABLE_SIZE, sizeof(CacheNode *));
+
+    int per_shard = (capacity + LRU_CACHE_SHARDS - 1) / LRU_CACHE_SHARDS;
+    unsigned int buckets = 1;
+    while (buckets < (unsigned int)per_shard) buckets <<= 1;
+
+    for (int i = 0; i < LRU_CACHE_SHARDS; i++) {
+        CacheShard *shard = &cache->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->capacity = per_shard;
+        shard->size = 0;
+        shard->head = NULL;
+        shard->tail = NULL;
+        shard->buckets = (CacheNode **)calloc(buckets, sizeof(CacheNode *));
+        shard->bucket_mask = buckets - 1;
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->evictions = 0;
+    }
     return cache;
 }
 
 void freeLRUCache(LRUCache *cache) {
-    printf("Freeing cache\n");
-    CacheNode *current = cache->head;
-    while (current) {
-        CacheNode *next = current->next;
-        free(current->key);
-        free(current);
-        current = next;
+    for (int i = 0; i < LRU_CACHE_SHARDS; i++) {
+        CacheShard *shard = &cache->shards[i];
+        CacheNode *current = shard->head;
+        while (current) {
+            CacheNode *next = current->next;
+            free(current->key);
+            free(current);
+            current = next;
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
     }
-    free(cache->hashTable);
     free(cache);
 }
 
-static void moveToHead(LRUCache *cache, CacheNode *node) {
-    printf("Moving to head\n");
-    if (node == cache->head) return;
+static void unlinkList(CacheShard *shard, CacheNode *node) {
     if (node->prev) node->prev->next = node->next;
+    else shard->head = node->next;
     if (node->next) node->next->prev = node->prev;
-    if (node == cache->tail) cache->tail = node->prev;
-    node->next = cache->head;
+    else shard->tail = node->prev;
     node->prev = NULL;
-    if (cache->head) cache->head->prev = node;
-    cache->head = node;
-    if (!cache->tail) cache->tail = node;
+    node->next = NULL;
 }
 
-static void removeTail(LRUCache *cache) {
-    printf("Removing tail\n");
-    if (!cache->tail) return;
-    CacheNode *tail = cache->tail;
-    if (tail->prev) tail->prev->next = NULL;
-    cache->tail = tail->prev;
-    if (cache->tail == NULL) cache->head = NULL;
-    unsigned int index = hashKey(tail->key);
-    cache->hashTable[index] = NULL;
-    free(tail->key);
-    free(tail);
-    cache->size--;
+static void pushHead(CacheShard *shard, CacheNode *node) {
+    node->prev = NULL;
+    node->next = shard->head;
+    if (shard->head) shard->head->prev = node;
+    shard->head = node;
+    if (!shard->tail) shard->tail = node;
 }
 
-Node *getLRUCache(LRUCache *cache, const char *key) {
-    printf("Getting cache\n");
-    
-    unsigned int index = hashKey(key);
-    CacheNode *node = cache->hashTable[index];
-
-    int flag = 0;
-    
-    while (node) {
-        if (strcmp(node->key, key) == 0) {
-            if(flag)
-            {
-                moveToHead(cache, node);
-            }
-            printCache(cache);
-            return node->node;
+static void unlinkBucket(CacheShard *shard, CacheNode *node) {
+    CacheNode **link = &shard->buckets[node->hash & shard->bucket_mask];
+    while (*link && *link != node) link = &(*link)->hnext;
+    if (*link) *link = node->hnext;
+}
+
+static void removeEntry(CacheShard *shard, CacheNode *node) {
+    unlinkBucket(shard, node);
+    unlinkList(shard, node);
+    free(node->key);
+    free(node);
+    shard->size--;
+}
+
+static CacheNode *findEntry(CacheShard *shard, const char *key, unsigned int hash) {
+    CacheNode *node = shard->buckets[hash & shard->bucket_mask];
+    while (node && (node->hash != hash || strcmp(node->key, key) != 0)) node = node->hnext;
+    return node;
+}
+
+StorageServer *getLRUCache(LRUCache *cache, const char *key, NodeType *type_out) {
+    unsigned int h = hash(key);
+    CacheShard *shard = shardFor(cache, h);
+    StorageServer *server = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+    CacheNode *node = findEntry(shard, key, h);
+    if (node) {
+        if (node != shard->head) {
+            unlinkList(shard, node);
+            pushHead(shard, node);
         }
-        node = node->next;
-        flag ++;
+        server = node->server;
+        if (type_out) *type_out = node->type;
+        shard->hits++;
+    } else {
+        shard->misses++;
     }
-    printCache(cache);
-    return NULL;
+    pthread_mutex_unlock(&shard->lock);
+    return server;
 }
 
-void putLRUCache(LRUCache *cache, const char *key, Node *node) {
-    printf("Putting cache\n");
-    unsigned int index = hashKey(key);
-    CacheNode *existingNode = cache->hashTable[index];
-    while (existingNode) {
-        if (strcmp(existingNode->key, key) == 0) {
-            existingNode->node = node;
-            moveToHead(cache, existingNode);
-            return;
+void putLRUCache(LRUCache *cache, const char *key, StorageServer *server, NodeType type) {
+    unsigned int h = hash(key);
+    CacheShard *shard = shardFor(cache, h);
+
+    pthread_mutex_lock(&shard->lock);
+    CacheNode *existing = findEntry(shard, key, h);
+    if (existing) {
+        existing->server = server;
+        existing->type = type;
+        if (existing != shard->head) {
+            unlinkList(shard, existing);
+            pushHead(shard, existing);
         }
-        existingNode = existingNode->next;
+        pthread_mutex_unlock(&shard->lock);
+        return;
     }
+
     CacheNode *newNode = (CacheNode *)malloc(sizeof(CacheNode));
-    newNode->node = node;
     newNode->key = strdup(key);
-    newNode->prev = NULL;
-    newNode->next = cache->head;
-    if (cache->head) cache->head->prev = newNode;
-    cache->head = newNode;
-    if (!cache->tail) cache->tail = newNode;
-    cache->hashTable[index] = newNode;
-    cache->size++;
-    if (cache->size > cache->capacity) {
-        removeTail(cache);
+    newNode->hash = h;
+    newNode->server = server;
+    newNode->type = type;
+    unsigned int bucket = h & shard->bucket_mask;
+    newNode->hnext = shard->buckets[bucket];
+    shard->buckets[bucket] = newNode;
+    pushHead(shard, newNode);
+    shard->size++;
+
+    if (shard->size > shard->capacity) {
+        removeEntry(shard, shard->tail);
+        shard->evictions++;
     }
+    pthread_mutex_unlock(&shard->lock);
 }
 
-void printCache(LRUCache *cache) {
-    printf("Printing cache\n");
-    CacheNode *current = cache->head;
-    while (current) {
-        printf("Key: %s\n", current->key);
-        current = current->next;
+// Drop key and every cached path below it ("key/..."). Descendants can live
+// in any shard, so each shard is swept.
+void removeLRUCache(LRUCache *cache, const char *key) {
+    size_t len = strlen(key);
+    for (int i = 0; i < LRU_CACHE_SHARDS; i++) {
+        CacheShard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        CacheNode *current = shard->head;
+        while (current) {
+            CacheNode *next = current->next;
+            if (strncmp(current->key, key, len) == 0 &&
+                (current->key[len] == '\0' || current->key[len] == '/' || (len == 1 && key[0] == '/'))) {
+                removeEntry(shard, current);
+            }
+            current = next;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+// Forget everything resolved to server, e.g. before it is freed
+void invalidateLRUCacheServer(LRUCache *cache, StorageServer *server) {
+    for (int i = 0; i < LRU_CACHE_SHARDS; i++) {
+        CacheShard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        CacheNode *current = shard->head;
+        while (current) {
+            CacheNode *next = current->next;
+            if (current->server == server) removeEntry(shard, current);
+            current = next;
+        }
+        pthread_mutex_unlock(&shard->lock);
     }
-}
\ No newline at end of file
+}
+
+void getLRUCacheStats(LRUCache *cache, LRUCacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->capacity = cache->capacity;
+    for (int i = 0; i < LRU_CACHE_SHARDS; i++) {
+        CacheShard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->size += shard->size;
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void printCache(LRUCache *cache) {
+    LRUCacheStats stats;
+    getLRUCacheStats(cache, &stats);
+    printf("Cache: %d/%d entries, %lu hits, %lu misses, %lu evictions\n",
+           stats.size, stats.capacity, stats.hits, stats.misses, stats.evictions);
+}
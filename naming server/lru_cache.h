@@ -3,24 +3,55 @@
 
 #include "header.h"
 
+#define LRU_CACHE_SHARDS 16 // must be a power of two
+#define LRU_DEFAULT_CAPACITY 1024
+
 typedef struct CacheNode {
-    Node *node;
     char *key;
-    struct CacheNode *prev;
+    unsigned int hash;
+    StorageServer *server; // resolved owner of the path
+    NodeType type;         // copied: the Node may be freed once the namespace lock is dropped
+    struct CacheNode *prev;  // recency list
     struct CacheNode *next;
+    struct CacheNode *hnext; // bucket chain
 } CacheNode;
 
-typedef struct LRUCache {
+// Each shard is an independent LRU with its own lock, so lookups for
+// different paths rarely contend.
+typedef struct CacheShard {
+    pthread_mutex_t lock;
     int capacity;
     int size;
     CacheNode *head;
     CacheNode *tail;
-    CacheNode **hashTable;
+    CacheNode **buckets;
+    unsigned int bucket_mask;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} CacheShard;
+
+typedef struct LRUCache {
+    int capacity;
+    CacheShard shards[LRU_CACHE_SHARDS];
 } LRUCache;
 
+typedef struct LRUCacheStats {
+    int capacity;
+    int size;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} LRUCacheStats;
+
+extern LRUCache *cache;
+
 LRUCache *createLRUCache(int capacity);
 void freeLRUCache(LRUCache *cache);
-Node *getLRUCache(LRUCache *cache, const char *key);
-void putLRUCache(LRUCache *cache, const char *key, Node *node);
+StorageServer *getLRUCache(LRUCache *cache, const char *key, NodeType *type_out);
+void putLRUCache(LRUCache *cache, const char *key, StorageServer *server, NodeType type);
+void removeLRUCache(LRUCache *cache, const char *key);
+void invalidateLRUCacheServer(LRUCache *cache, StorageServer *server);
+void getLRUCacheStats(LRUCache *cache, LRUCacheStats *stats);
 void printCache(LRUCache *cache);
-#endif // LRU_CACHE_H
\ No newline at end of file
+#endif // LRU_CACHE_H
@@ -0,0 +1,605 @@
+#include "namespace_store.h"
+#include "lru_cache.h"
+#include "path_index.h"
+#include <sys/mman.h>
+
+#define NAMESPACE_JOURNAL_MAGIC "NFSJRN01"
+#define NAMESPACE_JOURNAL_OLD NAMESPACE_JOURNAL_FILE ".old"
+#define NAMESPACE_SNAPSHOT_TMP NAMESPACE_SNAPSHOT_FILE ".tmp"
+
+static StorageServerTable *store_table;
+
+// Mutations and snapshots hold this exclusively: client requests and
+// storage server deltas may change the same tree from different threads.
+// Registration holds it shared while comparing fingerprints.
+static pthread_rwlock_t namespace_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static int journal_fd = -1;
+static off_t journal_size;
+static uint64_t journal_generation;
+static bool replaying;
+
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_wanted = PTHREAD_COND_INITIALIZER;
+static bool snapshot_pending;
+static pthread_t snapshot_thread;
+
+void lockNamespace(bool exclusive)
+{
+    if (exclusive)
+        pthread_rwlock_wrlock(&namespace_lock);
+    else
+        pthread_rwlock_rdlock(&namespace_lock);
+}
+
+void unlockNamespace(void)
+{
+    pthread_rwlock_unlock(&namespace_lock);
+}
+
+static uint64_t fingerprintNode(Node *node, uint64_t path_state)
+{
+    uint64_t sum = namespaceEntryDigest(path_state, node->type == DIRECTORY_NODE);
+    if (node->type != DIRECTORY_NODE || !node->children)
+        return sum;
+    for (unsigned int i = 0; i < node->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(node->children, i);
+        if (!child)
+            continue;
+        uint64_t state = namespaceHashExtend(path_state, "/", 1);
+        state = namespaceHashExtend(state, child->name, strlen(child->name));
+        sum += fingerprintNode(child, state);
+    }
+    return sum;
+}
+
+// Order-independent digest of every path and type below root; storage
+// servers compute the same value over their own tree
+uint64_t treeFingerprint(Node *root)
+{
+    return root ? fingerprintNode(root, NAMESPACE_HASH_INIT) : 0;
+}
+
+// ---- Journal ----
+
+static uint32_t checksum32(const char *data, size_t length)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Records are `length(4) checksum(4) body`; a torn or corrupt tail is
+// detected by the checksum and cut off at the next startup
+static void journalAppend(const WireBuffer *body)
+{
+    if (replaying)
+        return;
+
+    WireBuffer record;
+    wireBufferInit(&record);
+    wirePutU32(&record, (uint32_t)body->length);
+    wirePutU32(&record, checksum32(body->data, body->length));
+    wirePutBytes(&record, body->data, body->length);
+
+    bool compact = false;
+    pthread_mutex_lock(&journal_lock);
+    if (journal_fd >= 0)
+    {
+        if (write(journal_fd, record.data, record.length) != (ssize_t)record.length)
+            log_event(LOG_ERROR, NULL, 0, "NM", "Failed to append to namespace journal");
+        else
+            journal_size += record.length;
+        compact = journal_size > NAMESPACE_JOURNAL_LIMIT;
+    }
+    pthread_mutex_unlock(&journal_lock);
+    wireBufferFree(&record);
+
+    if (compact)
+        requestNamespaceSnapshot();
+}
+
+static int openJournal(uint64_t generation)
+{
+    int fd = open(NAMESPACE_JOURNAL_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    WireBuffer header;
+    wireBufferInit(&header);
+    wirePutBytes(&header, NAMESPACE_JOURNAL_MAGIC, 8);
+    wirePutU64(&header, generation);
+    if (write(fd, header.data, header.length) != (ssize_t)header.length)
+    {
+        wireBufferFree(&header);
+        close(fd);
+        return -1;
+    }
+    journal_size = header.length;
+    wireBufferFree(&header);
+    return fd;
+}
+
+// Map a whole file read-only. Returns NULL (and *length 0) if it is missing
+// or empty.
+static const char *mapFile(const char *path, size_t *length)
+{
+    *length = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    const char *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+        else
+            *length = st.st_size;
+    }
+    close(fd);
+    return data;
+}
+
+static void applyJournalRecord(const char *body, size_t length)
+{
+    char path[MAX_PATH_LENGTH];
+    char dest_dir[MAX_PATH_LENGTH];
+    WireReader reader;
+    wireReaderInit(&reader, body, length);
+    uint8_t type = wireGetU8(&reader);
+    StorageServer *server = findStorageServerById(store_table, (int)wireGetU32(&reader));
+    wireGetString(&reader, path, sizeof(path));
+
+    if (type == JOURNAL_CREATE)
+    {
+        NodeType node_type = (NodeType)wireGetU8(&reader);
+        if (!reader.error && server)
+            namespaceCreate(server, path, node_type);
+    }
+    else if (type == JOURNAL_DELETE)
+    {
+        if (!reader.error && server)
+            namespaceDelete(server, path);
+    }
+    else if (type == JOURNAL_COPY)
+    {
+        StorageServer *dest = findStorageServerById(store_table, (int)wireGetU32(&reader));
+        wireGetString(&reader, dest_dir, sizeof(dest_dir));
+        if (!reader.error && server && dest)
+            namespaceCopy(server, path, dest, dest_dir);
+    }
+}
+
+// Replay a journal written for min_generation or later. Returns the length
+// of its valid prefix, or -1 if the file is missing or belongs to an older
+// snapshot.
+static off_t replayJournal(const char *file, uint64_t min_generation, int *records)
+{
+    size_t length;
+    const char *data = mapFile(file, &length);
+    *records = 0;
+    if (!data)
+        return -1;
+
+    WireReader reader;
+    wireReaderInit(&reader, data, length);
+    char magic[8];
+    memcpy(magic, data, length < 8 ? length : 8);
+    reader.offset = 8;
+    uint64_t generation = wireGetU64(&reader);
+    if (length < 16 || memcmp(magic, NAMESPACE_JOURNAL_MAGIC, 8) != 0 || generation < min_generation)
+    {
+        munmap((void *)data, length);
+        return -1;
+    }
+
+    off_t valid = reader.offset;
+    while (1)
+    {
+        uint32_t body_length = wireGetU32(&reader);
+        uint32_t checksum = wireGetU32(&reader);
+        if (reader.error || length - reader.offset < body_length)
+            break;
+        const char *body = data + reader.offset;
+        if (checksum32(body, body_length) != checksum)
+            break;
+        applyJournalRecord(body, body_length);
+        reader.offset += body_length;
+        valid = reader.offset;
+        (*records)++;
+    }
+    munmap((void *)data, length);
+    return valid;
+}
+
+// ---- Snapshot ----
+
+// Same record layout as the registration image a storage server sends
+static void encodeTreeNode(WireBuffer *image, Node *node, uint32_t *count)
+{
+    uint8_t flags = node->type == DIRECTORY_NODE ? TREE_NODE_DIRECTORY : 0;
+    if (!node->has_location)
+        flags |= TREE_NODE_DERIVED_LOCATION;
+
+    wirePutU8(image, flags);
+    wirePutU8(image, (uint8_t)node->permissions);
+    wirePutString(image, node->name);
+    if (node->has_location)
+        wirePutString(image, node->location);
+    (*count)++;
+
+    if (node->type != DIRECTORY_NODE)
+        return;
+    wirePutU32(image, node->children ? node->children->count : 0);
+    if (!node->children)
+        return;
+    for (unsigned int i = 0; i < node->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(node->children, i);
+        if (child)
+            encodeTreeNode(image, child, count);
+    }
+}
+
+// Layout: magic(8) generation(8) server_count(4) next_id(4), then per server
+// id(4) ip(string) nm_port(4) client_port(4) node_count(4) image_length(8) image
+static void encodeSnapshot(WireBuffer *out, uint64_t generation)
+{
+    uint32_t servers = 0;
+    for (int i = 0; i < TABLE_SIZE; i++)
+    {
+        pthread_mutex_lock(&store_table->locks[i]);
+        for (StorageServer *server = store_table->table[i]; server; server = server->next)
+            servers += server->root != NULL;
+        pthread_mutex_unlock(&store_table->locks[i]);
+    }
+
+    wirePutBytes(out, NAMESPACE_SNAPSHOT_MAGIC, 8);
+    wirePutU64(out, generation);
+    wirePutU32(out, servers);
+    wirePutU32(out, (uint32_t)store_table->count);
+
+    WireBuffer image;
+    wireBufferInit(&image);
+    for (int i = 0; i < TABLE_SIZE; i++)
+    {
+        pthread_mutex_lock(&store_table->locks[i]);
+        for (StorageServer *server = store_table->table[i]; server; server = server->next)
+        {
+            if (!server->root)
+                continue;
+            uint32_t nodes = 0;
+            image.length = 0;
+            encodeTreeNode(&image, server->root, &nodes);
+            wirePutU32(out, (uint32_t)server->id);
+            wirePutString(out, server->ip);
+            wirePutU32(out, (uint32_t)server->nm_port);
+            wirePutU32(out, (uint32_t)server->client_port);
+            wirePutU32(out, nodes);
+            wirePutU64(out, image.length);
+            wirePutBytes(out, image.data, image.length);
+        }
+        pthread_mutex_unlock(&store_table->locks[i]);
+    }
+    wireBufferFree(&image);
+}
+
+// Write a new snapshot. The trees are encoded and the journal rotated under
+// the exclusive namespace lock; the file itself is written afterwards, so
+// mutations only wait for the in-memory encoding. A crash at any point
+// leaves a snapshot plus journals that replay to the same state: journals
+// older than the snapshot's generation are skipped.
+static int writeSnapshot(void)
+{
+    WireBuffer snapshot;
+    wireBufferInit(&snapshot);
+
+    pthread_rwlock_wrlock(&namespace_lock);
+    pthread_mutex_lock(&journal_lock);
+    uint64_t generation = journal_generation + 1;
+    encodeSnapshot(&snapshot, generation);
+    if (journal_fd >= 0)
+    {
+        close(journal_fd);
+        rename(NAMESPACE_JOURNAL_FILE, NAMESPACE_JOURNAL_OLD);
+    }
+    journal_generation = generation;
+    journal_fd = openJournal(generation);
+    pthread_mutex_unlock(&journal_lock);
+    pthread_rwlock_unlock(&namespace_lock);
+
+    int rc = -1;
+    int fd = open(NAMESPACE_SNAPSHOT_TMP, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0)
+    {
+        if (write(fd, snapshot.data, snapshot.length) == (ssize_t)snapshot.length && fsync(fd) == 0)
+            rc = 0;
+        close(fd);
+    }
+    if (rc == 0 && rename(NAMESPACE_SNAPSHOT_TMP, NAMESPACE_SNAPSHOT_FILE) == 0)
+    {
+        unlink(NAMESPACE_JOURNAL_OLD);
+        char log_buf[96];
+        snprintf(log_buf, sizeof(log_buf), "Namespace snapshot written: generation %llu, %zu bytes",
+                 (unsigned long long)generation, snapshot.length);
+        log_message(NULL, 0, "NM", log_buf);
+    }
+    else
+    {
+        rc = -1;
+        log_event(LOG_ERROR, NULL, 0, "NM", "Failed to write namespace snapshot");
+    }
+    wireBufferFree(&snapshot);
+    return rc;
+}
+
+static void *snapshotWriter(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        pthread_mutex_lock(&snapshot_lock);
+        while (!snapshot_pending)
+            pthread_cond_wait(&snapshot_wanted, &snapshot_lock);
+        snapshot_pending = false;
+        pthread_mutex_unlock(&snapshot_lock);
+        writeSnapshot();
+    }
+    return NULL;
+}
+
+// Ask the background writer for a fresh snapshot; requests made while one
+// is being written are folded into the next
+void requestNamespaceSnapshot(void)
+{
+    pthread_mutex_lock(&snapshot_lock);
+    snapshot_pending = true;
+    pthread_cond_signal(&snapshot_wanted);
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+// Restore every storage server in the snapshot as an inactive server.
+// Returns the snapshot generation, 0 when there is none.
+static uint64_t loadSnapshot(int *servers_out, uint32_t *nodes_out)
+{
+    size_t length;
+    const char *data = mapFile(NAMESPACE_SNAPSHOT_FILE, &length);
+    *servers_out = 0;
+    *nodes_out = 0;
+    if (!data)
+        return 0;
+
+    WireReader reader;
+    wireReaderInit(&reader, data, length);
+    if (length < 24 || memcmp(data, NAMESPACE_SNAPSHOT_MAGIC, 8) != 0)
+    {
+        log_event(LOG_ERROR, NULL, 0, "NM", "Ignoring namespace snapshot with a bad header");
+        munmap((void *)data, length);
+        return 0;
+    }
+    reader.offset = 8;
+    uint64_t generation = wireGetU64(&reader);
+    uint32_t servers = wireGetU32(&reader);
+    int next_id = (int)wireGetU32(&reader);
+
+    for (uint32_t i = 0; i < servers && !reader.error; i++)
+    {
+        StorageServer *server = createStorageServer(-1);
+        server->active = false;
+        server->health = SS_DEAD;
+        server->id = (int)wireGetU32(&reader);
+        wireGetString(&reader, server->ip, sizeof(server->ip));
+        server->nm_port = (int)wireGetU32(&reader);
+        server->client_port = (int)wireGetU32(&reader);
+        uint32_t nodes = wireGetU32(&reader);
+        uint64_t image_length = wireGetU64(&reader);
+        if (reader.error || image_length > length - reader.offset)
+        {
+            free(server);
+            break;
+        }
+        // Decoded straight out of the mapping
+        server->root = decodeTreeImage(data + reader.offset, image_length, nodes);
+        reader.offset += image_length;
+        if (!server->root)
+        {
+            free(server);
+            continue;
+        }
+        addStorageServer(store_table, server);
+        pathIndexAddServer(path_index, server);
+        (*servers_out)++;
+        *nodes_out += nodes;
+    }
+    if (next_id > store_table->count)
+        store_table->count = next_id;
+    munmap((void *)data, length);
+    return generation;
+}
+
+// Load the snapshot, replay the journals and start the snapshot writer
+int openNamespaceStore(StorageServerTable *table)
+{
+    store_table = table;
+
+    int servers, old_records, records;
+    uint32_t nodes;
+    uint64_t generation = loadSnapshot(&servers, &nodes);
+
+    replaying = true;
+    replayJournal(NAMESPACE_JOURNAL_OLD, generation, &old_records);
+    off_t valid = replayJournal(NAMESPACE_JOURNAL_FILE, generation, &records);
+    replaying = false;
+
+    // Keep appending to the current journal, minus any torn tail
+    journal_generation = generation;
+    if (valid > 0)
+    {
+        journal_fd = open(NAMESPACE_JOURNAL_FILE, O_WRONLY | O_APPEND);
+        if (journal_fd >= 0 && ftruncate(journal_fd, valid) == 0)
+            journal_size = valid;
+        else if (journal_fd >= 0)
+        {
+            close(journal_fd);
+            journal_fd = -1;
+        }
+    }
+    if (journal_fd < 0)
+        journal_fd = openJournal(generation);
+    if (journal_fd < 0)
+    {
+        perror("Failed to open namespace journal");
+        return -1;
+    }
+
+    char log_buf[128];
+    snprintf(log_buf, sizeof(log_buf), "Namespace restored: %d storage servers, %u nodes, %d journal records",
+             servers, nodes, old_records + records);
+    log_message(NULL, 0, "NM", log_buf);
+    printf("%s\n", log_buf);
+
+    if (pthread_create(&snapshot_thread, NULL, snapshotWriter, NULL) != 0)
+    {
+        perror("Failed to create namespace snapshot thread");
+        return -1;
+    }
+    pthread_detach(snapshot_thread);
+    if (old_records + records > 0)
+        requestNamespaceSnapshot();
+    return 0;
+}
+
+// ---- Mutations ----
+
+Node *namespaceCreate(StorageServer *server, const char *path, NodeType type)
+{
+    const char *lastSlash = strrchr(path, '/');
+    if (!lastSlash)
+        return NULL;
+    char parent_path[MAX_PATH_LENGTH];
+    snprintf(parent_path, sizeof(parent_path), "%.*s", (int)(lastSlash - path), path);
+
+    pthread_rwlock_wrlock(&namespace_lock);
+    Node *newNode = NULL;
+    Node *parentDir = server->root ? searchPath(server->root, parent_path) : NULL;
+    if (parentDir && parentDir->type == DIRECTORY_NODE && !searchNode(parentDir->children, lastSlash + 1))
+    {
+        newNode = createChildNode(parentDir, lastSlash + 1, type, READ | WRITE, path);
+        pathIndexInsert(path_index, path, server, newNode);
+
+        WireBuffer record;
+        wireBufferInit(&record);
+        wirePutU8(&record, JOURNAL_CREATE);
+        wirePutU32(&record, (uint32_t)server->id);
+        wirePutString(&record, path);
+        wirePutU8(&record, (uint8_t)type);
+        journalAppend(&record);
+        wireBufferFree(&record);
+    }
+    pthread_rwlock_unlock(&namespace_lock);
+    return newNode;
+}
+
+int namespaceDelete(StorageServer *server, const char *path)
+{
+    pthread_rwlock_wrlock(&namespace_lock);
+    Node *nodeToDelete = server->root ? searchPath(server->root, path) : NULL;
+    if (!nodeToDelete)
+    {
+        pthread_rwlock_unlock(&namespace_lock);
+        return -1;
+    }
+    char key[MAX_PATH_LENGTH];
+    pathIndexRemoveSubtree(path_index, path);
+    if (normalizePath(path, key, sizeof(key)) >= 0)
+        removeLRUCache(cache, key);
+    int rc = deleteNode(nodeToDelete);
+
+    WireBuffer record;
+    wireBufferInit(&record);
+    wirePutU8(&record, JOURNAL_DELETE);
+    wirePutU32(&record, (uint32_t)server->id);
+    wirePutString(&record, path);
+    journalAppend(&record);
+    wireBufferFree(&record);
+    pthread_rwlock_unlock(&namespace_lock);
+    return rc;
+}
+
+// Whether node is inside, or is, the subtree at top
+static bool isWithin(Node *node, Node *top)
+{
+    for (; node; node = node->parent)
+    {
+        if (node == top)
+            return true;
+    }
+    return false;
+}
+
+// Copy source_path (file or directory) from source into dest_dir on dest,
+// replacing whatever dest_dir held under the same name. Returns the new
+// node, or NULL if either end no longer exists or the source is inside
+// what it would replace.
+Node *namespaceCopy(StorageServer *source, const char *source_path, StorageServer *dest, const char *dest_dir)
+{
+    pthread_rwlock_wrlock(&namespace_lock);
+    Node *copy = NULL;
+    Node *source_node = findNode(source->root, source_path);
+    Node *destParentNode = findNode(dest->root, dest_dir);
+    Node *existing = source_node && destParentNode && destParentNode->type == DIRECTORY_NODE
+                         ? searchNode(destParentNode->children, source_node->name)
+                         : NULL;
+    if (source_node && destParentNode && destParentNode->type == DIRECTORY_NODE && !isWithin(source_node, existing))
+    {
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/%s", dest_dir, source_node->name);
+        if (existing)
+        {
+            // Deltas from dest may have added it already, and a replayed
+            // journal repeats the copy
+            char key[MAX_PATH_LENGTH];
+            pathIndexRemoveSubtree(path_index, path);
+            if (normalizePath(path, key, sizeof(key)) >= 0)
+                removeLRUCache(cache, key);
+            deleteNode(existing);
+        }
+
+        if (source_node->type == DIRECTORY_NODE)
+        {
+            addDirectory(destParentNode, source_node->name, source_node->permissions);
+            copy = searchNode(destParentNode->children, source_node->name);
+            // Copy the contents of the source directory to the destination directory
+            copyDirectoryContents(source_node, copy);
+        }
+        else
+        {
+            char location[PATH_MAX];
+            addFile(destParentNode, source_node->name, source_node->permissions,
+                    nodeLocation(source_node, location, sizeof(location)) >= 0 ? location : "");
+            copy = searchNode(destParentNode->children, source_node->name);
+        }
+
+        // Register the copy (and everything under it) in the path index
+        pathIndexAddSubtree(path_index, dest, copy, path);
+
+        WireBuffer record;
+        wireBufferInit(&record);
+        wirePutU8(&record, JOURNAL_COPY);
+        wirePutU32(&record, (uint32_t)source->id);
+        wirePutString(&record, source_path);
+        wirePutU32(&record, (uint32_t)dest->id);
+        wirePutString(&record, dest_dir);
+        journalAppend(&record);
+        wireBufferFree(&record);
+    }
+    pthread_rwlock_unlock(&namespace_lock);
+    return copy;
+}
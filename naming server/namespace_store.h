@@ -0,0 +1,46 @@
+#ifndef NAMESPACE_STORE_H
+#define NAMESPACE_STORE_H
+
+#include "header.h"
+
+// On-disk copy of the namespace so that a restarted naming server comes back
+// warm. It has two files:
+//
+//   namespace.img      snapshot: every storage server's identity and tree,
+//                      each tree in the registration image format (see
+//                      wire.h); mapped with mmap() and decoded in place
+//   namespace.journal  append-only log of the mutations applied since the
+//                      snapshot (CREATE, DELETE, COPY, backups)
+//
+// At startup the snapshot is loaded and the journal replayed. Restored
+// servers stay inactive until their storage server reconnects; if its
+// fingerprint matches the restored tree, no tree is transferred. Once the
+// journal grows past NAMESPACE_JOURNAL_LIMIT (and after every registration
+// that brings a new tree) a background thread writes a fresh snapshot and
+// empties the journal.
+
+#define NAMESPACE_SNAPSHOT_FILE "namespace.img"
+#define NAMESPACE_JOURNAL_FILE "namespace.journal"
+#define NAMESPACE_SNAPSHOT_MAGIC "NFSNAP01"
+#define NAMESPACE_JOURNAL_LIMIT (4 * 1024 * 1024)
+
+typedef enum
+{
+    JOURNAL_CREATE = 1, // server id, path, node type
+    JOURNAL_DELETE,     // server id, path
+    JOURNAL_COPY        // source id, source path, destination id, destination directory
+} JournalRecordType;
+
+int openNamespaceStore(StorageServerTable *table);
+void requestNamespaceSnapshot(void);
+void lockNamespace(bool exclusive);
+void unlockNamespace(void);
+uint64_t treeFingerprint(Node *root);
+
+// Every change to a registered tree goes through these, which update the
+// tree, the path index and the cache, and journal the change
+Node *namespaceCreate(StorageServer *server, const char *path, NodeType type);
+int namespaceDelete(StorageServer *server, const char *path);
+Node *namespaceCopy(StorageServer *source, const char *source_path, StorageServer *dest, const char *dest_dir);
+
+#endif // NAMESPACE_STORE_H
@@ -1,10 +1,15 @@
 #include "header.h"
 #include "lru_cache.h"
+#include "path_index.h"
+#include "reactor.h"
+#include "namespace_store.h"
+#include "placement.h"
+#include "stats.h"
+#include "lease.h"
+#include "write_tracker.h"
+#include "notify.h"
 
 LRUCache *cache;
-AsyncWriteState *writeStateQueue = NULL; // Head of the queue
-pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex to protect log file access
 pthread_t monitorThread;
 // Log file path
 const char *log_file_path = "serverlog.txt";
@@ -18,6 +23,10 @@ StorageServerTable *createStorageServerTable()
         pthread_mutex_init(&table->locks[i], NULL);
     }
     table->count = 0;
+    table->by_id = NULL;
+    table->by_id_capacity = 0;
+    pthread_rwlock_init(&table->by_id_lock, NULL);
+    initHashRing(&table->ring);
     return table;
 }
 
@@ -44,6 +53,20 @@ void addStorageServer(StorageServerTable *table, StorageServer *server)
     table->table[index] = server;
     // table->count++;
     pthread_mutex_unlock(&table->locks[index]);
+
+    pthread_rwlock_wrlock(&table->by_id_lock);
+    if (server->id >= table->by_id_capacity)
+    {
+        int capacity = table->by_id_capacity ? table->by_id_capacity : 16;
+        while (capacity <= server->id)
+            capacity *= 2;
+        table->by_id = realloc(table->by_id, capacity * sizeof(StorageServer *));
+        memset(table->by_id + table->by_id_capacity, 0, (capacity - table->by_id_capacity) * sizeof(StorageServer *));
+        table->by_id_capacity = capacity;
+    }
+    table->by_id[server->id] = server;
+    pthread_rwlock_unlock(&table->by_id_lock);
+    ringAddServer(&table->ring, server->id);
 }
 
 // Find storage server in hash table
@@ -66,50 +89,207 @@ StorageServer *findStorageServer(StorageServerTable *table, const char *ip, int
     return NULL;
 }
 
-// Find storage server containing a specific path
-StorageServer *findStorageServerByPath(StorageServerTable *table, const char *path)
+// Connected and heartbeating on time. A suspect server keeps its connection
+// but gets no new clients until it catches up (see healthMonitor).
+bool isRoutable(StorageServer *server)
+{
+    return server->active && server->health == SS_HEALTHY;
+}
+
+// Expected wait for one more read: the requests queued at the server times
+// its recent service time
+static uint64_t readCost(StorageServer *server)
+{
+    return (uint64_t)(server->load_inflight + server->load_assigned + 1) * (server->load_latency_us + 1000);
+}
+
+// A server holding a copy of some path, and the path to ask it for
+typedef struct PathCopy
 {
-    Node *cachedNode = getLRUCache(cache, path);
-    if (cachedNode != NULL)
+    StorageServer *server;
+    char path[MAX_PATH_LENGTH];
+    bool synced; // confirmed every change at the primary's last report
+} PathCopy;
+
+// Where a client should send one request: copies[0] is the server to use,
+// the others are live copies it may also read from
+typedef struct Resolution
+{
+    uint16_t status; // WIRE_OK, ERR_NOT_FOUND or ERR_INACTIVE
+    NodeType type;
+    StorageServer *primary;
+    int count;
+    PathCopy copies[1 + REPLICA_SLOTS];
+} Resolution;
+
+// The copies of path, held by primary, that may serve a read: the primary
+// and those of its backups that have confirmed every change and hold the
+// path under /backup_<id>. With the primary down or suspect, availability
+// comes first: any live backup holding the path will do. Called with
+// primary->lock held; returns how many were found.
+static int readCopies(StorageServer *primary, const char *path, PathCopy *copies)
+{
+    int count = 0;
+    bool primary_up = isRoutable(primary);
+    if (primary_up)
     {
-        // Return the server associated with the cached node
-        for (int i = 0; i < TABLE_SIZE; i++)
+        copies[count].server = primary;
+        snprintf(copies[count].path, sizeof(copies[count].path), "%s", path);
+        copies[count].synced = true;
+        count++;
+    }
+
+    StorageServer *backups[REPLICA_SLOTS] = {primary->ss_backup_1, primary->ss_backup_2};
+    lockNamespace(false);
+    for (int i = 0; i < REPLICA_SLOTS; i++)
+    {
+        StorageServer *backup = backups[i];
+        bool synced = primary->replica_lag[i] == 0;
+        if (!backup || backup == primary || !isRoutable(backup) || (primary_up && !synced))
+            continue;
+        PathCopy *copy = &copies[count];
+        if (snprintf(copy->path, sizeof(copy->path), "/backup_%d%s", primary->id, path) >= (int)sizeof(copy->path) ||
+            !backup->root || !searchPath(backup->root, copy->path))
+            continue;
+        copy->server = backup;
+        copy->synced = synced;
+        count++;
+    }
+    unlockNamespace();
+    return count;
+}
+
+// Where a read is cheapest: a copy that was in sync at the primary's last
+// report over one that was not, then the shortest expected wait. Returns
+// the index of the chosen copy, -1 if there is none.
+static int pickReadCopy(PathCopy *copies, int count)
+{
+    int best = -1;
+    uint64_t best_cost = UINT64_MAX;
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t cost = readCost(copies[i].server);
+        if (best < 0 || (copies[i].synced && !copies[best].synced) ||
+            (copies[i].synced == copies[best].synced && cost < best_cost))
         {
-            pthread_mutex_lock(&table->locks[i]);
-            StorageServer *server = table->table[i];
-            while (server)
-            {
-                if (server->root == cachedNode)
-                {
-                    pthread_mutex_unlock(&table->locks[i]);
-                    return server;
-                }
-                server = server->next;
-            }
-            pthread_mutex_unlock(&table->locks[i]);
+            best = i;
+            best_cost = cost;
         }
     }
+    if (best >= 0)
+        __atomic_add_fetch(&copies[best].server->load_assigned, 1, __ATOMIC_RELAXED);
+    return best;
+}
 
-    // If not found in cache, search in the storage servers
-    for (int i = 0; i < TABLE_SIZE; i++)
+// Server whose namespace holds path, whatever its health, and the type of
+// the path's Node. Owners that can take clients are served from and kept
+// in the cache.
+static StorageServer *resolveOwner(const char *path, NodeType *type_out)
+{
+    char key[MAX_PATH_LENGTH];
+    if (normalizePath(path, key, sizeof(key)) < 0)
+        return NULL;
+    StorageServer *server = getLRUCache(cache, key, type_out);
+    if (server && isRoutable(server))
+        return server;
+
+    // The Node may be deleted and freed once the namespace lock is dropped
+    Node *node;
+    lockNamespace(false);
+    server = pathIndexLookup(path_index, key, &node);
+    if (server && node)
+        *type_out = node->type;
+    unlockNamespace();
+    if (!server || !node)
+        return NULL;
+    if (isRoutable(server))
+        putLRUCache(cache, key, server, *type_out);
+    return server;
+}
+
+// Decide where a request of kind access on path should go. Writes always
+// go to the primary; reads to whichever copy is least busy, or to a backup
+// when the primary is down.
+static void resolvePath(const char *path, uint8_t access, Resolution *res)
+{
+    res->count = 0;
+    res->primary = resolveOwner(path, &res->type);
+    if (!res->primary)
     {
-        pthread_mutex_lock(&table->locks[i]);
-        StorageServer *server = table->table[i];
-        while (server)
+        res->status = ERR_NOT_FOUND;
+        return;
+    }
+
+    StorageServer *server = res->primary;
+    pthread_mutex_lock(&server->lock);
+    if (access != ACCESS_WRITE)
+    {
+        res->count = readCopies(server, path, res->copies);
+        int best = pickReadCopy(res->copies, res->count);
+        if (best > 0)
         {
-            if (server->active && server->root)
-            {
-                Node *found_node = searchPath(server->root, path);
-                if (found_node != NULL)
-                {
-                    putLRUCache(cache, path, found_node); // Cache the found node
-                    pthread_mutex_unlock(&table->locks[i]);
-                    return server;
-                }
-            }
-            server = server->next;
+            PathCopy chosen = res->copies[best];
+            res->copies[best] = res->copies[0];
+            res->copies[0] = chosen;
         }
-        pthread_mutex_unlock(&table->locks[i]);
+    }
+    else if (isRoutable(server))
+    {
+        res->copies[0].server = server;
+        snprintf(res->copies[0].path, sizeof(res->copies[0].path), "%s", path);
+        res->copies[0].synced = true;
+        res->count = 1;
+        // The backups are behind until a heartbeat says otherwise
+        for (int i = 0; i < REPLICA_SLOTS; i++)
+            server->replica_lag[i] = REPLICA_LAG_UNKNOWN;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    res->status = res->count > 0 ? WIRE_OK : ERR_INACTIVE;
+    if (res->count > 0)
+        __atomic_add_fetch(&res->copies[0].server->requests, 1, __ATOMIC_RELAXED);
+}
+
+// Lease on a resolution for the client's notice socket at notify_port.
+// *version is the lease version read before resolving, and is cleared when
+// no lease is given. Only answers naming the primary are leased: a backup
+// may fall behind without anything the naming server could revoke.
+static uint32_t leaseResolution(ClientConnection *conn, const char *path, const Resolution *res, uint16_t notify_port,
+                                uint64_t *version)
+{
+    uint32_t lease_ms = 0;
+    if (res->status == WIRE_OK && res->copies[0].server == res->primary)
+        lease_ms = grantLease(path, res->primary->id, conn->ip, notify_port, *version);
+    if (lease_ms == 0)
+        *version = 0;
+    return lease_ms;
+}
+
+// Find storage server containing a specific path
+StorageServer *findStorageServerByPath(const char *path)
+{
+    char key[MAX_PATH_LENGTH];
+    if (normalizePath(path, key, sizeof(key)) < 0)
+        return NULL;
+
+    StorageServer *server = getLRUCache(cache, key, NULL);
+    if (server && isRoutable(server))
+    {
+        return server;
+    }
+
+    // If not found in cache, resolve it through the namespace index
+    Node *found_node = NULL;
+    NodeType type = FILE_NODE;
+    lockNamespace(false);
+    server = pathIndexLookup(path_index, key, &found_node);
+    if (found_node)
+        type = found_node->type;
+    unlockNamespace();
+    if (server && isRoutable(server) && found_node)
+    {
+        putLRUCache(cache, key, server, type); // Cache the resolved server
+        return server;
     }
 
     return NULL;
@@ -144,662 +324,1063 @@ StorageServer *findStorageServerByPath2(StorageServerTable *table, const char *p
     return NULL;
 }
 
-// Handle new storage server connection
-StorageServer *handleNewStorageServer(int socket, StorageServerTable *table)
+// Unlink a server from its hash bucket; the caller frees or re-adds it
+void removeStorageServer(StorageServerTable *table, StorageServer *server)
+{
+    unsigned int index = hashStorageServer(server->ip, server->nm_port);
+
+    pthread_mutex_lock(&table->locks[index]);
+    StorageServer **link = &table->table[index];
+    while (*link && *link != server)
+        link = &(*link)->next;
+    if (*link)
+        *link = server->next;
+    pthread_mutex_unlock(&table->locks[index]);
+
+    pthread_rwlock_wrlock(&table->by_id_lock);
+    if (server->id < table->by_id_capacity && table->by_id[server->id] == server)
+        table->by_id[server->id] = NULL;
+    pthread_rwlock_unlock(&table->by_id_lock);
+}
+
+// Index every registered server's tree again after a server's paths were
+// dropped: paths it owned may have shadowed the same paths on others (see
+// insertLocked), which now get their entries back. Called with the
+// namespace lock held exclusively, so no tree changes meanwhile.
+static void reindexServers(StorageServerTable *table)
+{
+    pthread_rwlock_rdlock(&table->by_id_lock);
+    StorageServer **servers = malloc((table->by_id_capacity ? table->by_id_capacity : 1) * sizeof(StorageServer *));
+    int count = 0;
+    for (int id = 0; servers && id < table->by_id_capacity; id++)
+    {
+        if (table->by_id[id] && table->by_id[id]->root)
+            servers[count++] = table->by_id[id];
+    }
+    pthread_rwlock_unlock(&table->by_id_lock);
+    for (int i = 0; i < count; i++)
+        pathIndexAddServer(path_index, servers[i]);
+    free(servers);
+}
+
+// Find an inactive server from the same host whose tree matches a
+// registering storage server's fingerprint
+static StorageServer *findRestoredServer(StorageServerTable *table, const char *ip, uint64_t fingerprint)
 {
-    StorageServer *server = malloc(sizeof(StorageServer));
-    server->ss_backup_1 = NULL;
-    server->ss_backup_2 = NULL;
+    StorageServer *match = NULL;
+    lockNamespace(false);
+    for (int i = 0; i < TABLE_SIZE && !match; i++)
+    {
+        pthread_mutex_lock(&table->locks[i]);
+        for (StorageServer *server = table->table[i]; server; server = server->next)
+        {
+            if (!server->active && strcmp(server->ip, ip) == 0 && treeFingerprint(server->root) == fingerprint)
+            {
+                match = server;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&table->locks[i]);
+    }
+    unlockNamespace();
+    return match;
+}
+
+StorageServer *createStorageServer(int socket)
+{
+    StorageServer *server = calloc(1, sizeof(StorageServer));
     server->socket = socket;
     server->active = true;
     pthread_mutex_init(&server->lock, NULL);
-    
+    pthread_mutex_init(&server->send_lock, NULL);
+    pthread_mutex_init(&server->pending_lock, NULL);
+    initFailureDetector(&server->detector);
+    for (int i = 0; i < REPLICA_SLOTS; i++)
+        server->replica_lag[i] = REPLICA_LAG_UNKNOWN;
+    return server;
+}
+
+// Handle new storage server connection
+StorageServer *handleNewStorageServer(int socket, StorageServerTable *table)
+{
+    StorageServer *server = createStorageServer(socket);
+    StorageServer *restored = NULL;
+
     // Receive server information
-    if (receiveServerInfo(socket, server->ip, &server->nm_port, &server->client_port, &server->root) != 0)
+    if (receiveServerInfo(table, server, &restored) != 0)
     {
         free(server);
         return NULL;
     }
-    StorageServer *existing_server = findStorageServerByPath2(table, server->root->name);
-    if (existing_server)
+    if (restored)
+    {
+        // We already hold this tree (restored from disk, or from before a
+        // disconnect): only the connection details change
+        removeStorageServer(table, restored);
+        forgetBackups(table, restored);
+        revokeServerLeases(restored->id);
+        // The old connection's handler marked it inactive on its way out;
+        // once it is gone nothing uses the old socket
+        if (restored->has_handler)
+        {
+            pthread_join(restored->handler, NULL);
+            restored->has_handler = false;
+        }
+        if (restored->socket >= 0)
+            close(restored->socket);
+        restored->nm_port = server->nm_port;
+        restored->client_port = server->client_port;
+        restored->socket = socket;
+        restored->delta_seq = 0;
+        memcpy(restored->peer_ip, server->peer_ip, sizeof(restored->peer_ip));
+        resetFailureDetector(&restored->detector);
+        restored->health = SS_HEALTHY;
+        restored->active = true;
+        addStorageServer(table, restored);
+        free(server);
+        return restored;
+    }
+
+    lockNamespace(true);
+    StorageServer *existing_server = findStorageServerByPath2(table, server->root->name);
+    if (existing_server)
+    {
+        //add or correct it if already exist then dont increase the count just remove the older one and add new one
+        server->id = existing_server->id;
+        removeStorageServer(table, existing_server);
+        forgetBackups(table, existing_server);
+        revokeServerLeases(existing_server->id);
+
+        // Free the existing server resources
+        pathIndexRemoveServer(path_index, existing_server);
+        invalidateLRUCacheServer(cache, existing_server);
+        retireStorageServer(existing_server);
+        reindexServers(table);
+    }
+    else
+    {
+        table->count++;
+        server->id = table->count;
+    }
+    resetFailureDetector(&server->detector);
+    addStorageServer(table, server);
+    pathIndexAddServer(path_index, server);
+    unlockNamespace();
+
+    // The new tree only reaches the disk with the next snapshot
+    requestNamespaceSnapshot();
+    return server;
+}
+
+// Apply an OP_DELTA frame: changes the storage server made on its own disk.
+// Events are idempotent and numbered, so repeats (for instance of changes
+// that were already in the tree image) are skipped.
+static void applyDelta(StorageServer *server, const char *payload, size_t length)
+{
+    WireReader reader;
+    wireReaderInit(&reader, payload, length);
+    uint64_t seq = wireGetU64(&reader);
+    uint32_t count = wireGetU32(&reader);
+    if (reader.error)
+        return;
+    if (server->delta_seq && seq > server->delta_seq + 1)
+        log_event(LOG_WARN, server->ip, server->nm_port, "SS", "Namespace delta gap, some changes were lost");
+
+    char path[MAX_PATH_LENGTH];
+    uint32_t applied = 0;
+    for (uint32_t i = 0; i < count; i++, seq++)
+    {
+        uint8_t kind = wireGetU8(&reader);
+        NodeType type = (NodeType)wireGetU8(&reader);
+        if (wireGetString(&reader, path, sizeof(path)) < 0)
+            break;
+        if (server->delta_seq && seq <= server->delta_seq)
+            continue;
+        server->delta_seq = seq;
+        applied++;
+
+        if (kind == DELTA_ADD)
+            namespaceCreate(server, path, type == DIRECTORY_NODE ? DIRECTORY_NODE : FILE_NODE);
+        else if (kind == DELTA_REMOVE)
+        {
+            namespaceDelete(server, path);
+            revokeLeases(path);
+        }
+        // DELTA_MODIFY leaves the path where it was, so cached resolutions
+        // of it still hold
+    }
+
+    char log_buf[64];
+    snprintf(log_buf, sizeof(log_buf), "%u of %u changes applied", applied, count);
+    log_event(LOG_DEBUG, server->ip, server->nm_port, "Received from SS: DELTA", log_buf);
+}
+
+// Thread function to handle storage server. It is the only reader of the
+// control socket: replies are handed to the waiting storageServerRequest.
+void *storageServerHandler(void *arg)
+{
+    StorageServer *server = (StorageServer *)arg;
+
+    while (1)
+    {
+        WireHeader hdr;
+        char *payload;
+        if (recvFrame(server->socket, &hdr, &payload) < 0)
+        {
+            // Fail every request still waiting for a reply
+            pthread_mutex_lock(&server->pending_lock);
+            server->active = false;
+            for (int i = 0; i < PENDING_BUCKETS; i++)
+            {
+                for (PendingRequest *request = server->pending[i]; request; request = request->next)
+                {
+                    request->aborted = true;
+                    pthread_cond_signal(&request->cond);
+                }
+            }
+            pthread_mutex_unlock(&server->pending_lock);
+            printf("Storage server %s disconnected\n", server->ip);
+            log_event(LOG_WARN, server->ip, server->nm_port, "SS", "Storage Server Disconnected.");
+            break;
+        }
+
+        if (hdr.flags & WIRE_FLAG_REPLY)
+        {
+            pthread_mutex_lock(&server->pending_lock);
+            for (PendingRequest *request = server->pending[hdr.request_id % PENDING_BUCKETS]; request; request = request->next)
+            {
+                if (request->request_id == hdr.request_id && !request->done)
+                {
+                    request->reply = hdr;
+                    request->reply_payload = payload;
+                    request->done = true;
+                    payload = NULL;
+                    pthread_cond_signal(&request->cond);
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&server->pending_lock);
+        }
+        else if (hdr.opcode == OP_HEARTBEAT)
+        {
+            heartbeatArrived(&server->detector);
+            WireReader reader;
+            wireReaderInit(&reader, payload, hdr.length);
+            uint32_t inflight = wireGetU32(&reader);
+            uint32_t latency_us = wireGetU32(&reader);
+            uint64_t free_bytes = wireGetU64(&reader);
+            uint64_t total_bytes = wireGetU64(&reader);
+            uint32_t file_count = wireGetU32(&reader);
+            uint64_t lag[REPLICA_SLOTS];
+            for (int i = 0; i < REPLICA_SLOTS; i++)
+                lag[i] = wireGetU64(&reader);
+            if (!reader.error)
+            {
+                server->load_inflight = inflight;
+                server->load_latency_us = latency_us;
+                server->load_assigned = 0;
+                server->free_bytes = free_bytes;
+                server->total_bytes = total_bytes;
+                server->file_count = file_count;
+                memcpy(server->replica_lag, lag, sizeof(lag));
+            }
+        }
+        else if (hdr.opcode == OP_DELTA)
+        {
+            applyDelta(server, payload, hdr.length);
+        }
+        else if (hdr.opcode == OP_WRITE_ACK)
+        {
+            handleWriteAcks(server, payload, hdr.length);
+        }
+        free(payload);
+    }
+
+    return NULL;
+}
+
+// Where clients reached a server that died, for abortWritesOnServer
+typedef struct LostServer
+{
+    char ip[INET_ADDRSTRLEN];
+    int port;
+} LostServer;
+
+// Track every storage server's health from its heartbeats. A server whose
+// suspicion level passes PHI_SUSPECT stops receiving new work; past
+// PHI_DEAD its connection is shut down, which fails its outstanding
+// requests. A server that disconnects is declared dead the same way. For
+// each dead server, clients with unfinished writes on it are told at once
+// and the backup worker is asked to reassign backups; the loop itself never
+// waits on a storage server.
+void *healthMonitor(void *arg)
+{
+    StorageServerTable *table = (StorageServerTable *)arg;
+    while (1)
+    {
+        usleep(HEARTBEAT_CHECK_MS * 1000);
+
+        // Details of servers that died this round, handled after unlocking
+        LostServer *lost_servers = NULL;
+        int lost = 0, lost_capacity = 0;
+        // Servers no longer routed to; leases naming them are revoked
+        int *demoted = NULL;
+        int demoted_count = 0, demoted_capacity = 0;
+        for (int i = 0; i < TABLE_SIZE; i++)
+        {
+            pthread_mutex_lock(&table->locks[i]);
+            for (StorageServer *server = table->table[i]; server; server = server->next)
+            {
+                ServerHealth before = server->health;
+                double phi = 0;
+                if (!server->active)
+                    server->health = SS_DEAD;
+                else if (before != SS_DEAD)
+                {
+                    phi = suspicionLevel(&server->detector);
+                    server->health = phi >= PHI_DEAD ? SS_DEAD : phi >= PHI_SUSPECT ? SS_SUSPECT : SS_HEALTHY;
+                }
+                if (server->health == before)
+                    continue;
+
+                char log_buf[96];
+                snprintf(log_buf, sizeof(log_buf), "Storage server %d is %s (phi %.1f)", server->id,
+                         serverHealthName(server->health), phi);
+                printf("%s\n", log_buf);
+                log_event(server->health == SS_HEALTHY ? LOG_INFO : LOG_WARN, server->ip, server->nm_port, "SS", log_buf);
+
+                if (server->health != SS_HEALTHY)
+                {
+                    invalidateLRUCacheServer(cache, server);
+                    if (before == SS_HEALTHY)
+                    {
+                        if (demoted_count == demoted_capacity)
+                        {
+                            demoted_capacity = demoted_capacity ? demoted_capacity * 2 : 16;
+                            demoted = realloc(demoted, demoted_capacity * sizeof(int));
+                        }
+                        demoted[demoted_count++] = server->id;
+                    }
+                }
+                if (server->health == SS_DEAD)
+                {
+                    if (server->active)
+                        shutdown(server->socket, SHUT_RDWR); // storageServerHandler sees EOF
+                    if (lost == lost_capacity)
+                    {
+                        lost_capacity = lost_capacity ? lost_capacity * 2 : 16;
+                        lost_servers = realloc(lost_servers, lost_capacity * sizeof(LostServer));
+                    }
+                    memcpy(lost_servers[lost].ip, server->peer_ip, INET_ADDRSTRLEN);
+                    lost_servers[lost++].port = server->client_port;
+                }
+            }
+            pthread_mutex_unlock(&table->locks[i]);
+        }
+
+        for (int i = 0; i < demoted_count; i++)
+            revokeServerLeases(demoted[i]);
+        free(demoted);
+        for (int i = 0; i < lost; i++)
+            abortWritesOnServer(lost_servers[i].ip, lost_servers[i].port);
+        free(lost_servers);
+        if (lost > 0 && table->count >= 3)
+            requestBackups();
+    }
+    return NULL;
+}
+
+// Send a control request to a storage server and wait for its reply. Other
+// requests to the same server may be in flight at the same time. On success
+// *reply_payload is a NUL-terminated message the caller frees.
+int storageServerRequest(StorageServer *server, uint8_t opcode, const WireBuffer *payload, WireHeader *reply, char **reply_payload)
+{
+    *reply_payload = NULL;
+
+    PendingRequest request;
+    memset(&request, 0, sizeof(request));
+    pthread_cond_init(&request.cond, NULL);
+
+    pthread_mutex_lock(&server->pending_lock);
+    request.request_id = ++server->next_request_id;
+    PendingRequest **bucket = &server->pending[request.request_id % PENDING_BUCKETS];
+    request.next = *bucket;
+    *bucket = &request;
+    bool active = server->active;
+    pthread_mutex_unlock(&server->pending_lock);
+
+    int sent = -1;
+    if (active)
+    {
+        pthread_mutex_lock(&server->send_lock);
+        sent = sendFrame(server->socket, opcode, request.request_id, WIRE_OK,
+                         payload ? payload->data : NULL, payload ? payload->length : 0);
+        pthread_mutex_unlock(&server->send_lock);
+    }
+    if (sent == 0)
+    {
+        __atomic_add_fetch(&server->requests, 1, __ATOMIC_RELAXED);
+        char log_buf[64];
+        snprintf(log_buf, sizeof(log_buf), "%s request %u", wireOpcodeName(opcode), request.request_id);
+        log_message(server->ip, server->nm_port, "Sent to SS:", log_buf);
+    }
+
+    pthread_mutex_lock(&server->pending_lock);
+    while (sent == 0 && !request.done && !request.aborted)
+        pthread_cond_wait(&request.cond, &server->pending_lock);
+    for (PendingRequest **link = bucket; *link; link = &(*link)->next)
+    {
+        if (*link == &request)
+        {
+            *link = request.next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->pending_lock);
+    pthread_cond_destroy(&request.cond);
+
+    if (!request.done)
+        return -1;
+    *reply = request.reply;
+    *reply_payload = request.reply_payload;
+    return 0;
+}
+
+void getFileName(const char *path, char **filename)
+{
+    if (!path || !filename)
+    {
+        printf("Error: Invalid path or filename pointer.\n");
+        return;
+    }
+
+    const char *lastSlash = strrchr(path, '/');
+    *filename = lastSlash ? (char *)(lastSlash + 1) : (char *)path;
+}
+
+static void replyError(ClientConnection *conn, uint16_t status, const char *message)
+{
+    queueReply(conn, status, message, strlen(message));
+    char log_buf[256];
+    snprintf(log_buf, sizeof(log_buf), "ERROR %d: %s", status, message);
+    log_message(conn->ip, conn->port, "Sent to Client:", log_buf);
+}
+
+static void replyMessage(ClientConnection *conn, const char *message)
+{
+    queueReply(conn, WIRE_OK, message, strlen(message));
+    log_message(conn->ip, conn->port, "Sent to Client:", message);
+}
+
+// Pass a storage server's reply (status and message) through to the client
+static void forwardReply(ClientConnection *conn, WireHeader *reply, const char *payload)
+{
+    queueReply(conn, reply->status, payload, reply->length);
+    log_message(conn->ip, conn->port, "Sent to Client:", payload);
+}
+
+StorageServer *findStorageServerById(StorageServerTable *table, int id)
+{
+    StorageServer *server = NULL;
+    pthread_rwlock_rdlock(&table->by_id_lock);
+    if (id >= 0 && id < table->by_id_capacity)
+        server = table->by_id[id];
+    pthread_rwlock_unlock(&table->by_id_lock);
+    return server;
+}
+
+// READ, WRITE, META and STREAM: tell the client which storage server to contact
+static void handleLookup(ClientConnection *conn, WireReader *reader)
+{
+    char path[MAX_PATH_LENGTH];
+    uint8_t access = wireGetU8(reader);
+    if (wireGetString(reader, path, sizeof(path)) < 0)
+    {
+        replyError(conn, ERR_INVALID, "Invalid command!");
+        return;
+    }
+    uint16_t notify_port = reader->offset < reader->length ? wireGetU16(reader) : 0;
+    log_message(conn->ip, conn->port, "Received from Client: LOOKUP", path);
+
+    Resolution res;
+    uint64_t version = leaseVersion();
+    resolvePath(path, access, &res);
+    if (res.status != WIRE_OK)
+    {
+        replyError(conn, res.status, res.status == ERR_NOT_FOUND ? "Path not found!" : "Storage Server not active.");
+        return;
+    }
+    PathCopy *target = &res.copies[0];
+    if (target->server != res.primary && !isRoutable(res.primary))
+    {
+        char log_buf[MAX_PATH_LENGTH + 64];
+        snprintf(log_buf, sizeof(log_buf), "Storage server %d is %s; %s read from storage server %d", res.primary->id,
+                 serverHealthName(res.primary->health), path, target->server->id);
+        log_event(LOG_WARN, conn->ip, conn->port, "NM", log_buf);
+    }
+
+    uint32_t lease_ms = leaseResolution(conn, path, &res, notify_port, &version);
+    WireBuffer out;
+    wireBufferInit(&out);
+    wirePutString(&out, target->server->ip);
+    wirePutU16(&out, (uint16_t)target->server->client_port);
+    wirePutString(&out, target->path);
+    wirePutU32(&out, lease_ms);
+    wirePutU64(&out, version);
+    queueReply(conn, WIRE_OK, out.data, out.length);
+    wireBufferFree(&out);
+
+    char log_buf[MAX_PATH_LENGTH + 64];
+    snprintf(log_buf, sizeof(log_buf), "StorageServer: %s : %d %s", target->server->ip, target->server->client_port,
+             target->path);
+    log_message(conn->ip, conn->port, "Sent to Client(SS Details):", log_buf);
+}
+
+// LOOKUP for many paths in one round trip. Each path is resolved as a
+// LOOKUP would be; the reply lists every copy a client may use.
+static void handleResolve(ClientConnection *conn, WireReader *reader)
+{
+    uint8_t access = wireGetU8(reader);
+    uint16_t notify_port = wireGetU16(reader);
+    uint32_t count = wireGetU32(reader);
+    if (reader->error || count == 0 || count > RESOLVE_MAX_PATHS)
+    {
+        replyError(conn, ERR_INVALID, "Invalid command!");
+        return;
+    }
+    char log_buf[64];
+    snprintf(log_buf, sizeof(log_buf), "%u paths", count);
+    log_message(conn->ip, conn->port, "Received from Client: RESOLVE", log_buf);
+
+    WireBuffer out;
+    wireBufferInit(&out);
+    wirePutU32(&out, count);
+    uint32_t resolved = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        char path[MAX_PATH_LENGTH];
+        if (wireGetString(reader, path, sizeof(path)) < 0)
+        {
+            wireBufferFree(&out);
+            replyError(conn, ERR_INVALID, "Invalid command!");
+            return;
+        }
+        Resolution res;
+        uint64_t version = leaseVersion();
+        resolvePath(path, access, &res);
+        wirePutU16(&out, res.status);
+        if (res.status != WIRE_OK)
+            continue;
+        resolved++;
+        wirePutU8(&out, (uint8_t)res.type);
+        wirePutU8(&out, (uint8_t)res.count);
+        for (int j = 0; j < res.count; j++)
+        {
+            wirePutString(&out, res.copies[j].server->ip);
+            wirePutU16(&out, (uint16_t)res.copies[j].server->client_port);
+            wirePutString(&out, res.copies[j].path);
+        }
+        wirePutU32(&out, leaseResolution(conn, path, &res, notify_port, &version));
+        wirePutU64(&out, version);
+    }
+    queueReply(conn, WIRE_OK, out.data, out.length);
+    wireBufferFree(&out);
+
+    snprintf(log_buf, sizeof(log_buf), "RESOLVE results: %u of %u paths", resolved, count);
+    log_message(conn->ip, conn->port, "Sent to Client:", log_buf);
+}
+
+// Append one "Path: ..., Type: ..." line to the LIST batch being built
+static int appendListEntry(const char *path, StorageServer *server, Node *node, void *arg)
+{
+    WireBuffer *batch = (WireBuffer *)arg;
+    char line[MAX_PATH_LENGTH + 32];
+    (void)server;
+    int length = snprintf(line, sizeof(line), "Path: %s, Type: %s\n", path,
+                          node && node->type == FILE_NODE ? "File" : "Directory");
+    wirePutBytes(batch, line, length);
+    return 0;
+}
+
+// Where a streamed LIST has got to
+typedef struct ListStream
+{
+    char prefix[MAX_PATH_LENGTH];
+    char cursor[MAX_PATH_LENGTH];
+    int max_depth;
+    uint32_t limit;
+    uint32_t sent;
+} ListStream;
+
+// Queue the next batch of a LIST, or its end. Called by the reactor while
+// the client keeps up; see ClientConnection.resume.
+static int continueList(ClientConnection *conn)
+{
+    ListStream *list = conn->resume_state;
+    int want = LIST_BATCH_ENTRIES;
+    if (list->limit && list->limit - list->sent < (uint32_t)want)
+        want = list->limit - list->sent;
+    WireBuffer batch;
+    wireBufferInit(&batch);
+    int found = pathIndexScan(path_index, list->prefix, list->cursor, list->max_depth, want, appendListEntry, &batch,
+                              list->cursor, sizeof(list->cursor));
+    int rc = found > 0 ? queueFrame(conn, OP_DATA, WIRE_OK, batch.data, batch.length) : 0;
+    wireBufferFree(&batch);
+    if (rc < 0)
+        return -1;
+    list->sent += found;
+    if (found < want)
+        list->cursor[0] = '\0'; // nothing left
+    else if (!list->limit || list->sent < list->limit)
+        return 0;
+
+    queueFrame(conn, OP_END, WIRE_OK, list->cursor, strlen(list->cursor));
+    char log_buf[64];
+    snprintf(log_buf, sizeof(log_buf), "LIST results: %u entries", list->sent);
+    log_message(conn->ip, conn->port, "Sent to Client:", log_buf);
+    free(list);
+    conn->resume_state = NULL;
+    conn->resume = NULL;
+    return 0;
+}
+
+// LIST streams its results: an OK reply, then OP_DATA batches of at most
+// LIST_BATCH_ENTRIES lines, then OP_END carrying the cursor to resume from
+// (empty once the listing is complete). Each batch is a separate short scan
+// of the path index, made only once the client has taken the previous ones,
+// so no lock is held and no worker waits while the client reads.
+static void handleList(ClientConnection *conn, WireReader *reader)
+{
+    char path[MAX_PATH_LENGTH];
+    ListStream *list = calloc(1, sizeof(ListStream));
+    if (!list)
+    {
+        replyError(conn, ERR_NO_MEMORY, "Out of memory!");
+        return;
+    }
+    wireGetString(reader, path, sizeof(path));
+    uint32_t max_depth = wireGetU32(reader); // 0: unlimited
+    list->limit = wireGetU32(reader);        // 0: everything that follows the cursor
+    wireGetString(reader, list->cursor, sizeof(list->cursor));
+    list->max_depth = max_depth ? (int)max_depth : -1;
+    if (reader->error || normalizePath(path, list->prefix, sizeof(list->prefix)) < 0)
+    {
+        free(list);
+        replyError(conn, ERR_INVALID, "Invalid command!");
+        return;
+    }
+    log_message(conn->ip, conn->port, "Received from Client: LIST", list->prefix);
+
+    if (strcmp(list->prefix, "/") == 0)
+    {
+        if (path_index->entries == 0)
+        {
+            free(list);
+            replyError(conn, ERR_EMPTY, "No Files or Directories found in the path.");
+            return;
+        }
+    }
+    else
+    {
+        StorageServer *server = pathIndexLookup(path_index, list->prefix, NULL);
+        if (!server || !server->active)
+        {
+            free(list);
+            replyError(conn, ERR_NOT_FOUND, "Path not found!");
+            return;
+        }
+    }
+    if (queueReply(conn, WIRE_OK, NULL, 0) < 0)
+    {
+        free(list);
+        return;
+    }
+    conn->resume_state = list;
+    conn->resume = continueList;
+}
+
+// Where a streamed FIND has got to
+typedef struct FindStream
+{
+    char prefix[MAX_PATH_LENGTH];
+    char glob[MAX_PATH_LENGTH];
+    char cursor[MAX_PATH_LENGTH];
+    uint32_t limit;
+    uint32_t sent;
+} FindStream;
+
+// Queue the next batch of a FIND, or its end. Like continueList, except
+// that a call may find nothing yet and still not be done.
+static int continueFind(ClientConnection *conn)
+{
+    FindStream *find = conn->resume_state;
+    int want = LIST_BATCH_ENTRIES;
+    if (find->limit && find->limit - find->sent < (uint32_t)want)
+        want = find->limit - find->sent;
+    WireBuffer batch;
+    wireBufferInit(&batch);
+    int found = pathIndexFind(path_index, find->prefix, find->glob, find->cursor, want, appendListEntry, &batch,
+                              find->cursor, sizeof(find->cursor));
+    int rc = found > 0 ? queueFrame(conn, OP_DATA, WIRE_OK, batch.data, batch.length) : 0;
+    wireBufferFree(&batch);
+    if (rc < 0)
+        return -1;
+    find->sent += found;
+    if (find->cursor[0] && (!find->limit || find->sent < find->limit))
+        return 0;
+
+    queueFrame(conn, OP_END, WIRE_OK, find->cursor, strlen(find->cursor));
+    char log_buf[64];
+    snprintf(log_buf, sizeof(log_buf), "FIND results: %u entries", find->sent);
+    log_message(conn->ip, conn->port, "Sent to Client:", log_buf);
+    free(find);
+    conn->resume_state = NULL;
+    conn->resume = NULL;
+    return 0;
+}
+
+// Stream back the paths below a prefix whose names match a glob, as LIST
+// does: an OK reply, OP_DATA batches found by short searches of the path
+// index as the client takes them, then OP_END with the cursor to resume
+// from (empty once the search is complete).
+static void handleFind(ClientConnection *conn, WireReader *reader)
+{
+    char path[MAX_PATH_LENGTH];
+    FindStream *find = calloc(1, sizeof(FindStream));
+    if (!find)
+    {
+        replyError(conn, ERR_NO_MEMORY, "Out of memory!");
+        return;
+    }
+    wireGetString(reader, path, sizeof(path));
+    wireGetString(reader, find->glob, sizeof(find->glob));
+    find->limit = wireGetU32(reader); // 0: every match
+    if (reader->offset < reader->length)
+        wireGetString(reader, find->cursor, sizeof(find->cursor));
+    if (reader->error || !find->glob[0] || normalizePath(path, find->prefix, sizeof(find->prefix)) < 0)
+    {
+        free(find);
+        replyError(conn, ERR_INVALID, "Invalid command!");
+        return;
+    }
+    log_message(conn->ip, conn->port, "Received from Client: FIND", find->glob);
+
+    if (strcmp(find->prefix, "/") != 0)
+    {
+        StorageServer *server = pathIndexLookup(path_index, find->prefix, NULL);
+        if (!server || !server->active)
+        {
+            free(find);
+            replyError(conn, ERR_NOT_FOUND, "Path not found!");
+            return;
+        }
+    }
+    if (queueReply(conn, WIRE_OK, NULL, 0) < 0)
+    {
+        free(find);
+        return;
+    }
+    conn->resume_state = find;
+    conn->resume = continueFind;
+}
+
+static void handleCreate(ClientConnection *conn, WireReader *reader)
+{
+    char path[MAX_PATH_LENGTH];
+    uint8_t type = wireGetU8(reader);
+    int ss_num = (int)wireGetU32(reader);
+    if (wireGetString(reader, path, sizeof(path)) < 0 || (type != FILE_NODE && type != DIRECTORY_NODE))
+    {
+        replyError(conn, ERR_INVALID, "Invalid Command CREATE type!");
+        return;
+    }
+    log_message(conn->ip, conn->port, "Received from Client: CREATE", path);
+
+    StorageServer *server;
+    if (ss_num == 0)
+    {
+        server = placeNewEntry(conn->table, path);
+        if (!server)
+        {
+            replyError(conn, ERR_INACTIVE, "No storage server can hold this path.");
+            return;
+        }
+        char placed[MAX_PATH_LENGTH + 64];
+        snprintf(placed, sizeof(placed), "Placed %s on storage server %d (%s)", path, server->id, placementPolicyName());
+        log_message(server->ip, server->nm_port, "Placement:", placed);
+    }
+    else
+    {
+        server = findStorageServerById(conn->table, ss_num);
+    }
+    if (!server)
+    {
+        replyError(conn, ERR_INACTIVE, "Storage Server not active.");
+        return;
+    }
+
+    // No per-server lock: requests to one storage server are pipelined
+    if (!isRoutable(server))
+    {
+        replyError(conn, ERR_INACTIVE, "Storage Server not active.");
+        return;
+    }
+
+    WireBuffer out;
+    wireBufferInit(&out);
+    wirePutU8(&out, type);
+    wirePutString(&out, path);
+    WireHeader reply;
+    char *respond = NULL;
+    int rc = storageServerRequest(server, OP_CREATE, &out, &reply, &respond);
+    wireBufferFree(&out);
+    if (rc < 0)
+    {
+        replyError(conn, ERR_INACTIVE, "Storage Server not active.");
+        return;
+    }
+    log_message(server->ip, server->nm_port, "Received from SS:", respond);
+
+    if (reply.status == WIRE_OK)
     {
-        server->id=existing_server->id;
-        unsigned int index = hashStorageServer(existing_server->ip, existing_server->nm_port);
-        pthread_mutex_lock(&table->locks[index]);
-        //add or correct it if already exist then dont increase the count just remove the older one and add new one
-        StorageServer *prev = NULL;
-        StorageServer *current = table->table[index];
-        while (current)
+        if (!namespaceCreate(server, path, (NodeType)type))
         {
-            if (current == existing_server)
-            {
-                if (prev)
-                    prev->next = current->next;
-                else
-                    table->table[index] = current->next;
-
-                // Free the existing server resources
-                close(existing_server->socket);
-                pthread_mutex_destroy(&existing_server->lock);
-                free(existing_server->root); // Assuming root needs to be freed
-                free(existing_server);
-
-                break;
-            }
-            prev = current;
-            current = current->next;
+            free(respond);
+            replyError(conn, ERR_PARENT_MISSING, "Parent Directory Missing!");
+            return;
         }
-        pthread_mutex_unlock(&table->locks[index]);
-        unsigned int index2 = hashStorageServer(server->ip, server->nm_port);
-        pthread_mutex_lock(&table->locks[index2]);
-        server->next = table->table[index2];
-        table->table[index2] = server;
-        pthread_mutex_unlock(&table->locks[index2]);
-        return server;
     }
-    table->count++;
-    server->id = table->count;
-    addStorageServer(table, server);
-    return server;
+    forwardReply(conn, &reply, respond);
+    free(respond);
 }
 
-// Thread function to handle storage server
-void *storageServerHandler(void *arg)
+static void handleDelete(ClientConnection *conn, WireReader *reader)
 {
-    StorageServer *server = (StorageServer *)arg;
-
-    while (1)
+    char path[MAX_PATH_LENGTH];
+    if (wireGetString(reader, path, sizeof(path)) < 0)
     {
-        char command[1024];
-        memset(command, 0, sizeof(command));
-        ssize_t bytes_received = recv(server->socket, command, sizeof(command) - 1, 0);
-
-        if (bytes_received <= 0)
-        {
-            pthread_mutex_lock(&server->lock);
-            server->active = false;
-            pthread_mutex_unlock(&server->lock);
-            printf("Storage server %s disconnected\n", server->ip);
-            log_message(server->ip, server->nm_port, "SS", "Storage Server Disconnected.");
-            break;
-        }
+        replyError(conn, ERR_INVALID, "Invalid Command!");
+        return;
+    }
+    log_message(conn->ip, conn->port, "Received from Client: DELETE", path);
 
-        command[bytes_received] = '\0';
-        // Handle storage server commands/updates
-        // Update the server's node tree as needed
+    StorageServer *server = findStorageServerByPath(path);
+    if (!server)
+    {
+        replyError(conn, ERR_NOT_FOUND, "Path not found!");
+        return;
     }
 
-    return NULL;
-}
+    // No per-server lock: requests to one storage server are pipelined
+    if (!isRoutable(server))
+    {
+        replyError(conn, ERR_INACTIVE, "Storage Server not active.");
+        return;
+    }
 
-void getFileName(const char *path, char **filename)
-{
-    if (!path || !filename)
+    WireBuffer out;
+    wireBufferInit(&out);
+    wirePutString(&out, path);
+    WireHeader reply;
+    char *respond = NULL;
+    int rc = storageServerRequest(server, OP_DELETE, &out, &reply, &respond);
+    wireBufferFree(&out);
+    if (rc < 0)
     {
-        printf("Error: Invalid path or filename pointer.\n");
+        replyError(conn, ERR_INACTIVE, "Storage Server not active.");
         return;
     }
+    log_message(server->ip, server->nm_port, "Received from SS:", respond);
 
-    const char *lastSlash = strrchr(path, '/');
-    *filename = lastSlash ? (char *)(lastSlash + 1) : (char *)path;
+    if (reply.status == WIRE_OK)
+    {
+        namespaceDelete(server, path);
+        revokeLeases(path);
+    }
+    forwardReply(conn, &reply, respond);
+    free(respond);
 }
 
-void *clientHandler(void *arg)
+// COPY <src> <dest>: dest is either an existing directory, or a path whose
+// parent directory receives the copy under the source's name
+static void handleCopy(ClientConnection *conn, WireReader *reader)
 {
-    struct
-    {
-        int socket;
-        StorageServerTable *table;
-    } *args = arg;
-    int client_socket = args->socket;
-    StorageServerTable *table = args->table;
-    char buffer[MAX_BUFFER_SIZE];
-    char command[20];
     char path[MAX_PATH_LENGTH];
     char dest_path[MAX_PATH_LENGTH];
-    ssize_t bytes_received;
-
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-
-    // Now, let's log the action (get client's IP and port)
-    if (getpeername(client_socket, (struct sockaddr *)&client_addr, &addr_len) == -1)
+    if (wireGetString(reader, path, sizeof(path)) < 0 || wireGetString(reader, dest_path, sizeof(dest_path)) < 0)
     {
-        perror("getpeername failed");
-        return NULL;
+        replyError(conn, ERR_INVALID, "Invalid Command!");
+        return;
+    }
+    log_message(conn->ip, conn->port, "Received from Client: COPY", path);
+
+    // Nodes may be freed once the namespace lock is dropped, and the request
+    // below blocks, so only their types are kept
+    StorageServer *source_server = findStorageServerByPath(path);
+    lockNamespace(false);
+    Node *source_node = source_server ? findNode(source_server->root, path) : NULL;
+    bool found = source_node != NULL;
+    NodeType source_type = found ? source_node->type : FILE_NODE;
+    unlockNamespace();
+    if (!found)
+    {
+        replyError(conn, ERR_NOT_FOUND, "Source Path not found!");
+        return;
     }
 
-    // Extract the client IP address and port
-    char client_ip[INET_ADDRSTRLEN];
-    int client_port;
-    get_ip_and_port(&client_addr, client_ip, &client_port);
-    while (1)
+    char dest_dir[MAX_PATH_LENGTH];
+    StorageServer *dest_server = findStorageServerByPath(dest_path);
+    if (dest_server)
     {
-        memset(buffer, 0, sizeof(buffer));
-        bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
-        buffer[bytes_received] = '\0';
-        log_message(client_ip, client_port, "Received from Client:", buffer);
-        if (sscanf(buffer, "%s %s", command, path) < 1)
-        {
-            send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid command!\n\0\033[0m",
-                 strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid command!\n\0\033[0m"), 0);
-            log_message(client_ip, client_port, "Sent to Client:", " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid command!\n\0\033[0m");
-            continue;
-        }
-        for (int i = 0; command[i]; i++)
+        lockNamespace(false);
+        Node *dest_node = findNode(dest_server->root, dest_path);
+        bool is_dir = dest_node && dest_node->type != FILE_NODE;
+        unlockNamespace();
+        if (!is_dir)
         {
-            command[i] = toupper(command[i]);
+            replyError(conn, ERR_NOT_DIRECTORY, "Destination Path is not a directory!");
+            return;
         }
-        printf("%s \n", path);
-        if (strcmp(command, "READ") == 0 || strcmp(command, "WRITE") == 0 || strcmp(command, "META") == 0 || strcmp(command, "STREAM") == 0)
+        snprintf(dest_dir, sizeof(dest_dir), "%s", dest_path);
+    }
+    else
+    {
+        // Destination server not found, check if parent directory exists
+        getParentPath(dest_path, dest_dir);
+        dest_server = findStorageServerByPath(dest_dir);
+        if (!dest_server)
         {
-            StorageServer *server = findStorageServerByPath(table, path);
-            if (!server || server->active != 1)
-            {
-                const char *error = " \033[1;31mERROR: 404\033[0m \033[38;5;214mPath not found!\n\0\033[0m";
-                send(client_socket, error, strlen(error), 0);
-                log_message(client_ip, client_port, "Sent to Client:", error);
-                printf("sent error\n");
-                fflush(stdout);
-                continue;
-            }
-            printf("%s\n", server->root->name);
-            pthread_mutex_lock(&server->lock);
-            char response[MAX_BUFFER_SIZE];
-            if (server->active)
-            {
-                printf("storage details %s %d\n", server->ip, server->client_port);
-                memset(response, 0, sizeof(response));
-                snprintf(response, sizeof(response), "StorageServer: %s : %d", server->ip, server->client_port);
-                send(client_socket, response, strlen(response), 0);
-                log_message(client_ip, client_port, "Sent to Client(SS Details):", response);
-            }
-            else
-            {
-                const char *error = " \033[1;31mERROR 402:\033[0m \033[38;5;214mStorge Server not active.\n\0\033[0m";
-                send(client_socket, error, strlen(error), 0);
-                log_message(client_ip, client_port, "Sent to Client:", error);
-            }
-            pthread_mutex_unlock(&server->lock);
+            replyError(conn, ERR_NOT_FOUND, "Destination Path not found!");
+            return;
         }
-        else if (sscanf(buffer, "LIST %s", path) == 1 || strncmp(buffer, "LIST", 4) == 0)
+        lockNamespace(false);
+        Node *parent_node = findNode(dest_server->root, dest_dir);
+        bool is_dir = parent_node && parent_node->type == DIRECTORY_NODE;
+        unlockNamespace();
+        if (!is_dir)
         {
-            char response[100001];
-            int response_offset = 0;
-            if (strcmp(buffer, "LIST") == 0)
-            {
-                for (int i = 0; i < TABLE_SIZE; i++)
-                {
-                    pthread_mutex_lock(&table->locks[i]);
-                    StorageServer *server = table->table[i];
-                    while (server)
-                    {
-                        if (server->active)
-                        {
-                            // Traverse the entire structure of this server
-                            recursiveList(server->root, "", response, &response_offset, sizeof(response));
-                        }
-                        server = server->next;
-                    }
-                    pthread_mutex_unlock(&table->locks[i]);
-                }
-                // Send the response with all the matching servers
-                if (response_offset > 0)
-                {
-                    send(client_socket, response, response_offset, 0); // Send the listing response to the client
-                    log_message(client_ip, client_port, "Sent to Client:", response);
-                }
-                else
-                {
-                    const char *error = " \033[1;31mERROR 401:\033[0m \033[38;5;214mNo Files or Directories found in the path.\n\0\033[0m";
-                    send(client_socket, error, strlen(error), 0);
-                    log_message(client_ip, client_port, "Sent to Client:", error);
-                }
-            }
-            else
-            {
-                StorageServerList *servers = findStorageServersByPath_List(table, path);
-                if (!servers)
-                {
-                    const char *error = " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\n\0\033[0m";
-                    send(client_socket, error, strlen(error), 0);
-                    log_message(client_ip, client_port, "Sent to Client:", error);
-
-                    continue;
-                }
-
-                // Iterate over all matching servers
-                for (StorageServerList *server_list = servers; server_list != NULL; server_list = server_list->next)
-                {
-                    StorageServer *server = server_list->server;
-                    pthread_mutex_lock(&server->lock);
-                    if (server->active)
-                    {
-                        // The path has been found in this server, now find the specified path inside the server
-                        Node *target_node = searchPath(server->root, path);
-                        if (!target_node)
-                        {
-                            const char *error = " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\n\0\033[0m";
-                            send(client_socket, error, strlen(error), 0);
-                            log_message(client_ip, client_port, "Sent to Client:", error);
-                            pthread_mutex_unlock(&server->lock);
-                            continue;
-                        }
-                        else
-                        {
-                            recursiveList(target_node, path, response, &response_offset, sizeof(response));
-                        }
-
-                        // If the path is a directory, list its immediate children
-                    }
-                    else
-                    {
-                        const char *error = " \033[1;31mERROR 402:\033[0m \033[38;5;214mStorage Server not active.\0\n\033[0m";
-                        send(client_socket, error, strlen(error), 0);
-                        log_message(client_ip, client_port, "Sent to Client:", error);
-                    }
-                    pthread_mutex_unlock(&server->lock);
-                }
-
-                // Send the response with all the matching servers
-                if (response_offset > 0)
-                {
-                    send(client_socket, response, response_offset, 0); // Send the listing response to the client
-                    log_message(client_ip, client_port, "Sent to Client:", response);
-                }
-                else
-                {
-                    const char *error = " \033[1;31mERROR 401:\033[0m \033[38;5;214mNo files or directories found in the path.\n\0\033[0m";
-                    send(client_socket, error, strlen(error), 0);
-                    log_message(client_ip, client_port, "Sent to Client:", error);
-                }
-
-                // Free the list of servers
-                while (servers)
-                {
-                    StorageServerList *tmp = servers;
-                    servers = servers->next;
-                    free(tmp);
-                }
-            }
+            replyError(conn, ERR_NOT_DIRECTORY, "Path is not a directory!");
+            return;
         }
+    }
 
-        else if (strcmp(command, "CREATE") == 0 || strcmp(command, "DELETE") == 0 || strcmp(command, "COPY") == 0)
-        {
-            // send(client_socket,command,sizeof(command),0);
-            char type[5];
-            int ss_num = -1;
-            if (sscanf(buffer, "CREATE %s %d %s", type, &ss_num, path) == 3)
-            {
-                if (strcmp(type, "FILE") == 0 || strcmp(type, "DIR") == 0)
-                {
-                    printf("%d \n", ss_num);
-                    StorageServer *server;
-                    for (int i = 0; i < TABLE_SIZE && ss_num != 0; i++)
-                    {
-                        pthread_mutex_lock(&table->locks[i]);
-                        server = table->table[i];
-                        int flag = 0;
-                        while (server)
-                        {
-                            if (server && server->id == ss_num)
-                            {
-                                // ss_num--;
-                                flag = 1;
-                                break;
-                            }
-                            server = server->next;
-                        }
-                        pthread_mutex_unlock(&table->locks[i]);
-                        if (flag)
-                            break;
-                    }
-                    if (server != NULL)
-                    {
-                        // printf("hii\n");
-                        pthread_mutex_lock(&server->lock);
-                        if (server->active)
-                        {
-                            char respond[100001];
-                            send(server->socket, buffer, strlen(buffer), 0);
-                            // recv(server->socket,buffer,sizeof(buffer),0);
-                            // send(server->socket,buffer,strlen(buffer),0);
-                            log_message(server->ip, server->nm_port, "Sent to SS:", buffer);
-                            memset(respond, 0, sizeof(respond));
-                            // printf("hyubnj\n");
-                            // usleep(10000);
-                            if (recv(server->socket, respond, sizeof(respond), 0) < 0)
-                            {
-                                perror("receive ns");
-                            }
-                            // printf(" hjbhjbj\n");
-                            log_message(server->ip, server->nm_port, "Received from SS:", respond);
-                            fflush(stdout);
-                            if (strncmp(respond, "CREATE DONE", 11) == 0)
-                            {
-                                // printf("yeahhh\n");
-                                char *lastSlash = strrchr(path, '/');
-                                if (!lastSlash)
-                                {
-                                    send(client_socket, " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\033[0m\n\0", strlen(" \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\033[0m\n\0"), 0);
-                                    log_message(client_ip, client_port, "Sent to Client:", " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\033[0m\n\0");
-                                    return NULL;
-                                }
-                                *lastSlash = '\0';
-                                char *name = lastSlash + 1;
-                                Node *parentDir = searchPath(server->root, path);
-                                *lastSlash = '/';
-                                if (!parentDir)
-                                {
-                                    send(client_socket, " \033[1;31mERROR 100:\033[0m \033[38;5;214mParent Directory Missing!\033[0m\n\0", strlen(" \033[1;31mERROR 100:\033[0m \033[38;5;214mParent Directory Missing!\033[0m\n\0"), 0);
-                                    log_message(client_ip, client_port, "Sent to Client:", " \033[1;31mERROR 100:\033[0m \033[38;5;214mParent Directory Missing!\033[0m\n\0");
-
-                                    return NULL;
-                                }
-                                NodeType typ;
-                                if (strcmp(type, "DIR") == 0)
-                                {
-                                    typ = DIRECTORY_NODE;
-                                }
-                                else
-                                {
-                                    typ = FILE_NODE;
-                                }
-                                Node *newNode = createNode(name, typ, READ | WRITE, path);
-                                newNode->parent = parentDir;
-                                insertNode(parentDir->children, newNode);
-                            }
-                            // printf("bhbbh\n");
-                            fflush(stdout);
-                            send(client_socket, respond, strlen(respond), 0);
-                            // printf("bhbbsgfsgh\n");
-                            fflush(stdout);
-                            log_message(client_ip, client_port, "Sent to Client:", respond);
-                        }
-                        else
-                        {
-                            const char *error = "Storage server is not active";
-                            send(client_socket, error, strlen(error), 0);
-                            log_message(client_ip, client_port, "Sent to Client:", error);
-                        }
-                        pthread_mutex_unlock(&server->lock);
-                    }
-                    else
-                    {
-                        // printf("bhbh\n");
-                        fflush(stdout);
-                        const char *error = " \033[1;31mERROR 402:\033[0m \033[38;5;214mStorage Server not active.\033[0m\n\0";
-                        send(client_socket, error, strlen(error), 0);
-                        log_message(client_ip, client_port, "Sent to Client:", error);
-                    }
-                }
-                else
-                {
-                    printf("else   \n");
-                    fflush(stdout);
-                    send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command CREATE type!\033[0m\n\0", strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command CREATE type!\033[0m\n\0"), 0);
-                    log_message(client_ip, client_port, "Sent to Client:", " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command CREATE type!\033[0m\n\0");
-                }
-                // }
-            }
-            else if (sscanf(buffer, "DELETE %s", path) == 1)
-            {
-                StorageServer *server = findStorageServerByPath(table, path);
-                if (!server)
-                {
-                    const char *error = " \033[1;31mERROR 404:\033[0m \033[38;5;214mPath not found!\033[0m\n\0";
-                    send(client_socket, error, strlen(error), 0);
-                    log_message(client_ip, client_port, "Sent to Client:", error);
-
-                    continue;
-                }
-                else
-                {
-                    printf("hiiii delete");
-                    pthread_mutex_lock(&server->lock);
-                    if (server->active)
-                    {
-                        char respond[100001];
-                        printf("server root %s\n", server->root->name);
-                        send(server->socket, buffer, strlen(buffer), 0);
-                        log_message(server->ip, server->nm_port, "Sent to SS:", buffer);
-
-                        memset(respond, 0, sizeof(respond));
-                        recv(server->socket, respond, sizeof(respond), 0);
-                        log_message(server->ip, server->nm_port, "Received from SS:", respond);
-
-                        printf("%s\n", respond);
-                        if (strcmp(respond, "DELETE DONE") == 0)
-                        {
-                            Node *nodeToDelete = searchPath(server->root, path);
-                            deleteNode(nodeToDelete);
-                            putLRUCache(cache, path, NULL);
-                        }
-                        send(client_socket, respond, strlen(respond), 0);
-                        log_message(client_ip, client_port, "Sent to Client:", respond);
-                    }
-                    else
-                    {
-                        const char *error = " \033[1;31mERROR 402:\033[0m \033[38;5;214mStorage Server not active.\033[0m\n\0";
-                        send(client_socket, error, strlen(error), 0);
-                        log_message(client_ip, client_port, "Sent to Client:", error);
-                    }
-                    pthread_mutex_unlock(&server->lock);
-                }
-            }
-            else if (sscanf(buffer, "COPY %s %s", path, dest_path) == 2)
-            {
-                StorageServer *source_server = findStorageServerByPath(table, path);
-                // printf("%s\n", source_server->root->name);
-                if (!source_server)
-                {
-                    const char *error = " \033[1;31mERROR 404:\033[0m \033[38;5;214mSource Path not found!\033[0m\n\0";
-                    send(client_socket, error, strlen(error), 0);
-                    log_message(client_ip, client_port, "Sent to Client:", error);
+    // The source server pushes the data to the destination server itself
+    WireBuffer out;
+    wireBufferInit(&out);
+    wirePutString(&out, path);
+    wirePutString(&out, dest_dir);
+    wirePutString(&out, dest_server->ip);
+    wirePutU16(&out, (uint16_t)dest_server->client_port);
+    WireHeader reply;
+    char *response = NULL;
+    int rc = storageServerRequest(source_server, OP_COPY, &out, &reply, &response);
+    wireBufferFree(&out);
+    if (rc < 0)
+    {
+        replyError(conn, ERR_INACTIVE, "Storage Server not active.");
+        return;
+    }
+    log_message(source_server->ip, source_server->nm_port, "Received from SS:", response);
+    if (reply.status != WIRE_OK)
+    {
+        forwardReply(conn, &reply, response);
+        free(response);
+        return;
+    }
+    free(response);
 
-                    continue;
-                }
-                Node *source_node = findNode(source_server->root, path);
-                if (!source_node)
-                {
-                    const char *error = " \033[1;31mERROR 404:\033[0m \033[38;5;214mSource Path not found!\033[0m\n\0";
-                    send(client_socket, error, strlen(error), 0);
-                    log_message(client_ip, client_port, "Sent to Client:", error);
-                    continue;
-                }
-                // printf("bansal maa ka loda\n");
-                StorageServer *dest_server = findStorageServerByPath(table, dest_path);
-                if (!dest_server)
-                {
-                    // Destination server not found, check if parent directory exists
-                    char parent_path[MAX_PATH_LENGTH];
-                    getParentPath(dest_path, parent_path);
+    if (!namespaceCopy(source_server, path, dest_server, dest_dir))
+    {
+        printf("Error: Destination path is not a valid directory\n");
+        replyError(conn, ERR_NOT_DIRECTORY, "Destination Path is not a valid Directory!");
+        return;
+    }
+    // Whatever was at the destination under the source's name is replaced
+    char copied[MAX_PATH_LENGTH * 2];
+    snprintf(copied, sizeof(copied), "%s/%s", dest_dir, strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
+    revokeLeases(copied);
+    replyMessage(conn, source_type == DIRECTORY_NODE ? "Directory copied successfully" : "File copied successfully");
+}
 
-                    dest_server = findStorageServerByPath(table, parent_path);
-                    if (!dest_server)
-                    {
-                        const char *error = " \033[1;31mERROR 404:\033[0m \033[38;5;214mDestination Path not found!\033[0m\n\0";
-                        send(client_socket, error, strlen(error), 0);
-                        log_message(client_ip, client_port, "Sent to Client:", error);
-                        continue;
-                    }
+static void handleStats(ClientConnection *conn, WireReader *reader)
+{
+    uint8_t format = wireGetU8(reader);
+    if (reader->error || (format != STATS_FORMAT_TEXT && format != STATS_FORMAT_JSON))
+    {
+        replyError(conn, ERR_INVALID, "Invalid Command STATS format!");
+        return;
+    }
+    log_message(conn->ip, conn->port, "Received from Client:", "STATS");
+    WireBuffer report;
+    wireBufferInit(&report);
+    formatStats(conn->table, format, &report);
+    queueReply(conn, WIRE_OK, report.data, report.length);
+    wireBufferFree(&report);
+}
 
-                    // Check if parent directory exists and is actually a directory
-                    Node *parent_node = findNode(dest_server->root, parent_path);
-                    if (!parent_node || parent_node->type != DIRECTORY_NODE)
-                    {
-                        const char *error = " \033[1;31mERROR 400:\033[0m \033[38;5;214mPath is not a directory!\033[0m\n\0";
-                        send(client_socket, error, strlen(error), 0);
-                        log_message(client_ip, client_port, "Sent to Client:", error);
-                        continue;
-                    }
-                    else
-                    {
-                        char init_cmd[MAX_BUFFER_SIZE];
-                        memset(buffer, 0, sizeof(buffer));
-                        snprintf(buffer, sizeof(buffer), "COPY %s %s", path, parent_path);
-                        send(source_server->socket, buffer, strlen(buffer), 0);
-                        log_message(source_server->ip, source_server->nm_port, "Sent to SS:", buffer);
-                        memset(init_cmd, 0, sizeof(init_cmd));
-                        recv(source_server->socket, init_cmd, sizeof(init_cmd), 0);
-                        log_message(source_server->ip, source_server->nm_port, "Received from SS:", init_cmd);
-
-                        char server_info[MAX_BUFFER_SIZE];
-                        memset(server_info, 0, sizeof(server_info));
-                        snprintf(server_info, sizeof(server_info), "SOURCE SERVER_INFO %s %d",
-                                 dest_server->ip, dest_server->client_port);
-                        send(source_server->socket, server_info, strlen(server_info), 0);
-                        log_message(source_server->ip, source_server->nm_port, "Sent to SS:", server_info);
-
-                        char response[100001];
-                        memset(response, 0, sizeof(response));
-                        recv(source_server->socket, response, sizeof(response), 0);
-                        log_message(source_server->ip, source_server->nm_port, "Received from SS:", response);
-
-                        if (strncmp(response, "COPY DONE", 9) == 0)
-                        {
-                            // implement logic to copy files and directrix from the source hast table to dest in the directrix we are copying the data
-                            if (source_node->type == DIRECTORY_NODE)
-                            {
-                                Node *destParentNode = findNode(dest_server->root, parent_path);
-                                if (!destParentNode || destParentNode->type != DIRECTORY_NODE)
-                                {
-                                    printf("Error: Destination path is not a valid directory\n");
-                                    const char *error = " \033[1;31mERROR 400:\033[0m \033[38;5;214mDestination Path is not a directory!\033[0m\n\0";
-                                    send(client_socket, error, strlen(error), 0);
-                                    log_message(client_ip, client_port, "Sent to Client:", error);
-                                    continue;
-                                }
-                                addDirectory(destParentNode, source_node->name, source_node->permissions);
-                                Node *newRootDir = searchNode(destParentNode->children, source_node->name);
-                                // Copy the contents of the source directory to the destination directory
-                                copyDirectoryContents(source_node, destParentNode);
-
-                                const char *success = "Directory copied successfully";
-                                send(client_socket, success, strlen(success), 0);
-                                log_message(client_ip, client_port, "Sent to Client:", success);
-                            }
-                            else
-                            {
-                                // Handle single file copy (using previous implementation)
-                                // char parent_path[MAX_PATH_LENGTH];
-                                // getParentPath(dest_path, parent_path);
-                                Node *destParentNode = findNode(dest_server->root, dest_path);
-                                addFile(destParentNode, source_node->name, source_node->permissions, source_node->dataLocation);
-                                // handleCopyOperation(source_node, destParentNode, dest_path);
-                                const char *success = "File copied successfully";
-                                send(client_socket, success, strlen(success), 0);
-                                log_message(client_ip, client_port, "Sent to Client:", success);
-                            }
-                        }
-                        send(client_socket, response, strlen(response), 0);
-                        log_message(client_ip, client_port, "Sent to Client:", response);
-                    }
-                }
-                else
-                {
-                    Node *dest_node = findNode(dest_server->root, dest_path);
-                    if (dest_node->type == FILE_NODE)
-                    {
-                        const char *error = " \033[1;31mERROR 400:\033[0m \033[38;5;214mDestination Path is not a directory!\033[0m\n\0";
-                        send(client_socket, error, strlen(error), 0);
-                        log_message(client_ip, client_port, "Sent to Client:", error);
+// Handle one framed client request (conn->request, conn->payload). Called by
+// a reactor worker; see reactor.c. Returns -1 to close the connection.
+int handleClientRequest(ClientConnection *conn)
+{
+    WireReader reader;
+    wireReaderInit(&reader, conn->payload, conn->request.length);
+    uint64_t start = statsNow();
 
-                        continue;
-                    }
-                    else
-                    {
-                        printf("hello\n");
-                        char init_cmd[MAX_BUFFER_SIZE];
-                        send(source_server->socket, buffer, strlen(buffer), 0);
-                        log_message(source_server->ip, source_server->nm_port, "Sent to SS:", buffer);
-                        memset(init_cmd, 0, sizeof(init_cmd));
-                        recv(source_server->socket, init_cmd, sizeof(init_cmd), 0);
-                        log_message(source_server->ip, source_server->nm_port, "Received from SS:", init_cmd);
-                        char server_info[MAX_BUFFER_SIZE];
-                        memset(server_info, 0, sizeof(server_info));
-                        snprintf(server_info, sizeof(server_info), "SOURCE SERVER_INFO %s %d",
-                                 dest_server->ip, dest_server->client_port);
-                        send(source_server->socket, server_info, strlen(server_info), 0);
-                        log_message(source_server->ip, source_server->nm_port, "Sent to SS:", server_info);
-
-                        char response[100001];
-                        memset(response, 0, sizeof(response));
-                        recv(source_server->socket, response, sizeof(response), 0);
-                        log_message(source_server->ip, source_server->nm_port, "Received from SS:", response);
-
-                        if (strncmp(response, "COPY DONE", 9) == 0)
-                        {
-                            // implement logic to copy files and directrix from the source hast table to dest in the directrix we are copying the data
-                            if (source_node->type == DIRECTORY_NODE)
-                            {
-                                printf("%s\n", dest_path);
-                                Node *destParentNode = findNode(dest_server->root, dest_path);
-                                if (!destParentNode || destParentNode->type != DIRECTORY_NODE)
-                                {
-                                    printf("Error: Destination path is not a valid directory\n");
-                                    const char *error = " \033[1;31mERROR 400:\033[0m \033[38;5;214mDestination Path is not a valid Directory!\033[0m\n\0";
-                                    send(client_socket, error, strlen(error), 0);
-                                    log_message(client_ip, client_port, "Sent to Client:", error);
-                                    continue;
-                                }
-                                addDirectory(destParentNode, source_node->name, source_node->permissions);
-                                Node *newRootDir = searchNode(destParentNode->children, source_node->name);
-                                // Copy the contents of the source directory to the destination directory
-                                copyDirectoryContents(source_node, newRootDir);
-
-                                const char *success = "Directory copied successfully";
-                                send(client_socket, success, strlen(success), 0);
-                                log_message(client_ip, client_port, "Sent to Client:", success);
-                            }
-                            else
-                            {
-                                // Handle single file copy (using previous implementation)
-                                // char parent_path[MAX_PATH_LENGTH];
-                                // getParentPath(dest_path, parent_path);
-                                Node *destParentNode = findNode(dest_server->root, dest_path);
-                                addFile(destParentNode, source_node->name, source_node->permissions, source_node->dataLocation);
-                                // handleCopyOperation(source_node, destParentNode, dest_path);
-                                const char *success = "File copied successfully";
-                                send(client_socket, success, strlen(success), 0);
-                                log_message(client_ip, client_port, "Sent to Client:", success);
-                            }
-                        }
-                        send(client_socket, response, strlen(response), 0);
-                        log_message(client_ip, client_port, "Received from Client:", response);
-                    }
-                }
-            }
-            else
-            {
-                send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n\0",
-                     strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n\0"), 0);
-                log_message(client_ip, client_port, "Sent to Client:", " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n\0");
-            }
-        }
-        else if (strcmp(command, "EXIT") == 0)
-        {
-            break;
-        }
-        else
-        {
-            send(client_socket, " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n\0",
-                 strlen(" \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n\0"), 0);
-            log_message(client_ip, client_port, "Sent to Client:", " \033[1;31mERROR 101:\033[0m \033[38;5;214mInvalid Command!\033[0m\n\0");
-        }
+    switch (conn->request.opcode)
+    {
+    case OP_LOOKUP:
+        handleLookup(conn, &reader);
+        statsRecord(STAT_LOOKUP, start);
+        break;
+    case OP_LIST:
+        handleList(conn, &reader);
+        statsRecord(STAT_LIST, start);
+        break;
+    case OP_CREATE:
+        handleCreate(conn, &reader);
+        statsRecord(STAT_CREATE, start);
+        break;
+    case OP_DELETE:
+        handleDelete(conn, &reader);
+        statsRecord(STAT_DELETE, start);
+        break;
+    case OP_COPY:
+        handleCopy(conn, &reader);
+        statsRecord(STAT_COPY, start);
+        break;
+    case OP_RESOLVE:
+        handleResolve(conn, &reader);
+        statsRecord(STAT_RESOLVE, start);
+        break;
+    case OP_FIND:
+        handleFind(conn, &reader);
+        statsRecord(STAT_FIND, start);
+        break;
+    case OP_STATS:
+        handleStats(conn, &reader);
+        break;
+    case OP_EXIT:
+        return -1;
+    default:
+        replyError(conn, ERR_INVALID, "Invalid Command!");
+        break;
     }
+    return 0;
 }
 
-// Function to receive all server information
-int receiveServerInfo(int sock, char *ip_out, int *nm_port_out, int *client_port_out, Node **root_out)
+// Function to receive all server information. If the fingerprint matches a
+// tree we already hold, *restored_out is set and no image is transferred;
+// otherwise the new tree is left in server->root.
+int receiveServerInfo(StorageServerTable *table, StorageServer *server, StorageServer **restored_out)
 {
-    char buffer[1024];
-    int bytes_received;
-    memset(buffer, 0, sizeof(buffer));
-    bytes_received = recv(sock, buffer, sizeof(buffer), 0);
-    if (bytes_received <= 0)
+    int sock = server->socket;
+    WireHeader hdr;
+    char *payload;
+    *restored_out = NULL;
+    if (recvFrame(sock, &hdr, &payload) < 0 || hdr.opcode != OP_REGISTER)
     {
         perror("Failed to receive data");
+        free(payload);
         return -1;
     }
     struct sockaddr_in ss_addr;
@@ -809,6 +1390,7 @@ int receiveServerInfo(int sock, char *ip_out, int *nm_port_out, int *client_port
     if (getpeername(sock, (struct sockaddr *)&ss_addr, &addr_len) == -1)
     {
         perror("getpeername failed");
+        free(payload);
         return -1;
     }
 
@@ -817,19 +1399,40 @@ int receiveServerInfo(int sock, char *ip_out, int *nm_port_out, int *client_port
     int ss_port;
     get_ip_and_port(&ss_addr, ss_ip, &ss_port);
 
+    WireReader reader;
+    wireReaderInit(&reader, payload, hdr.length);
+    wireGetString(&reader, server->ip, sizeof(server->ip));
+    server->nm_port = (int)wireGetU32(&reader);
+    server->client_port = (int)wireGetU32(&reader);
+    uint64_t fingerprint = wireGetU64(&reader);
+    free(payload);
+    if (reader.error)
+    {
+        sendError(sock, &hdr, ERR_INVALID, "Malformed registration");
+        return -1;
+    }
+
     // Log the message to the log file
-    log_message(ss_ip, ss_port, "Received from SS:", buffer);
-    // memset(buffer, 0 , sizeof(buffer));
-    memcpy(ip_out, buffer, 16);
-    memcpy(nm_port_out, buffer + 16, sizeof(int));
-    memcpy(client_port_out, buffer + 16 + sizeof(int), sizeof(int));
-    ip_out[15] = '\0';
-    send(sock, buffer, sizeof(buffer), 0);
-    log_message(ss_ip, ss_port, "Sent to SS:", buffer);
-
-    *root_out = receiveNodeChain(sock);
-    if (*root_out == NULL)
+    log_message(ss_ip, ss_port, "Received from SS: REGISTER", server->ip);
+    snprintf(server->peer_ip, sizeof(server->peer_ip), "%s", ss_ip);
+
+    *restored_out = findRestoredServer(table, server->ip, fingerprint);
+    uint8_t answer = *restored_out ? REGISTER_TREE_KNOWN : REGISTER_SEND_TREE;
+    sendReply(sock, &hdr, WIRE_OK, (const char *)&answer, 1);
+    if (*restored_out)
+    {
+        log_message(ss_ip, ss_port, "Sent to SS:", "REGISTER OK (namespace known)");
+        return 0;
+    }
+
+    server->root = receiveTreeImage(sock, ss_ip, ss_port);
+    if (server->root == NULL)
+    {
+        sendError(sock, &hdr, ERR_INVALID, "Malformed namespace image");
         return -1;
+    }
+    sendReply(sock, &hdr, WIRE_OK, NULL, 0);
+    log_message(ss_ip, ss_port, "Sent to SS:", "REGISTER OK");
 
     return 0;
 }
@@ -855,32 +1458,37 @@ void *storageServerAcceptor(void *arg)
         log_message(NULL, 0, "SS", "New Storage Server Connected!");
 
         // Handle the new storage server connection in a separate thread
+        uint64_t start = statsNow();
         StorageServer *server = handleNewStorageServer(storage_sock, server_table);
         if (!server)
         {
             printf("Failed to handle new storage server connection.\n");
-            log_message(NULL, 0, "SS", "Failed to handle new storage server connection.");
+            log_event(LOG_ERROR, NULL, 0, "SS", "Failed to handle new storage server connection.");
 
             close(storage_sock);
             continue;
         }
 
+        statsRecord(STAT_REGISTER, start);
+
         // Create a new thread to handle this storage server
         pthread_t server_thread;
         if (pthread_create(&server_thread, NULL, storageServerHandler, server) != 0)
         {
             perror("Failed to create storage server handler thread");
-            log_message(NULL, 0, "SS", "Failed to create storage server handler thread");
+            log_event(LOG_ERROR, NULL, 0, "SS", "Failed to create storage server handler thread");
 
             pthread_mutex_lock(&server->lock);
             server->active = false;
+            server->socket = -1;
             pthread_mutex_unlock(&server->lock);
             close(storage_sock);
             continue;
         }
 
-        // Detach the thread so it can clean up itself when done
-        pthread_detach(server_thread);
+        // Joined when the server registers again (see handleNewStorageServer)
+        server->handler = server_thread;
+        server->has_handler = true;
 
         printf("Storage server successfully registered:\n");
 
@@ -907,7 +1515,7 @@ void *storageServerAcceptor(void *arg)
 
         if(server_table->count >= 3)
         {
-            backup_data(server_table);
+            requestBackups();
         }
     }
 
@@ -946,12 +1554,84 @@ void get_local_ip(char *ip_buffer, size_t buffer_size)
     strncpy(ip_buffer, "Unknown", buffer_size);
 }
 
-pthread_t ackListenerThread;
-
-int main()
+int main(int argc, char *argv[])
 {
+    int cache_capacity = LRU_DEFAULT_CAPACITY;
+    int worker_count = defaultWorkerCount();
+    LogLevel log_level = LOG_INFO;
+    int stats_seconds = 0;
+    int storage_port = 0; // 0 picks a free port
+    int naming_port = 0;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "c:w:l:p:s:S:N:")) != -1)
+    {
+        switch (opt_char)
+        {
+        case 'c':
+            cache_capacity = atoi(optarg);
+            break;
+        case 'w':
+            worker_count = atoi(optarg);
+            break;
+        case 'l':
+            if (parseLogLevel(optarg, &log_level) < 0)
+            {
+                fprintf(stderr, "Invalid log level. Use debug, info, warn or error.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            if (setPlacementPolicy(optarg) < 0)
+            {
+                fprintf(stderr, "Invalid placement policy. Use least-used, two-choices or locality.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            stats_seconds = atoi(optarg);
+            break;
+        case 'S':
+            storage_port = atoi(optarg);
+            break;
+        case 'N':
+            naming_port = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c cache_capacity] [-w client_workers] [-l log_level] [-p placement_policy] [-s stats_seconds] [-S storage_port] [-N naming_port]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (cache_capacity <= 0)
+    {
+        fprintf(stderr, "Invalid cache capacity. Please enter a positive value.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (worker_count <= 0)
+    {
+        fprintf(stderr, "Invalid worker count. Please enter a positive value.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (stats_seconds < 0)
+    {
+        fprintf(stderr, "Invalid statistics interval. Please enter 0 or more seconds.\n");
+        exit(EXIT_FAILURE);
+    }
+    // Fixed ports let storage servers find a restarted naming server
+    if (storage_port < 0 || storage_port > 65535 || naming_port < 0 || naming_port > 65535)
+    {
+        fprintf(stderr, "Invalid port number. Please enter a value between 0 and 65535.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (startLogger(log_file_path, log_level) < 0)
+        exit(EXIT_FAILURE);
+    atexit(stopLogger); // flush queued lines on every exit path
+
     StorageServerTable *server_table = createStorageServerTable();
-    cache = createLRUCache(5);
+    cache = createLRUCache(cache_capacity);
+    path_index = createPathIndex();
+    if (openNamespaceStore(server_table) < 0)
+        exit(EXIT_FAILURE);
     int storage_server_fd, naming_server_fd;
     struct sockaddr_in storage_addr, naming_addr;
     int opt = 1;
@@ -960,25 +1640,25 @@ int main()
     if ((storage_server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
     {
         perror("Storage socket creation failed");
-        log_message(NULL, 0, "SS", "Storage socket creation failed");
+        log_event(LOG_ERROR, NULL, 0, "SS", "Storage socket creation failed");
         exit(EXIT_FAILURE);
     }
 
     if (setsockopt(storage_server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)))
     {
         perror("Set socket options failed");
-        log_message(NULL, 0, "SS", "Set socket options failed");
+        log_event(LOG_ERROR, NULL, 0, "SS", "Set socket options failed");
         exit(EXIT_FAILURE);
     }
 
     storage_addr.sin_family = AF_INET;
     storage_addr.sin_addr.s_addr = INADDR_ANY;
-    storage_addr.sin_port = 0;
+    storage_addr.sin_port = htons(storage_port);
 
     if (bind(storage_server_fd, (struct sockaddr *)&storage_addr, sizeof(storage_addr)) < 0)
     {
         perror("Storage bind failed");
-        log_message(NULL, 0, "SS", "Storage bind failed");
+        log_event(LOG_ERROR, NULL, 0, "SS", "Storage bind failed");
         exit(EXIT_FAILURE);
     }
 
@@ -986,14 +1666,14 @@ int main()
     if (getsockname(storage_server_fd, (struct sockaddr *)&storage_addr, &addr_len) < 0)
     {
         perror("Getsockname for storage server failed");
-        log_message(NULL, 0, "SS", "Getsockname for storage server failed");
+        log_event(LOG_ERROR, NULL, 0, "SS", "Getsockname for storage server failed");
         exit(EXIT_FAILURE);
     }
 
     if (listen(storage_server_fd, 10) < 0)
     {
         perror("Storage listen failed");
-        log_message(NULL, 0, "SS", "Storage listen failed");
+        log_event(LOG_ERROR, NULL, 0, "SS", "Storage listen failed");
         exit(EXIT_FAILURE);
     }
 
@@ -1007,7 +1687,7 @@ int main()
     if (pthread_create(&storage_acceptor_thread, NULL, storageServerAcceptor, args) != 0)
     {
         perror("Failed to create storage server acceptor thread");
-        log_message(NULL, 0, "SS", "Failed to create storage server acceptor thread");
+        log_event(LOG_ERROR, NULL, 0, "SS", "Failed to create storage server acceptor thread");
 
         free(args);
         close(storage_server_fd);
@@ -1017,26 +1697,25 @@ int main()
     // Detach the acceptor thread
     pthread_detach(storage_acceptor_thread);
 
+    pthread_t healthThread;
+    if (pthread_create(&healthThread, NULL, healthMonitor, server_table) != 0)
+    {
+        perror("Failed to create health monitor thread");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(healthThread);
+    if (startBackupWorker(server_table) < 0)
+        exit(EXIT_FAILURE);
+    if (startStatsSampler(server_table, stats_seconds) < 0)
+        exit(EXIT_FAILURE);
     if (pthread_create(&monitorThread, NULL, monitorWriteStates, NULL) != 0)
     {
         perror("Failed to create monitor thread");
         exit(EXIT_FAILURE);
     }
     pthread_detach(monitorThread);
-
-    if (pthread_create(&ackListenerThread, NULL, ackListener, NULL) != 0)
-    {
-        perror("Failed to create acknowledgment listener thread");
-        log_message(NULL, 0, "SS", "Failed to create acknowledgment listener thread");
-
+    if (startNotifier() < 0)
         exit(EXIT_FAILURE);
-    }
-
-    printf("Acknowledgment listener thread started.\n");
-    log_message(NULL, 0, "SS", "Acknowledgment listener thread started.");
-
-    // Detach the thread to allow independent execution
-    pthread_detach(ackListenerThread);
 
     // printf("Storage server acceptor started on port %d\n", STORAGE_PORT);
     // log_message(NULL, 0, "SS", "Storage server acceptor started on STORAGE_PORT");
@@ -1044,25 +1723,25 @@ int main()
     if ((naming_server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
     {
         perror("Naming socket creation failed");
-        log_message(NULL, 0, "NM", "Naming socket creation failed");
+        log_event(LOG_ERROR, NULL, 0, "NM", "Naming socket creation failed");
         exit(EXIT_FAILURE);
     }
 
     if (setsockopt(naming_server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)))
     {
         perror("Set naming socket options failed");
-        log_message(NULL, 0, "NM", "Set naming socket options failed");
+        log_event(LOG_ERROR, NULL, 0, "NM", "Set naming socket options failed");
         exit(EXIT_FAILURE);
     }
 
     naming_addr.sin_family = AF_INET;
     naming_addr.sin_addr.s_addr = INADDR_ANY;
-    naming_addr.sin_port = 0;
+    naming_addr.sin_port = htons(naming_port);
 
     if (bind(naming_server_fd, (struct sockaddr *)&naming_addr, sizeof(naming_addr)) < 0)
     {
         perror("Naming bind failed");
-        log_message(NULL, 0, "NM", "Naming bind failed");
+        log_event(LOG_ERROR, NULL, 0, "NM", "Naming bind failed");
         exit(EXIT_FAILURE);
     }
 
@@ -1070,41 +1749,29 @@ int main()
     if (getsockname(naming_server_fd, (struct sockaddr *)&naming_addr, &addr_len) < 0)
     {
         perror("Getsockname for naming server failed");
-        log_message(NULL, 0, "NM", "Getsockname for naming server failed");
+        log_event(LOG_ERROR, NULL, 0, "NM", "Getsockname for naming server failed");
         exit(EXIT_FAILURE);
     }
 
     if (listen(naming_server_fd, MAX_CLIENTS) < 0)
     {
         perror("Naming listen failed");
-        log_message(NULL, 0, "NM", "Naming listen failed");
+        log_event(LOG_ERROR, NULL, 0, "NM", "Naming listen failed");
         exit(EXIT_FAILURE);
     }
     char ip_buffer[INET_ADDRSTRLEN];
     get_local_ip(ip_buffer, sizeof(ip_buffer));
     int Storage_port = ntohs(storage_addr.sin_port);
     // inet_ntop(AF_INET, &(naming_addr.sin_addr), ip_buffer, INET_ADDRSTRLEN);
-    int naming_port=ntohs(naming_addr.sin_port);
+    naming_port = ntohs(naming_addr.sin_port);
     printf("IP: %s \nStorage_port :%d\nnaming_port :%d\n",ip_buffer,Storage_port,naming_port);
-    while (1)
+    ClientReactor *reactor = createClientReactor(naming_server_fd, server_table, worker_count);
+    if (!reactor)
     {
-        socklen_t storage_addrlen = sizeof(naming_addr);
-        int client_sock = accept(naming_server_fd, (struct sockaddr *)&naming_addr, &storage_addrlen);
-        if (client_sock < 0)
-            continue;
-
-        struct
-        {
-            int socket;
-            StorageServerTable *table;
-        } *args = malloc(sizeof(*args));
-        args->socket = client_sock;
-        args->table = server_table;
-
-        pthread_t client_thread;
-        pthread_create(&client_thread, NULL, clientHandler, args);
-        pthread_detach(client_thread);
+        log_event(LOG_ERROR, NULL, 0, "NM", "Failed to start client reactor");
+        exit(EXIT_FAILURE);
     }
+    runClientReactor(reactor);
 
     // Cleanup
     // freeNode(storage_info.root);
@@ -0,0 +1,364 @@
+#include "notify.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+typedef struct NoticeChannel
+{
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    WireBuffer queued;      // encoded frames not taken by the sender yet
+    bool ready;             // on the ready list
+    uint64_t down_until_ms; // unreachable; notices are dropped until then
+    uint64_t last_used_ms;
+    // Used by the sender thread only
+    int socket;           // -1 while not connected
+    bool connecting;      // non-blocking connect under way
+    WireBuffer sending;   // frames being written
+    size_t sent;          // bytes of sending already written
+    uint64_t deadline_ms; // the connect or the next write must get through by then
+    struct NoticeChannel *next; // same bucket
+    struct NoticeChannel *ready_next;
+} NoticeChannel;
+
+static NoticeChannel *buckets[NOTIFY_BUCKETS];
+static NoticeChannel *ready_head;
+static pthread_mutex_t notify_lock = PTHREAD_MUTEX_INITIALIZER;
+static int epoll_fd = -1;
+static int wake_fd = -1; // eventfd; written when a channel joins the ready list
+
+static uint64_t nowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static unsigned int bucketOf(const char *ip, int port)
+{
+    return (hash(ip) ^ (unsigned int)port * 2654435761u) % NOTIFY_BUCKETS;
+}
+
+// Queue one frame for a client's notice socket. Returns 0 once it is
+// queued, -1 if the client is unreachable or too far behind.
+int notifyClient(const char *clientIP, int clientPort, uint8_t opcode, const void *payload, size_t length)
+{
+    struct in_addr addr;
+    if (inet_pton(AF_INET, clientIP, &addr) <= 0)
+    {
+        fprintf(stderr, "Invalid client IP address: %s\n", clientIP);
+        log_event(LOG_WARN, NULL, 0, "Client", "Invalid client IP address");
+        return -1;
+    }
+    unsigned int bucket = bucketOf(clientIP, clientPort);
+    uint64_t now = nowMs();
+
+    pthread_mutex_lock(&notify_lock);
+    NoticeChannel *channel = buckets[bucket];
+    while (channel && (channel->port != clientPort || strcmp(channel->ip, clientIP) != 0))
+        channel = channel->next;
+    if (!channel)
+    {
+        channel = calloc(1, sizeof(NoticeChannel));
+        if (!channel)
+        {
+            pthread_mutex_unlock(&notify_lock);
+            return -1;
+        }
+        snprintf(channel->ip, sizeof(channel->ip), "%s", clientIP);
+        channel->port = clientPort;
+        channel->socket = -1;
+        channel->last_used_ms = now;
+        wireBufferInit(&channel->queued);
+        wireBufferInit(&channel->sending);
+        channel->next = buckets[bucket];
+        buckets[bucket] = channel;
+    }
+    if (channel->down_until_ms > now || channel->queued.length + WIRE_HEADER_SIZE + length > NOTIFY_MAX_QUEUED)
+    {
+        pthread_mutex_unlock(&notify_lock);
+        return -1;
+    }
+
+    WireHeader hdr = {WIRE_MAGIC, WIRE_VERSION, opcode, 0, WIRE_OK, 0, (uint32_t)length};
+    unsigned char raw[WIRE_HEADER_SIZE];
+    encodeHeader(&hdr, raw);
+    wirePutBytes(&channel->queued, raw, sizeof(raw));
+    wirePutBytes(&channel->queued, payload, length);
+    bool wake = false;
+    if (!channel->ready)
+    {
+        channel->ready = true;
+        channel->ready_next = ready_head;
+        ready_head = channel;
+        wake = true;
+    }
+    pthread_mutex_unlock(&notify_lock);
+
+    if (wake)
+    {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("Failed to wake notifier");
+    }
+    return 0;
+}
+
+// Wait for the socket to take more (or finish connecting), or for nothing
+static void watchChannel(NoticeChannel *channel, bool writable)
+{
+    struct epoll_event ev;
+    ev.events = writable ? EPOLLOUT : 0; // errors and hangups are reported regardless
+    ev.data.ptr = channel;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, channel->socket, &ev);
+}
+
+static void closeChannelSocket(NoticeChannel *channel)
+{
+    if (channel->socket < 0)
+        return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, channel->socket, NULL);
+    close(channel->socket);
+    channel->socket = -1;
+    channel->connecting = false;
+}
+
+// The client could not be reached, or stopped reading: drop what it was
+// sent and, for NOTIFY_RETRY_MS, whatever else comes for it
+static void failChannel(NoticeChannel *channel, uint64_t now)
+{
+    closeChannelSocket(channel);
+    wireBufferFree(&channel->sending);
+    channel->sent = 0;
+    pthread_mutex_lock(&notify_lock);
+    channel->down_until_ms = now + NOTIFY_RETRY_MS;
+    channel->last_used_ms = now;
+    channel->queued.length = 0;
+    pthread_mutex_unlock(&notify_lock);
+    log_event(LOG_DEBUG, channel->ip, channel->port, "Client", "Notice socket unreachable");
+}
+
+// Start a non-blocking connect. Returns -1 if it failed at once.
+static int connectChannel(NoticeChannel *channel, uint64_t now)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(channel->port);
+    inet_pton(AF_INET, channel->ip, &addr.sin_addr);
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(sock);
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = channel;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    channel->socket = sock;
+    channel->connecting = true;
+    channel->deadline_ms = now + NOTIFY_TIMEOUT_MS;
+    return 0;
+}
+
+// Write what the channel has, as far as its socket takes it without
+// blocking, picking up newly queued frames once the current ones are out
+static void pumpChannel(NoticeChannel *channel, uint64_t now)
+{
+    while (1)
+    {
+        if (channel->connecting)
+            return; // EPOLLOUT says when it is done
+        if (channel->sent == channel->sending.length)
+        {
+            wireBufferFree(&channel->sending);
+            channel->sent = 0;
+            pthread_mutex_lock(&notify_lock);
+            channel->sending = channel->queued;
+            wireBufferInit(&channel->queued);
+            channel->last_used_ms = now;
+            pthread_mutex_unlock(&notify_lock);
+            if (channel->sending.length == 0)
+            {
+                if (channel->socket >= 0)
+                    watchChannel(channel, false);
+                return;
+            }
+            channel->deadline_ms = now + NOTIFY_TIMEOUT_MS;
+        }
+        if (channel->socket < 0)
+        {
+            if (connectChannel(channel, now) < 0)
+                failChannel(channel, now);
+            continue;
+        }
+
+        ssize_t sent = send(channel->socket, channel->sending.data + channel->sent,
+                            channel->sending.length - channel->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            channel->sent += sent;
+            channel->deadline_ms = now + NOTIFY_TIMEOUT_MS;
+        }
+        else if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            watchChannel(channel, true);
+            return;
+        }
+        else
+        {
+            failChannel(channel, now);
+            return;
+        }
+    }
+}
+
+// An event on a channel's socket
+static void channelEvent(NoticeChannel *channel, uint32_t events, uint64_t now)
+{
+    if (channel->connecting)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(channel->socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+        {
+            failChannel(channel, now);
+            return;
+        }
+        channel->connecting = false;
+    }
+    else if ((events & (EPOLLERR | EPOLLHUP)) && channel->sent == channel->sending.length)
+    {
+        // The client went away between notices; the next one reconnects
+        closeChannelSocket(channel);
+        return;
+    }
+    pumpChannel(channel, now);
+}
+
+// Give up on connects and writes that made no progress in time, and close
+// and forget channels that have had nothing to send for a while
+static void sweepChannels(uint64_t now, bool idle_sweep)
+{
+    for (int i = 0; i < NOTIFY_BUCKETS; i++)
+    {
+        pthread_mutex_lock(&notify_lock);
+        NoticeChannel *stalled = NULL;
+        NoticeChannel **link = &buckets[i];
+        while (*link)
+        {
+            NoticeChannel *channel = *link;
+            bool busy = channel->connecting || channel->sent < channel->sending.length;
+            if (busy && channel->deadline_ms <= now && !stalled)
+                stalled = channel; // one per pass is plenty at this rate
+            if (!idle_sweep || busy || channel->ready || now - channel->last_used_ms < NOTIFY_IDLE_MS ||
+                channel->down_until_ms > now)
+            {
+                link = &channel->next;
+                continue;
+            }
+            *link = channel->next;
+            closeChannelSocket(channel);
+            wireBufferFree(&channel->queued);
+            wireBufferFree(&channel->sending);
+            free(channel);
+        }
+        pthread_mutex_unlock(&notify_lock);
+        if (stalled)
+            failChannel(stalled, now);
+    }
+}
+
+// Single sender thread: every socket is non-blocking and driven by epoll,
+// so a client that is slow or unreachable only holds up its own notices
+static void *notifier(void *arg)
+{
+    (void)arg;
+    struct epoll_event events[NOTIFY_MAX_EVENTS];
+    uint64_t last_sweep = nowMs();
+    uint64_t last_idle_sweep = last_sweep;
+    while (1)
+    {
+        int n = epoll_wait(epoll_fd, events, NOTIFY_MAX_EVENTS, NOTIFY_TICK_MS);
+        if (n < 0 && errno != EINTR)
+            perror("Notifier epoll_wait failed");
+        uint64_t now = nowMs();
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    perror("Failed to read notifier wakeup");
+            }
+            else
+            {
+                channelEvent((NoticeChannel *)events[i].data.ptr, events[i].events, now);
+            }
+        }
+
+        // Channels that had frames queued since; channels are only freed
+        // by this thread, so they stay valid once off the list
+        pthread_mutex_lock(&notify_lock);
+        NoticeChannel *batch = ready_head;
+        ready_head = NULL;
+        for (NoticeChannel *channel = batch; channel; channel = channel->ready_next)
+            channel->ready = false;
+        pthread_mutex_unlock(&notify_lock);
+        while (batch)
+        {
+            NoticeChannel *channel = batch;
+            batch = channel->ready_next;
+            pumpChannel(channel, now);
+        }
+
+        if (now - last_sweep >= NOTIFY_TICK_MS)
+        {
+            bool idle_sweep = now - last_idle_sweep >= NOTIFY_IDLE_MS / 2;
+            sweepChannels(now, idle_sweep);
+            last_sweep = now;
+            if (idle_sweep)
+                last_idle_sweep = now;
+        }
+    }
+    return NULL;
+}
+
+int startNotifier(void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0)
+    {
+        perror("Failed to set up notifier");
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0)
+    {
+        perror("Failed to set up notifier");
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, notifier, NULL) != 0)
+    {
+        perror("Failed to create notifier thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include "header.h"
+
+// Frames for clients' notice sockets (write acks, OP_INVALIDATE). Each
+// client gets one long-lived connection, opened on its first notice. Frames
+// are queued and written by a single sender thread over non-blocking
+// sockets, so whatever piles up while a write is under way goes out in the
+// next one and a slow client only delays its own notices. A client whose
+// connect or writes make no progress for NOTIFY_TIMEOUT_MS is given up on
+// for NOTIFY_RETRY_MS, and its notices are dropped meanwhile. A connection
+// that stays idle for NOTIFY_IDLE_MS is closed.
+
+#define NOTIFY_BUCKETS 256
+#define NOTIFY_MAX_QUEUED (1 << 20) // bytes waiting for one client before notices are dropped
+#define NOTIFY_TIMEOUT_MS 1000      // connect, or any progress on a pending write
+#define NOTIFY_RETRY_MS 1000
+#define NOTIFY_IDLE_MS 60000
+#define NOTIFY_TICK_MS 100 // how often stalled channels are checked
+#define NOTIFY_MAX_EVENTS 64
+
+int startNotifier(void);
+int notifyClient(const char *clientIP, int clientPort, uint8_t opcode, const void *payload, size_t length);
+
+#endif // NOTIFY_H
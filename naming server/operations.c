@@ -14,7 +14,10 @@ ssize_t readFile(Node *fileNode, char *buffer, size_t size)
         return -1;
     }
 
-    int fd = open(fileNode->dataLocation, O_RDONLY);
+    char location[PATH_MAX];
+    if (nodeLocation(fileNode, location, sizeof(location)) < 0)
+        return -1;
+    int fd = open(location, O_RDONLY);
     if (fd == -1)
     {
         perror("Error opening file");
@@ -55,7 +58,10 @@ ssize_t writeFile(Node *fileNode, const char *buffer, size_t size)
         flags |= O_TRUNC;
     }
 
-    int fd = open(fileNode->dataLocation, flags);
+    char location[PATH_MAX];
+    if (nodeLocation(fileNode, location, sizeof(location)) < 0)
+        return -1;
+    int fd = open(location, flags);
     if (fd == -1)
     {
         perror("Error opening file");
@@ -74,12 +80,13 @@ ssize_t writeFile(Node *fileNode, const char *buffer, size_t size)
 
 int getFileMetadata(Node *fileNode, struct stat *metadata)
 {
-    if (!fileNode || !fileNode->dataLocation)
+    char location[PATH_MAX];
+    if (!fileNode || nodeLocation(fileNode, location, sizeof(location)) < 0)
     {
         return -1;
     }
 
-    return stat(fileNode->dataLocation, metadata);
+    return stat(location, metadata);
 }
 
 ssize_t streamAudioFile(Node *fileNode, char *buffer, size_t size, off_t offset)
@@ -96,7 +103,10 @@ ssize_t streamAudioFile(Node *fileNode, char *buffer, size_t size, off_t offset)
         return -1;
     }
 
-    int fd = open(fileNode->dataLocation, O_RDONLY);
+    char location[PATH_MAX];
+    if (nodeLocation(fileNode, location, sizeof(location)) < 0)
+        return -1;
+    int fd = open(location, O_RDONLY);
     if (fd == -1)
     {
         perror("Error opening audio file");
@@ -137,8 +147,14 @@ Node *createEmptyNode(Node *parentDir, const char *name, NodeType type)
     }
 
     // Create the physical file/directory
+    char parentPath[PATH_MAX];
     char fullPath[PATH_MAX];
-    snprintf(fullPath, PATH_MAX, "%s/%s", parentDir->dataLocation, name);
+    if (nodeLocation(parentDir, parentPath, sizeof(parentPath)) < 0 ||
+        snprintf(fullPath, PATH_MAX, "%s/%s", parentPath, name) >= PATH_MAX)
+    {
+        printf("Error: Path too long\n");
+        return NULL;
+    }
 
     if (type == DIRECTORY_NODE)
     {
@@ -160,10 +176,7 @@ Node *createEmptyNode(Node *parentDir, const char *name, NodeType type)
     }
 
     // Create and insert the node
-    Node *newNode = createNode(name, type, READ | WRITE, fullPath);
-    newNode->parent = parentDir;
-    insertNode(parentDir->children, newNode);
-    return newNode;
+    return createChildNode(parentDir, name, type, READ | WRITE, fullPath);
 }
 
 int deleteNode(Node *node)
@@ -177,15 +190,11 @@ int deleteNode(Node *node)
     // Recursively delete all children if the node is a directory
     if (node->type == DIRECTORY_NODE && node->children)
     {
-        for (int i = 0; i < TABLE_SIZE; i++)
+        for (unsigned int i = 0; i < node->children->capacity; i++)
         {
-            Node *child = node->children->table[i];
-            while (child)
-            {
-                Node *next = child->next;
+            Node *child = nodeTableSlot(node->children, i);
+            if (child)
                 deleteNode(child);
-                child = next;
-            }
         }
     }
 
@@ -208,32 +217,12 @@ int deleteNode(Node *node)
     // }
 
     // Remove node from parent's hash table
-    unsigned int index = hash(node->name);
-    Node *current = node->parent->children->table[index];
-    Node *prev = NULL;
-
-    while (current != NULL)
+    if (removeNode(node->parent->children, node) != 0)
     {
-        if (current == node)
-        {
-            if (prev == NULL)
-            {
-                node->parent->children->table[index] = current->next;
-            }
-            else
-            {
-                prev->next = current->next;
-            }
-            free(node->name);
-            free(node->dataLocation);
-            free(node);
-            return 0;
-        }
-        prev = current;
-        current = current->next;
+        return -1;
     }
-
-    return -1;
+    freeNode(node);
+    return 0;
 }
 
 int copyNode(Node *sourceNode, Node *destDir, const char *newName)
@@ -245,10 +234,18 @@ int copyNode(Node *sourceNode, Node *destDir, const char *newName)
     }
 
     // Create destination path
+    char sourcePath[PATH_MAX];
+    char destDirPath[PATH_MAX];
     char destPath[PATH_MAX];
-    snprintf(destPath, PATH_MAX, "%s/%s",
-             destDir->dataLocation,
-             newName ? newName : sourceNode->name);
+    if (nodeLocation(sourceNode, sourcePath, sizeof(sourcePath)) < 0 ||
+        nodeLocation(destDir, destDirPath, sizeof(destDirPath)) < 0 ||
+        snprintf(destPath, PATH_MAX, "%s/%s",
+                 destDirPath,
+                 newName ? newName : sourceNode->name) >= PATH_MAX)
+    {
+        printf("Error: Invalid source or destination\n");
+        return -1;
+    }
 
     if (sourceNode->type == DIRECTORY_NODE)
     {
@@ -260,13 +257,11 @@ int copyNode(Node *sourceNode, Node *destDir, const char *newName)
         }
 
         // Create node in our file system
-        Node *newDir = createNode(newName ? newName : sourceNode->name,
-                                  DIRECTORY_NODE, sourceNode->permissions, destPath);
-        newDir->parent = destDir;
-        insertNode(destDir->children, newDir);
+        Node *newDir = createChildNode(destDir, newName ? newName : sourceNode->name,
+                                       DIRECTORY_NODE, sourceNode->permissions, destPath);
 
         // Copy contents recursively
-        DIR *dir = opendir(sourceNode->dataLocation);
+        DIR *dir = opendir(sourcePath);
         if (!dir)
         {
             perror("Error opening source directory");
@@ -292,7 +287,7 @@ int copyNode(Node *sourceNode, Node *destDir, const char *newName)
     {
         // Copy file contents
         char buffer[8192];
-        int sourceFd = open(sourceNode->dataLocation, O_RDONLY);
+        int sourceFd = open(sourcePath, O_RDONLY);
         int destFd = open(destPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
 
         if (sourceFd == -1 || destFd == -1)
@@ -321,9 +316,7 @@ int copyNode(Node *sourceNode, Node *destDir, const char *newName)
         close(destFd);
 
         // Create node in our file system
-        Node *newFile = createNode(newName ? newName : sourceNode->name, FILE_NODE, sourceNode->permissions, destPath);
-        newFile->parent = destDir;
-        insertNode(destDir->children, newFile);
+        createChildNode(destDir, newName ? newName : sourceNode->name, FILE_NODE, sourceNode->permissions, destPath);
     }
 
     return 0;
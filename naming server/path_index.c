@@ -0,0 +1,766 @@
+#include "path_index.h"
+#include <fnmatch.h>
+
+#define EXT_INITIAL_CAPACITY 64
+
+PathIndex *path_index;
+
+static PathIndexNode *createIndexNode(const char *label, int label_len)
+{
+    PathIndexNode *node = (PathIndexNode *)calloc(1, sizeof(PathIndexNode));
+    node->label = (char *)malloc(label_len + 1);
+    memcpy(node->label, label, label_len);
+    node->label[label_len] = '\0';
+    node->label_len = label_len;
+    return node;
+}
+
+static void freeIndexNode(PathIndexNode *node)
+{
+    for (int i = 0; i < node->child_count; i++)
+    {
+        freeIndexNode(node->children[i]);
+    }
+    free(node->children);
+    free(node->label);
+    free(node);
+}
+
+PathIndex *createPathIndex()
+{
+    PathIndex *index = (PathIndex *)malloc(sizeof(PathIndex));
+    index->root = createIndexNode("", 0);
+    index->entries = 0;
+    index->ext_capacity = EXT_INITIAL_CAPACITY;
+    index->ext_count = 0;
+    index->ext_buckets = calloc(index->ext_capacity, sizeof(ExtensionBucket *));
+    pthread_rwlock_init(&index->lock, NULL);
+    return index;
+}
+
+void freePathIndex(PathIndex *index)
+{
+    freeIndexNode(index->root);
+    for (int i = 0; i < index->ext_capacity; i++)
+    {
+        ExtensionBucket *bucket = index->ext_buckets[i];
+        while (bucket)
+        {
+            ExtensionBucket *next = bucket->next;
+            free(bucket->ext);
+            freeIndexNode(bucket->root);
+            free(bucket);
+            bucket = next;
+        }
+    }
+    free(index->ext_buckets);
+    pthread_rwlock_destroy(&index->lock);
+    free(index);
+}
+
+// Collapse repeated separators, force a leading '/' and drop any trailing '/'
+// so that "/a//b/" and "a/b" share a key. Returns the key length or -1.
+int normalizePath(const char *path, char *out, size_t size)
+{
+    size_t len = 0;
+    if (size < 2)
+        return -1;
+    out[len++] = '/';
+    for (const char *p = path; *p; p++)
+    {
+        if (*p == '/' && out[len - 1] == '/')
+            continue;
+        if (len + 1 >= size)
+            return -1;
+        out[len++] = *p;
+    }
+    if (len > 1 && out[len - 1] == '/')
+        len--;
+    out[len] = '\0';
+    return (int)len;
+}
+
+// Extension of the last component of key, or NULL if its name has none
+static const char *keyExtension(const char *key, int len)
+{
+    for (int i = len - 1; i >= 0 && key[i] != '/'; i--)
+    {
+        if (key[i] == '.')
+            return i + 1 < len ? key + i + 1 : NULL;
+    }
+    return NULL;
+}
+
+static ExtensionBucket *findExtension(PathIndex *index, const char *ext, int ext_len)
+{
+    char name[MAX_PATH_LENGTH];
+    snprintf(name, sizeof(name), "%.*s", ext_len, ext);
+    for (ExtensionBucket *bucket = index->ext_buckets[hash(name) & (index->ext_capacity - 1)]; bucket;
+         bucket = bucket->next)
+    {
+        if (strcmp(bucket->ext, name) == 0)
+            return bucket;
+    }
+    return NULL;
+}
+
+static void growExtensions(PathIndex *index)
+{
+    int capacity = index->ext_capacity * 2;
+    ExtensionBucket **buckets = calloc(capacity, sizeof(ExtensionBucket *));
+    for (int i = 0; i < index->ext_capacity; i++)
+    {
+        ExtensionBucket *bucket = index->ext_buckets[i];
+        while (bucket)
+        {
+            ExtensionBucket *next = bucket->next;
+            unsigned int slot = hash(bucket->ext) & (capacity - 1);
+            bucket->next = buckets[slot];
+            buckets[slot] = bucket;
+            bucket = next;
+        }
+    }
+    free(index->ext_buckets);
+    index->ext_buckets = buckets;
+    index->ext_capacity = capacity;
+}
+
+static PathIndexNode *trieInsert(PathIndexNode *root, const char *key, int len);
+static void trieRelease(PathIndexNode *node);
+
+static void addExtensionEntry(PathIndex *index, PathIndexNode *entry, const char *key, int len)
+{
+    const char *ext = keyExtension(key, len);
+    if (!ext)
+        return;
+    int ext_len = (int)(key + len - ext);
+    ExtensionBucket *bucket = findExtension(index, ext, ext_len);
+    if (!bucket)
+    {
+        if (index->ext_count >= index->ext_capacity)
+            growExtensions(index);
+        bucket = calloc(1, sizeof(ExtensionBucket));
+        bucket->ext = strndup(ext, ext_len);
+        bucket->root = createIndexNode("", 0);
+        unsigned int slot = hash(bucket->ext) & (index->ext_capacity - 1);
+        bucket->next = index->ext_buckets[slot];
+        index->ext_buckets[slot] = bucket;
+        index->ext_count++;
+    }
+    PathIndexNode *link = trieInsert(bucket->root, key, len);
+    link->ext_link = entry;
+    entry->ext = bucket;
+    entry->ext_link = link;
+    bucket->count++;
+}
+
+// Empty buckets are kept; the set of extensions in use stays small
+static void removeExtensionEntry(PathIndexNode *entry)
+{
+    ExtensionBucket *bucket = entry->ext;
+    if (!bucket)
+        return;
+    entry->ext_link->ext_link = NULL;
+    trieRelease(entry->ext_link);
+    bucket->count--;
+    entry->ext = NULL;
+    entry->ext_link = NULL;
+}
+
+static void clearEntry(PathIndex *index, PathIndexNode *node)
+{
+    if (!node->server)
+        return;
+    removeExtensionEntry(node);
+    node->server = NULL;
+    node->node = NULL;
+    index->entries--;
+}
+
+// Take count entries off node and every node above it
+static void subtractEntries(PathIndexNode *node, int count)
+{
+    for (; node; node = node->parent)
+        node->entries_below -= count;
+}
+
+// Free a detached subtree, dropping its entries from the counts
+static void dropSubtree(PathIndex *index, PathIndexNode *node)
+{
+    for (int i = 0; i < node->child_count; i++)
+    {
+        dropSubtree(index, node->children[i]);
+    }
+    node->child_count = 0;
+    clearEntry(index, node);
+    freeIndexNode(node);
+}
+
+// Binary search for the child whose label starts with byte c. On a miss,
+// *slot receives the position at which such a child would be inserted.
+static PathIndexNode *findChild(PathIndexNode *node, unsigned char c, int *slot)
+{
+    int lo = 0, hi = node->child_count - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        unsigned char first = (unsigned char)node->children[mid]->label[0];
+        if (first == c)
+        {
+            *slot = mid;
+            return node->children[mid];
+        }
+        if (first < c)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    *slot = lo;
+    return NULL;
+}
+
+static void insertChild(PathIndexNode *node, int slot, PathIndexNode *child)
+{
+    if (node->child_count == node->child_capacity)
+    {
+        node->child_capacity = node->child_capacity ? node->child_capacity * 2 : 2;
+        node->children = realloc(node->children, node->child_capacity * sizeof(PathIndexNode *));
+    }
+    memmove(&node->children[slot + 1], &node->children[slot], (node->child_count - slot) * sizeof(PathIndexNode *));
+    node->children[slot] = child;
+    node->child_count++;
+    child->parent = node;
+}
+
+static void removeChild(PathIndexNode *node, int slot)
+{
+    memmove(&node->children[slot], &node->children[slot + 1], (node->child_count - slot - 1) * sizeof(PathIndexNode *));
+    node->child_count--;
+}
+
+// Fold a valueless node with a single child into that child, or drop a
+// valueless leaf. A node of an extension's trie holds a value while it links
+// to an entry. Returns the node that now occupies parent->children[slot],
+// or NULL if the slot was removed.
+static PathIndexNode *compactChild(PathIndexNode *parent, int slot)
+{
+    PathIndexNode *node = parent->children[slot];
+    if (node->server || node->ext_link)
+        return node;
+    if (node->child_count == 0)
+    {
+        removeChild(parent, slot);
+        freeIndexNode(node);
+        return NULL;
+    }
+    if (node->child_count == 1)
+    {
+        PathIndexNode *child = node->children[0];
+        char *label = (char *)malloc(node->label_len + child->label_len + 1);
+        memcpy(label, node->label, node->label_len);
+        memcpy(label + node->label_len, child->label, child->label_len + 1);
+        free(child->label);
+        child->label = label;
+        child->label_len += node->label_len;
+        node->child_count = 0;
+        freeIndexNode(node);
+        parent->children[slot] = child;
+        child->parent = parent;
+        return child;
+    }
+    return node;
+}
+
+// node just lost its value: compact it and then, for as long as nodes are
+// dropped, its parents
+static void trieRelease(PathIndexNode *node)
+{
+    while (node->parent)
+    {
+        PathIndexNode *parent = node->parent;
+        int slot;
+        findChild(parent, (unsigned char)node->label[0], &slot);
+        if (compactChild(parent, slot))
+            return;
+        node = parent;
+    }
+}
+
+// The node for key below root, made if need be by adding a leaf or
+// splitting an edge
+static PathIndexNode *trieInsert(PathIndexNode *root, const char *key, int len)
+{
+    PathIndexNode *current = root;
+    int pos = 0;
+
+    while (pos < len)
+    {
+        int slot;
+        PathIndexNode *child = findChild(current, (unsigned char)key[pos], &slot);
+        if (!child)
+        {
+            child = createIndexNode(key + pos, len - pos);
+            insertChild(current, slot, child);
+            current = child;
+            pos = len;
+            break;
+        }
+
+        int common = 0;
+        while (common < child->label_len && pos + common < len && child->label[common] == key[pos + common])
+        {
+            common++;
+        }
+
+        if (common < child->label_len)
+        {
+            // Split the edge: the shared prefix becomes a new interior node
+            PathIndexNode *mid = createIndexNode(child->label, common);
+            mid->entries_below = child->entries_below;
+            memmove(child->label, child->label + common, child->label_len - common + 1);
+            child->label_len -= common;
+            insertChild(mid, 0, child);
+            current->children[slot] = mid;
+            mid->parent = current;
+            child = mid;
+        }
+        current = child;
+        pos += common;
+    }
+    return current;
+}
+
+static void insertLocked(PathIndex *index, const char *key, int len, StorageServer *server, Node *node)
+{
+    PathIndexNode *current = trieInsert(index->root, key, len);
+    if (current->server && current->server != server && current->server->active)
+    {
+        // The path is already served by another live storage server. Ours
+        // is indexed again if that one is removed (see reindexServers).
+        return;
+    }
+    if (!current->server)
+    {
+        index->entries++;
+        addExtensionEntry(index, current, key, len);
+        for (PathIndexNode *node = current; node; node = node->parent)
+            node->entries_below++;
+    }
+    current->server = server;
+    current->node = node;
+}
+
+void pathIndexInsert(PathIndex *index, const char *path, StorageServer *server, Node *node)
+{
+    char key[MAX_PATH_LENGTH];
+    int len = normalizePath(path, key, sizeof(key));
+    if (len < 0)
+        return;
+
+    pthread_rwlock_wrlock(&index->lock);
+    insertLocked(index, key, len, server, node);
+    pthread_rwlock_unlock(&index->lock);
+}
+
+StorageServer *pathIndexLookup(PathIndex *index, const char *path, Node **node_out)
+{
+    char key[MAX_PATH_LENGTH];
+    int len = normalizePath(path, key, sizeof(key));
+    if (node_out)
+        *node_out = NULL;
+    if (len < 0)
+        return NULL;
+
+    pthread_rwlock_rdlock(&index->lock);
+    PathIndexNode *current = index->root;
+    int pos = 0;
+    while (current && pos < len)
+    {
+        int slot;
+        PathIndexNode *child = findChild(current, (unsigned char)key[pos], &slot);
+        if (!child || pos + child->label_len > len || memcmp(child->label, key + pos, child->label_len) != 0)
+        {
+            current = NULL;
+            break;
+        }
+        pos += child->label_len;
+        current = child;
+    }
+
+    StorageServer *server = NULL;
+    if (current && current->server)
+    {
+        server = current->server;
+        if (node_out)
+            *node_out = current->node;
+    }
+    pthread_rwlock_unlock(&index->lock);
+    return server;
+}
+
+// Clear every entry owned by server below node, compacting as we unwind.
+// Returns the number of entries cleared.
+static int removeServerEntries(PathIndex *index, PathIndexNode *node, StorageServer *server)
+{
+    int removed = 0;
+    for (int i = node->child_count - 1; i >= 0; i--)
+    {
+        removed += removeServerEntries(index, node->children[i], server);
+        compactChild(node, i);
+    }
+    if (node->server == server)
+    {
+        clearEntry(index, node);
+        removed++;
+    }
+    node->entries_below -= removed;
+    return removed;
+}
+
+// Remove the entry for path and every entry beneath it ("path/...")
+void pathIndexRemoveSubtree(PathIndex *index, const char *path)
+{
+    char key[MAX_PATH_LENGTH];
+    int len = normalizePath(path, key, sizeof(key));
+    if (len < 0)
+        return;
+
+    pthread_rwlock_wrlock(&index->lock);
+    if (len == 1)
+    {
+        // "/" covers the whole namespace
+        dropSubtree(index, index->root);
+        index->root = createIndexNode("", 0);
+        pthread_rwlock_unlock(&index->lock);
+        return;
+    }
+
+    // Remember the descent so that emptied nodes can be compacted bottom-up
+    PathIndexNode *parents[MAX_PATH_LENGTH];
+    int slots[MAX_PATH_LENGTH];
+    int depth = 0;
+    PathIndexNode *current = index->root;
+    int pos = 0;
+
+    while (pos < len)
+    {
+        int slot;
+        PathIndexNode *child = findChild(current, (unsigned char)key[pos], &slot);
+        if (!child)
+        {
+            pthread_rwlock_unlock(&index->lock);
+            return;
+        }
+        int remaining = len - pos;
+        int common = remaining < child->label_len ? remaining : child->label_len;
+        if (memcmp(child->label, key + pos, common) != 0)
+        {
+            pthread_rwlock_unlock(&index->lock);
+            return;
+        }
+        if (common < child->label_len)
+        {
+            // The key ends inside this edge: only a '/' continuation is a descendant
+            if (child->label[common] == '/')
+            {
+                subtractEntries(current, child->entries_below);
+                removeChild(current, slot);
+                dropSubtree(index, child);
+            }
+            current = NULL;
+            break;
+        }
+        parents[depth] = current;
+        slots[depth] = slot;
+        depth++;
+        current = child;
+        pos += common;
+    }
+
+    if (current)
+    {
+        int slot;
+        PathIndexNode *descendants = findChild(current, '/', &slot);
+        subtractEntries(current, (current->server ? 1 : 0) + (descendants ? descendants->entries_below : 0));
+        clearEntry(index, current);
+        if (descendants)
+        {
+            removeChild(current, slot);
+            dropSubtree(index, descendants);
+        }
+    }
+
+    while (depth > 0)
+    {
+        depth--;
+        compactChild(parents[depth], slots[depth]);
+    }
+    pthread_rwlock_unlock(&index->lock);
+}
+
+static void joinPath(const char *parent, const char *name, char *out, size_t size)
+{
+    char joined[MAX_PATH_LENGTH * 2];
+    snprintf(joined, sizeof(joined), "%s/%s", parent, name);
+    if (normalizePath(joined, out, size) < 0)
+        out[0] = '\0';
+}
+
+static void addSubtreeLocked(PathIndex *index, StorageServer *server, Node *node, const char *key)
+{
+    insertLocked(index, key, strlen(key), server, node);
+    if (node->type != DIRECTORY_NODE || !node->children)
+        return;
+
+    for (unsigned int i = 0; i < node->children->capacity; i++)
+    {
+        Node *child = nodeTableSlot(node->children, i);
+        if (!child)
+            continue;
+        char child_key[MAX_PATH_LENGTH];
+        joinPath(key, child->name, child_key, sizeof(child_key));
+        if (child_key[0])
+            addSubtreeLocked(index, server, child, child_key);
+    }
+}
+
+// Index node and all of its descendants, with node living at path
+void pathIndexAddSubtree(PathIndex *index, StorageServer *server, Node *node, const char *path)
+{
+    char key[MAX_PATH_LENGTH];
+    if (!node || normalizePath(path, key, sizeof(key)) < 0)
+        return;
+
+    pthread_rwlock_wrlock(&index->lock);
+    addSubtreeLocked(index, server, node, key);
+    pthread_rwlock_unlock(&index->lock);
+}
+
+// Index a freshly registered storage server's whole tree
+void pathIndexAddServer(PathIndex *index, StorageServer *server)
+{
+    pathIndexAddSubtree(index, server, server->root, "/");
+}
+
+// Drop every path owned by server (re-registration or replacement)
+void pathIndexRemoveServer(PathIndex *index, StorageServer *server)
+{
+    pthread_rwlock_wrlock(&index->lock);
+    removeServerEntries(index, index->root, server);
+    pthread_rwlock_unlock(&index->lock);
+}
+
+// Walk down from root to the node whose key first covers the whole prefix,
+// copying that key to key and its length to *key_len. NULL if no key starts
+// with prefix. Called with the lock held.
+static PathIndexNode *descendToPrefix(PathIndexNode *root, const char *prefix, int len, char *key, int *key_len)
+{
+    PathIndexNode *current = root;
+    int pos = 0;
+    while (current && pos < len)
+    {
+        int slot;
+        PathIndexNode *child = findChild(current, (unsigned char)prefix[pos], &slot);
+        int common = child ? (len - pos < child->label_len ? len - pos : child->label_len) : 0;
+        if (!child || memcmp(child->label, prefix + pos, common) != 0 || pos + child->label_len >= MAX_PATH_LENGTH)
+            return NULL;
+        memcpy(key + pos, child->label, child->label_len);
+        pos += child->label_len;
+        current = child;
+    }
+    *key_len = pos;
+    return current;
+}
+
+typedef struct ScanState
+{
+    char key[MAX_PATH_LENGTH]; // key of the node being visited
+    char prefix[MAX_PATH_LENGTH];
+    int prefix_len;
+    char after[MAX_PATH_LENGTH]; // resume strictly after this key; "" starts at the beginning
+    int after_len;
+    int max_depth;    // < 0 for unlimited
+    const char *glob; // only names matching it are visited (FIND); NULL for all
+    int budget;       // nodes to walk before stopping (FIND); 0 for no bound
+    bool by_extension; // walking an extension's trie, whose nodes link to the entries
+    int walked;
+    int limit;
+    int count;
+    bool stopped;
+    PathIndexVisitor visit;
+    void *arg;
+    char *last;
+    size_t last_size;
+} ScanState;
+
+// Set up s for a scan below prefix. Returns -1 if prefix is not a valid path.
+static int initScan(ScanState *s, const char *prefix, const char *after, int limit, PathIndexVisitor visit, void *arg,
+                    char *last, size_t last_size)
+{
+    memset(s, 0, sizeof(*s));
+    s->prefix_len = normalizePath(prefix, s->prefix, sizeof(s->prefix));
+    if (s->prefix_len < 0)
+        return -1;
+    // after may be the caller's last buffer, which the scan overwrites
+    snprintf(s->after, sizeof(s->after), "%s", after ? after : "");
+    s->after_len = strlen(s->after);
+    s->max_depth = -1;
+    s->limit = limit;
+    s->visit = visit;
+    s->arg = arg;
+    s->last = last;
+    s->last_size = last_size;
+    return 0;
+}
+
+// Depth of key[0..len) below the scanned prefix: the prefix itself is 0 and
+// each further path component adds one
+static int scanDepth(const ScanState *s, int len)
+{
+    if (len <= s->prefix_len)
+        return 0;
+    int depth = s->key[s->prefix_len] == '/' ? 0 : 1; // "/" is followed by a name directly
+    for (int i = s->prefix_len; i < len; i++)
+    {
+        if (s->key[i] == '/')
+            depth++;
+    }
+    return depth;
+}
+
+// Whether the path key[0..len) is one the scan reports
+static bool scanWants(const ScanState *s, const char *key, int len)
+{
+    if (!s->glob)
+        return len >= s->prefix_len;
+    // FIND reports what is strictly below the prefix, by name
+    if (len <= s->prefix_len)
+        return false;
+    return fnmatch(s->glob, strrchr(key, '/') + 1, 0) == 0;
+}
+
+static void scanNode(ScanState *s, PathIndexNode *node, int len, bool check_cursor)
+{
+    // Keys that merely extend the prefix ("/ab" for "/a") are not below it
+    if (len > s->prefix_len && s->prefix_len > 1 && s->key[s->prefix_len] != '/')
+        return;
+    if (s->max_depth >= 0 && scanDepth(s, len) > s->max_depth)
+        return;
+
+    bool emit = true;
+    if (check_cursor)
+    {
+        int n = len < s->after_len ? len : s->after_len;
+        int cmp = memcmp(s->key, s->after, n);
+        if (cmp < 0 || (cmp == 0 && len <= s->after_len && node->child_count == 0))
+            return; // the whole subtree sorts at or before the cursor
+        if (cmp == 0 && len <= s->after_len)
+            emit = false; // this key is a prefix of the cursor, only some descendants follow it
+        else
+            check_cursor = false; // everything below sorts after the cursor
+    }
+
+    s->key[len] = '\0';
+    PathIndexNode *entry = s->by_extension ? node->ext_link : node;
+    if (emit && entry && entry->server && entry->server->active && scanWants(s, s->key, len))
+    {
+        s->count++;
+        snprintf(s->last, s->last_size, "%s", s->key);
+        if (s->visit(s->key, entry->server, entry->node, s->arg) != 0 || s->count >= s->limit)
+        {
+            s->stopped = true;
+            return;
+        }
+    }
+    if (emit && s->budget && ++s->walked >= s->budget)
+    {
+        // Out of time for this call: the next one resumes below this key
+        snprintf(s->last, s->last_size, "%s", s->key);
+        s->stopped = true;
+        return;
+    }
+
+    for (int i = 0; i < node->child_count && !s->stopped; i++)
+    {
+        PathIndexNode *child = node->children[i];
+        if (len + child->label_len >= MAX_PATH_LENGTH)
+            continue;
+        memcpy(s->key + len, child->label, child->label_len);
+        scanNode(s, child, len + child->label_len, check_cursor);
+    }
+}
+
+// Visit, in byte order, up to limit paths at or below prefix that sort after
+// the cursor `after`, descending at most max_depth components (< 0 for no
+// limit). The read lock is held only for this call, so a long listing is
+// taken as a series of short scans; the last visited key is copied to last
+// as the cursor for the next one. Returns the number of paths visited.
+int pathIndexScan(PathIndex *index, const char *prefix, const char *after, int max_depth, int limit,
+                  PathIndexVisitor visit, void *arg, char *last, size_t last_size)
+{
+    ScanState s;
+    if (limit <= 0 || initScan(&s, prefix, after, limit, visit, arg, last, last_size) < 0)
+        return 0;
+    s.max_depth = max_depth;
+
+    pthread_rwlock_rdlock(&index->lock);
+    int pos;
+    PathIndexNode *current = descendToPrefix(index->root, s.prefix, s.prefix_len, s.key, &pos);
+    if (current)
+        scanNode(&s, current, pos, s.after_len > 0);
+    pthread_rwlock_unlock(&index->lock);
+    return s.count;
+}
+
+// The extension every name matching glob must have, when the glob ends in a
+// literal ".ext"; NULL when any name could match
+static const char *globExtension(const char *glob)
+{
+    const char *dot = strrchr(glob, '.');
+    if (!dot || dot[1] == '\0' || strpbrk(dot + 1, "*?[]\\/"))
+        return NULL;
+    return dot + 1;
+}
+
+// Visit, in byte order, up to limit paths below prefix whose name matches
+// glob (fnmatch syntax) and that sort after the cursor `after`. Like
+// pathIndexScan, each call is one short hold of the read lock: a walk of
+// the prefix's subtree stops after FIND_SCAN_BUDGET nodes even if nothing
+// matched. A glob ending in a literal extension is answered from that
+// extension's trie instead, under the same budget, when it has fewer
+// entries than there are below the prefix. The cursor for the next call is copied to last, or ""
+// once there is nothing left. Returns the number of paths visited.
+int pathIndexFind(PathIndex *index, const char *prefix, const char *glob, const char *after, int limit,
+                  PathIndexVisitor visit, void *arg, char *last, size_t last_size)
+{
+    ScanState s;
+    if (limit <= 0 || initScan(&s, prefix, after, limit, visit, arg, last, last_size) < 0)
+    {
+        if (last_size > 0)
+            last[0] = '\0';
+        return 0;
+    }
+    s.glob = glob;
+    s.budget = FIND_SCAN_BUDGET;
+
+    pthread_rwlock_rdlock(&index->lock);
+    int pos;
+    PathIndexNode *top = descendToPrefix(index->root, s.prefix, s.prefix_len, s.key, &pos);
+    const char *ext = globExtension(glob);
+    ExtensionBucket *bucket = top && ext ? findExtension(index, ext, strlen(ext)) : NULL;
+    if (!top || (ext && !bucket))
+        ; // nothing below the prefix, or no name has the extension
+    else if (bucket && bucket->count < top->entries_below)
+    {
+        s.by_extension = true;
+        PathIndexNode *start = descendToPrefix(bucket->root, s.prefix, s.prefix_len, s.key, &pos);
+        if (start)
+            scanNode(&s, start, pos, s.after_len > 0);
+    }
+    else
+        scanNode(&s, top, pos, s.after_len > 0);
+    pthread_rwlock_unlock(&index->lock);
+    if (!s.stopped && last_size > 0)
+        last[0] = '\0';
+    return s.count;
+}
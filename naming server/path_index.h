@@ -0,0 +1,70 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include "header.h"
+
+// Namespace-wide index: a compressed (radix) trie over normalized client
+// paths ("/dir/file"), mapping each path to the storage server that owns it
+// and the Node describing it. Lookups cost O(path length) regardless of how
+// many storage servers are registered.
+//
+// Entries are also grouped by extension (what follows the last '.' of the
+// name), so FIND "*.mp3" can touch only the paths ending in ".mp3" when
+// there are fewer of those than paths below the prefix searched. Each
+// extension keeps a trie of its own over those paths, so they are walked
+// in order and a FIND resumes by descending to its cursor.
+typedef struct PathIndexNode
+{
+    char *label; // edge label leading into this node
+    int label_len;
+    struct PathIndexNode *parent;
+    struct PathIndexNode **children; // sorted by first byte of label
+    int child_count;
+    int child_capacity;
+    StorageServer *server; // NULL if no path terminates here
+    Node *node;
+    int entries_below; // entries at or below this node
+    struct ExtensionBucket *ext; // bucket holding this entry, if its name has an extension
+    // Between an entry and its node in ext->root, both ways; NULL elsewhere
+    struct PathIndexNode *ext_link;
+} PathIndexNode;
+
+typedef struct ExtensionBucket
+{
+    char *ext;
+    PathIndexNode *root; // the entries' keys; a key's node links to its entry
+    int count;
+    struct ExtensionBucket *next;
+} ExtensionBucket;
+
+typedef struct PathIndex
+{
+    PathIndexNode *root;
+    pthread_rwlock_t lock;
+    int entries;
+    ExtensionBucket **ext_buckets; // chained hash table by extension
+    int ext_capacity;              // power of two
+    int ext_count;
+} PathIndex;
+
+#define FIND_SCAN_BUDGET 4096 // index nodes one pathIndexFind call walks at most
+
+// Called for each path visited by pathIndexScan; a nonzero return stops the scan
+typedef int (*PathIndexVisitor)(const char *path, StorageServer *server, Node *node, void *arg);
+
+extern PathIndex *path_index;
+
+PathIndex *createPathIndex();
+void freePathIndex(PathIndex *index);
+int normalizePath(const char *path, char *out, size_t size);
+void pathIndexInsert(PathIndex *index, const char *path, StorageServer *server, Node *node);
+StorageServer *pathIndexLookup(PathIndex *index, const char *path, Node **node_out);
+void pathIndexRemoveSubtree(PathIndex *index, const char *path);
+void pathIndexAddSubtree(PathIndex *index, StorageServer *server, Node *node, const char *path);
+void pathIndexAddServer(PathIndex *index, StorageServer *server);
+void pathIndexRemoveServer(PathIndex *index, StorageServer *server);
+int pathIndexScan(PathIndex *index, const char *prefix, const char *after, int max_depth, int limit,
+                  PathIndexVisitor visit, void *arg, char *last, size_t last_size);
+int pathIndexFind(PathIndex *index, const char *prefix, const char *glob, const char *after, int limit,
+                  PathIndexVisitor visit, void *arg, char *last, size_t last_size);
+#endif // PATH_INDEX_H
@@ -0,0 +1,131 @@
+#include "placement.h"
+#include "namespace_store.h"
+
+typedef StorageServer *(*PlacementFn)(StorageServer **candidates, int count, StorageServer *parent_owner);
+
+// Fraction of the file system in use; a server that has not reported yet
+// counts as full
+static double usage(const StorageServer *server)
+{
+    if (server->total_bytes == 0)
+        return 1.0;
+    return 1.0 - (double)server->free_bytes / (double)server->total_bytes;
+}
+
+static StorageServer *leastUsed(StorageServer **candidates, int count, StorageServer *parent_owner)
+{
+    (void)parent_owner;
+    StorageServer *best = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        StorageServer *server = candidates[i];
+        if (!best || usage(server) < usage(best) ||
+            (usage(server) == usage(best) && server->file_count < best->file_count))
+            best = server;
+    }
+    return best;
+}
+
+static double placementScore(const StorageServer *server)
+{
+    return usage(server) + PLACEMENT_LOAD_WEIGHT * (server->load_inflight + server->load_assigned);
+}
+
+static StorageServer *twoChoices(StorageServer **candidates, int count, StorageServer *parent_owner)
+{
+    (void)parent_owner;
+    if (count == 1)
+        return candidates[0];
+    int a = random() % count;
+    int b = random() % (count - 1);
+    if (b >= a)
+        b++;
+    return placementScore(candidates[a]) <= placementScore(candidates[b]) ? candidates[a] : candidates[b];
+}
+
+static StorageServer *locality(StorageServer **candidates, int count, StorageServer *parent_owner)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (candidates[i] == parent_owner)
+            return parent_owner;
+    }
+    return leastUsed(candidates, count, NULL);
+}
+
+static const struct
+{
+    const char *name;
+    PlacementFn place;
+} policies[] = {
+    {"least-used", leastUsed},
+    {"two-choices", twoChoices},
+    {"locality", locality},
+};
+
+static int current_policy = 0;
+
+int setPlacementPolicy(const char *name)
+{
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+    {
+        if (strcmp(policies[i].name, name) == 0)
+        {
+            current_policy = (int)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *placementPolicyName(void)
+{
+    return policies[current_policy].name;
+}
+
+// Choose the storage server for a new entry at path, NULL when none can
+// take it
+StorageServer *placeNewEntry(StorageServerTable *table, const char *path)
+{
+    const char *lastSlash = strrchr(path, '/');
+    if (!lastSlash || lastSlash[1] == '\0')
+        return NULL;
+    char parent_path[MAX_PATH_LENGTH];
+    snprintf(parent_path, sizeof(parent_path), "%.*s", (int)(lastSlash - path), path);
+    StorageServer *parent_owner = parent_path[0] ? findStorageServerByPath(parent_path) : NULL;
+
+    // Namespace lock first, see by_id_lock
+    lockNamespace(false);
+    pthread_rwlock_rdlock(&table->by_id_lock);
+    StorageServer **candidates = malloc((table->by_id_capacity + 1) * sizeof(StorageServer *));
+    int count = 0, roomy = 0;
+    for (int id = 0; id < table->by_id_capacity; id++)
+    {
+        StorageServer *server = table->by_id[id];
+        if (!server || !isRoutable(server) || !server->root)
+            continue;
+        Node *parent = parent_path[0] ? searchPath(server->root, parent_path) : server->root;
+        if (!parent || parent->type != DIRECTORY_NODE || searchNode(parent->children, lastSlash + 1))
+            continue;
+        // Servers with room go first; the rest only count if none has any
+        if (server->free_bytes >= PLACEMENT_MIN_FREE)
+        {
+            candidates[count++] = candidates[roomy];
+            candidates[roomy++] = server;
+        }
+        else
+        {
+            candidates[count++] = server;
+        }
+    }
+    pthread_rwlock_unlock(&table->by_id_lock);
+    unlockNamespace();
+
+    StorageServer *chosen = NULL;
+    if (count > 0)
+        chosen = policies[current_policy].place(candidates, roomy > 0 ? roomy : count, parent_owner);
+    free(candidates);
+    if (chosen)
+        __atomic_add_fetch(&chosen->load_assigned, 1, __ATOMIC_RELAXED);
+    return chosen;
+}
@@ -0,0 +1,28 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include "header.h"
+
+// Where CREATE puts a new entry when the client leaves the choice to the
+// naming server (storage server id 0). Only healthy servers whose
+// namespace holds the parent directory can take it; among those the
+// placement policy decides, using the capacity and load each storage
+// server reports with its heartbeats:
+//
+//   least-used   most free space, then fewest files
+//   two-choices  the better of two servers picked at random, by space and
+//                load; spreads a burst of creates between heartbeats
+//   locality     the server that resolves the parent directory, so a
+//                directory's entries stay together; least-used otherwise
+//
+// Servers with less than PLACEMENT_MIN_FREE bytes left are passed over
+// while any other can take the entry.
+
+#define PLACEMENT_MIN_FREE (64ULL * 1024 * 1024)
+#define PLACEMENT_LOAD_WEIGHT 0.05 // usage fraction one queued request is worth
+
+int setPlacementPolicy(const char *name);
+const char *placementPolicyName(void);
+StorageServer *placeNewEntry(StorageServerTable *table, const char *path);
+
+#endif // PLACEMENT_H
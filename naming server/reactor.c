@@ -0,0 +1,316 @@
+#include "reactor.h"
+#include <sys/epoll.h>
+
+int defaultWorkerCount()
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < REACTOR_MIN_WORKERS)
+        cores = REACTOR_MIN_WORKERS;
+    return (int)cores;
+}
+
+static ClientConnection *createConnection(int socket, struct sockaddr_in *addr, StorageServerTable *table)
+{
+    ClientConnection *conn = (ClientConnection *)calloc(1, sizeof(ClientConnection));
+    if (!conn)
+        return NULL;
+    conn->socket = socket;
+    conn->table = table;
+    wireBufferInit(&conn->input);
+    wireBufferInit(&conn->output);
+    get_ip_and_port(addr, conn->ip, &conn->port);
+    return conn;
+}
+
+static void closeConnection(ClientReactor *reactor, ClientConnection *conn)
+{
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->socket, NULL);
+    close(conn->socket);
+    wireBufferFree(&conn->input);
+    wireBufferFree(&conn->output);
+    free(conn->resume_state);
+    free(conn);
+}
+
+// While replies are waiting, wait for room to write them rather than for
+// more requests: a client that does not read is not served further
+static int armConnection(ClientReactor *reactor, ClientConnection *conn, int op)
+{
+    struct epoll_event ev;
+    ev.events = (conn->output.length > conn->output_sent ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    return epoll_ctl(reactor->epoll_fd, op, conn->socket, &ev);
+}
+
+static void pushReady(ClientReactor *reactor, ClientConnection *conn)
+{
+    pthread_mutex_lock(&reactor->ready_lock);
+    conn->next = NULL;
+    if (reactor->ready_tail)
+        reactor->ready_tail->next = conn;
+    else
+        reactor->ready_head = conn;
+    reactor->ready_tail = conn;
+    pthread_cond_signal(&reactor->ready_cond);
+    pthread_mutex_unlock(&reactor->ready_lock);
+}
+
+static ClientConnection *popReady(ClientReactor *reactor)
+{
+    pthread_mutex_lock(&reactor->ready_lock);
+    while (!reactor->ready_head)
+        pthread_cond_wait(&reactor->ready_cond, &reactor->ready_lock);
+    ClientConnection *conn = reactor->ready_head;
+    reactor->ready_head = conn->next;
+    if (!reactor->ready_head)
+        reactor->ready_tail = NULL;
+    pthread_mutex_unlock(&reactor->ready_lock);
+    return conn;
+}
+
+// Write as much queued output as the socket takes without blocking; the
+// buffer is dropped once it has all gone out
+static void flushOutput(ClientConnection *conn)
+{
+    while (!conn->broken && conn->output_sent < conn->output.length)
+    {
+        ssize_t sent = send(conn->socket, conn->output.data + conn->output_sent,
+                            conn->output.length - conn->output_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent > 0)
+            conn->output_sent += sent;
+        else if (sent < 0 && errno == EINTR)
+            continue;
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else
+            conn->broken = true;
+    }
+    wireBufferFree(&conn->output);
+    conn->output_sent = 0;
+}
+
+static int queueFrameFlags(ClientConnection *conn, uint8_t opcode, uint16_t status, uint16_t flags,
+                           const void *payload, uint32_t length)
+{
+    if (conn->broken)
+        return -1;
+    WireHeader hdr = {WIRE_MAGIC, WIRE_VERSION, opcode, conn->request.request_id, status, flags, length};
+    unsigned char raw[WIRE_HEADER_SIZE];
+    encodeHeader(&hdr, raw);
+    wirePutBytes(&conn->output, raw, sizeof(raw));
+    if (length)
+        wirePutBytes(&conn->output, payload, length);
+    // Small replies usually go out here and then
+    flushOutput(conn);
+    return conn->broken ? -1 : 0;
+}
+
+int queueFrame(ClientConnection *conn, uint8_t opcode, uint16_t status, const void *payload, uint32_t length)
+{
+    return queueFrameFlags(conn, opcode, status, 0, payload, length);
+}
+
+int queueReply(ClientConnection *conn, uint16_t status, const void *payload, uint32_t length)
+{
+    return queueFrameFlags(conn, conn->request.opcode, status, WIRE_FLAG_REPLY, payload, length);
+}
+
+// Read what has arrived without blocking. Returns 1 once the client has
+// closed its end or the socket failed, else 0.
+static int readInput(ClientConnection *conn)
+{
+    char chunk[REACTOR_READ_CHUNK];
+    while (conn->input.length < MAX_BUFFER_SIZE)
+    {
+        ssize_t bytes_received = recv(conn->socket, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (bytes_received > 0)
+        {
+            wirePutBytes(&conn->input, chunk, bytes_received);
+            continue;
+        }
+        if (bytes_received < 0 && errno == EINTR)
+            continue;
+        return bytes_received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    }
+    return 0;
+}
+
+// Serve a ready connection: read what has arrived, then alternately write
+// out queued replies and produce more (the next step of a streamed reply,
+// else the next complete frame) until the client stops taking them or
+// there is nothing left to do. Frames may arrive split or back to back; a
+// partial frame waits for the next wakeup, and frames behind a streamed
+// reply wait for it to finish.
+static void serveConnection(ClientReactor *reactor, ClientConnection *conn)
+{
+    int closed = readInput(conn);
+    size_t offset = 0;
+    while (1)
+    {
+        flushOutput(conn);
+        if (conn->broken)
+            break;
+        if (conn->output.length - conn->output_sent >= REACTOR_OUTPUT_HIGH)
+            break;
+        if (conn->resume)
+        {
+            if (conn->resume(conn) < 0)
+                conn->broken = true;
+            continue;
+        }
+        if (conn->input.length - offset < WIRE_HEADER_SIZE)
+            break;
+
+        WireHeader hdr;
+        if (decodeHeader((unsigned char *)conn->input.data + offset, &hdr) < 0 ||
+            hdr.length > MAX_BUFFER_SIZE - WIRE_HEADER_SIZE)
+        {
+            log_event(LOG_WARN, conn->ip, conn->port, "Client", "Malformed frame, closing connection.");
+            closeConnection(reactor, conn);
+            return;
+        }
+        if (conn->input.length - offset < WIRE_HEADER_SIZE + hdr.length)
+            break;
+
+        conn->request = hdr;
+        conn->payload = conn->input.data + offset + WIRE_HEADER_SIZE;
+        offset += WIRE_HEADER_SIZE + hdr.length;
+        if (handleClientRequest(conn) < 0)
+        {
+            closeConnection(reactor, conn);
+            return;
+        }
+    }
+
+    // Keep only the unhandled bytes; an idle connection keeps no buffer
+    if (offset == conn->input.length)
+    {
+        wireBufferFree(&conn->input);
+    }
+    else if (offset > 0)
+    {
+        memmove(conn->input.data, conn->input.data + offset, conn->input.length - offset);
+        conn->input.length -= offset;
+    }
+
+    if (conn->broken)
+    {
+        log_event(LOG_DEBUG, conn->ip, conn->port, "Client", "Write failed, closing connection.");
+        closeConnection(reactor, conn);
+        return;
+    }
+    if (closed)
+    {
+        log_message(conn->ip, conn->port, "Client", "Client Disconnected.");
+        closeConnection(reactor, conn);
+        return;
+    }
+    if (armConnection(reactor, conn, EPOLL_CTL_MOD) < 0)
+        closeConnection(reactor, conn);
+}
+
+static void *reactorWorker(void *arg)
+{
+    ClientReactor *reactor = (ClientReactor *)arg;
+    while (1)
+    {
+        serveConnection(reactor, popReady(reactor));
+    }
+    return NULL;
+}
+
+ClientReactor *createClientReactor(int listen_fd, StorageServerTable *table, int worker_count)
+{
+    ClientReactor *reactor = (ClientReactor *)calloc(1, sizeof(ClientReactor));
+    reactor->listen_fd = listen_fd;
+    reactor->table = table;
+    reactor->worker_count = worker_count > 0 ? worker_count : defaultWorkerCount();
+    pthread_mutex_init(&reactor->ready_lock, NULL);
+    pthread_cond_init(&reactor->ready_cond, NULL);
+
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epoll_fd < 0)
+    {
+        perror("epoll_create1 failed");
+        free(reactor);
+        return NULL;
+    }
+
+    // The listener is level-triggered and drained by the loop thread itself
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+    {
+        perror("epoll_ctl on listener failed");
+        close(reactor->epoll_fd);
+        free(reactor);
+        return NULL;
+    }
+
+    reactor->workers = (pthread_t *)malloc(reactor->worker_count * sizeof(pthread_t));
+    for (int i = 0; i < reactor->worker_count; i++)
+    {
+        if (pthread_create(&reactor->workers[i], NULL, reactorWorker, reactor) != 0)
+        {
+            perror("Failed to create reactor worker");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(reactor->workers[i]);
+    }
+    return reactor;
+}
+
+static void acceptClients(ClientReactor *reactor)
+{
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int client_sock = accept(reactor->listen_fd, (struct sockaddr *)&client_addr, &addr_len);
+        if (client_sock < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("Client accept failed");
+            return;
+        }
+
+        ClientConnection *conn = createConnection(client_sock, &client_addr, reactor->table);
+        if (!conn)
+        {
+            close(client_sock);
+            continue;
+        }
+        if (armConnection(reactor, conn, EPOLL_CTL_ADD) < 0)
+        {
+            perror("epoll_ctl on client failed");
+            close(client_sock);
+            free(conn);
+        }
+    }
+}
+
+// Event loop; never returns
+void runClientReactor(ClientReactor *reactor)
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    printf("Client reactor running with %d workers\n", reactor->worker_count);
+    while (1)
+    {
+        int n = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno != EINTR)
+                perror("epoll_wait failed");
+            continue;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == NULL)
+                acceptClients(reactor);
+            else
+                pushReady(reactor, (ClientConnection *)events[i].data.ptr);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "header.h"
+
+#define REACTOR_MAX_EVENTS 64
+#define REACTOR_MIN_WORKERS 2
+#define REACTOR_READ_CHUNK 4096
+#define REACTOR_OUTPUT_HIGH (256 * 1024) // queued reply bytes before a connection stops producing more
+
+// State kept for one client session. Both buffers are allocated only while
+// they hold data and are only touched by the worker currently serving the
+// connection, so an idle client costs one small struct instead of a thread
+// and its stack.
+typedef struct ClientConnection
+{
+    int socket;
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    StorageServerTable *table;
+    WireBuffer input;   // bytes received but not yet handled
+    WireBuffer output;  // frames queued but not yet written
+    size_t output_sent; // bytes of output already written
+    bool broken;        // a write failed; the connection is closed once served
+    WireHeader request; // frame currently being handled
+    const char *payload;
+    // A reply streamed in steps (LIST, FIND): called again whenever the
+    // queued output has drained below REACTOR_OUTPUT_HIGH, until it clears
+    // resume. Returns -1 to close the connection.
+    int (*resume)(struct ClientConnection *conn);
+    void *resume_state; // freed with the connection
+    struct ClientConnection *next; // ready queue link
+} ClientConnection;
+
+// Client sockets are multiplexed by one epoll loop and handed to a fixed pool
+// of workers. Sockets are armed with EPOLLONESHOT, so a connection is served
+// by at most one worker at a time and is re-armed once its request is done.
+// Workers may block on storage server round-trips without stalling the loop,
+// but never on a client: replies are queued and written as the socket
+// accepts them, with EPOLLOUT armed while some are left.
+typedef struct ClientReactor
+{
+    int epoll_fd;
+    int listen_fd;
+    StorageServerTable *table;
+    int worker_count;
+    pthread_t *workers;
+    ClientConnection *ready_head;
+    ClientConnection *ready_tail;
+    pthread_mutex_t ready_lock;
+    pthread_cond_t ready_cond;
+} ClientReactor;
+
+ClientReactor *createClientReactor(int listen_fd, StorageServerTable *table, int worker_count);
+void runClientReactor(ClientReactor *reactor);
+int defaultWorkerCount();
+
+// Serve the frame in conn->request / conn->payload. Returns 0 to keep the
+// connection open, -1 to close it.
+int handleClientRequest(ClientConnection *conn);
+
+// Queue a frame for the client. Return -1 once the connection is broken.
+int queueFrame(ClientConnection *conn, uint8_t opcode, uint16_t status, const void *payload, uint32_t length);
+int queueReply(ClientConnection *conn, uint16_t status, const void *payload, uint32_t length);
+#endif // REACTOR_H
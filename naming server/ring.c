@@ -0,0 +1,102 @@
+#include "header.h"
+
+static uint32_t pointHash(int id, int vnode)
+{
+    char key[32];
+    if (vnode < 0)
+        snprintf(key, sizeof(key), "ss-%d", id);
+    else
+        snprintf(key, sizeof(key), "ss-%d#%d", id, vnode);
+    // FNV-1a spreads short keys poorly in the high bits; finish with a mix
+    uint32_t h = hash(key);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Index of the first point at or after h, wrapping to 0
+static int firstPointAtOrAfter(const HashRing *ring, uint32_t h)
+{
+    int low = 0, high = ring->count;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (ring->points[mid].hash < h)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low == ring->count ? 0 : low;
+}
+
+static int comparePoints(const void *a, const void *b)
+{
+    const RingPoint *pa = a, *pb = b;
+    if (pa->hash != pb->hash)
+        return pa->hash < pb->hash ? -1 : 1;
+    return pa->id - pb->id;
+}
+
+void initHashRing(HashRing *ring)
+{
+    pthread_rwlock_init(&ring->lock, NULL);
+    ring->points = NULL;
+    ring->count = 0;
+    ring->capacity = 0;
+}
+
+// Adding a server that is already on the ring changes nothing
+void ringAddServer(HashRing *ring, int id)
+{
+    pthread_rwlock_wrlock(&ring->lock);
+    for (int i = 0; i < ring->count; i++)
+    {
+        if (ring->points[i].id == id)
+        {
+            pthread_rwlock_unlock(&ring->lock);
+            return;
+        }
+    }
+    if (ring->count + RING_VNODES > ring->capacity)
+    {
+        int capacity = ring->capacity ? ring->capacity : 16 * RING_VNODES;
+        while (capacity < ring->count + RING_VNODES)
+            capacity *= 2;
+        ring->points = realloc(ring->points, capacity * sizeof(RingPoint));
+        ring->capacity = capacity;
+    }
+    for (int v = 0; v < RING_VNODES; v++)
+    {
+        ring->points[ring->count].hash = pointHash(id, v);
+        ring->points[ring->count].id = id;
+        ring->count++;
+    }
+    qsort(ring->points, ring->count, sizeof(RingPoint), comparePoints);
+    pthread_rwlock_unlock(&ring->lock);
+}
+
+// Up to want distinct servers, other than id, that eligible accepts, in
+// clockwise order from id's position. Returns how many were found.
+int ringSuccessors(HashRing *ring, int id, int *successors, int want, bool (*eligible)(int id, void *arg), void *arg)
+{
+    int found = 0;
+    pthread_rwlock_rdlock(&ring->lock);
+    if (ring->count > 0)
+    {
+        int start = firstPointAtOrAfter(ring, pointHash(id, -1));
+        for (int step = 0; step < ring->count && found < want; step++)
+        {
+            int candidate = ring->points[(start + step) % ring->count].id;
+            bool seen = candidate == id;
+            for (int i = 0; i < found && !seen; i++)
+                seen = successors[i] == candidate;
+            if (!seen && eligible(candidate, arg))
+                successors[found++] = candidate;
+        }
+    }
+    pthread_rwlock_unlock(&ring->lock);
+    return found;
+}
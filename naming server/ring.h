@@ -0,0 +1,35 @@
+#ifndef RING_H
+#define RING_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Consistent-hashing ring of storage server ids. Each server owns
+// RING_VNODES points, so the arcs even out however few servers there are.
+// A server's backups are the first live servers met walking clockwise from
+// its own position: a server joining, failing or coming back only changes
+// the backups of the servers whose walk crosses its points, about 1/N of
+// them. Ids stay on the ring once registered; liveness is checked per walk.
+
+#define RING_VNODES 64
+
+typedef struct RingPoint
+{
+    uint32_t hash;
+    int id;
+} RingPoint;
+
+typedef struct HashRing
+{
+    pthread_rwlock_t lock;
+    RingPoint *points; // sorted by hash
+    int count;
+    int capacity;
+} HashRing;
+
+void initHashRing(HashRing *ring);
+void ringAddServer(HashRing *ring, int id);
+int ringSuccessors(HashRing *ring, int id, int *successors, int want, bool (*eligible)(int id, void *arg), void *arg);
+
+#endif // RING_H
@@ -0,0 +1,266 @@
+#include "stats.h"
+#include "lru_cache.h"
+#include <stdarg.h>
+
+typedef struct StatsShard
+{
+    uint64_t counts[STAT_OP_COUNT][STATS_BUCKETS];
+    uint64_t total[STAT_OP_COUNT];
+    uint64_t sum_us[STAT_OP_COUNT];
+    uint64_t max_us[STAT_OP_COUNT];
+    struct StatsShard *next;
+} StatsShard;
+
+static const char *op_names[STAT_OP_COUNT] = {"lookup", "list", "create", "delete", "copy", "find", "resolve", "register"};
+
+static StatsShard *shards; // every thread's shard, pushed once and never freed
+static __thread StatsShard *local_shard;
+
+uint64_t statsNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int bucketOf(uint64_t value)
+{
+    if (value < (1u << STATS_SUB_BITS))
+        return (int)value;
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > STATS_MAX_EXPONENT)
+        return STATS_BUCKETS - 1;
+    int sub = (int)(value >> (exponent - STATS_SUB_BITS)) & ((1 << STATS_SUB_BITS) - 1);
+    return ((exponent - STATS_SUB_BITS + 1) << STATS_SUB_BITS) + sub;
+}
+
+// Largest value that falls in bucket
+static uint64_t bucketLimit(int bucket)
+{
+    if (bucket < (1 << STATS_SUB_BITS))
+        return (uint64_t)bucket;
+    int exponent = (bucket >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << STATS_SUB_BITS) - 1);
+    uint64_t low = ((1ull << STATS_SUB_BITS) + sub) << (exponent - STATS_SUB_BITS);
+    return low + (1ull << (exponent - STATS_SUB_BITS)) - 1;
+}
+
+static StatsShard *localShard(void)
+{
+    if (!local_shard)
+    {
+        local_shard = calloc(1, sizeof(StatsShard));
+        local_shard->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&shards, &local_shard->next, local_shard, false, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+    return local_shard;
+}
+
+// Record one operation of kind op that started at start_us (see statsNow)
+void statsRecord(StatOp op, uint64_t start_us)
+{
+    uint64_t elapsed = statsNow() - start_us;
+    StatsShard *shard = localShard();
+    // Only this thread writes the shard; the atomics keep readers coherent
+    __atomic_add_fetch(&shard->counts[op][bucketOf(elapsed)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shard->total[op], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shard->sum_us[op], elapsed, __ATOMIC_RELAXED);
+    if (elapsed > __atomic_load_n(&shard->max_us[op], __ATOMIC_RELAXED))
+        __atomic_store_n(&shard->max_us[op], elapsed, __ATOMIC_RELAXED);
+}
+
+typedef struct OpSummary
+{
+    uint64_t count;
+    uint64_t mean_us;
+    uint64_t p50_us;
+    uint64_t p99_us;
+    uint64_t p999_us;
+    uint64_t max_us;
+} OpSummary;
+
+static uint64_t percentile(const uint64_t *counts, uint64_t total, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * total + 0.5);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+    {
+        seen += counts[bucket];
+        if (seen >= rank)
+            return bucketLimit(bucket);
+    }
+    return bucketLimit(STATS_BUCKETS - 1);
+}
+
+static void summarize(StatOp op, OpSummary *summary)
+{
+    static uint64_t counts[STATS_BUCKETS];
+    static pthread_mutex_t counts_lock = PTHREAD_MUTEX_INITIALIZER;
+    uint64_t sum = 0;
+    memset(summary, 0, sizeof(*summary));
+
+    pthread_mutex_lock(&counts_lock);
+    memset(counts, 0, sizeof(counts));
+    for (StatsShard *shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); shard; shard = shard->next)
+    {
+        for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+            counts[bucket] += __atomic_load_n(&shard->counts[op][bucket], __ATOMIC_RELAXED);
+        summary->count += __atomic_load_n(&shard->total[op], __ATOMIC_RELAXED);
+        sum += __atomic_load_n(&shard->sum_us[op], __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&shard->max_us[op], __ATOMIC_RELAXED);
+        if (max > summary->max_us)
+            summary->max_us = max;
+    }
+    if (summary->count > 0)
+    {
+        summary->mean_us = sum / summary->count;
+        summary->p50_us = percentile(counts, summary->count, 0.50);
+        summary->p99_us = percentile(counts, summary->count, 0.99);
+        summary->p999_us = percentile(counts, summary->count, 0.999);
+        // A bucket's limit can overshoot the largest sample in it
+        if (summary->p50_us > summary->max_us)
+            summary->p50_us = summary->max_us;
+        if (summary->p99_us > summary->max_us)
+            summary->p99_us = summary->max_us;
+        if (summary->p999_us > summary->max_us)
+            summary->p999_us = summary->max_us;
+    }
+    pthread_mutex_unlock(&counts_lock);
+}
+
+static void appendf(WireBuffer *out, const char *format, ...)
+{
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > (int)sizeof(line) - 1)
+        length = sizeof(line) - 1;
+    if (length > 0)
+        wirePutBytes(out, line, length);
+}
+
+// Latencies, cache counters and per-storage-server traffic, as a table for
+// people or as one JSON object for scripts
+void formatStats(StorageServerTable *table, uint8_t format, WireBuffer *out)
+{
+    bool json = format == STATS_FORMAT_JSON;
+    appendf(out, json ? "{\"operations\":{" : "%-10s %10s %10s %10s %10s %10s %10s\n", "operation", "count",
+            "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+    for (int op = 0; op < STAT_OP_COUNT; op++)
+    {
+        OpSummary s;
+        summarize((StatOp)op, &s);
+        appendf(out,
+                json ? "%s\"%s\":{\"count\":%lu,\"mean_us\":%lu,\"p50_us\":%lu,\"p99_us\":%lu,\"p999_us\":%lu,\"max_us\":%lu}"
+                     : "%s%-10s %10lu %10lu %10lu %10lu %10lu %10lu\n",
+                json && op > 0 ? "," : "", op_names[op], s.count, s.mean_us, s.p50_us, s.p99_us, s.p999_us, s.max_us);
+    }
+
+    LRUCacheStats cache_stats;
+    getLRUCacheStats(cache, &cache_stats);
+    appendf(out,
+            json ? "},\"cache\":{\"size\":%d,\"capacity\":%d,\"hits\":%lu,\"misses\":%lu,\"evictions\":%lu},\"servers\":["
+                 : "\ncache: %d/%d entries, %lu hits, %lu misses, %lu evictions\n\n",
+            cache_stats.size, cache_stats.capacity, cache_stats.hits, cache_stats.misses, cache_stats.evictions);
+
+    if (!json)
+        appendf(out, "%-6s %-21s %-8s %12s %10s %10s %10s %8s\n", "server", "address", "health", "requests", "req/s",
+                "tree_kb", "used_kb", "names");
+    bool first = true;
+    pthread_rwlock_rdlock(&table->by_id_lock);
+    for (int id = 0; id < table->by_id_capacity; id++)
+    {
+        StorageServer *server = table->by_id[id];
+        if (!server)
+            continue;
+        char address[INET_ADDRSTRLEN + 8];
+        snprintf(address, sizeof(address), "%s:%d", server->ip, server->client_port);
+        uint64_t requests = __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+        // A replaced server's tree is only freed once it is out of the table
+        ArenaUsage usage = {0};
+        if (server->root)
+            arenaGetUsage(nodeArena(server->root), &usage);
+        if (json)
+            appendf(out,
+                    "%s{\"id\":%d,\"address\":\"%s\",\"health\":\"%s\",\"requests\":%lu,\"rate\":%.2f,"
+                    "\"tree_kb\":%zu,\"used_kb\":%zu,\"objects\":%zu,\"names\":%zu,\"name_refs\":%zu}",
+                    first ? "" : ",", server->id, address, serverHealthName(server->health), requests,
+                    server->request_rate, usage.reserved / 1024, usage.in_use / 1024, usage.objects, usage.interned,
+                    usage.intern_refs);
+        else
+            appendf(out, "%-6d %-21s %-8s %12lu %10.2f %10zu %10zu %8zu\n", server->id, address,
+                    serverHealthName(server->health), requests, server->request_rate, usage.reserved / 1024,
+                    usage.in_use / 1024, usage.interned);
+        first = false;
+    }
+    pthread_rwlock_unlock(&table->by_id_lock);
+    if (json)
+        appendf(out, "]}\n");
+}
+
+typedef struct StatsSamplerArgs
+{
+    StorageServerTable *table;
+    int dump_seconds;
+} StatsSamplerArgs;
+
+// Turn the per-server request counters into moving-average rates, and
+// print everything every dump_seconds when asked to
+static void *statsSampler(void *arg)
+{
+    StatsSamplerArgs *args = (StatsSamplerArgs *)arg;
+    StorageServerTable *table = args->table;
+    uint64_t last_dump = statsNow();
+    while (1)
+    {
+        usleep(STATS_SAMPLE_MS * 1000);
+
+        pthread_rwlock_rdlock(&table->by_id_lock);
+        for (int id = 0; id < table->by_id_capacity; id++)
+        {
+            StorageServer *server = table->by_id[id];
+            if (!server)
+                continue;
+            uint64_t requests = __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+            double rate = (requests - server->requests_sampled) * 1000.0 / STATS_SAMPLE_MS;
+            server->request_rate += STATS_RATE_WEIGHT * (rate - server->request_rate);
+            server->requests_sampled = requests;
+        }
+        pthread_rwlock_unlock(&table->by_id_lock);
+
+        if (args->dump_seconds > 0 && statsNow() - last_dump >= (uint64_t)args->dump_seconds * 1000000)
+        {
+            WireBuffer text;
+            wireBufferInit(&text);
+            formatStats(table, STATS_FORMAT_TEXT, &text);
+            printf("\n%.*s", (int)text.length, text.data);
+            fflush(stdout);
+            wireBufferFree(&text);
+            last_dump = statsNow();
+        }
+    }
+    return NULL;
+}
+
+// dump_seconds 0 keeps the statistics for STATS only
+int startStatsSampler(StorageServerTable *table, int dump_seconds)
+{
+    StatsSamplerArgs *args = malloc(sizeof(StatsSamplerArgs));
+    args->table = table;
+    args->dump_seconds = dump_seconds;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, statsSampler, args) != 0)
+    {
+        perror("Failed to create statistics thread");
+        free(args);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
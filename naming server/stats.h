@@ -0,0 +1,39 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "header.h"
+
+// Latency histograms for the naming server's operations. Every thread
+// records into its own shard, so the hot path is a few relaxed atomic adds
+// on memory no other thread writes; STATS sums the shards when asked.
+//
+// Buckets are log-linear, as in HDR histograms: values below
+// 2^STATS_SUB_BITS microseconds get one bucket each, and every power of two
+// above that is split into 2^STATS_SUB_BITS buckets, so a percentile is
+// reported within about 3% of the true value.
+
+#define STATS_SUB_BITS 5
+#define STATS_MAX_EXPONENT 35 // 2^36 us, about 19 hours; longer samples are clamped
+#define STATS_BUCKETS ((STATS_MAX_EXPONENT - STATS_SUB_BITS + 2) << STATS_SUB_BITS)
+#define STATS_SAMPLE_MS 1000  // how often request rates are sampled
+#define STATS_RATE_WEIGHT 0.2 // weight of the newest sample in the moving average
+
+typedef enum
+{
+    STAT_LOOKUP,
+    STAT_LIST,
+    STAT_CREATE,
+    STAT_DELETE,
+    STAT_COPY,
+    STAT_FIND,
+    STAT_RESOLVE,
+    STAT_REGISTER,
+    STAT_OP_COUNT
+} StatOp;
+
+uint64_t statsNow(void);
+void statsRecord(StatOp op, uint64_t start_us);
+void formatStats(StorageServerTable *table, uint8_t format, WireBuffer *out);
+int startStatsSampler(StorageServerTable *table, int dump_seconds);
+
+#endif // STATS_H
@@ -0,0 +1,224 @@
+#include "write_tracker.h"
+
+typedef struct AsyncWriteState
+{
+    char fileName[256];
+    int clientId;
+    char clientIP[INET_ADDRSTRLEN];
+    int clientPort;
+    char serverIP[INET_ADDRSTRLEN]; // storage server doing the write: its peer
+    int serverPort;                 // address and client port
+    uint64_t deadline;              // tick at which the write counts as stalled
+    struct AsyncWriteState *next;   // same bucket
+    struct AsyncWriteState *wheel_next;
+    struct AsyncWriteState **wheel_link; // whatever points at this entry on the wheel
+} AsyncWriteState;
+
+static AsyncWriteState *buckets[WRITE_BUCKETS];
+static AsyncWriteState *wheel[2][WRITE_WHEEL_SLOTS];
+static uint64_t current_tick;
+static pthread_mutex_t tracker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define WHEEL_MASK (WRITE_WHEEL_SLOTS - 1)
+
+static uint64_t tickNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000) / WRITE_TICK_MS;
+}
+
+static unsigned int bucketOf(const char *fileName, int clientId)
+{
+    return (hash(fileName) ^ (unsigned int)clientId * 2654435761u) % WRITE_BUCKETS;
+}
+
+static void wheelInsert(AsyncWriteState **slot, AsyncWriteState *state)
+{
+    state->wheel_next = *slot;
+    if (*slot)
+        (*slot)->wheel_link = &state->wheel_next;
+    *slot = state;
+    state->wheel_link = slot;
+}
+
+static void wheelRemove(AsyncWriteState *state)
+{
+    *state->wheel_link = state->wheel_next;
+    if (state->wheel_next)
+        state->wheel_next->wheel_link = state->wheel_link;
+}
+
+// Put state in the slot that comes up at its deadline: the first level if
+// that is within one turn, else the second, from where it is cascaded down
+// when its turn begins. Called with tracker_lock held.
+static void schedule(AsyncWriteState *state)
+{
+    uint64_t delta = state->deadline > current_tick ? state->deadline - current_tick : 0;
+    if (delta < WRITE_WHEEL_SLOTS)
+    {
+        uint64_t due = current_tick + delta;
+        wheelInsert(&wheel[0][due & WHEEL_MASK], state);
+    }
+    else
+    {
+        if (delta >= (uint64_t)WRITE_WHEEL_SLOTS * WRITE_WHEEL_SLOTS)
+            delta = (uint64_t)WRITE_WHEEL_SLOTS * WRITE_WHEEL_SLOTS - 1;
+        uint64_t due = current_tick + delta;
+        wheelInsert(&wheel[1][(due >> WRITE_WHEEL_BITS) & WHEEL_MASK], state);
+    }
+}
+
+// Unhook state from its bucket and the wheel. Called with tracker_lock held.
+static void unlinkState(AsyncWriteState *state)
+{
+    AsyncWriteState **link = &buckets[bucketOf(state->fileName, state->clientId)];
+    while (*link != state)
+        link = &(*link)->next;
+    *link = state->next;
+    wheelRemove(state);
+}
+
+void trackWriteAck(uint8_t phase, const char *fileName, int clientId, const char *clientIP, int clientPort,
+                   const char *serverIP, int serverPort)
+{
+    unsigned int bucket = bucketOf(fileName, clientId);
+    AsyncWriteState *done = NULL;
+
+    pthread_mutex_lock(&tracker_lock);
+    AsyncWriteState *state = buckets[bucket];
+    while (state && (state->clientId != clientId || strcmp(state->fileName, fileName) != 0))
+        state = state->next;
+
+    if (phase == WRITE_ACK_COMPLETED)
+    {
+        if (state)
+        {
+            unlinkState(state);
+            done = state;
+        }
+    }
+    else if (state)
+    {
+        // Started again: the deadline starts over
+        wheelRemove(state);
+        state->deadline = tickNow() + WRITE_STALL_MS / WRITE_TICK_MS;
+        schedule(state);
+    }
+    else
+    {
+        state = malloc(sizeof(AsyncWriteState));
+        if (!state)
+        {
+            perror("Failed to allocate memory for write state");
+            pthread_mutex_unlock(&tracker_lock);
+            return;
+        }
+        snprintf(state->fileName, sizeof(state->fileName), "%s", fileName);
+        state->clientId = clientId;
+        snprintf(state->clientIP, sizeof(state->clientIP), "%s", clientIP);
+        state->clientPort = clientPort;
+        snprintf(state->serverIP, sizeof(state->serverIP), "%s", serverIP);
+        state->serverPort = serverPort;
+        state->deadline = tickNow() + WRITE_STALL_MS / WRITE_TICK_MS;
+        state->next = buckets[bucket];
+        buckets[bucket] = state;
+        schedule(state);
+    }
+    pthread_mutex_unlock(&tracker_lock);
+    free(done);
+}
+
+// Warn the client of each write on list, then free it. Called without
+// tracker_lock, since reaching a client may take a while.
+static void notifyWriters(AsyncWriteState *list, const char *format)
+{
+    while (list)
+    {
+        AsyncWriteState *state = list;
+        list = list->next;
+        char message[MAX_BUFFER_SIZE];
+        snprintf(message, sizeof(message), format, state->fileName);
+        forwardAckToClient(state->clientIP, state->clientPort, message);
+        printf("Notified client %s:%d about write of '%s'.\n", state->clientIP, state->clientPort, state->fileName);
+        free(state);
+    }
+}
+
+// Drive the timer wheel; writes still running at their deadline are
+// reported to their clients as stalled
+void *monitorWriteStates(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&tracker_lock);
+    current_tick = tickNow();
+    pthread_mutex_unlock(&tracker_lock);
+
+    while (1)
+    {
+        usleep(WRITE_TICK_MS * 1000);
+        AsyncWriteState *stalled = NULL;
+
+        pthread_mutex_lock(&tracker_lock);
+        uint64_t now = tickNow();
+        while (current_tick < now)
+        {
+            current_tick++;
+            if ((current_tick & WHEEL_MASK) == 0)
+            {
+                // A new turn: bring down the writes due during it
+                AsyncWriteState **slot = &wheel[1][(current_tick >> WRITE_WHEEL_BITS) & WHEEL_MASK];
+                AsyncWriteState *list = *slot;
+                *slot = NULL;
+                while (list)
+                {
+                    AsyncWriteState *state = list;
+                    list = list->wheel_next;
+                    schedule(state);
+                }
+            }
+            AsyncWriteState **slot = &wheel[0][current_tick & WHEEL_MASK];
+            while (*slot)
+            {
+                AsyncWriteState *state = *slot;
+                unlinkState(state);
+                printf("Warning: Write operation for file '%s' not completed within %d seconds.\n", state->fileName,
+                       WRITE_STALL_MS / 1000);
+                state->next = stalled;
+                stalled = state;
+            }
+        }
+        pthread_mutex_unlock(&tracker_lock);
+
+        notifyWriters(stalled, "WARNING: Write operation for file '%s' has not completed in time.");
+    }
+    return NULL;
+}
+
+// A storage server was declared dead: tell the clients of its unfinished
+// writes now rather than when their deadline passes
+void abortWritesOnServer(const char *serverIP, int serverPort)
+{
+    AsyncWriteState *aborted = NULL;
+    pthread_mutex_lock(&tracker_lock);
+    for (int i = 0; i < WRITE_BUCKETS; i++)
+    {
+        AsyncWriteState **link = &buckets[i];
+        while (*link)
+        {
+            AsyncWriteState *state = *link;
+            if (state->serverPort != serverPort || strcmp(state->serverIP, serverIP) != 0)
+            {
+                link = &state->next;
+                continue;
+            }
+            *link = state->next;
+            wheelRemove(state);
+            state->next = aborted;
+            aborted = state;
+        }
+    }
+    pthread_mutex_unlock(&tracker_lock);
+
+    notifyWriters(aborted, "WARNING: Write operation for file '%s' is aborted since ss goes offline.");
+}
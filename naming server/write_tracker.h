@@ -0,0 +1,28 @@
+#ifndef WRITE_TRACKER_H
+#define WRITE_TRACKER_H
+
+#include "header.h"
+
+// Asynchronous writes in progress. A storage server acknowledges an async
+// write twice over OP_WRITE_ACK, when it starts and when the data is on
+// disk. A write is tracked from STARTED until COMPLETED, keyed by file and
+// client. If it does not complete within WRITE_STALL_MS, or its server dies
+// first, its client is warned and the write is forgotten.
+//
+// Deadlines are kept on a two-level timer wheel (WRITE_WHEEL_SLOTS slots of
+// WRITE_TICK_MS, then WRITE_WHEEL_SLOTS slots of a full turn each), so
+// every ack costs O(1) whatever the number of writes in flight. Clients
+// are notified after the tracker's lock is released.
+
+#define WRITE_STALL_MS 10000
+#define WRITE_TICK_MS 100
+#define WRITE_WHEEL_BITS 6
+#define WRITE_WHEEL_SLOTS (1 << WRITE_WHEEL_BITS)
+#define WRITE_BUCKETS 1024
+
+void trackWriteAck(uint8_t phase, const char *fileName, int clientId, const char *clientIP, int clientPort,
+                   const char *serverIP, int serverPort);
+void abortWritesOnServer(const char *serverIP, int serverPort);
+void *monitorWriteStates(void *arg);
+
+#endif // WRITE_TRACKER_H